@@ -0,0 +1,1400 @@
+/*
+ * patricia_bench.cpp
+ *
+ * Benchmarks for the modules, one case each.
+ *
+ * Usage: patricia_bench [<case> ...]
+ *
+ * Without arguments every case runs in turn. The key sets are generated
+ * from fixed seeds, so every run works on the same data. Counts such as
+ * bytes, states or page reads are repeatable; timings depend on the
+ * machine, build type and load.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+#include "patricia.h"
+#include "patricia_da.h"
+#include "patricia_dawg.h"
+#include "patricia_fc.h"
+#include "patricia_hope.h"
+#include "patricia_hot.h"
+#include "patricia_paged_aio.h"
+#include "patricia_persist.h"
+#include "patricia_route.h"
+#include "patricia_shard.h"
+#include "patricia_static.h"
+
+/* Datastructures */
+
+typedef struct bench_case_s {
+    const char  *name;
+    const char  *desc;
+    void        (*fn) (void);
+} bench_case_t;
+
+/*
+ * bench_now
+ *
+ * Monotonic time in seconds
+ */
+static double
+bench_now (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * bench_path_keys
+ *
+ * count distinct keys shaped like the paths of a web site's files, in
+ * random order: a few hundred directories, then file names with a number
+ * and an extension. No key is a prefix of another.
+ */
+static void
+bench_path_keys (std::vector<std::string> &keys, uint32_t count,
+                 uint32_t seed)
+{
+    static const char *top[] = { "static", "img", "docs", "api", "blog",
+                                 "assets", "media", "user" };
+    static const char *sub[] = { "css", "js", "2019", "2020", "2021",
+                                 "thumbs", "large", "v1", "v2", "en", "de",
+                                 "archive" };
+    static const char *ext[] = { ".html", ".png", ".jpg", ".css", ".js",
+                                 ".xml" };
+    std::mt19937 rng(seed);
+    std::set<std::string> seen;
+    std::string key;
+    uint32_t depth;
+
+    keys.clear();
+    while (keys.size() < count) {
+        key = "/";
+        key += top[rng() % 8];
+        for (depth = rng() % 4; depth > 0; depth--) {
+            key += '/';
+            key += sub[rng() % 12];
+        }
+        key += "/file" + std::to_string(rng() % 100000) + ext[rng() % 6];
+        if (seen.insert(key).second) {
+            keys.push_back(key);
+        }
+    }
+}
+
+/*
+ * bench_tree_bytes
+ *
+ * Recursively add up the memory the nodes under the given node take in
+ * the tree, counted as patricia_print_stats does
+ */
+static void
+bench_tree_bytes (patricia_node_t *root, uint64_t *bytes)
+{
+    patricia_node_t *child;
+
+    *bytes += sizeof(patricia_node_t) + strlen(root->key) + 1;
+    if (root->children) {
+        *bytes += sizeof(list_t);
+    }
+
+    child = PATRICIA_FIRST_CHILD(root);
+    while (child) {
+        bench_tree_bytes(child, bytes);
+        child = (patricia_node_t *)list_get_next(root->children, child);
+    }
+}
+
+/*
+ * bench_route
+ *
+ * Longest prefix match over a table the size of a full IPv4 BGP feed,
+ * with and without the direct index. Prefix lengths follow the usual
+ * shape of such a table, most of it /24.
+ */
+static void
+bench_route (void)
+{
+    static const int flags[] = { 0, PATRICIA_RT_ACCEL };
+    const uint32_t routes = 900000, lookups = 2000000;
+    std::vector<uint32_t> addrs(lookups);
+    patricia_rt_tree_t *tree;
+    std::mt19937 rng(1);
+    uint8_t addr[4];
+    uint32_t i, len, r, a, found, hits;
+    double start, secs;
+    int f;
+
+    for (i = 0; i < lookups; i++) {
+        addrs[i] = rng();
+    }
+
+    for (f = 0; f < 2; f++) {
+        tree = patricia_rt_init(PATRICIA_RT_IPV4_ADDRLEN, flags[f]);
+        rng.seed(2);
+        for (i = 0; i < routes; i++) {
+            r = rng() % 100;
+            len = (r < 60) ? 24 : (r < 75) ? 22 + rng() % 2 :
+                  (r < 95) ? 16 + rng() % 6 : 8 + rng() % 8;
+            a = rng();
+            addr[0] = a >> 24;
+            addr[1] = a >> 16;
+            addr[2] = a >> 8;
+            addr[3] = a;
+            patricia_rt_add(tree, addr, len, (void *)(uintptr_t)(i + 1));
+        }
+
+        found = 0;
+        start = bench_now();
+        for (i = 0; i < lookups; i++) {
+            a = addrs[i];
+            addr[0] = a >> 24;
+            addr[1] = a >> 16;
+            addr[2] = a >> 8;
+            addr[3] = a;
+            found += patricia_rt_lookup(tree, addr, NULL);
+        }
+        secs = bench_now() - start;
+
+        printf("route %-8s %lu routes, %u lookups, %u matched, "
+               "%.2f M lookups/s\n", flags[f] ? "accel" : "tree",
+               tree->count, lookups, found, lookups / secs / 1e6);
+
+        /* Counted apart from the timed loop, lookups do not count */
+        if (tree->accel) {
+            hits = 0;
+            for (i = 0; i < lookups; i++) {
+                a = addrs[i];
+                addr[0] = a >> 24;
+                addr[1] = a >> 16;
+                hits += patricia_rt_accel_hit(tree, addr);
+            }
+            printf("route accel    answered by the index alone: %u of %u\n",
+                   hits, lookups);
+        }
+        patricia_rt_destroy(tree);
+    }
+}
+
+/* The C keywords, for the static set case */
+static constexpr char bench_kw_auto[] = "auto";
+static constexpr char bench_kw_break[] = "break";
+static constexpr char bench_kw_case[] = "case";
+static constexpr char bench_kw_char[] = "char";
+static constexpr char bench_kw_const[] = "const";
+static constexpr char bench_kw_continue[] = "continue";
+static constexpr char bench_kw_default[] = "default";
+static constexpr char bench_kw_do[] = "do";
+static constexpr char bench_kw_double[] = "double";
+static constexpr char bench_kw_else[] = "else";
+static constexpr char bench_kw_enum[] = "enum";
+static constexpr char bench_kw_extern[] = "extern";
+static constexpr char bench_kw_float[] = "float";
+static constexpr char bench_kw_for[] = "for";
+static constexpr char bench_kw_goto[] = "goto";
+static constexpr char bench_kw_if[] = "if";
+static constexpr char bench_kw_int[] = "int";
+static constexpr char bench_kw_long[] = "long";
+static constexpr char bench_kw_register[] = "register";
+static constexpr char bench_kw_return[] = "return";
+static constexpr char bench_kw_short[] = "short";
+static constexpr char bench_kw_signed[] = "signed";
+static constexpr char bench_kw_sizeof[] = "sizeof";
+static constexpr char bench_kw_static[] = "static";
+static constexpr char bench_kw_struct[] = "struct";
+static constexpr char bench_kw_switch[] = "switch";
+static constexpr char bench_kw_typedef[] = "typedef";
+static constexpr char bench_kw_union[] = "union";
+static constexpr char bench_kw_unsigned[] = "unsigned";
+static constexpr char bench_kw_void[] = "void";
+static constexpr char bench_kw_volatile[] = "volatile";
+static constexpr char bench_kw_while[] = "while";
+
+typedef patricia::StaticSet<
+    patricia::literal_of<bench_kw_auto>,
+    patricia::literal_of<bench_kw_break>,
+    patricia::literal_of<bench_kw_case>,
+    patricia::literal_of<bench_kw_char>,
+    patricia::literal_of<bench_kw_const>,
+    patricia::literal_of<bench_kw_continue>,
+    patricia::literal_of<bench_kw_default>,
+    patricia::literal_of<bench_kw_do>,
+    patricia::literal_of<bench_kw_double>,
+    patricia::literal_of<bench_kw_else>,
+    patricia::literal_of<bench_kw_enum>,
+    patricia::literal_of<bench_kw_extern>,
+    patricia::literal_of<bench_kw_float>,
+    patricia::literal_of<bench_kw_for>,
+    patricia::literal_of<bench_kw_goto>,
+    patricia::literal_of<bench_kw_if>,
+    patricia::literal_of<bench_kw_int>,
+    patricia::literal_of<bench_kw_long>,
+    patricia::literal_of<bench_kw_register>,
+    patricia::literal_of<bench_kw_return>,
+    patricia::literal_of<bench_kw_short>,
+    patricia::literal_of<bench_kw_signed>,
+    patricia::literal_of<bench_kw_sizeof>,
+    patricia::literal_of<bench_kw_static>,
+    patricia::literal_of<bench_kw_struct>,
+    patricia::literal_of<bench_kw_switch>,
+    patricia::literal_of<bench_kw_typedef>,
+    patricia::literal_of<bench_kw_union>,
+    patricia::literal_of<bench_kw_unsigned>,
+    patricia::literal_of<bench_kw_void>,
+    patricia::literal_of<bench_kw_volatile>,
+    patricia::literal_of<bench_kw_while>> bench_kw_set_t;
+
+static const char *bench_kws[] = {
+    bench_kw_auto, bench_kw_break, bench_kw_case, bench_kw_char,
+    bench_kw_const, bench_kw_continue, bench_kw_default, bench_kw_do,
+    bench_kw_double, bench_kw_else, bench_kw_enum, bench_kw_extern,
+    bench_kw_float, bench_kw_for, bench_kw_goto, bench_kw_if, bench_kw_int,
+    bench_kw_long, bench_kw_register, bench_kw_return, bench_kw_short,
+    bench_kw_signed, bench_kw_sizeof, bench_kw_static, bench_kw_struct,
+    bench_kw_switch, bench_kw_typedef, bench_kw_union, bench_kw_unsigned,
+    bench_kw_void, bench_kw_volatile, bench_kw_while,
+};
+
+#define BENCH_KWS   (sizeof(bench_kws) / sizeof(bench_kws[0]))
+
+/*
+ * bench_static
+ *
+ * Keyword recognition over a token stream, half keywords and half
+ * identifiers, with the compile-time set and with patricia_lookup on a
+ * tree of the same keywords. patricia_lookup also finds the prefixes the
+ * tree split at ("d" for "do" and "default"), so the tree gets every
+ * token with a space appended, which keeps its key set prefix-free.
+ */
+static void
+bench_static (void)
+{
+    const uint32_t tokens = 4096, rounds = 2000;
+    std::vector<std::string> stream(tokens);
+    std::string key;
+    patricia_tree_t *tree;
+    std::mt19937 rng(3);
+    uint32_t i, r, found;
+    size_t k;
+    double start, secs;
+
+    for (i = 0; i < tokens; i++) {
+        stream[i] = bench_kws[rng() % BENCH_KWS];
+        if (rng() % 2) {
+            /* An identifier, often sharing a keyword's prefix */
+            stream[i].resize(1 + rng() % stream[i].size());
+            for (k = rng() % 6; k > 0; k--) {
+                stream[i] += (char)('a' + rng() % 26);
+            }
+        }
+        stream[i] += ' ';
+    }
+
+    found = 0;
+    start = bench_now();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < tokens; i++) {
+            found += (bench_kw_set_t::lookup(stream[i].data(),
+                                             stream[i].size() - 1) >= 0);
+        }
+    }
+    secs = bench_now() - start;
+    printf("static StaticSet       %u lookups, %u found, %.1f M lookups/s\n",
+           tokens * rounds, found, tokens * rounds / secs / 1e6);
+
+    tree = patricia_init();
+    for (k = 0; k < BENCH_KWS; k++) {
+        key = std::string(bench_kws[k]) + ' ';
+        patricia_add(tree, &key[0]);
+    }
+    found = 0;
+    start = bench_now();
+    for (r = 0; r < rounds; r++) {
+        for (i = 0; i < tokens; i++) {
+            found += patricia_lookup(tree, &stream[i][0]);
+        }
+    }
+    secs = bench_now() - start;
+    printf("static patricia_lookup %u lookups, %u found, %.1f M lookups/s\n",
+           tokens * rounds, found, tokens * rounds / secs / 1e6);
+    patricia_destroy(tree);
+}
+
+/*
+ * bench_da
+ *
+ * The double-array trie against the pointer tree it is built from: the
+ * memory each takes, the time to get a usable set in a new process
+ * (building the tree from the keys, or mapping a saved trie), and the
+ * lookup rate for keys that are present and keys one byte longer
+ */
+static void
+bench_da (void)
+{
+    const uint32_t count = 500000;
+    std::vector<std::string> keys, misses;
+    char path[] = "/tmp/patricia_bench.XXXXXX";
+    patricia_tree_t *tree;
+    patricia_da_t *da, *mapped;
+    uint64_t bytes = 0;
+    uint32_t i, found;
+    double start, secs;
+    int fd;
+
+    bench_path_keys(keys, count, 4);
+    for (i = 0; i < count; i++) {
+        misses.push_back(keys[i] + "~");
+    }
+
+    start = bench_now();
+    tree = patricia_init();
+    for (i = 0; i < count; i++) {
+        patricia_add(tree, &keys[i][0]);
+    }
+    secs = bench_now() - start;
+    bench_tree_bytes(tree->root, &bytes);
+    printf("da tree  %u keys, %lu bytes, built in %.3f s\n", count,
+           (unsigned long)bytes, secs);
+
+    da = patricia_da_build(tree);
+    fd = mkstemp(path);
+    if (!da || fd < 0 || patricia_da_save(da, path) != 0) {
+        printf("da failed to build or save the trie\n");
+        return;
+    }
+    close(fd);
+    start = bench_now();
+    mapped = patricia_da_load(path);
+    secs = bench_now() - start;
+    unlink(path);
+    if (!mapped) {
+        printf("da failed to load the trie\n");
+        return;
+    }
+    printf("da trie  %u keys, %lu bytes, loaded in %.3f s\n",
+           mapped->key_count,
+           (unsigned long)mapped->size * 2 * sizeof(int32_t) +
+           mapped->tail_size, secs);
+
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(6));
+    found = 0;
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        found += patricia_lookup(tree, &keys[i][0]);
+        found += patricia_lookup(tree, &misses[i][0]);
+    }
+    secs = bench_now() - start;
+    printf("da tree  %u lookups, %u found, %.2f M lookups/s\n", 2 * count,
+           found, 2 * count / secs / 1e6);
+
+    found = 0;
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        found += patricia_da_lookup(mapped, keys[i].c_str());
+        found += patricia_da_lookup(mapped, misses[i].c_str());
+    }
+    secs = bench_now() - start;
+    printf("da trie  %u lookups, %u found, %.2f M lookups/s\n", 2 * count,
+           found, 2 * count / secs / 1e6);
+
+    patricia_da_destroy(mapped);
+    patricia_da_destroy(da);
+    patricia_destroy(tree);
+}
+
+/*
+ * bench_hot
+ *
+ * Random lookups on an arena tree larger than the last level cache and
+ * on the blocked layout built from it, and the 64-byte blocks each of
+ * those lookups reads, which bounds the cache misses it can take.
+ */
+static void
+bench_hot (void)
+{
+    const uint32_t count = 3000000, lookups = 2000000;
+    std::vector<std::string> keys;
+    patricia_arena_t *arena;
+    patricia_hot_t *hot;
+    uint32_t i, found;
+    uint64_t blocks;
+    double start, secs;
+    long llc;
+
+    bench_path_keys(keys, count, 7);
+    arena = patricia_arena_init(0, 0);
+    for (i = 0; i < count; i++) {
+        patricia_arena_add(arena, keys[i].c_str());
+    }
+    hot = patricia_hot_build(arena);
+    if (!arena || !hot) {
+        printf("hot failed to build the trees\n");
+        return;
+    }
+
+    llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    printf("hot arena  %u keys, %lu bytes (last level cache %ld bytes)\n",
+           count, (unsigned long)PATRICIA_ARENA_HDR(arena)->used *
+           PATRICIA_ARENA_ALIGN, llc);
+    printf("hot blocks %u keys, %lu bytes hot, %u bytes cold\n",
+           hot->key_count, (unsigned long)hot->block_count *
+           PATRICIA_HOT_BLOCK_SIZE, hot->cold_size);
+
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(8));
+    found = 0;
+    start = bench_now();
+    for (i = 0; i < lookups; i++) {
+        found += patricia_arena_lookup(arena, keys[i].c_str());
+    }
+    secs = bench_now() - start;
+    printf("hot arena  %u lookups, %u found, %.2f M lookups/s\n", lookups,
+           found, lookups / secs / 1e6);
+
+    found = 0;
+    start = bench_now();
+    for (i = 0; i < lookups; i++) {
+        found += patricia_hot_lookup(hot, keys[i].c_str());
+    }
+    secs = bench_now() - start;
+    printf("hot blocks %u lookups, %u found, %.2f M lookups/s\n", lookups,
+           found, lookups / secs / 1e6);
+
+    /* Counted apart from the timed loop, lookups do not count */
+    blocks = 0;
+    for (i = 0; i < lookups; i++) {
+        blocks += patricia_hot_blocks_read(hot, keys[i].c_str());
+    }
+    printf("hot blocks %.2f blocks read per lookup\n",
+           (double)blocks / lookups);
+
+    patricia_hot_destroy(hot);
+    patricia_arena_destroy(arena);
+}
+
+/*
+ * bench_count_key
+ *
+ * Walk callback counting the keys
+ */
+static int
+bench_count_key (const char *key, int len, void *arg)
+{
+    (void)key;
+    (void)len;
+    (*(uint64_t *)arg)++;
+    return 0;
+}
+
+/*
+ * bench_compact_scan
+ *
+ * Time prefix scans over the given directories, after one untimed pass
+ * so that both sides start with warm caches
+ */
+static void
+bench_compact_scan (patricia_arena_t *arena,
+                    const std::vector<std::string> &dirs, const char *when)
+{
+    patricia_arena_header_t *hdr = PATRICIA_ARENA_HDR(arena);
+    uint64_t visited = 0;
+    double start, secs;
+    size_t i;
+
+    for (i = 0; i < dirs.size(); i++) {
+        patricia_arena_walk_prefix(arena, dirs[i].c_str(), bench_count_key,
+                                   &visited);
+    }
+    visited = 0;
+    start = bench_now();
+    for (i = 0; i < dirs.size(); i++) {
+        patricia_arena_walk_prefix(arena, dirs[i].c_str(), bench_count_key,
+                                   &visited);
+    }
+    secs = bench_now() - start;
+    printf("compact %-6s %lu bytes used, %lu dead, %zu scans, "
+           "%.2f M keys/s\n", when,
+           (unsigned long)hdr->used * PATRICIA_ARENA_ALIGN,
+           (unsigned long)hdr->dead * PATRICIA_ARENA_ALIGN, dirs.size(),
+           visited / secs / 1e6);
+}
+
+/*
+ * bench_compact
+ *
+ * Prefix scan throughput over an arena tree churned by a long run of adds
+ * and deletes, before and after compacting it
+ */
+static void
+bench_compact (void)
+{
+    const uint32_t count = 1000000;
+    std::vector<std::string> keys, more, dirs;
+    patricia_arena_t *arena;
+    std::mt19937 rng(11);
+    uint32_t i;
+
+    bench_path_keys(keys, count, 9);
+    bench_path_keys(more, count, 10);
+    arena = patricia_arena_init(0, 0);
+    if (!arena) {
+        printf("compact failed to create the arena\n");
+        return;
+    }
+
+    /* Every key goes in, half of them are replaced by others later */
+    for (i = 0; i < count; i++) {
+        patricia_arena_add(arena, keys[i].c_str());
+    }
+    for (i = 0; i < count; i += 2) {
+        patricia_arena_delete(arena, keys[i].c_str());
+        patricia_arena_add(arena, more[i].c_str());
+    }
+
+    /* Scan the directories of random keys */
+    for (i = 0; i < 2000; i++) {
+        dirs.push_back(keys[rng() % count]);
+        dirs.back().resize(dirs.back().rfind('/') + 1);
+    }
+
+    bench_compact_scan(arena, dirs, "before");
+    if (patricia_arena_compact(arena) != 0) {
+        printf("compact failed\n");
+    } else {
+        bench_compact_scan(arena, dirs, "after");
+    }
+
+    patricia_arena_destroy(arena);
+}
+
+/*
+ * bench_huge
+ *
+ * Random lookups on the same large arena tree on normal pages and on huge
+ * pages. How many bytes really got huge pages depends on the kernel's
+ * settings and free memory, so that is printed along with the rates.
+ */
+static void
+bench_huge (void)
+{
+    static const uint32_t flags[] = { 0, PATRICIA_ARENA_HUGE };
+    const uint32_t count = 2000000, lookups = 2000000;
+    std::vector<std::string> keys, order;
+    patricia_arena_t *arena;
+    uint32_t i, found;
+    double start, secs;
+    int f;
+
+    bench_path_keys(keys, count, 12);
+    order = keys;
+    std::shuffle(order.begin(), order.end(), std::mt19937(13));
+
+    for (f = 0; f < 2; f++) {
+        arena = patricia_arena_init(0, flags[f]);
+        if (!arena) {
+            printf("huge failed to create the arena\n");
+            return;
+        }
+        for (i = 0; i < count; i++) {
+            patricia_arena_add(arena, keys[i].c_str());
+        }
+
+        found = 0;
+        start = bench_now();
+        for (i = 0; i < lookups; i++) {
+            found += patricia_arena_lookup(arena, order[i].c_str());
+        }
+        secs = bench_now() - start;
+        printf("huge %-6s %lu bytes, %lu on huge pages, %u found, "
+               "%.2f M lookups/s\n", flags[f] ? "huge" : "normal",
+               (unsigned long)arena->cap,
+               (unsigned long)patricia_arena_huge_bytes(arena), found,
+               lookups / secs / 1e6);
+        patricia_arena_destroy(arena);
+    }
+}
+
+#define BENCH_SHARD_THREADS     4
+
+typedef struct bench_shard_arg_s {
+    patricia_shard_tree_t       *st;
+    std::vector<std::string>    *keys;
+    uint32_t                    start;
+    uint32_t                    end;
+} bench_shard_arg_t;
+
+/*
+ * bench_shard_writer
+ *
+ * Add keys[start] up to keys[end]
+ */
+static void *
+bench_shard_writer (void *arg)
+{
+    bench_shard_arg_t *w = (bench_shard_arg_t *)arg;
+    uint32_t i;
+
+    for (i = w->start; i < w->end; i++) {
+        patricia_shard_add(w->st, &(*w->keys)[i][0]);
+    }
+
+    return NULL;
+}
+
+/*
+ * bench_shard
+ *
+ * Adds from BENCH_SHARD_THREADS threads at once into trees of 1 to 64
+ * hashed shards. Writers only scale up to the number of CPUs, which is
+ * printed with the rates.
+ */
+static void
+bench_shard (void)
+{
+    static const uint32_t counts[] = { 1, 4, 16, 64 };
+    const uint32_t count = 400000;
+    bench_shard_arg_t args[BENCH_SHARD_THREADS];
+    pthread_t threads[BENCH_SHARD_THREADS];
+    std::vector<std::string> keys;
+    patricia_shard_tree_t *st;
+    double start, secs;
+    uint32_t c, t;
+
+    bench_path_keys(keys, count, 14);
+    printf("shard %d writer threads, %ld CPUs online\n",
+           BENCH_SHARD_THREADS, sysconf(_SC_NPROCESSORS_ONLN));
+
+    for (c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        st = patricia_shard_init(counts[c], PATRICIA_SHARD_HASH);
+        if (!st) {
+            printf("shard failed to create the tree\n");
+            return;
+        }
+
+        start = bench_now();
+        for (t = 0; t < BENCH_SHARD_THREADS; t++) {
+            args[t].st = st;
+            args[t].keys = &keys;
+            args[t].start = count / BENCH_SHARD_THREADS * t;
+            args[t].end = count / BENCH_SHARD_THREADS * (t + 1);
+            pthread_create(&threads[t], NULL, bench_shard_writer, &args[t]);
+        }
+        for (t = 0; t < BENCH_SHARD_THREADS; t++) {
+            pthread_join(threads[t], NULL);
+        }
+        secs = bench_now() - start;
+
+        printf("shard %2u shards  %u adds, %.2f M adds/s\n", counts[c],
+               count, count / secs / 1e6);
+        patricia_shard_destroy(st);
+    }
+}
+
+/*
+ * bench_persist_updates
+ *
+ * Add keys[start] up to keys[end] to tree and print the rate and the node
+ * copies and memory it took. With every set, a snapshot is held all the
+ * time and replaced by a new one every that many adds, like readers
+ * coming and going.
+ */
+static void
+bench_persist_updates (patricia_pt_tree_t *tree,
+                       const std::vector<std::string> &keys, uint32_t start,
+                       uint32_t end, uint32_t every)
+{
+    patricia_pt_stats_t before, after;
+    patricia_pt_node_t *snap = NULL;
+    double t0, secs;
+    uint32_t i;
+
+    patricia_pt_get_stats(&before);
+    t0 = bench_now();
+    for (i = start; i < end; i++) {
+        if (every && (i - start) % every == 0) {
+            patricia_pt_release(snap);
+            snap = patricia_pt_snapshot(tree);
+        }
+        patricia_pt_add(tree, keys[i].c_str(), NULL);
+    }
+    secs = bench_now() - t0;
+    patricia_pt_get_stats(&after);
+    patricia_pt_release(snap);
+
+    printf("persist %-14s %u adds, %.2f M adds/s, %.2f node copies and "
+           "%.0f bytes per add\n", every ? "with snapshots" : "in place",
+           end - start, (end - start) / secs / 1e6,
+           (double)(after.total_copies - before.total_copies) /
+           (end - start),
+           (double)(after.total_mem - before.total_mem) / (end - start));
+}
+
+/*
+ * bench_persist
+ *
+ * The cost of a snapshot, and of the path copying it causes: adds while no
+ * snapshot is held update the nodes in place, adds while one is held copy
+ * the path to the key
+ */
+static void
+bench_persist (void)
+{
+    const uint32_t count = 1000000, more = 100000, snaps = 1000000;
+    std::vector<std::string> keys;
+    patricia_pt_tree_t *tree;
+    double start, secs;
+    uint32_t i;
+
+    bench_path_keys(keys, count + 2 * more, 15);
+    tree = patricia_pt_init();
+    if (!tree) {
+        printf("persist failed to create the tree\n");
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        patricia_pt_add(tree, keys[i].c_str(), NULL);
+    }
+
+    start = bench_now();
+    for (i = 0; i < snaps; i++) {
+        patricia_pt_release(patricia_pt_snapshot(tree));
+    }
+    secs = bench_now() - start;
+    printf("persist snapshot       %lu keys, %.0f ns per snapshot\n",
+           tree->count, secs / snaps * 1e9);
+
+    bench_persist_updates(tree, keys, count, count + more, 0);
+    bench_persist_updates(tree, keys, count + more, count + 2 * more, 1000);
+
+    patricia_pt_destroy(tree);
+}
+
+/*
+ * bench_clone
+ *
+ * A clone against building a copy key by key, and what a round of edits on
+ * the clone costs in memory next to the size of the whole tree
+ */
+static void
+bench_clone (void)
+{
+    const uint32_t count = 1000000, edits = 10000;
+    std::vector<std::string> keys;
+    patricia_pt_tree_t *tree, *copy, *clone;
+    patricia_pt_stats_t before, after;
+    double start, clone_secs, copy_secs;
+    uint32_t i;
+
+    bench_path_keys(keys, count + edits, 16);
+    tree = patricia_pt_init();
+    if (!tree) {
+        printf("clone failed to create the tree\n");
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        patricia_pt_add(tree, keys[i].c_str(), NULL);
+    }
+
+    start = bench_now();
+    copy = patricia_pt_init();
+    for (i = 0; copy && i < count; i++) {
+        patricia_pt_add(copy, keys[i].c_str(), NULL);
+    }
+    copy_secs = bench_now() - start;
+    patricia_pt_destroy(copy);
+
+    patricia_pt_get_stats(&before);
+    start = bench_now();
+    clone = patricia_pt_clone(tree);
+    clone_secs = bench_now() - start;
+    if (!clone) {
+        printf("clone failed\n");
+        patricia_pt_destroy(tree);
+        return;
+    }
+    printf("clone copy     %lu keys, %.1f ms key by key, %.3f ms to clone\n",
+           tree->count, copy_secs * 1e3, clone_secs * 1e3);
+
+    /* Half adds, half deletes of existing keys */
+    for (i = 0; i < edits; i++) {
+        if (i & 1) {
+            patricia_pt_delete(clone, keys[i].c_str(), NULL);
+        } else {
+            patricia_pt_add(clone, keys[count + i].c_str(), NULL);
+        }
+    }
+    patricia_pt_get_stats(&after);
+    printf("clone edits    %u edits, %lu node copies, %.1f MB of %.1f MB "
+           "in total\n", edits, after.total_copies - before.total_copies,
+           (after.total_mem - before.total_mem) / 1048576.0,
+           after.total_mem / 1048576.0);
+
+    patricia_pt_destroy(clone);
+    patricia_pt_destroy(tree);
+}
+
+static int
+bench_setop_add (const char *key, int len, void *data, void *arg)
+{
+    (void)len;
+    return patricia_pt_add((patricia_pt_tree_t *)arg, key, data);
+}
+
+/*
+ * bench_setop_run
+ *
+ * Time the union of a and b against adding every key of b to a clone of a
+ */
+static void
+bench_setop_run (const char *what, patricia_pt_tree_t *a,
+                 patricia_pt_tree_t *b)
+{
+    patricia_pt_tree_t *u, *walked;
+    double start, union_secs, walk_secs;
+
+    start = bench_now();
+    u = patricia_pt_union(a, b);
+    union_secs = bench_now() - start;
+
+    start = bench_now();
+    walked = patricia_pt_clone(a);
+    if (walked) {
+        patricia_pt_walk(b->root, "", bench_setop_add, walked);
+    }
+    walk_secs = bench_now() - start;
+
+    printf("setop %-10s %lu + %lu keys, %.2f ms union, %.2f ms walk and "
+           "add, %s\n", what, a->count, b->count, union_secs * 1e3,
+           walk_secs * 1e3,
+           u && walked && u->count == walked->count ? "same" : "DIFFER");
+
+    patricia_pt_destroy(u);
+    patricia_pt_destroy(walked);
+}
+
+/*
+ * bench_setop
+ *
+ * Union of two independent trees, and of a tree with an edited clone of
+ * itself, where the shared subtrees are not visited
+ */
+static void
+bench_setop (void)
+{
+    const uint32_t count = 500000, edits = 1000;
+    std::vector<std::string> keys;
+    patricia_pt_tree_t *a, *b;
+    uint32_t i;
+
+    bench_path_keys(keys, 2 * count + edits, 17);
+    a = patricia_pt_init();
+    b = patricia_pt_init();
+    if (!a || !b) {
+        printf("setop failed to create the trees\n");
+        patricia_pt_destroy(a);
+        patricia_pt_destroy(b);
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        patricia_pt_add(a, keys[i].c_str(), NULL);
+        patricia_pt_add(b, keys[count + i].c_str(), NULL);
+    }
+    bench_setop_run("disjoint", a, b);
+
+    patricia_pt_destroy(b);
+    b = patricia_pt_clone(a);
+    for (i = 0; b && i < edits; i++) {
+        patricia_pt_add(b, keys[2 * count + i].c_str(), NULL);
+    }
+    if (b) {
+        bench_setop_run("clone", a, b);
+    }
+
+    patricia_pt_destroy(a);
+    patricia_pt_destroy(b);
+}
+
+/*
+ * bench_paged
+ *
+ * Page reads per add and per lookup on a paged trie much larger than its
+ * buffer pool, for a few pool sizes. The file lives in /tmp and is
+ * removed at the end.
+ */
+static void
+bench_paged (void)
+{
+    static const uint32_t pools[] = { 16, 256, 4096 };
+    const uint32_t count = 200000, lookups = 100000;
+    std::vector<std::string> keys;
+    std::mt19937 rng(18);
+    patricia_paged_t *pt;
+    std::string path;
+    double start, secs;
+    uint32_t i, p, found;
+
+    path = "/tmp/patricia_bench_paged_" + std::to_string(getpid());
+    bench_path_keys(keys, count, 18);
+    pt = patricia_paged_open(path.c_str(), pools[0], PATRICIA_PAGED_CREATE);
+    if (!pt) {
+        printf("paged failed to create %s\n", path.c_str());
+        return;
+    }
+    start = bench_now();
+    for (i = 0; i < count; i++) {
+        patricia_paged_add(pt, keys[i].c_str());
+    }
+    secs = bench_now() - start;
+    printf("paged add      %u keys, %u pages, %u frames, %.2f page reads "
+           "per add, %.0f K adds/s\n", count, pt->meta.page_count,
+           pools[0], (double)pt->reads / count, count / secs / 1e3);
+    patricia_paged_close(pt);
+
+    for (p = 0; p < sizeof(pools) / sizeof(pools[0]); p++) {
+        pt = patricia_paged_open(path.c_str(), pools[p], 0);
+        if (!pt) {
+            printf("paged failed to open %s\n", path.c_str());
+            break;
+        }
+        found = 0;
+        start = bench_now();
+        for (i = 0; i < lookups; i++) {
+            found += patricia_paged_lookup(pt, keys[rng() % count].c_str());
+        }
+        secs = bench_now() - start;
+        printf("paged lookup   %u frames, %.2f page reads per lookup, "
+               "%.0f K lookups/s, %u found\n", pools[p],
+               (double)pt->reads / lookups, lookups / secs / 1e3, found);
+        patricia_paged_close(pt);
+    }
+
+    unlink(path.c_str());
+}
+
+/*
+ * bench_aio
+ *
+ * The same lookups on a paged trie with a small pool, one at a time with
+ * patricia_paged_lookup, and in batches through io_uring and through the
+ * thread pool. The file is opened with O_DIRECT where the file system
+ * has it, so that page reads go to the device. It is removed at the end.
+ */
+static void
+bench_aio (void)
+{
+    const uint32_t count = 150000, lookups = 50000, batch = 1000,
+                   pool = 32;
+    static const char *modes[] = { "sync", "io_uring", "threads" };
+    std::vector<std::string> keys;
+    std::vector<const char *> ptrs;
+    std::vector<int> results;
+    patricia_paged_aio_t *aio;
+    patricia_paged_t *pt;
+    std::mt19937 rng(19);
+    std::string path;
+    double start, secs;
+    uint32_t i, j, m, found;
+
+    path = "/tmp/patricia_bench_aio_" + std::to_string(getpid());
+    bench_path_keys(keys, count, 19);
+    pt = patricia_paged_open(path.c_str(), 256, PATRICIA_PAGED_CREATE);
+    if (!pt) {
+        printf("aio failed to create %s\n", path.c_str());
+        return;
+    }
+    for (i = 0; i < count; i++) {
+        patricia_paged_add(pt, keys[i].c_str());
+    }
+    patricia_paged_close(pt);
+    for (i = 0; i < lookups; i++) {
+        ptrs.push_back(keys[rng() % count].c_str());
+    }
+    results.resize(batch);
+
+    for (m = 0; m < 3; m++) {
+        pt = patricia_paged_open(path.c_str(), pool, PATRICIA_PAGED_DIRECT);
+        aio = NULL;
+        if (pt && m > 0) {
+            aio = patricia_paged_aio_init(pt, 0, m == 2 ?
+                                          PATRICIA_PAGED_AIO_NO_URING : 0);
+        }
+        if (!pt || (m > 0 && !aio)) {
+            printf("aio failed to open %s\n", path.c_str());
+            patricia_paged_close(pt);
+            continue;
+        }
+        if (m == 1 && aio->ring_fd < 0) {
+            printf("aio %-9s not available, threads used\n", modes[m]);
+        }
+        found = 0;
+        start = bench_now();
+        for (i = 0; i < lookups; i += batch) {
+            if (aio) {
+                patricia_paged_aio_lookup(aio, &ptrs[i], batch,
+                                          results.data());
+                for (j = 0; j < batch; j++) {
+                    found += results[j] == 1;
+                }
+            } else {
+                for (j = 0; j < batch; j++) {
+                    found += patricia_paged_lookup(pt, ptrs[i + j]) == 1;
+                }
+            }
+        }
+        secs = bench_now() - start;
+        printf("aio %-9s %u lookups, %u frames, %.2f page reads per "
+               "lookup, %.0f ms, %u found\n", modes[m], lookups, pool,
+               (double)pt->reads / lookups, secs * 1e3, found);
+        patricia_paged_aio_destroy(aio);
+        patricia_paged_close(pt);
+    }
+
+    unlink(path.c_str());
+}
+
+/*
+ * bench_fc_run
+ *
+ * Build a front-coded store from the keys, print its size against the
+ * tree's and time lookups of every key in both
+ */
+static void
+bench_fc_run (const char *what, std::vector<std::string> &keys)
+{
+    patricia_tree_t *tree;
+    patricia_fc_t *fc;
+    uint64_t bytes, fc_bytes;
+    double start, tree_secs, fc_secs;
+    uint32_t i, found;
+
+    tree = patricia_init();
+    if (!tree) {
+        printf("fc failed to create the tree\n");
+        return;
+    }
+    for (i = 0; i < keys.size(); i++) {
+        patricia_add(tree, &keys[i][0]);
+    }
+    fc = patricia_fc_build(tree);
+    if (!fc) {
+        printf("fc failed to build the store\n");
+        patricia_destroy(tree);
+        return;
+    }
+    bytes = 0;
+    bench_tree_bytes(tree->root, &bytes);
+    fc_bytes = (uint64_t)fc->block_count * sizeof(uint32_t) + fc->data_size;
+
+    found = 0;
+    start = bench_now();
+    for (i = 0; i < keys.size(); i++) {
+        found += patricia_lookup(tree, &keys[i][0]);
+    }
+    tree_secs = bench_now() - start;
+    start = bench_now();
+    for (i = 0; i < keys.size(); i++) {
+        found += patricia_fc_lookup(fc, keys[i].c_str());
+    }
+    fc_secs = bench_now() - start;
+
+    printf("fc %-6s %u keys, tree %.1f MB (leaves %.1f MB), fc %.1f MB, "
+           "%.1fx smaller than the leaves\n", what, fc->key_count,
+           bytes / 1048576.0, fc->node_bytes / 1048576.0,
+           fc_bytes / 1048576.0, (double)fc->node_bytes / fc_bytes);
+    printf("fc %-6s lookups %.2f M/s tree, %.2f M/s fc, %u found\n", what,
+           keys.size() / tree_secs / 1e6, keys.size() / fc_secs / 1e6,
+           found);
+
+    patricia_fc_destroy(fc);
+    patricia_destroy(tree);
+}
+
+/*
+ * bench_fc
+ *
+ * Front-coded storage for path keys, which share long prefixes with their
+ * neighbours, and for short random keys, which share little
+ */
+static void
+bench_fc (void)
+{
+    const uint32_t count = 500000;
+    std::vector<std::string> keys;
+    std::mt19937 rng(20);
+    std::string key;
+    std::set<std::string> seen;
+
+    bench_path_keys(keys, count, 20);
+    bench_fc_run("paths", keys);
+
+    /* Fixed length, so that no key is a prefix of another */
+    keys.clear();
+    while (seen.size() < count) {
+        key.clear();
+        while (key.size() < 8) {
+            key += (char)('a' + rng() % 26);
+        }
+        if (seen.insert(key).second) {
+            keys.push_back(key);
+        }
+    }
+    bench_fc_run("random", keys);
+}
+
+/*
+ * bench_hope
+ *
+ * Path keys in a plain tree and in one storing them encoded by an encoder
+ * trained on a tenth of them: bytes of the keys, bytes of the trees, and
+ * lookups of every key, which pay for encoding the key first
+ */
+static void
+bench_hope (void)
+{
+    const uint32_t count = 500000;
+    std::vector<std::string> keys;
+    std::vector<const char *> sample;
+    patricia_tree_t *trees[2];
+    patricia_hope_t *hope;
+    char enc[PATRICIA_DEFAULT_KEYLEN];
+    uint64_t bytes[2], in, out;
+    double start, secs[2];
+    uint32_t i, t, found;
+    int len;
+
+    bench_path_keys(keys, count, 21);
+    for (i = 0; i < count; i += 10) {
+        sample.push_back(keys[i].c_str());
+    }
+    start = bench_now();
+    hope = patricia_hope_train(sample.data(), sample.size(), 0);
+    if (!hope) {
+        printf("hope failed to train the encoder\n");
+        return;
+    }
+    printf("hope train  %zu sample keys, %u substrings, %.0f ms\n",
+           sample.size(), hope->dict_count, (bench_now() - start) * 1e3);
+
+    trees[0] = patricia_init();
+    trees[1] = patricia_init();
+    if (!trees[0] || !trees[1] ||
+        patricia_set_codec(trees[1], patricia_hope_encode,
+                           patricia_hope_decode, hope) != 0) {
+        printf("hope failed to create the trees\n");
+        patricia_destroy(trees[0]);
+        patricia_destroy(trees[1]);
+        patricia_hope_destroy(hope);
+        return;
+    }
+    found = 0;
+    for (t = 0; t < 2; t++) {
+        for (i = 0; i < count; i++) {
+            patricia_add(trees[t], &keys[i][0]);
+        }
+        bytes[t] = 0;
+        bench_tree_bytes(trees[t]->root, &bytes[t]);
+        start = bench_now();
+        for (i = 0; i < count; i++) {
+            found += patricia_lookup(trees[t], &keys[i][0]);
+        }
+        secs[t] = bench_now() - start;
+    }
+
+    /* Encoded once more apart from the timed loops */
+    in = out = 0;
+    for (i = 0; i < count; i++) {
+        len = patricia_hope_encode(keys[i].c_str(), enc, sizeof(enc), hope);
+        if (len >= 0) {
+            in += keys[i].size();
+            out += len;
+        }
+    }
+    printf("hope sample %lu bytes in, %lu bytes out, ratio %.2f\n",
+           hope->sample_in, hope->sample_out,
+           (double)hope->sample_in / hope->sample_out);
+    printf("hope keys   %lu bytes in, %lu bytes out, ratio %.2f\n",
+           (unsigned long)in, (unsigned long)out, (double)in / out);
+    printf("hope tree   %u keys, %.1f MB plain, %.1f MB encoded\n", count,
+           bytes[0] / 1048576.0, bytes[1] / 1048576.0);
+    printf("hope lookup %.2f M/s plain, %.2f M/s encoded, %u found\n",
+           count / secs[0] / 1e6, count / secs[1] / 1e6, found);
+
+    patricia_destroy(trees[0]);
+    patricia_destroy(trees[1]);
+    patricia_hope_destroy(hope);
+}
+
+/*
+ * bench_dawg_run
+ *
+ * Build a DAWG from the keys, print its states and bytes against the
+ * tree's and time lookups of every key
+ */
+static void
+bench_dawg_run (const char *what, const std::set<std::string> &keys)
+{
+    std::set<std::string>::const_iterator it;
+    patricia_tree_t *tree;
+    patricia_dawg_t *dawg;
+    std::string key;
+    uint64_t bytes;
+    double start, secs;
+    uint32_t found;
+
+    tree = patricia_init();
+    if (!tree) {
+        printf("dawg failed to create the tree\n");
+        return;
+    }
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        key = *it;
+        patricia_add(tree, &key[0]);
+    }
+    dawg = patricia_dawg_build(tree);
+    if (!dawg) {
+        printf("dawg failed to build\n");
+        patricia_destroy(tree);
+        return;
+    }
+    bytes = (uint64_t)(dawg->state_count + 1) * sizeof(uint32_t) +
+            (uint64_t)dawg->edge_count * (sizeof(uint8_t) + sizeof(uint32_t));
+
+    found = 0;
+    start = bench_now();
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        found += patricia_dawg_lookup(dawg, it->c_str());
+    }
+    secs = bench_now() - start;
+
+    printf("dawg %-6s %u keys, %u -> %u states, tree %.2f MB, dawg %.2f MB, "
+           "%.1fx\n", what, dawg->key_count, dawg->trie_states,
+           dawg->state_count, dawg->node_bytes / 1048576.0,
+           bytes / 1048576.0, (double)dawg->node_bytes / bytes);
+    printf("dawg %-6s %.2f M lookups/s, %u found\n", what,
+           keys.size() / secs / 1e6, found);
+
+    patricia_dawg_destroy(dawg);
+    patricia_destroy(tree);
+}
+
+/*
+ * bench_dawg
+ *
+ * DAWGs for key sets whose endings repeat, log and site paths, and for
+ * the path keys the other cases use
+ */
+static void
+bench_dawg (void)
+{
+    const uint32_t count = 100000;
+    std::set<std::string> keys;
+    std::vector<std::string> paths;
+    std::mt19937 rng(22);
+    char buf[128];
+
+    while (keys.size() < count) {
+        snprintf(buf, sizeof(buf), "/var/log/svc%u/2024-%02u-%02u.%u.log",
+                 (unsigned)(rng() % 200), (unsigned)(1 + rng() % 12),
+                 (unsigned)(1 + rng() % 28), (unsigned)(rng() % 24));
+        keys.insert(buf);
+    }
+    bench_dawg_run("logs", keys);
+
+    keys.clear();
+    while (keys.size() < count) {
+        snprintf(buf, sizeof(buf), "/srv/www/site%u/page%u/index.html",
+                 (unsigned)(rng() % 1000), (unsigned)(rng() % 1000));
+        keys.insert(buf);
+    }
+    bench_dawg_run("sites", keys);
+
+    bench_path_keys(paths, count, 22);
+    keys = std::set<std::string>(paths.begin(), paths.end());
+    bench_dawg_run("paths", keys);
+}
+
+static bench_case_t bench_cases[] = {
+    { "route", "IPv4 longest prefix match, tree and direct index",
+      bench_route },
+    { "static", "C keyword recognition, compile-time set and tree",
+      bench_static },
+    { "da", "Double-array trie against the pointer tree, path keys",
+      bench_da },
+    { "hot", "Cache line blocked layout against the arena tree",
+      bench_hot },
+    { "compact", "Prefix scans on a churned arena, before and after compaction",
+      bench_compact },
+    { "huge", "Arena tree lookups on normal and on huge pages",
+      bench_huge },
+    { "shard", "Concurrent adds against the number of shards",
+      bench_shard },
+    { "persist", "Snapshot cost and path copying on the persistent tree",
+      bench_persist },
+    { "clone", "Cloning a large tree and editing the clone",
+      bench_clone },
+    { "setop", "Union of persistent trees against walking and adding",
+      bench_setop },
+    { "paged", "Page reads of the disk backed trie against the pool size",
+      bench_paged },
+    { "aio", "Paged trie lookups, one at a time and in async batches",
+      bench_aio },
+    { "fc", "Front-coded key store size and lookups against the tree",
+      bench_fc },
+    { "hope", "Tree size and lookups with order-preserving key encoding",
+      bench_hope },
+    { "dawg", "Minimized automaton size against the tree, shared endings",
+      bench_dawg },
+};
+
+#define BENCH_CASES (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+int
+main (int argc, char **argv)
+{
+    size_t i;
+    int j, ran;
+
+    if (argc == 1) {
+        for (i = 0; i < BENCH_CASES; i++) {
+            printf("== %s: %s\n", bench_cases[i].name, bench_cases[i].desc);
+            bench_cases[i].fn();
+        }
+        return 0;
+    }
+
+    for (j = 1; j < argc; j++) {
+        ran = 0;
+        for (i = 0; i < BENCH_CASES; i++) {
+            if (strcmp(argv[j], bench_cases[i].name) == 0) {
+                printf("== %s: %s\n", bench_cases[i].name,
+                       bench_cases[i].desc);
+                bench_cases[i].fn();
+                ran = 1;
+            }
+        }
+        if (!ran) {
+            fprintf(stderr, "Unknown case %s, one of:\n", argv[j]);
+            for (i = 0; i < BENCH_CASES; i++) {
+                fprintf(stderr, "  %-10s %s\n", bench_cases[i].name,
+                        bench_cases[i].desc);
+            }
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/* End of File */
@@ -0,0 +1,165 @@
+/*
+ * list.c
+ *
+ * This file implements the doubly linked list used for the children of a
+ * patricia tree node. The list does not own its elements, destroying it
+ * only frees the list itself.
+ *
+ * Dileep Ramesh, July 2012
+ */
+
+#include <stdlib.h>
+#include "list.h"
+
+/*
+ * list_empty
+ *
+ * Returns 1 if the list has no elements, 0 otherwise
+ */
+int
+list_empty (list_t *list)
+{
+    /* Sanity check */
+    if (!list) {
+        return 1;
+    }
+
+    return list->head == NULL;
+}
+
+/*
+ * list_get_head
+ *
+ * Returns the first element of the list, NULL if it is empty
+ */
+void *
+list_get_head (list_t *list)
+{
+    /* Sanity check */
+    if (!list) {
+        return NULL;
+    }
+
+    return list->head;
+}
+
+/*
+ * list_get_next
+ *
+ * Returns the element following the given one, NULL at the end of the list
+ */
+void *
+list_get_next (list_t *list, void *elem)
+{
+    /* Sanity check */
+    if (!list || !elem) {
+        return NULL;
+    }
+
+    return ((list_elem_t *)elem)->next;
+}
+
+/*
+ * list_remove
+ *
+ * Unlink the given element from the list. Returns 0 upon success, -1 upon
+ * failure.
+ */
+int
+list_remove (list_t *list, list_elem_t *elem)
+{
+    /* Sanity check */
+    if (!list || !elem) {
+        return -1;
+    }
+
+    if (elem->prev) {
+        elem->prev->next = elem->next;
+    } else {
+        list->head = elem->next;
+    }
+    if (elem->next) {
+        elem->next->prev = elem->prev;
+    } else {
+        list->tail = elem->prev;
+    }
+    elem->next = elem->prev = NULL;
+
+    return 0;
+}
+
+/*
+ * list_insert_before
+ *
+ * Insert the given element in front of pos, which has to be on the list.
+ * Returns 0 upon success, -1 upon failure.
+ */
+int
+list_insert_before (list_t *list, list_elem_t *pos, list_elem_t *elem)
+{
+    /* Sanity check */
+    if (!list || !pos || !elem) {
+        return -1;
+    }
+
+    elem->next = pos;
+    elem->prev = pos->prev;
+    if (pos->prev) {
+        pos->prev->next = elem;
+    } else {
+        list->head = elem;
+    }
+    pos->prev = elem;
+
+    return 0;
+}
+
+/*
+ * list_insert
+ *
+ * Append the given element at the end of the list. Returns 0 upon success,
+ * -1 upon failure.
+ */
+int
+list_insert (list_t *list, list_elem_t *elem)
+{
+    /* Sanity check */
+    if (!list || !elem) {
+        return -1;
+    }
+
+    elem->next = NULL;
+    elem->prev = list->tail;
+    if (list->tail) {
+        list->tail->next = elem;
+    } else {
+        list->head = elem;
+    }
+    list->tail = elem;
+
+    return 0;
+}
+
+/*
+ * list_destroy
+ *
+ * Free the list. The elements are left alone, they belong to the caller.
+ */
+void
+list_destroy (list_t *list)
+{
+    free(list);
+}
+
+/*
+ * list_create
+ *
+ * Create an empty list
+ */
+list_t *
+list_create (void)
+{
+    return (list_t *)calloc(1, sizeof(list_t));
+}
+
+/* End of File */
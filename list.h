@@ -0,0 +1,37 @@
+/*
+ * list.h - Header file for the doubly linked list
+ *
+ * The list is intrusive: a list_elem_t is embedded as the first member of
+ * the structure kept on the list, so a pointer to the element is also a
+ * pointer to the structure.
+ *
+ * Dileep Ramesh, July 2012
+ */
+
+#ifndef LIST_H
+#define LIST_H
+
+/* Datastructures */
+
+typedef struct list_elem_s {
+    struct list_elem_s  *next;
+    struct list_elem_s  *prev;
+} list_elem_t;
+
+typedef struct list_s {
+    list_elem_t *head;
+    list_elem_t *tail;
+} list_t;
+
+/* Function Prototypes */
+
+int list_empty (list_t *list);
+void *list_get_head (list_t *list);
+void *list_get_next (list_t *list, void *elem);
+int list_remove (list_t *list, list_elem_t *elem);
+int list_insert_before (list_t *list, list_elem_t *pos, list_elem_t *elem);
+int list_insert (list_t *list, list_elem_t *elem);
+void list_destroy (list_t *list);
+list_t *list_create (void);
+
+#endif /* LIST_H */
@@ -19,11 +19,24 @@
 
 #ifdef PATRICIA_STATS_ON
 /*
- * Globals
+ * Every tree keeps its own counters. They only change along with the tree,
+ * under whatever serializes its writers, so trees used from different
+ * threads never touch the same counter. Lookups do not update them.
  */
-static patricia_stats_t stats;
+#define PATRICIA_STAT_ADD(tree, field, n)   ((tree)->stats.field += (n))
+#define PATRICIA_STAT_SUB(tree, field, n)   ((tree)->stats.field -= (n))
 #endif
 
+/* State of a walk, see patricia_walk_internal */
+typedef struct patricia_walk_ctx_s {
+    patricia_tree_t     *tree;
+    const char          *lo;                /* First key, NULL if none */
+    const char          *hi;                /* Past the last key, or NULL */
+    patricia_walk_fn    fn;
+    void                *arg;
+    int                 past;               /* Reached hi */
+} patricia_walk_ctx_t;
+
 /*
  * substring
  *
@@ -43,9 +56,6 @@ substring (const char *str, int begin, int len)
     }
 
     substr = (char *)malloc(len + 1);
-#ifdef PATRICIA_STATS_ON
-    stats.total_mem += (len + 1);
-#endif
 
     i = 0;
     while (i < len) {
@@ -103,13 +113,13 @@ is_substring (char *str1, char *str2)
  * Create a new node for the given key
  */
 patricia_node_t *
-patricia_node_init (char *key, uint8_t create_list)
+patricia_node_init (patricia_tree_t *tree, char *key, uint8_t create_list)
 {
     int ret = 0, keylen;
     patricia_node_t *node;
 
     /* Sanity check */
-    if (!key) {
+    if (!tree || !key) {
         return NULL;
     }
 
@@ -119,8 +129,8 @@ patricia_node_init (char *key, uint8_t create_list)
         return NULL;
     }
 #ifdef PATRICIA_STATS_ON
-    stats.total_mem += sizeof(patricia_node_t);
-    stats.total_nodes++;
+    PATRICIA_STAT_ADD(tree, total_mem, sizeof(patricia_node_t));
+    PATRICIA_STAT_ADD(tree, total_nodes, 1);
 #endif
 
     keylen = strlen(key);
@@ -131,20 +141,23 @@ patricia_node_init (char *key, uint8_t create_list)
     strncpy(node->key, key, keylen);
     node->key[keylen] = 0;
 #ifdef PATRICIA_STATS_ON
-    stats.total_mem += (keylen + 1);
+    PATRICIA_STAT_ADD(tree, total_mem, (keylen + 1));
 #endif
+    node->is_key = 0;
 
     /*
-     * Are we asked to create a children list? Will be false in case of a node
-     * split.
+     * Are we asked to create a children list? Leaves are created without one,
+     * it is allocated when the first child is added. In case of a node split
+     * the caller hands over the existing list.
      */
+    node->children = NULL;
     if (create_list) {
         node->children = list_create();
         if (!node->children) {
             return NULL;
         }
 #ifdef PATRICIA_STATS_ON
-        stats.total_mem += sizeof(list_t);
+        PATRICIA_STAT_ADD(tree, total_mem, sizeof(list_t));
 #endif
     }
 
@@ -154,17 +167,29 @@ patricia_node_init (char *key, uint8_t create_list)
 /*
  * patricia_add_child_node
  *
- * Add the given child node to the parent's list of children
+ * Add the given child node to the parent's list of children. The list is
+ * created here if the parent was a leaf. Returns 0 upon success, -1 upon
+ * failure.
  */
-static void
-patricia_add_child_node (patricia_node_t *parent, patricia_node_t *child)
+static int
+patricia_add_child_node (patricia_tree_t *tree, patricia_node_t *parent,
+                         patricia_node_t *child)
 {
-    int ret = 0;
     patricia_node_t *node, *next_node;
 
     /* Sanity check */
     if (!parent || !child) {
-        return;
+        return -1;
+    }
+
+    if (!parent->children) {
+        parent->children = list_create();
+        if (!parent->children) {
+            return -1;
+        }
+#ifdef PATRICIA_STATS_ON
+        PATRICIA_STAT_ADD(tree, total_mem, sizeof(list_t));
+#endif
     }
 
     /* 
@@ -173,21 +198,71 @@ patricia_add_child_node (patricia_node_t *parent, patricia_node_t *child)
      */
     if (list_empty(parent->children)) {
         list_insert(parent->children, &child->link);
-        return;
+        return 0;
     }
 
-    node = (patricia_node_t *)list_get_head(parent->children);
+    node = PATRICIA_FIRST_CHILD(parent);
     while (node) {
         next_node = (patricia_node_t *)list_get_next(parent->children, node);
         if (strcmp(child->key, node->key) < 0) {
             list_insert_before(parent->children, &node->link, 
                                &child->link);
-            return;
+            return 0;
         }
         node = next_node;
     }
 
     list_insert(parent->children, &child->link);
+    return 0;
+}
+
+/*
+ * patricia_remove_child_node
+ *
+ * Remove the given child node from the parent's list of children. The list
+ * is freed once the parent becomes a leaf.
+ */
+static int
+patricia_remove_child_node (patricia_tree_t *tree, patricia_node_t *parent,
+                            patricia_node_t *child)
+{
+    int ret;
+
+    ret = list_remove(parent->children, &child->link);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (list_empty(parent->children)) {
+        list_destroy(parent->children);
+        parent->children = NULL;
+#ifdef PATRICIA_STATS_ON
+        PATRICIA_STAT_SUB(tree, total_mem, sizeof(list_t));
+#endif
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_truncate_key
+ *
+ * Cut the key of the given node down to its first len bytes. The key
+ * buffer is shrunk in place, there is no need for a new copy.
+ */
+static void
+patricia_truncate_key (patricia_tree_t *tree, patricia_node_t *node, int len)
+{
+    char *key;
+
+#ifdef PATRICIA_STATS_ON
+    PATRICIA_STAT_SUB(tree, total_mem, (strlen(node->key) - len));
+#endif
+    node->key[len] = 0;
+    key = (char *)realloc(node->key, len + 1);
+    if (key) {
+        node->key = key;
+    }
 }
 
 /*
@@ -244,7 +319,7 @@ patricia_get_key_count (patricia_node_t *root, unsigned long *count)
         return;
     }
 
-    child = (patricia_node_t *)list_get_head(root->children);
+    child = PATRICIA_FIRST_CHILD(root);
     while (child) {
         next_child = (patricia_node_t *)list_get_next(root->children, child);
         patricia_get_key_count(child, count);
@@ -252,7 +327,7 @@ patricia_get_key_count (patricia_node_t *root, unsigned long *count)
     }
 
     /* Update the count when we reach a leaf node */
-    if (list_empty(root->children)) {
+    if (PATRICIA_IS_LEAF(root)) {
         *count = *count + 1;
     }
 #endif
@@ -267,12 +342,19 @@ void
 patricia_print_stats (patricia_tree_t *tree)
 {
 #ifdef PATRICIA_STATS_ON
-    stats.total_keys = 0;
-    patricia_get_key_count(tree->root, &stats.total_keys);
+    unsigned long keys = 0;
 
-    printf("\nTotal number of keys: %lu\n", stats.total_keys);
-    printf("Total number of nodes: %lu\n", stats.total_nodes);
-    printf("Total memory used: %lu bytes\n\n", stats.total_mem);
+    /* Sanity check */
+    if (!tree) {
+        return;
+    }
+
+    /* Keys are counted here, so that printing does not write to the tree */
+    patricia_get_key_count(tree->root, &keys);
+
+    printf("\nTotal number of keys: %lu\n", keys);
+    printf("Total number of nodes: %lu\n", tree->stats.total_nodes);
+    printf("Total memory used: %lu bytes\n\n", tree->stats.total_mem);
 #endif
 }
 
@@ -349,14 +431,11 @@ patricia_lookup_node_internal (patricia_tree_t *tree,
             return NULL;
         }
 
-        child = (patricia_node_t *)list_get_head(cur_node->children);
+        child = PATRICIA_FIRST_CHILD(cur_node);
         while (child) {
             next_child = (patricia_node_t *)list_get_next(cur_node->children, child);
             if (child->key[0] == new_key[0]) {
                 retnode = patricia_lookup_node_internal(tree, child, new_key);
-#ifdef PATRICIA_STATS_ON
-                stats.total_mem -= strlen(new_key);
-#endif
                 free(new_key);
                 return retnode;
             }
@@ -364,9 +443,6 @@ patricia_lookup_node_internal (patricia_tree_t *tree,
         }
 
         if (new_key) {
-#ifdef PATRICIA_STATS_ON
-            stats.total_mem -= strlen(new_key);
-#endif
             free(new_key);
         }
 
@@ -439,14 +515,11 @@ patricia_lookup_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
             return 0;
         }
 
-        child = (patricia_node_t *)list_get_head(cur_node->children);
+        child = PATRICIA_FIRST_CHILD(cur_node);
         while (child) {
             next_child = (patricia_node_t *)list_get_next(cur_node->children, child);
             if (child->key[0] == new_key[0]) {
                 ret = patricia_lookup_internal(tree, child, new_key);
-#ifdef PATRICIA_STATS_ON
-                stats.total_mem -= strlen(new_key);
-#endif
                 free(new_key);
                 return ret;
             }
@@ -454,9 +527,6 @@ patricia_lookup_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
         }
 
         if (new_key) {
-#ifdef PATRICIA_STATS_ON
-            stats.total_mem -= strlen(new_key);
-#endif
             free(new_key);
         }
 
@@ -477,6 +547,15 @@ patricia_lookup_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
 int
 patricia_lookup (patricia_tree_t *tree, char *key)
 {
+    char enc[PATRICIA_DEFAULT_KEYLEN];
+
+    if (tree && key && tree->encode_fn) {
+        if (tree->encode_fn(key, enc, sizeof(enc), tree->codec_arg) < 0) {
+            return 0;
+        }
+        key = enc;
+    }
+
     return patricia_lookup_internal(tree, tree->root, key);
 }
 
@@ -501,7 +580,7 @@ patricia_lookup_prefix_partial_internal (patricia_node_t *cur_node, char *res,
     }
 
     /* This is similar to a depth first search of the tree */
-    child = (patricia_node_t *)list_get_head(cur_node->children);
+    child = PATRICIA_FIRST_CHILD(cur_node);
     while (child) {
         next_child = (patricia_node_t *)list_get_next(cur_node->children, child);
 
@@ -552,7 +631,7 @@ patricia_lookup_prefix_partial_internal (patricia_node_t *cur_node, char *res,
     }
 
     /* Update res_list only when we reach a leaf node */
-    if (list_empty(cur_node->children)) {
+    if (PATRICIA_IS_LEAF(cur_node)) {
         /* 
          * TODO Hack to ensure duplicates are not added to the list. See if we
          * can avoid this!
@@ -588,6 +667,11 @@ patricia_lookup_prefix_partial (patricia_tree_t *tree, char *prefix,
     if (!tree || !prefix || !res_list) {
         return -1;
     }
+
+    /* The stored keys are encoded, see patricia_walk_prefix instead */
+    if (tree->encode_fn) {
+        return -1;
+    }
     prefix_len = strlen(prefix);
 
     /* 
@@ -629,14 +713,14 @@ patricia_lookup_prefix_full_internal (patricia_node_t *cur_node,
     prev_res[len] = 0;
 
     strcat(res, cur_node->key);    
-    child = (patricia_node_t *)list_get_head(cur_node->children);
+    child = PATRICIA_FIRST_CHILD(cur_node);
     while (child) {
         next_child = (patricia_node_t *)list_get_next(cur_node->children, child);
         patricia_lookup_prefix_full_internal(child, res, res_list);
         child = next_child;
     }
 
-    if (list_empty(cur_node->children)) {
+    if (PATRICIA_IS_LEAF(cur_node)) {
         strcat(res_list, res);
         strcat(res_list, " ");
     }
@@ -662,6 +746,11 @@ patricia_lookup_prefix_full (patricia_tree_t *tree, char *prefix, char *buf)
         return -1;
     }
 
+    /* The stored keys are encoded, see patricia_walk_prefix instead */
+    if (tree->encode_fn) {
+        return -1;
+    }
+
     prefix_node = patricia_lookup_node(tree, prefix);
     if (!prefix_node) {
         return -1;
@@ -676,6 +765,165 @@ patricia_lookup_prefix_full (patricia_tree_t *tree, char *prefix, char *buf)
     return 0;
 }
 
+/*
+ * patricia_walk_internal
+ *
+ * Recursive routine which invokes fn on every key under the given node
+ * between the bounds of the walk. res holds the key of the parent node,
+ * len bytes long. Every key under a node starts with its key, so subtrees
+ * wholly below lo are skipped and the walk ends at the first node not
+ * below hi. Stops as soon as fn returns a non zero value and passes that
+ * value back up.
+ */
+static int
+patricia_walk_internal (patricia_walk_ctx_t *ctx, patricia_node_t *cur_node,
+                        char *res, int len)
+{
+    patricia_node_t *child, *next_child;
+    char dec[PATRICIA_DEFAULT_KEYLEN];
+    int keylen, ret;
+
+    keylen = strlen(cur_node->key);
+    if (len + keylen >= PATRICIA_DEFAULT_KEYLEN) {
+        return -1;
+    }
+    memcpy(res + len, cur_node->key, keylen);
+    len += keylen;
+    res[len] = 0;
+
+    if (ctx->hi && strcmp(res, ctx->hi) >= 0) {
+        ctx->past = 1;
+        return 0;
+    }
+    if (ctx->lo && strcmp(res, ctx->lo) < 0 &&
+        (PATRICIA_IS_LEAF(cur_node) || strncmp(res, ctx->lo, len) != 0)) {
+        return 0;
+    }
+
+    /* Keys are stored at the leaves */
+    if (PATRICIA_IS_LEAF(cur_node)) {
+        if (!ctx->tree->decode_fn) {
+            return ctx->fn(res, ctx->arg);
+        }
+        if (ctx->tree->decode_fn(res, dec, sizeof(dec),
+                                 ctx->tree->codec_arg) < 0) {
+            return -1;
+        }
+        return ctx->fn(dec, ctx->arg);
+    }
+
+    child = PATRICIA_FIRST_CHILD(cur_node);
+    while (child && !ctx->past) {
+        next_child = (patricia_node_t *)list_get_next(cur_node->children, child);
+        ret = patricia_walk_internal(ctx, child, res, len);
+        if (ret != 0) {
+            return ret;
+        }
+        child = next_child;
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_walk_prefix
+ *
+ * Invoke fn on every key of the tree starting with prefix, in
+ * lexicographical order. They are the keys from prefix up to the first
+ * string past all of them, the prefix with the last byte not 0xff
+ * incremented. Returns as patricia_walk does.
+ */
+int
+patricia_walk_prefix (patricia_tree_t *tree, char *prefix,
+                      patricia_walk_fn fn, void *arg)
+{
+    char hi[PATRICIA_DEFAULT_KEYLEN];
+    int len;
+
+    /* Sanity check */
+    if (!tree || !prefix || !fn) {
+        return -1;
+    }
+
+    len = strlen(prefix);
+    if (len >= PATRICIA_DEFAULT_KEYLEN) {
+        return 0;
+    }
+    memcpy(hi, prefix, len);
+    while (len > 0 && (uint8_t)hi[len - 1] == 0xff) {
+        len--;
+    }
+    if (len == 0) {
+        return patricia_walk_range(tree, prefix, NULL, fn, arg);
+    }
+    hi[len - 1]++;
+    hi[len] = 0;
+
+    return patricia_walk_range(tree, prefix, hi, fn, arg);
+}
+
+/*
+ * patricia_walk_range
+ *
+ * Invoke fn on every key of the tree from lo up to but not including hi,
+ * in lexicographical order. Either bound may be NULL to leave that side
+ * open. With a codec set the bounds are encoded too, which keeps the range
+ * as long as the encoding preserves the order. Returns as patricia_walk
+ * does.
+ */
+int
+patricia_walk_range (patricia_tree_t *tree, char *lo, char *hi,
+                     patricia_walk_fn fn, void *arg)
+{
+    char res[PATRICIA_DEFAULT_KEYLEN];
+    char enc_lo[PATRICIA_DEFAULT_KEYLEN];
+    char enc_hi[PATRICIA_DEFAULT_KEYLEN];
+    patricia_walk_ctx_t ctx;
+
+    /* Sanity check */
+    if (!tree || !fn) {
+        return -1;
+    }
+
+    if (PATRICIA_IS_LEAF(tree->root)) {
+        return 0;
+    }
+
+    if (tree->encode_fn) {
+        if (lo && tree->encode_fn(lo, enc_lo, sizeof(enc_lo),
+                                  tree->codec_arg) < 0) {
+            return -1;
+        }
+        if (hi && tree->encode_fn(hi, enc_hi, sizeof(enc_hi),
+                                  tree->codec_arg) < 0) {
+            return -1;
+        }
+        lo = lo ? enc_lo : NULL;
+        hi = hi ? enc_hi : NULL;
+    }
+
+    ctx.tree = tree;
+    ctx.lo = lo;
+    ctx.hi = hi;
+    ctx.fn = fn;
+    ctx.arg = arg;
+    ctx.past = 0;
+
+    return patricia_walk_internal(&ctx, tree->root, res, 0);
+}
+
+/*
+ * patricia_walk
+ *
+ * Invoke fn on every key of the tree in lexicographical order. Returns 0
+ * once all the keys are visited, else the non zero value returned by fn.
+ */
+int
+patricia_walk (patricia_tree_t *tree, patricia_walk_fn fn, void *arg)
+{
+    return patricia_walk_range(tree, NULL, NULL, fn, arg);
+}
+
 /*
  * patricia_delete_keys
  *
@@ -683,7 +931,7 @@ patricia_lookup_prefix_full (patricia_tree_t *tree, char *prefix, char *buf)
  * associated memory
  */
 static int
-patricia_delete_keys (patricia_node_t *root)
+patricia_delete_keys (patricia_tree_t *tree, patricia_node_t *root)
 {
     patricia_node_t *child, *next_child;
 #ifdef PATRICIA_STATS_ON
@@ -696,21 +944,85 @@ patricia_delete_keys (patricia_node_t *root)
     }
 
     /* Do a depth first search */
-    child = (patricia_node_t *)list_get_head(root->children);
+    child = PATRICIA_FIRST_CHILD(root);
     while (child) {
         next_child = (patricia_node_t *)list_get_next(root->children, child);
-        list_remove(root->children, &child->link);
-        patricia_delete_keys(child);
+        patricia_remove_child_node(tree, root, child);
+        patricia_delete_keys(tree, child);
         child = next_child;
     }
 
     /* We have cleaned up all the children. Its safe to blow away this node. */
-    list_destroy(root->children);
     free(root->key);
     free(root);
 #ifdef PATRICIA_STATS_ON
-    stats.total_mem -= (sizeof(list_t) + len + sizeof(patricia_node_t));
-    stats.total_nodes--;
+    PATRICIA_STAT_SUB(tree, total_mem, (len + 1 + sizeof(patricia_node_t)));
+    PATRICIA_STAT_SUB(tree, total_nodes, 1);
+#endif
+
+    return 0;
+}
+
+/*
+ * patricia_collapse_node
+ *
+ * Called on the way back up once a key below node is deleted. A node that
+ * is not a key itself and is left without children only held the common
+ * prefix of the deleted keys and is removed, else it would be reported as
+ * a key of its own. One left with a single child is merged with it. Nodes
+ * where a key ends stay as they are. Returns 0 upon success, -1 upon
+ * failure.
+ */
+static int
+patricia_collapse_node (patricia_tree_t *tree, patricia_node_t *parent,
+                        patricia_node_t *node)
+{
+    patricia_node_t *child;
+    int len, child_len;
+    char *key;
+
+    /* Sanity check */
+    if (!parent || !node) {
+        return -1;
+    }
+
+    if (node->is_key) {
+        return 0;
+    }
+
+    if (!node->children) {
+        if (patricia_remove_child_node(tree, parent, node) != 0) {
+            return -1;
+        }
+        return patricia_delete_keys(tree, node);
+    }
+
+    child = PATRICIA_FIRST_CHILD(node);
+    if (list_get_next(node->children, child)) {
+        return 0;
+    }
+
+    /* Without memory for the longer label the tree is left unmerged */
+    len = strlen(node->key);
+    child_len = strlen(child->key);
+    key = (char *)realloc(node->key, len + child_len + 1);
+    if (!key) {
+        return 0;
+    }
+    memcpy(key + len, child->key, child_len + 1);
+    node->key = key;
+
+    /* The child's list, if any, moves up to the node */
+    if (patricia_remove_child_node(tree, node, child) != 0) {
+        return -1;
+    }
+    node->children = child->children;
+    node->is_key = child->is_key;
+    free(child->key);
+    free(child);
+#ifdef PATRICIA_STATS_ON
+    PATRICIA_STAT_SUB(tree, total_mem, (1 + sizeof(patricia_node_t)));
+    PATRICIA_STAT_SUB(tree, total_nodes, 1);
 #endif
 
     return 0;
@@ -721,7 +1033,8 @@ patricia_delete_keys (patricia_node_t *root)
  *
  * Recursive routine which removes a key from the given patricia tree. If the
  * key is not associated with a leaf, all the keys having the given key as
- * prefix will be removed.
+ * prefix will be removed. The nodes above the deleted key are collapsed,
+ * see patricia_collapse_node.
  */
 static int
 patricia_delete_internal (patricia_tree_t *tree, patricia_node_t *cur_node, 
@@ -764,17 +1077,17 @@ patricia_delete_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
             return -1;
         }
 
-        child = (patricia_node_t *)list_get_head(cur_node->children);
+        child = PATRICIA_FIRST_CHILD(cur_node);
         while (child) {
             next_child = (patricia_node_t *)list_get_next(cur_node->children, child);
             if (child->key[0] == new_key[0]) {
                 if (strcmp(child->key, new_key) == 0) {
-                    ret = list_remove(cur_node->children, &child->link);
+                    ret = patricia_remove_child_node(tree, cur_node, child);
                     if (ret != 0) {
                         break;
                     }
 
-                    ret = patricia_delete_keys(child);
+                    ret = patricia_delete_keys(tree, child);
                     if (ret != 0) {
                         break;
                     }
@@ -782,15 +1095,17 @@ patricia_delete_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
                     deleted = 1;
                     break;
                 }
-                return patricia_delete_internal(tree, child, new_key);
+                ret = patricia_delete_internal(tree, child, new_key);
+                if (ret == 0) {
+                    ret = patricia_collapse_node(tree, cur_node, child);
+                    deleted = (ret == 0);
+                }
+                break;
             }
             child = next_child;
         }
 
         if (new_key) {
-#ifdef PATRICIA_STATS_ON
-            stats.total_mem -= strlen(new_key);
-#endif
             free(new_key);
         }
     }
@@ -811,12 +1126,26 @@ patricia_delete_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
 int
 patricia_delete (patricia_tree_t *tree, char *key)
 {
+    char enc[PATRICIA_DEFAULT_KEYLEN];
+
     /* Sanity check */
     if (!tree || !key) {
         return -1;
     }
 
-    return patricia_delete_internal(tree, tree->root, key);
+    if (tree->encode_fn) {
+        if (tree->encode_fn(key, enc, sizeof(enc), tree->codec_arg) < 0 ||
+            patricia_delete_internal(tree, tree->root, enc) != 0) {
+            return -1;
+        }
+    } else if (patricia_delete_internal(tree, tree->root, key) != 0) {
+        return -1;
+    }
+    if (tree->change_fn) {
+        tree->change_fn(PATRICIA_CHANGE_DELETE, key, tree->change_arg);
+    }
+
+    return 0;
 }
 
 /*
@@ -831,8 +1160,9 @@ patricia_add_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
 {
     int prefix_len, ret = 0;
     uint8_t insert_done;
-    char *new_key, *common_key, *prev_key, *next_key;
+    char *new_key;
     patricia_node_t *child, *next_child, *prev_node, *next_node, *new_node;
+    list_t *children;
 
     /* Sanity check */
     if (!tree || !cur_node || !key) {
@@ -876,7 +1206,7 @@ patricia_add_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
 
         insert_done = 0;
 
-        child = (patricia_node_t *)list_get_head(cur_node->children);
+        child = PATRICIA_FIRST_CHILD(cur_node);
         while (child) {
             next_child = (patricia_node_t *)list_get_next(cur_node->children, child);
             if (child->key[0] == new_key[0]) {
@@ -884,15 +1214,9 @@ patricia_add_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
                 ret = patricia_add_internal(tree, child, new_key);
                 if (ret != 0) {
                     insert_done = 0;
-#ifdef PATRICIA_STATS_ON
-                    stats.total_mem -= strlen(new_key);
-#endif
                     free(new_key);
                     return -1;
                 } else {
-#ifdef PATRICIA_STATS_ON
-                    stats.total_mem -= strlen(new_key);
-#endif
                     free(new_key);
                     return 0;
                 }
@@ -900,39 +1224,59 @@ patricia_add_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
             child = next_child;
         }
 
+        /*
+         * The new leaf keeps the whole remaining suffix. It is only split
+         * when another key diverges inside it.
+         */
         if (insert_done == 0) {
-            new_node = patricia_node_init(new_key, 1);
-            patricia_add_child_node(cur_node, new_node);
+            new_node = patricia_node_init(tree, new_key, 0);
+            if (!new_node ||
+                patricia_add_child_node(tree, cur_node, new_node) != 0) {
+                ret = -1;
+            } else {
+                new_node->is_key = 1;
+            }
         }
 
-#ifdef PATRICIA_STATS_ON
-        stats.total_mem -= strlen(new_key);
-#endif
         free(new_key);
 
+        return ret;
+
     } else if (prefix_len < strlen(key)) {
-        /* Case 3 */
-        common_key = substring(key, 0, prefix_len);
-        prev_key = substring(cur_node->key, prefix_len, 
-                             strlen(cur_node->key) - prefix_len);
-        next_key = substring(key, prefix_len, strlen(key) - prefix_len);
+        /*
+         * Case 3. The suffixes are taken straight from the existing key
+         * and the new key, and the current node keeps the common prefix.
+         */
+        prev_node = patricia_node_init(tree, cur_node->key + prefix_len, 0);
+        next_node = patricia_node_init(tree, key + prefix_len, 0);
+        children = list_create();
+        if (!prev_node || !next_node || !children) {
+            if (prev_node) {
+                patricia_delete_keys(tree, prev_node);
+            }
+            if (next_node) {
+                patricia_delete_keys(tree, next_node);
+            }
+            list_destroy(children);
+            return -1;
+        }
+#ifdef PATRICIA_STATS_ON
+        PATRICIA_STAT_ADD(tree, total_mem, sizeof(list_t));
+#endif
 
-        prev_node = patricia_node_init(prev_key, 0);
+        /*
+         * Everything the split needs is allocated, so the current node is
+         * only changed once nothing can fail any more
+         */
         prev_node->children = cur_node->children;
+        prev_node->is_key = cur_node->is_key;
+        next_node->is_key = 1;
 
-        next_node = patricia_node_init(next_key, 1);
-
-        free(cur_node->key);
-#ifdef PATRICIA_STATS_ON
-        stats.total_mem -= strlen(cur_node->key);
-#endif
-        cur_node->key = common_key;
-        cur_node->children = list_create();
-#ifdef PATRICIA_STATS_ON
-        stats.total_mem += sizeof(list_t);
-#endif
-        patricia_add_child_node(cur_node, prev_node);
-        patricia_add_child_node(cur_node, next_node);
+        patricia_truncate_key(tree, cur_node, prefix_len);
+        cur_node->children = children;
+        cur_node->is_key = 0;
+        patricia_add_child_node(tree, cur_node, prev_node);
+        patricia_add_child_node(tree, cur_node, next_node);
 
     } else if (prefix_len == strlen(key)) {
         /* 
@@ -940,30 +1284,31 @@ patricia_add_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
          * an existing key. In this case, we replace the existing key with
          * the prefix and create a new node for the remaining key.
          */
-        common_key = substring(key, 0, prefix_len);
-        next_key = substring(cur_node->key, prefix_len,
-                             strlen(cur_node->key) - prefix_len);
-
         if (prefix_len == strlen(cur_node->key)) {
-            /* Nothing to do */
-            free(common_key);
-            free(next_key);
+            /* The key ends at a node made by an earlier split */
+            cur_node->is_key = 1;
             return 0;
         }
 
-        next_node = patricia_node_init(next_key, 0);
-        next_node->children = cur_node->children;
-
-        free(cur_node->key);
-#ifdef PATRICIA_STATS_ON
-        stats.total_mem -= strlen(cur_node->key);
-#endif
-        cur_node->key = common_key;
-        cur_node->children = list_create();
+        next_node = patricia_node_init(tree, cur_node->key + prefix_len, 0);
+        children = list_create();
+        if (!next_node || !children) {
+            if (next_node) {
+                patricia_delete_keys(tree, next_node);
+            }
+            list_destroy(children);
+            return -1;
+        }
 #ifdef PATRICIA_STATS_ON
-        stats.total_mem += sizeof(list_t);
+        PATRICIA_STAT_ADD(tree, total_mem, sizeof(list_t));
 #endif
-        patricia_add_child_node(cur_node, next_node);
+        next_node->children = cur_node->children;
+        next_node->is_key = cur_node->is_key;
+
+        patricia_truncate_key(tree, cur_node, prefix_len);
+        cur_node->children = children;
+        cur_node->is_key = 1;
+        patricia_add_child_node(tree, cur_node, next_node);
     }
 
     return 0;
@@ -977,12 +1322,81 @@ patricia_add_internal (patricia_tree_t *tree, patricia_node_t *cur_node,
 int
 patricia_add (patricia_tree_t *tree, char *key)
 {
+    char enc[PATRICIA_DEFAULT_KEYLEN];
+
     /* Sanity check */
     if (!tree || !key) {
         return -1;
     }
 
-    return patricia_add_internal(tree, tree->root, key);
+    /* The key has to fit decoded as well, see patricia_walk */
+    if (tree->encode_fn) {
+        if (strlen(key) >= PATRICIA_DEFAULT_KEYLEN ||
+            tree->encode_fn(key, enc, sizeof(enc), tree->codec_arg) < 0 ||
+            patricia_add_internal(tree, tree->root, enc) != 0) {
+            return -1;
+        }
+    } else if (patricia_add_internal(tree, tree->root, key) != 0) {
+        return -1;
+    }
+    if (tree->change_fn) {
+        tree->change_fn(PATRICIA_CHANGE_ADD, key, tree->change_arg);
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_set_change_fn
+ *
+ * Have fn called with arg after every successful add or delete on the
+ * tree, in the order they happen, or stop it if fn is NULL. Returns 0 upon
+ * success, -1 upon failure.
+ */
+int
+patricia_set_change_fn (patricia_tree_t *tree, patricia_change_fn fn,
+                        void *arg)
+{
+    /* Sanity check */
+    if (!tree) {
+        return -1;
+    }
+
+    tree->change_fn = fn;
+    tree->change_arg = arg;
+
+    return 0;
+}
+
+/*
+ * patricia_set_codec
+ *
+ * Have every key encoded with encode_fn before it is added, deleted or
+ * looked up, and decoded with decode_fn before a walk hands it out, or
+ * stop it if both are NULL. The change function still sees the keys as
+ * given. The encoding must keep the order of the keys, or walks lose
+ * their order and ranges, and the tree must be empty. The prefix lookups
+ * that fill a buffer do not work on encoded keys, patricia_walk_prefix
+ * does. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_set_codec (patricia_tree_t *tree, patricia_codec_fn encode_fn,
+                    patricia_codec_fn decode_fn, void *arg)
+{
+    /* Sanity check */
+    if (!tree || !encode_fn != !decode_fn) {
+        return -1;
+    }
+
+    if (!PATRICIA_IS_LEAF(tree->root)) {
+        return -1;
+    }
+
+    tree->encode_fn = encode_fn;
+    tree->decode_fn = decode_fn;
+    tree->codec_arg = arg;
+
+    return 0;
 }
 
 /*
@@ -993,15 +1407,29 @@ patricia_add (patricia_tree_t *tree, char *key)
 int
 patricia_destroy (patricia_tree_t *tree)
 {
+    patricia_node_t *child, *next_child;
+
+    /* Sanity check */
+    if (!tree) {
+        return -1;
+    }
+
+    child = PATRICIA_FIRST_CHILD(tree->root);
+    while (child) {
+        next_child = (patricia_node_t *)list_get_next(tree->root->children,
+                                                      child);
+        patricia_remove_child_node(tree, tree->root, child);
+        patricia_delete_keys(tree, child);
+        child = next_child;
+    }
+
+    /* The counters go with the tree */
     free(tree->root->key);
-    list_destroy(tree->root->children);
+    if (tree->root->children) {
+        list_destroy(tree->root->children);
+    }
     free(tree->root);
     free(tree);
-#ifdef PATRICIA_STATS_ON
-    stats.total_mem += (sizeof(patricia_tree_t) + sizeof(patricia_node_t) + 
-                        sizeof(list_t) + PATRICIA_ROOT_KEYLEN);
-    stats.total_nodes--;
-#endif
 
     return 0;
 }
@@ -1025,26 +1453,32 @@ patricia_init (void)
     root = (patricia_node_t *)malloc(sizeof(patricia_node_t));
     if (!root) {
         free(tree);
-#ifdef PATRICIA_STATS_ON
-        stats.total_mem -= sizeof(patricia_tree_t);
-#endif
         return NULL;
     }
 
     root->key = (char *)malloc(PATRICIA_ROOT_KEYLEN);
-    root->key[0] = 0;
-    root->children = list_create();
-    if (!root->children) {
+    if (!root->key) {
+        free(root);
+        free(tree);
         return NULL;
     }
+    root->key[0] = 0;
+    root->children = NULL;
+    root->is_key = 0;
 
 #ifdef PATRICIA_STATS_ON
-    stats.total_mem += (sizeof(patricia_tree_t) + sizeof(patricia_node_t) + 
-                        sizeof(list_t) + PATRICIA_ROOT_KEYLEN);
-    stats.total_nodes++;
+    tree->stats.total_mem = sizeof(patricia_tree_t) + sizeof(patricia_node_t) +
+                            PATRICIA_ROOT_KEYLEN;
+    tree->stats.total_keys = 0;
+    tree->stats.total_nodes = 1;
 #endif
 
     tree->root = root;
+    tree->change_fn = NULL;
+    tree->change_arg = NULL;
+    tree->encode_fn = NULL;
+    tree->decode_fn = NULL;
+    tree->codec_arg = NULL;
     return tree;
 }
 
@@ -18,18 +18,43 @@
 
 #define PATRICIA_STATS_ON		            /* For Debugging */
 
+/*
+ * Leaves are created without a children list. It is allocated when the
+ * first child is added, see patricia_add_child_node.
+ */
+#define PATRICIA_IS_LEAF(node)      (!(node)->children || \
+                                     list_empty((node)->children))
+#define PATRICIA_FIRST_CHILD(node)  ((node)->children ? \
+                                     (patricia_node_t *)list_get_head((node)->children) : \
+                                     NULL)
+
+/* Changes reported to the change function of a tree */
+#define PATRICIA_CHANGE_ADD     1
+#define PATRICIA_CHANGE_DELETE  2
+
 /* Datastructures */
 
+/*
+ * Called after every successful patricia_add or patricia_delete, see
+ * patricia_set_change_fn
+ */
+typedef void (*patricia_change_fn) (int op, char *key, void *arg);
+
+/*
+ * Key codec, see patricia_set_codec. Writes the encoded or decoded form of
+ * in, NUL terminated, to out of size bytes and returns its length, or -1
+ * if it does not fit.
+ */
+typedef int (*patricia_codec_fn) (const char *in, char *out, int size,
+                                  void *arg);
+
 typedef struct patricia_node_s {
     list_elem_t link;
     char        *key;
     list_t      *children;
+    uint8_t     is_key;                 /* A key ends at this node */
 } patricia_node_t;
 
-typedef struct patricia_tree_s {
-    patricia_node_t *root;
-} patricia_tree_t;
-
 #ifdef PATRICIA_STATS_ON
 typedef struct patricia_stats_s {
     unsigned long   total_mem;
@@ -38,10 +63,29 @@ typedef struct patricia_stats_s {
 } patricia_stats_t;
 #endif
 
+typedef struct patricia_tree_s {
+    patricia_node_t     *root;
+    patricia_change_fn  change_fn;
+    void                *change_arg;
+    patricia_codec_fn   encode_fn;
+    patricia_codec_fn   decode_fn;
+    void                *codec_arg;
+#ifdef PATRICIA_STATS_ON
+    patricia_stats_t    stats;              /* Changed by writers only */
+#endif
+} patricia_tree_t;
+
+typedef int (*patricia_walk_fn) (char *key, void *arg);
+
 /* Function Prototypes */
 
 void patricia_get_key_count (patricia_node_t *root, unsigned long *count);
 void patricia_print_stats (patricia_tree_t *tree);
+int patricia_walk_prefix (patricia_tree_t *tree, char *prefix,
+                          patricia_walk_fn fn, void *arg);
+int patricia_walk_range (patricia_tree_t *tree, char *lo, char *hi,
+                         patricia_walk_fn fn, void *arg);
+int patricia_walk (patricia_tree_t *tree, patricia_walk_fn fn, void *arg);
 int patricia_lookup (patricia_tree_t *tree, char *key);
 int patricia_lookup_prefix_partial (patricia_tree_t *tree, 
                                     char *prefix, char *buf);
@@ -49,6 +93,10 @@ int patricia_lookup_prefix_full (patricia_tree_t *tree,
                                  char *prefix, char *buf);
 int patricia_delete (patricia_tree_t *tree, char *key);
 int patricia_add (patricia_tree_t *tree, char *key);
+int patricia_set_change_fn (patricia_tree_t *tree, patricia_change_fn fn,
+                            void *arg);
+int patricia_set_codec (patricia_tree_t *tree, patricia_codec_fn encode_fn,
+                        patricia_codec_fn decode_fn, void *arg);
 int patricia_destroy (patricia_tree_t *tree);
 patricia_tree_t *patricia_init (void);
 
@@ -0,0 +1,1035 @@
+/*
+ * patricia_arena.c
+ *
+ * This file implements a patricia tree whose nodes are carved out of a
+ * single growable buffer. Nodes refer to their first child and next sibling
+ * through 32-bit refs, which are offsets from the start of the buffer in
+ * PATRICIA_ARENA_ALIGN byte units, and the label bytes are stored inline
+ * right after the node. On a 64-bit build a node with a short label takes
+ * 16 bytes, against a patricia_node_t, its list_t and two malloc'd blocks
+ * for the regular tree.
+ *
+ * Nothing in the buffer is an absolute address, so the tree can be copied
+ * with memcpy, written to a file or placed in shared memory and then used
+ * from patricia_arena_open without any fixups.
+ *
+ * With PATRICIA_ARENA_HUGE the buffer is mmap'd on a 2 MB boundary and
+ * backed by huge pages, from the hugetlbfs pool if one is configured and
+ * otherwise through transparent huge pages. A large tree then needs far
+ * fewer TLB entries for lookups that hop all over the arena.
+ *
+ * Space that is no longer referenced (truncated labels on a split, unlinked
+ * and merged nodes) is not reused. It is accounted for in the dead counter
+ * of the header and given back by patricia_arena_compact.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "patricia_arena.h"
+
+/*
+ * patricia_arena_buf_alloc
+ *
+ * Allocate a buffer of at least *size bytes according to arena->mem and
+ * update *size to the real size. Falls back from hugetlbfs pages to
+ * transparent huge pages when the pool cannot satisfy the request.
+ */
+static char *
+patricia_arena_buf_alloc (patricia_arena_t *arena, uint64_t *size)
+{
+    uint64_t len, head;
+    char *p;
+
+    if (arena->mem == PATRICIA_ARENA_MEM_HEAP) {
+        return (char *)malloc(*size);
+    }
+
+    *size = (*size + PATRICIA_ARENA_HUGE_SIZE - 1) &
+            ~((uint64_t)PATRICIA_ARENA_HUGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+    if (arena->mem == PATRICIA_ARENA_MEM_HUGETLB) {
+        p = (char *)mmap(NULL, *size, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            return p;
+        }
+        arena->mem = PATRICIA_ARENA_MEM_THP;
+    }
+#endif
+
+    /*
+     * Transparent huge pages are only used for 2 MB aligned ranges. Map
+     * one huge page more than needed and trim both ends to get there.
+     */
+    len = *size + PATRICIA_ARENA_HUGE_SIZE;
+    p = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+    head = (PATRICIA_ARENA_HUGE_SIZE -
+            ((uintptr_t)p & (PATRICIA_ARENA_HUGE_SIZE - 1))) &
+           (PATRICIA_ARENA_HUGE_SIZE - 1);
+    if (head) {
+        munmap(p, head);
+    }
+    munmap(p + head + *size, len - head - *size);
+    p += head;
+
+#ifdef MADV_HUGEPAGE
+    madvise(p, *size, MADV_HUGEPAGE);
+#endif
+
+    return p;
+}
+
+/*
+ * patricia_arena_buf_free
+ *
+ * Free a buffer of size bytes obtained from patricia_arena_buf_alloc
+ */
+static void
+patricia_arena_buf_free (patricia_arena_t *arena, char *base, uint64_t size)
+{
+    if (arena->mem == PATRICIA_ARENA_MEM_HEAP) {
+        free(base);
+    } else {
+        munmap(base, size);
+    }
+}
+
+/*
+ * patricia_arena_reserve
+ *
+ * Make sure there is room for units more units, growing the buffer if
+ * needed. Node pointers taken before this call are stale if it grows the
+ * buffer. Returns 0 upon success, -1 upon failure.
+ */
+static int
+patricia_arena_reserve (patricia_arena_t *arena, uint64_t units)
+{
+    uint64_t need, cap;
+    char *base;
+
+    need = (PATRICIA_ARENA_HDR(arena)->used + units) * PATRICIA_ARENA_ALIGN;
+    if (need <= arena->cap) {
+        return 0;
+    }
+
+    /* Refs are 32 bits wide and a buffer we do not own cannot grow */
+    if (!arena->owned || need / PATRICIA_ARENA_ALIGN > UINT32_MAX) {
+        return -1;
+    }
+
+    cap = arena->cap * 2;
+    if (cap < need) {
+        cap = need;
+    }
+    if (cap / PATRICIA_ARENA_ALIGN > UINT32_MAX) {
+        cap = (uint64_t)UINT32_MAX * PATRICIA_ARENA_ALIGN;
+    }
+
+    if (arena->mem == PATRICIA_ARENA_MEM_HEAP) {
+        base = (char *)realloc(arena->base, cap);
+        if (!base) {
+            return -1;
+        }
+    } else {
+        /* Pages can be of a different kind after a fallback, so copy */
+        base = patricia_arena_buf_alloc(arena, &cap);
+        if (!base) {
+            return -1;
+        }
+        memcpy(base, arena->base,
+               (uint64_t)PATRICIA_ARENA_HDR(arena)->used * PATRICIA_ARENA_ALIGN);
+        patricia_arena_buf_free(arena, arena->base, arena->cap);
+    }
+    arena->base = base;
+    arena->cap = cap;
+
+    return 0;
+}
+
+/*
+ * patricia_arena_alloc
+ *
+ * Carve a node with room for a len byte label out of the arena and copy the
+ * label into it if one is given. The caller must have reserved the space.
+ */
+static patricia_ref_t
+patricia_arena_alloc (patricia_arena_t *arena, const char *label, uint32_t len)
+{
+    patricia_arena_header_t *hdr;
+    patricia_arena_node_t *node;
+    patricia_ref_t ref;
+    uint32_t units;
+
+    hdr = PATRICIA_ARENA_HDR(arena);
+    units = PATRICIA_ARENA_NODE_UNITS(len);
+    ref = hdr->used;
+    hdr->used += units;
+    hdr->node_count++;
+
+    node = PATRICIA_ARENA_NODE(arena, ref);
+    memset(node, 0, units * PATRICIA_ARENA_ALIGN);
+    node->label_len = len;
+    if (label) {
+        memcpy(node->label, label, len);
+    }
+
+    return ref;
+}
+
+/*
+ * patricia_arena_merge
+ *
+ * Fold the only child of the given node into it, so that no node other
+ * than the root is left without a key and with a single child. parent and
+ * prev are the parent of the node and its previous sibling.
+ */
+static void
+patricia_arena_merge (patricia_arena_t *arena, patricia_ref_t parent,
+                      patricia_ref_t prev, patricia_ref_t ref)
+{
+    patricia_arena_header_t *hdr;
+    patricia_arena_node_t *node, *child, *merged;
+    patricia_ref_t new_ref;
+    uint32_t len;
+
+    node = PATRICIA_ARENA_NODE(arena, ref);
+    if ((node->flags & PATRICIA_ARENA_KEY) || !node->first_child) {
+        return;
+    }
+    child = PATRICIA_ARENA_NODE(arena, node->first_child);
+    if (child->next_sibling) {
+        return;
+    }
+
+    /* Too long for one label, or no room. Both leave a valid tree. */
+    len = node->label_len + child->label_len;
+    if (len > PATRICIA_ARENA_MAX_KEYLEN ||
+        patricia_arena_reserve(arena, PATRICIA_ARENA_NODE_UNITS(len)) != 0) {
+        return;
+    }
+
+    new_ref = patricia_arena_alloc(arena, NULL, len);
+    hdr = PATRICIA_ARENA_HDR(arena);
+    node = PATRICIA_ARENA_NODE(arena, ref);
+    child = PATRICIA_ARENA_NODE(arena, node->first_child);
+    merged = PATRICIA_ARENA_NODE(arena, new_ref);
+
+    memcpy(merged->label, node->label, node->label_len);
+    memcpy(merged->label + node->label_len, child->label, child->label_len);
+    merged->first_child = child->first_child;
+    merged->next_sibling = node->next_sibling;
+    merged->flags = child->flags;
+
+    if (prev) {
+        PATRICIA_ARENA_NODE(arena, prev)->next_sibling = new_ref;
+    } else {
+        PATRICIA_ARENA_NODE(arena, parent)->first_child = new_ref;
+    }
+
+    hdr->dead += PATRICIA_ARENA_NODE_UNITS(node->label_len) +
+                 PATRICIA_ARENA_NODE_UNITS(child->label_len);
+    hdr->node_count -= 2;
+}
+
+/*
+ * patricia_arena_walk_internal
+ *
+ * Recursive routine which invokes fn on every key under the given node. buf
+ * holds the key of the parent node, len bytes long.
+ */
+static int
+patricia_arena_walk_internal (patricia_arena_t *arena, patricia_ref_t ref,
+                              char *buf, uint32_t len, patricia_arena_fn fn,
+                              void *arg)
+{
+    patricia_arena_node_t *node;
+    patricia_ref_t child;
+    int ret;
+
+    node = PATRICIA_ARENA_NODE(arena, ref);
+    memcpy(buf + len, node->label, node->label_len);
+    len += node->label_len;
+
+    if (node->flags & PATRICIA_ARENA_KEY) {
+        buf[len] = 0;
+        ret = fn(buf, len, arg);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    for (child = node->first_child; child;
+         child = PATRICIA_ARENA_NODE(arena, child)->next_sibling) {
+        ret = patricia_arena_walk_internal(arena, child, buf, len, fn, arg);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_arena_copy
+ *
+ * Copy the subtree under ref from the old arena into the new one, the node
+ * first and then its children in order. Returns the ref of the copy, or
+ * PATRICIA_ARENA_NULL upon failure.
+ */
+static patricia_ref_t
+patricia_arena_copy (patricia_arena_t *arena, patricia_arena_t *old,
+                     patricia_ref_t ref)
+{
+    patricia_arena_node_t *node;
+    patricia_ref_t new_ref, child, prev, copy;
+
+    node = PATRICIA_ARENA_NODE(old, ref);
+    if (patricia_arena_reserve(arena,
+                               PATRICIA_ARENA_NODE_UNITS(node->label_len)) != 0) {
+        return PATRICIA_ARENA_NULL;
+    }
+    new_ref = patricia_arena_alloc(arena, node->label, node->label_len);
+    PATRICIA_ARENA_NODE(arena, new_ref)->flags = node->flags;
+
+    prev = PATRICIA_ARENA_NULL;
+    for (child = node->first_child; child;
+         child = PATRICIA_ARENA_NODE(old, child)->next_sibling) {
+        copy = patricia_arena_copy(arena, old, child);
+        if (!copy) {
+            return PATRICIA_ARENA_NULL;
+        }
+        if (prev) {
+            PATRICIA_ARENA_NODE(arena, prev)->next_sibling = copy;
+        } else {
+            PATRICIA_ARENA_NODE(arena, new_ref)->first_child = copy;
+        }
+        prev = copy;
+    }
+
+    return new_ref;
+}
+
+/*
+ * patricia_arena_huge_bytes
+ *
+ * Return how many bytes of the arena are backed by huge pages right now,
+ * as reported by /proc/self/smaps. Returns 0 where that is not available.
+ */
+uint64_t
+patricia_arena_huge_bytes (patricia_arena_t *arena)
+{
+    unsigned long start, end, kb;
+    uintptr_t lo, hi;
+    uint64_t total = 0;
+    char line[256];
+    int in = 0;
+    FILE *fp;
+
+    /* Sanity check */
+    if (!arena) {
+        return 0;
+    }
+
+    fp = fopen("/proc/self/smaps", "r");
+    if (!fp) {
+        return 0;
+    }
+
+    lo = (uintptr_t)arena->base;
+    hi = lo + arena->cap;
+    while (fgets(line, sizeof(line), fp)) {
+        /* Each mapping starts with a "start-end perms ..." line */
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2) {
+            in = (start < hi && end > lo);
+            continue;
+        }
+        if (!in) {
+            continue;
+        }
+        if (sscanf(line, "AnonHugePages: %lu kB", &kb) == 1 ||
+            sscanf(line, "Private_Hugetlb: %lu kB", &kb) == 1 ||
+            sscanf(line, "Shared_Hugetlb: %lu kB", &kb) == 1) {
+            total += (uint64_t)kb * 1024;
+        }
+    }
+    fclose(fp);
+
+    return (total > arena->cap) ? arena->cap : total;
+}
+
+/*
+ * patricia_arena_print_stats
+ *
+ * Dump the stats for the given arena
+ */
+void
+patricia_arena_print_stats (patricia_arena_t *arena)
+{
+#ifdef PATRICIA_STATS_ON
+    patricia_arena_header_t *hdr;
+
+    /* Sanity check */
+    if (!arena) {
+        return;
+    }
+
+    hdr = PATRICIA_ARENA_HDR(arena);
+    printf("\nTotal number of keys: %u\n", hdr->key_count);
+    printf("Total number of nodes: %u\n", hdr->node_count);
+    printf("Arena used: %llu bytes\n",
+           (unsigned long long)hdr->used * PATRICIA_ARENA_ALIGN);
+    printf("Arena dead: %llu bytes\n",
+           (unsigned long long)hdr->dead * PATRICIA_ARENA_ALIGN);
+    printf("Arena size: %llu bytes\n", (unsigned long long)arena->cap);
+    printf("Huge page coverage: %llu bytes\n",
+           (unsigned long long)patricia_arena_huge_bytes(arena));
+    if (hdr->key_count) {
+        printf("Bytes per key: %.1f\n\n",
+               (double)hdr->used * PATRICIA_ARENA_ALIGN / hdr->key_count);
+    }
+#endif
+}
+
+/*
+ * patricia_arena_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 otherwise.
+ */
+int
+patricia_arena_lookup (patricia_arena_t *arena, const char *key)
+{
+    patricia_arena_node_t *node, *child;
+    patricia_ref_t next;
+    uint32_t len, pos;
+
+    /* Sanity check */
+    if (!arena || !key) {
+        return 0;
+    }
+
+    len = strlen(key);
+    pos = 0;
+    node = PATRICIA_ARENA_NODE(arena, PATRICIA_ARENA_HDR(arena)->root);
+    while (pos < len) {
+        /* Children are kept sorted by their first byte */
+        child = NULL;
+        for (next = node->first_child; next; next = child->next_sibling) {
+            child = PATRICIA_ARENA_NODE(arena, next);
+            if ((uint8_t)child->label[0] >= (uint8_t)key[pos]) {
+                break;
+            }
+        }
+        if (!next || child->label[0] != key[pos]) {
+            return 0;
+        }
+
+        if (len - pos < child->label_len ||
+            memcmp(child->label, key + pos, child->label_len) != 0) {
+            return 0;
+        }
+        pos += child->label_len;
+        node = child;
+    }
+
+    return (node->flags & PATRICIA_ARENA_KEY) ? 1 : 0;
+}
+
+/*
+ * patricia_arena_walk
+ *
+ * Invoke fn on every key in the arena in lexicographical order. Stops as
+ * soon as fn returns a non zero value and returns that value.
+ */
+int
+patricia_arena_walk (patricia_arena_t *arena, patricia_arena_fn fn, void *arg)
+{
+    char *buf;
+    int ret;
+
+    /* Sanity check */
+    if (!arena || !fn) {
+        return -1;
+    }
+
+    buf = (char *)malloc(PATRICIA_ARENA_HDR(arena)->max_keylen + 1);
+    if (!buf) {
+        return -1;
+    }
+
+    ret = patricia_arena_walk_internal(arena, PATRICIA_ARENA_HDR(arena)->root,
+                                       buf, 0, fn, arg);
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * patricia_arena_walk_prefix
+ *
+ * Invoke fn on every key starting with the given prefix, in lexicographical
+ * order. Stops as soon as fn returns a non zero value and returns that
+ * value.
+ */
+int
+patricia_arena_walk_prefix (patricia_arena_t *arena, const char *prefix,
+                            patricia_arena_fn fn, void *arg)
+{
+    patricia_arena_node_t *node, *child;
+    patricia_ref_t ref, next;
+    uint32_t len, pos, start, n;
+    char *buf;
+    int ret;
+
+    /* Sanity check */
+    if (!arena || !prefix || !fn) {
+        return -1;
+    }
+
+    /*
+     * Find the highest node whose key starts with the prefix. start is the
+     * length of the key above that node.
+     */
+    len = strlen(prefix);
+    pos = start = 0;
+    ref = PATRICIA_ARENA_HDR(arena)->root;
+    while (pos < len) {
+        node = PATRICIA_ARENA_NODE(arena, ref);
+        child = NULL;
+        for (next = node->first_child; next; next = child->next_sibling) {
+            child = PATRICIA_ARENA_NODE(arena, next);
+            if ((uint8_t)child->label[0] >= (uint8_t)prefix[pos]) {
+                break;
+            }
+        }
+        if (!next || child->label[0] != prefix[pos]) {
+            return 0;
+        }
+
+        n = (len - pos < child->label_len) ? len - pos : child->label_len;
+        if (memcmp(child->label, prefix + pos, n) != 0) {
+            return 0;
+        }
+        start = pos;
+        pos += child->label_len;
+        ref = next;
+    }
+
+    buf = (char *)malloc(PATRICIA_ARENA_HDR(arena)->max_keylen + 1);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(buf, prefix, start);
+
+    ret = patricia_arena_walk_internal(arena, ref, buf, start, fn, arg);
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * patricia_arena_delete
+ *
+ * Delete the given key. A node left without a key and children is unlinked,
+ * and one left with a single child is merged with it. Returns 0 upon
+ * success, -1 if the key is not present.
+ */
+int
+patricia_arena_delete (patricia_arena_t *arena, const char *key)
+{
+    patricia_arena_header_t *hdr;
+    patricia_arena_node_t *node, *child;
+    patricia_ref_t cur, parent, prev, gparent, pprev, next, sib_prev;
+    uint32_t len, pos;
+
+    /* Sanity check */
+    if (!arena || !key) {
+        return -1;
+    }
+
+    hdr = PATRICIA_ARENA_HDR(arena);
+    len = strlen(key);
+    pos = 0;
+    cur = hdr->root;
+    parent = prev = gparent = pprev = PATRICIA_ARENA_NULL;
+
+    /* Find the node, remembering the links that point to it and its parent */
+    while (pos < len) {
+        node = PATRICIA_ARENA_NODE(arena, cur);
+        child = NULL;
+        sib_prev = PATRICIA_ARENA_NULL;
+        for (next = node->first_child; next; next = child->next_sibling) {
+            child = PATRICIA_ARENA_NODE(arena, next);
+            if ((uint8_t)child->label[0] >= (uint8_t)key[pos]) {
+                break;
+            }
+            sib_prev = next;
+        }
+        if (!next || child->label[0] != key[pos] ||
+            len - pos < child->label_len ||
+            memcmp(child->label, key + pos, child->label_len) != 0) {
+            return -1;
+        }
+
+        gparent = parent;
+        pprev = prev;
+        parent = cur;
+        prev = sib_prev;
+        cur = next;
+        pos += child->label_len;
+    }
+
+    node = PATRICIA_ARENA_NODE(arena, cur);
+    if (!(node->flags & PATRICIA_ARENA_KEY)) {
+        return -1;
+    }
+    node->flags &= ~PATRICIA_ARENA_KEY;
+    hdr->key_count--;
+
+    if (cur == hdr->root) {
+        return 0;
+    }
+
+    if (node->first_child) {
+        patricia_arena_merge(arena, parent, prev, cur);
+        return 0;
+    }
+
+    /* Unlink the leaf. Its parent may be left with a single child. */
+    if (prev) {
+        PATRICIA_ARENA_NODE(arena, prev)->next_sibling = node->next_sibling;
+    } else {
+        PATRICIA_ARENA_NODE(arena, parent)->first_child = node->next_sibling;
+    }
+    hdr->dead += PATRICIA_ARENA_NODE_UNITS(node->label_len);
+    hdr->node_count--;
+
+    if (parent != hdr->root) {
+        patricia_arena_merge(arena, gparent, pprev, parent);
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_arena_add
+ *
+ * Add the given key to the arena. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_arena_add (patricia_arena_t *arena, const char *key)
+{
+    patricia_arena_header_t *hdr;
+    patricia_arena_node_t *node, *child, *tail;
+    patricia_ref_t cur, prev, next, ref;
+    uint32_t len, pos, m;
+
+    /* Sanity check */
+    if (!arena || !key) {
+        return -1;
+    }
+
+    len = strlen(key);
+    if (len > PATRICIA_ARENA_MAX_KEYLEN) {
+        return -1;
+    }
+
+    /*
+     * An add creates at most two nodes, a leaf for the rest of the key and
+     * the tail of a split label, which is no longer than the longest key.
+     * Reserve the space up front so that the buffer cannot move under the
+     * node pointers below.
+     */
+    hdr = PATRICIA_ARENA_HDR(arena);
+    m = (len > hdr->max_keylen) ? len : hdr->max_keylen;
+    if (patricia_arena_reserve(arena, 2 * PATRICIA_ARENA_NODE_UNITS(m)) != 0) {
+        return -1;
+    }
+    hdr = PATRICIA_ARENA_HDR(arena);
+
+    cur = hdr->root;
+    pos = 0;
+    while (1) {
+        node = PATRICIA_ARENA_NODE(arena, cur);
+        if (pos == len) {
+            if (!(node->flags & PATRICIA_ARENA_KEY)) {
+                node->flags |= PATRICIA_ARENA_KEY;
+                hdr->key_count++;
+            }
+            break;
+        }
+
+        child = NULL;
+        prev = PATRICIA_ARENA_NULL;
+        for (next = node->first_child; next; next = child->next_sibling) {
+            child = PATRICIA_ARENA_NODE(arena, next);
+            if ((uint8_t)child->label[0] >= (uint8_t)key[pos]) {
+                break;
+            }
+            prev = next;
+        }
+
+        /* No child shares a byte with the key, the rest goes into a leaf */
+        if (!next || child->label[0] != key[pos]) {
+            ref = patricia_arena_alloc(arena, key + pos, len - pos);
+            child = PATRICIA_ARENA_NODE(arena, ref);
+            child->flags = PATRICIA_ARENA_KEY;
+            child->next_sibling = next;
+            if (prev) {
+                PATRICIA_ARENA_NODE(arena, prev)->next_sibling = ref;
+            } else {
+                node->first_child = ref;
+            }
+            hdr->key_count++;
+            break;
+        }
+
+        m = 1;
+        while (m < child->label_len && pos + m < len &&
+               child->label[m] == key[pos + m]) {
+            m++;
+        }
+
+        /*
+         * The key diverges inside the label. The child keeps the common
+         * part and the rest of its label moves into a new node below it,
+         * so the refs pointing at the child stay valid.
+         */
+        if (m < child->label_len) {
+            ref = patricia_arena_alloc(arena, child->label + m,
+                                       child->label_len - m);
+            tail = PATRICIA_ARENA_NODE(arena, ref);
+            tail->first_child = child->first_child;
+            tail->flags = child->flags;
+            child->first_child = ref;
+            child->flags = 0;
+            hdr->dead += PATRICIA_ARENA_NODE_UNITS(child->label_len) -
+                         PATRICIA_ARENA_NODE_UNITS(m);
+            child->label_len = m;
+        }
+
+        cur = next;
+        pos += m;
+    }
+
+    if (len > hdr->max_keylen) {
+        hdr->max_keylen = len;
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_arena_compact
+ *
+ * Copy the tree into a new buffer in depth first order and free the old
+ * one. This gives back the dead space and puts every subtree in one
+ * contiguous range, so a walk or prefix scan reads the arena sequentially
+ * again after a long run of adds and deletes. Refs held by the caller are
+ * invalid afterwards. Returns 0 upon success, -1 upon failure, in which
+ * case the arena is left as it was.
+ */
+int
+patricia_arena_compact (patricia_arena_t *arena)
+{
+    patricia_arena_header_t *hdr;
+    patricia_arena_t old;
+    patricia_ref_t root;
+    uint64_t size;
+    uint32_t hdr_units;
+
+    /* Sanity check */
+    if (!arena || !arena->owned) {
+        return -1;
+    }
+
+    hdr_units = PATRICIA_ARENA_UNITS(sizeof(patricia_arena_header_t));
+    hdr = PATRICIA_ARENA_HDR(arena);
+    size = (uint64_t)(hdr->used - hdr->dead) * PATRICIA_ARENA_ALIGN;
+
+    old = *arena;
+    arena->base = patricia_arena_buf_alloc(arena, &size);
+    if (!arena->base) {
+        *arena = old;
+        return -1;
+    }
+    arena->cap = size;
+
+    memcpy(arena->base, old.base, hdr_units * PATRICIA_ARENA_ALIGN);
+    hdr = PATRICIA_ARENA_HDR(arena);
+    hdr->used = hdr_units;
+    hdr->node_count = 0;
+    hdr->dead = 0;
+
+    root = patricia_arena_copy(arena, &old, PATRICIA_ARENA_HDR(&old)->root);
+    if (!root) {
+        patricia_arena_buf_free(arena, arena->base, arena->cap);
+        *arena = old;
+        return -1;
+    }
+    PATRICIA_ARENA_HDR(arena)->root = root;
+    patricia_arena_buf_free(&old, old.base, old.cap);
+
+    return 0;
+}
+
+/*
+ * patricia_arena_image
+ *
+ * Return the start of the arena and its length in bytes. The image can be
+ * copied or written out as is and later passed to patricia_arena_open.
+ */
+void *
+patricia_arena_image (patricia_arena_t *arena, size_t *len)
+{
+    /* Sanity check */
+    if (!arena || !len) {
+        return NULL;
+    }
+
+    *len = (size_t)PATRICIA_ARENA_HDR(arena)->used * PATRICIA_ARENA_ALIGN;
+    return arena->base;
+}
+
+/*
+ * patricia_arena_validate_node
+ *
+ * Recursive routine which checks the subtree under ref. The node has to
+ * lie within the used units, only the root may have an empty label, no
+ * key may get longer than max_keylen, which is the size of the buffer
+ * walks rebuild keys in, and siblings have to be in strictly ascending
+ * order of their first byte. Nodes and keys are counted as they are seen,
+ * the walk gives up once there are more nodes than the header says, so a
+ * ref pointing back up the tree cannot keep it going.
+ */
+static int
+patricia_arena_validate_node (patricia_arena_t *arena, patricia_ref_t ref,
+                              uint32_t len, uint32_t *nodes, uint32_t *keys)
+{
+    patricia_arena_header_t *hdr;
+    patricia_arena_node_t *node;
+    patricia_ref_t child;
+    int last;
+
+    hdr = PATRICIA_ARENA_HDR(arena);
+    if (ref < PATRICIA_ARENA_UNITS(sizeof(patricia_arena_header_t)) ||
+        (uint64_t)ref + PATRICIA_ARENA_NODE_UNITS(0) > hdr->used) {
+        return -1;
+    }
+    node = PATRICIA_ARENA_NODE(arena, ref);
+    if ((uint64_t)ref + PATRICIA_ARENA_NODE_UNITS(node->label_len) >
+        hdr->used) {
+        return -1;
+    }
+    if ((node->label_len == 0) != (ref == hdr->root) ||
+        node->label_len > hdr->max_keylen - len ||
+        ++*nodes > hdr->node_count) {
+        return -1;
+    }
+    len += node->label_len;
+    if (node->flags & PATRICIA_ARENA_KEY) {
+        (*keys)++;
+    }
+
+    last = -1;
+    for (child = node->first_child; child;
+         child = PATRICIA_ARENA_NODE(arena, child)->next_sibling) {
+        if (patricia_arena_validate_node(arena, child, len, nodes,
+                                         keys) != 0) {
+            return -1;
+        }
+        if ((uint8_t)PATRICIA_ARENA_NODE(arena, child)->label[0] <= last) {
+            return -1;
+        }
+        last = (uint8_t)PATRICIA_ARENA_NODE(arena, child)->label[0];
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_arena_validate
+ *
+ * Check an image passed to patricia_arena_open before it is used. Every
+ * node reachable from the root has to pass patricia_arena_validate_node,
+ * and the nodes and keys found have to match the counts in the header.
+ * Returns 0 if the image is sound, -1 otherwise.
+ */
+static int
+patricia_arena_validate (patricia_arena_t *arena)
+{
+    patricia_arena_header_t *hdr;
+    uint32_t nodes = 0, keys = 0;
+
+    hdr = PATRICIA_ARENA_HDR(arena);
+    if (hdr->max_keylen > PATRICIA_ARENA_MAX_KEYLEN || hdr->dead > hdr->used) {
+        return -1;
+    }
+    if (patricia_arena_validate_node(arena, hdr->root, 0, &nodes,
+                                     &keys) != 0) {
+        return -1;
+    }
+
+    return (nodes == hdr->node_count && keys == hdr->key_count) ? 0 : -1;
+}
+
+/*
+ * patricia_arena_open
+ *
+ * Use an arena image found at buf, for instance a copy or an mmap'd file.
+ * The buffer stays owned by the caller, so adds only succeed while they fit
+ * in len bytes. The whole tree is checked first, an image that does not
+ * hold together is refused.
+ */
+patricia_arena_t *
+patricia_arena_open (void *buf, size_t len)
+{
+    patricia_arena_header_t *hdr;
+    patricia_arena_t *arena;
+
+    /* Sanity check */
+    if (!buf || len < sizeof(patricia_arena_header_t) ||
+        ((uintptr_t)buf % PATRICIA_ARENA_ALIGN) != 0) {
+        return NULL;
+    }
+
+    hdr = (patricia_arena_header_t *)buf;
+    if (memcmp(hdr->magic, PATRICIA_ARENA_MAGIC, 4) != 0 ||
+        hdr->version != PATRICIA_ARENA_VERSION ||
+        (uint64_t)hdr->used * PATRICIA_ARENA_ALIGN > len ||
+        hdr->root == PATRICIA_ARENA_NULL || hdr->root >= hdr->used) {
+        return NULL;
+    }
+
+    arena = (patricia_arena_t *)malloc(sizeof(patricia_arena_t));
+    if (!arena) {
+        return NULL;
+    }
+    arena->base = (char *)buf;
+    arena->cap = len;
+    arena->owned = 0;
+    arena->mem = PATRICIA_ARENA_MEM_HEAP;
+
+    if (patricia_arena_validate(arena) != 0) {
+        free(arena);
+        return NULL;
+    }
+
+    return arena;
+}
+
+/*
+ * patricia_arena_build_key
+ *
+ * patricia_walk callback used by patricia_arena_build
+ */
+static int
+patricia_arena_build_key (char *key, void *arg)
+{
+    return patricia_arena_add((patricia_arena_t *)arg, key);
+}
+
+/*
+ * patricia_arena_build
+ *
+ * Create an arena holding the keys of the given tree
+ */
+patricia_arena_t *
+patricia_arena_build (patricia_tree_t *tree, uint32_t flags)
+{
+    patricia_arena_t *arena;
+
+    /* Sanity check */
+    if (!tree) {
+        return NULL;
+    }
+
+    arena = patricia_arena_init(0, flags);
+    if (!arena) {
+        return NULL;
+    }
+
+    if (patricia_walk(tree, patricia_arena_build_key, arena) != 0) {
+        patricia_arena_destroy(arena);
+        return NULL;
+    }
+
+    return arena;
+}
+
+/*
+ * patricia_arena_destroy
+ *
+ * Free the arena. A buffer passed to patricia_arena_open is left alone.
+ */
+int
+patricia_arena_destroy (patricia_arena_t *arena)
+{
+    /* Sanity check */
+    if (!arena) {
+        return -1;
+    }
+
+    if (arena->owned) {
+        patricia_arena_buf_free(arena, arena->base, arena->cap);
+    }
+    free(arena);
+
+    return 0;
+}
+
+/*
+ * patricia_arena_init
+ *
+ * Create an empty arena with an initial buffer of size bytes
+ */
+patricia_arena_t *
+patricia_arena_init (size_t size, uint32_t flags)
+{
+    patricia_arena_header_t *hdr;
+    patricia_arena_t *arena;
+    uint64_t cap;
+
+    if (size < PATRICIA_ARENA_INIT_SIZE) {
+        size = PATRICIA_ARENA_INIT_SIZE;
+    }
+    size = PATRICIA_ARENA_UNITS(size) * PATRICIA_ARENA_ALIGN;
+
+    arena = (patricia_arena_t *)malloc(sizeof(patricia_arena_t));
+    if (!arena) {
+        return NULL;
+    }
+
+    arena->mem = (flags & PATRICIA_ARENA_HUGE) ? PATRICIA_ARENA_MEM_HUGETLB :
+                                                 PATRICIA_ARENA_MEM_HEAP;
+    cap = size;
+    arena->base = patricia_arena_buf_alloc(arena, &cap);
+    if (!arena->base) {
+        free(arena);
+        return NULL;
+    }
+    arena->cap = cap;
+    arena->owned = 1;
+
+    hdr = PATRICIA_ARENA_HDR(arena);
+    memset(hdr, 0, PATRICIA_ARENA_UNITS(sizeof(patricia_arena_header_t)) *
+                   PATRICIA_ARENA_ALIGN);
+    memcpy(hdr->magic, PATRICIA_ARENA_MAGIC, 4);
+    hdr->version = PATRICIA_ARENA_VERSION;
+    hdr->used = PATRICIA_ARENA_UNITS(sizeof(patricia_arena_header_t));
+
+    /* The root has an empty label and is never removed */
+    hdr->root = patricia_arena_alloc(arena, NULL, 0);
+
+    return arena;
+}
+
+/* End of File */
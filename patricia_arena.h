@@ -0,0 +1,107 @@
+/*
+ * patricia_arena.h - Header file for the arena backed patricia tree
+ *
+ * All nodes live in one contiguous buffer and refer to each other by 32-bit
+ * offsets instead of pointers, so the whole tree can be copied, written out
+ * or mapped at a different address without any fixups.
+ */
+
+#ifndef PATRICIA_ARENA_H
+#define PATRICIA_ARENA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_ARENA_MAGIC        "PTAR"
+#define PATRICIA_ARENA_VERSION      1
+#define PATRICIA_ARENA_ALIGN        8           /* Bytes per ref unit */
+#define PATRICIA_ARENA_INIT_SIZE    4096        /* Initial arena bytes */
+#define PATRICIA_ARENA_MAX_KEYLEN   65535
+#define PATRICIA_ARENA_NULL         0
+
+/* Arena flags */
+#define PATRICIA_ARENA_HUGE         0x01        /* Back with 2 MB pages */
+#define PATRICIA_ARENA_HUGE_SIZE    (2 * 1024 * 1024)
+
+/* Where the buffer comes from */
+#define PATRICIA_ARENA_MEM_HEAP     0           /* malloc */
+#define PATRICIA_ARENA_MEM_THP      1           /* mmap + MADV_HUGEPAGE */
+#define PATRICIA_ARENA_MEM_HUGETLB  2           /* mmap + MAP_HUGETLB */
+
+/* Node flags */
+#define PATRICIA_ARENA_KEY          0x0001      /* A key ends at this node */
+
+/*
+ * A ref is the offset of a node from the start of the arena, counted in
+ * PATRICIA_ARENA_ALIGN units. This lets 32 bits address up to 32 GB.
+ * Offset 0 holds the header, so 0 can serve as the NULL ref.
+ */
+#define PATRICIA_ARENA_UNITS(bytes) \
+    (((bytes) + PATRICIA_ARENA_ALIGN - 1) / PATRICIA_ARENA_ALIGN)
+#define PATRICIA_ARENA_NODE(arena, ref) \
+    ((patricia_arena_node_t *)((arena)->base + \
+                               (uint64_t)(ref) * PATRICIA_ARENA_ALIGN))
+#define PATRICIA_ARENA_HDR(arena) \
+    ((patricia_arena_header_t *)(arena)->base)
+#define PATRICIA_ARENA_NODE_UNITS(len) \
+    PATRICIA_ARENA_UNITS(offsetof(patricia_arena_node_t, label) + (len))
+
+/* Datastructures */
+
+typedef uint32_t patricia_ref_t;
+
+/*
+ * Node. The label bytes follow the node header inline. The children of a
+ * node are chained through next_sibling in order of their first byte.
+ */
+typedef struct patricia_arena_node_s {
+    patricia_ref_t  first_child;
+    patricia_ref_t  next_sibling;
+    uint16_t        label_len;
+    uint16_t        flags;
+    char            label[1];
+} patricia_arena_node_t;
+
+/* Arena header, stored at offset 0 of the buffer */
+typedef struct patricia_arena_header_s {
+    char            magic[4];
+    uint32_t        version;
+    uint32_t        used;                   /* Units handed out */
+    patricia_ref_t  root;
+    uint32_t        key_count;
+    uint32_t        node_count;
+    uint32_t        dead;                   /* Units no longer referenced */
+    uint32_t        max_keylen;
+} patricia_arena_header_t;
+
+typedef struct patricia_arena_s {
+    char            *base;
+    uint64_t        cap;                    /* Buffer size in bytes */
+    uint8_t         owned;                  /* Buffer may be realloc'd */
+    uint8_t         mem;                    /* PATRICIA_ARENA_MEM_* */
+} patricia_arena_t;
+
+typedef int (*patricia_arena_fn) (const char *key, int len, void *arg);
+
+/* Function Prototypes */
+
+void patricia_arena_print_stats (patricia_arena_t *arena);
+uint64_t patricia_arena_huge_bytes (patricia_arena_t *arena);
+int patricia_arena_lookup (patricia_arena_t *arena, const char *key);
+int patricia_arena_walk (patricia_arena_t *arena, patricia_arena_fn fn,
+                         void *arg);
+int patricia_arena_walk_prefix (patricia_arena_t *arena, const char *prefix,
+                                patricia_arena_fn fn, void *arg);
+int patricia_arena_delete (patricia_arena_t *arena, const char *key);
+int patricia_arena_add (patricia_arena_t *arena, const char *key);
+int patricia_arena_compact (patricia_arena_t *arena);
+void *patricia_arena_image (patricia_arena_t *arena, size_t *len);
+patricia_arena_t *patricia_arena_open (void *buf, size_t len);
+patricia_arena_t *patricia_arena_build (patricia_tree_t *tree, uint32_t flags);
+int patricia_arena_destroy (patricia_arena_t *arena);
+patricia_arena_t *patricia_arena_init (size_t size, uint32_t flags);
+
+#endif /* PATRICIA_ARENA_H */
@@ -0,0 +1,448 @@
+/*
+ * patricia_critbit.c
+ *
+ * This file implements a bit-level PATRICIA tree, also known as a crit-bit
+ * tree, for fixed-width binary keys. Every internal node stores the index
+ * of the first bit at which the keys in its two subtrees differ (the
+ * critical bit). A lookup does one bit test per level and a single key
+ * compare once it reaches a leaf. Since the keys are fixed width, no key can
+ * be a prefix of another and there is no need for a terminating byte.
+ *
+ * Bits are numbered MSB first, so an in-order walk of the tree returns the
+ * keys in memcmp() order. Integer keys should be stored big endian (see
+ * patricia_cb_key_from_u64) to make this match numeric order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "patricia_critbit.h"
+
+/*
+ * Helpers for the tagged child pointers
+ */
+#define PATRICIA_CB_IS_INTERNAL(p)  (((uintptr_t)(p)) & 1)
+#define PATRICIA_CB_NODE(p)         ((patricia_cb_node_t *)((uintptr_t)(p) - 1))
+#define PATRICIA_CB_TAG(n)          ((void *)((uintptr_t)(n) + 1))
+
+/*
+ * patricia_cb_get_bit
+ *
+ * Return the value of the given bit in the key. Bit 0 is the MSB of key[0].
+ */
+static inline int
+patricia_cb_get_bit (const uint8_t *key, uint32_t bit)
+{
+    return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/*
+ * patricia_cb_key_from_u64
+ *
+ * Store a 64-bit integer as an 8 byte big endian key
+ */
+void
+patricia_cb_key_from_u64 (uint64_t val, uint8_t *key)
+{
+    int i;
+
+    for (i = 7; i >= 0; i--) {
+        key[i] = (uint8_t)(val & 0xff);
+        val >>= 8;
+    }
+}
+
+/*
+ * patricia_cb_key_to_u64
+ *
+ * Convert an 8 byte big endian key back to a 64-bit integer
+ */
+uint64_t
+patricia_cb_key_to_u64 (const uint8_t *key)
+{
+    uint64_t val = 0;
+    int i;
+
+    for (i = 0; i < 8; i++) {
+        val = (val << 8) | key[i];
+    }
+
+    return val;
+}
+
+/*
+ * patricia_cb_leaf_init
+ *
+ * Create a new leaf holding a copy of the key
+ */
+static patricia_cb_leaf_t *
+patricia_cb_leaf_init (patricia_cb_tree_t *tree, const uint8_t *key,
+                       void *data)
+{
+    patricia_cb_leaf_t *leaf;
+    size_t size;
+
+    size = offsetof(patricia_cb_leaf_t, key) + tree->keylen;
+    leaf = (patricia_cb_leaf_t *)malloc(size);
+    if (!leaf) {
+        return NULL;
+    }
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem += size;
+#endif
+
+    memcpy(leaf->key, key, tree->keylen);
+    leaf->data = data;
+
+    return leaf;
+}
+
+/*
+ * patricia_cb_print_stats
+ *
+ * Dump the stats for the given tree
+ */
+void
+patricia_cb_print_stats (patricia_cb_tree_t *tree)
+{
+#ifdef PATRICIA_STATS_ON
+    printf("\nTotal number of keys: %lu\n", tree->count);
+    printf("Total number of internal nodes: %lu\n", tree->total_nodes);
+    printf("Total memory used: %lu bytes\n\n", tree->total_mem);
+#endif
+}
+
+/*
+ * patricia_cb_walk_internal
+ *
+ * Recursive in-order traversal. Stops as soon as the callback returns a non
+ * zero value and passes that value back up.
+ */
+static int
+patricia_cb_walk_internal (void *p, patricia_cb_walk_fn fn, void *arg)
+{
+    patricia_cb_node_t *node;
+    patricia_cb_leaf_t *leaf;
+    int ret;
+
+    if (PATRICIA_CB_IS_INTERNAL(p)) {
+        node = PATRICIA_CB_NODE(p);
+        ret = patricia_cb_walk_internal(node->child[0], fn, arg);
+        if (ret != 0) {
+            return ret;
+        }
+        return patricia_cb_walk_internal(node->child[1], fn, arg);
+    }
+
+    leaf = (patricia_cb_leaf_t *)p;
+    return fn(leaf->key, leaf->data, arg);
+}
+
+/*
+ * patricia_cb_walk
+ *
+ * Invoke fn on every key of the tree in ascending key order
+ */
+int
+patricia_cb_walk (patricia_cb_tree_t *tree, patricia_cb_walk_fn fn, void *arg)
+{
+    /* Sanity check */
+    if (!tree || !fn) {
+        return -1;
+    }
+
+    if (!tree->root) {
+        return 0;
+    }
+
+    return patricia_cb_walk_internal(tree->root, fn, arg);
+}
+
+/*
+ * patricia_cb_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 otherwise. The data stored
+ * with the key is returned through data if it is non NULL.
+ */
+int
+patricia_cb_lookup (patricia_cb_tree_t *tree, const uint8_t *key, void **data)
+{
+    patricia_cb_node_t *node;
+    patricia_cb_leaf_t *leaf;
+    void *p;
+
+    /* Sanity check */
+    if (!tree || !key || !tree->root) {
+        return 0;
+    }
+
+    /* One bit test per level until we hit a leaf */
+    p = tree->root;
+    while (PATRICIA_CB_IS_INTERNAL(p)) {
+        node = PATRICIA_CB_NODE(p);
+        p = node->child[patricia_cb_get_bit(key, node->bit)];
+    }
+
+    /* The bits we skipped over have to be verified against the leaf */
+    leaf = (patricia_cb_leaf_t *)p;
+    if (memcmp(leaf->key, key, tree->keylen) != 0) {
+        return 0;
+    }
+
+    if (data) {
+        *data = leaf->data;
+    }
+
+    return 1;
+}
+
+/*
+ * patricia_cb_delete
+ *
+ * Remove the given key from the tree. The data stored with the key is
+ * returned through data if it is non NULL. Returns 0 upon success, -1 if the
+ * key is not present.
+ */
+int
+patricia_cb_delete (patricia_cb_tree_t *tree, const uint8_t *key, void **data)
+{
+    patricia_cb_node_t *node = NULL;
+    patricia_cb_leaf_t *leaf;
+    void **where, **parent_where = NULL;
+    void *p;
+    int dir = 0;
+
+    /* Sanity check */
+    if (!tree || !key || !tree->root) {
+        return -1;
+    }
+
+    /* Find the leaf, remembering the slot pointing to its parent */
+    where = &tree->root;
+    p = *where;
+    while (PATRICIA_CB_IS_INTERNAL(p)) {
+        parent_where = where;
+        node = PATRICIA_CB_NODE(p);
+        dir = patricia_cb_get_bit(key, node->bit);
+        where = &node->child[dir];
+        p = *where;
+    }
+
+    leaf = (patricia_cb_leaf_t *)p;
+    if (memcmp(leaf->key, key, tree->keylen) != 0) {
+        return -1;
+    }
+
+    if (data) {
+        *data = leaf->data;
+    }
+
+    /* The sibling takes the place of the parent */
+    if (!parent_where) {
+        tree->root = NULL;
+    } else {
+        *parent_where = node->child[1 - dir];
+        free(node);
+#ifdef PATRICIA_STATS_ON
+        tree->total_mem -= sizeof(patricia_cb_node_t);
+        tree->total_nodes--;
+#endif
+    }
+
+    free(leaf);
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem -= offsetof(patricia_cb_leaf_t, key) + tree->keylen;
+#endif
+    tree->count--;
+
+    return 0;
+}
+
+/*
+ * patricia_cb_add
+ *
+ * Add a key to the tree. If the key is already present, its data is
+ * replaced. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_cb_add (patricia_cb_tree_t *tree, const uint8_t *key, void *data)
+{
+    patricia_cb_node_t *node, *new_node;
+    patricia_cb_leaf_t *leaf, *new_leaf;
+    void **where, *p;
+    uint32_t crit_bit, i;
+    uint8_t diff;
+    int dir;
+
+    /* Sanity check */
+    if (!tree || !key) {
+        return -1;
+    }
+
+    /* Empty tree. The new leaf becomes the root. */
+    if (!tree->root) {
+        new_leaf = patricia_cb_leaf_init(tree, key, data);
+        if (!new_leaf) {
+            return -1;
+        }
+        tree->root = new_leaf;
+        tree->count++;
+        return 0;
+    }
+
+    /*
+     * Walk down to the leaf which the new key would have been compared
+     * against. It shares the longest prefix with the key among all the keys
+     * in the tree.
+     */
+    p = tree->root;
+    while (PATRICIA_CB_IS_INTERNAL(p)) {
+        node = PATRICIA_CB_NODE(p);
+        p = node->child[patricia_cb_get_bit(key, node->bit)];
+    }
+    leaf = (patricia_cb_leaf_t *)p;
+
+    /* Find the first differing bit */
+    for (i = 0; i < tree->keylen; i++) {
+        if (leaf->key[i] != key[i]) {
+            break;
+        }
+    }
+
+    if (i == tree->keylen) {
+        /* Key already present, just update the data */
+        leaf->data = data;
+        return 0;
+    }
+
+    diff = leaf->key[i] ^ key[i];
+    crit_bit = i * 8;
+    while (!(diff & 0x80)) {
+        diff <<= 1;
+        crit_bit++;
+    }
+    dir = patricia_cb_get_bit(key, crit_bit);
+
+    new_leaf = patricia_cb_leaf_init(tree, key, data);
+    if (!new_leaf) {
+        return -1;
+    }
+
+    new_node = (patricia_cb_node_t *)malloc(sizeof(patricia_cb_node_t));
+    if (!new_node) {
+        free(new_leaf);
+#ifdef PATRICIA_STATS_ON
+        tree->total_mem -= offsetof(patricia_cb_leaf_t, key) + tree->keylen;
+#endif
+        return -1;
+    }
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem += sizeof(patricia_cb_node_t);
+    tree->total_nodes++;
+#endif
+    new_node->bit = crit_bit;
+    new_node->child[dir] = new_leaf;
+
+    /*
+     * Critical bits strictly increase along any path. Insert the new node
+     * above the first node that tests a later bit.
+     */
+    where = &tree->root;
+    while (PATRICIA_CB_IS_INTERNAL(*where)) {
+        node = PATRICIA_CB_NODE(*where);
+        if (node->bit > crit_bit) {
+            break;
+        }
+        where = &node->child[patricia_cb_get_bit(key, node->bit)];
+    }
+
+    new_node->child[1 - dir] = *where;
+    *where = PATRICIA_CB_TAG(new_node);
+    tree->count++;
+
+    return 0;
+}
+
+/*
+ * patricia_cb_destroy_internal
+ *
+ * Recursively free all the nodes and leaves under p
+ */
+static void
+patricia_cb_destroy_internal (patricia_cb_tree_t *tree, void *p)
+{
+    patricia_cb_node_t *node;
+
+    if (PATRICIA_CB_IS_INTERNAL(p)) {
+        node = PATRICIA_CB_NODE(p);
+        patricia_cb_destroy_internal(tree, node->child[0]);
+        patricia_cb_destroy_internal(tree, node->child[1]);
+        free(node);
+#ifdef PATRICIA_STATS_ON
+        tree->total_mem -= sizeof(patricia_cb_node_t);
+        tree->total_nodes--;
+#endif
+        return;
+    }
+
+    free(p);
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem -= offsetof(patricia_cb_leaf_t, key) + tree->keylen;
+#endif
+}
+
+/*
+ * patricia_cb_destroy
+ *
+ * Cleanup the given crit-bit tree instance
+ */
+int
+patricia_cb_destroy (patricia_cb_tree_t *tree)
+{
+    /* Sanity check */
+    if (!tree) {
+        return -1;
+    }
+
+    if (tree->root) {
+        patricia_cb_destroy_internal(tree, tree->root);
+    }
+    free(tree);
+
+    return 0;
+}
+
+/*
+ * patricia_cb_init
+ *
+ * Create a crit-bit tree for keys of keylen bytes
+ */
+patricia_cb_tree_t *
+patricia_cb_init (size_t keylen)
+{
+    patricia_cb_tree_t *tree;
+
+    /* Sanity check */
+    if (keylen == 0 || keylen > PATRICIA_CB_MAX_KEYLEN) {
+        return NULL;
+    }
+
+    tree = (patricia_cb_tree_t *)malloc(sizeof(patricia_cb_tree_t));
+    if (!tree) {
+        return NULL;
+    }
+
+    tree->root = NULL;
+    tree->keylen = keylen;
+    tree->count = 0;
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem = sizeof(patricia_cb_tree_t);
+    tree->total_nodes = 0;
+#endif
+
+    return tree;
+}
+
+/* End of File */
@@ -0,0 +1,64 @@
+/*
+ * patricia_critbit.h - Header file for the bit-level (crit-bit) patricia tree
+ *
+ * This variant works on fixed-width binary keys (64-bit/128-bit identifiers,
+ * addresses, digests) instead of NUL terminated strings. Internal nodes only
+ * store the index of the critical bit and two children, the keys themselves
+ * live in the leaves.
+ */
+
+#ifndef PATRICIA_CRITBIT_H
+#define PATRICIA_CRITBIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_CB_MAX_KEYLEN  64          /* 512 bit keys */
+
+/* Datastructures */
+
+/*
+ * Child pointers are tagged. If the low bit is set, the pointer refers to an
+ * internal node, else it refers to a leaf.
+ */
+typedef struct patricia_cb_node_s {
+    void        *child[2];
+    uint32_t    bit;                        /* Critical bit, MSB first */
+} patricia_cb_node_t;
+
+typedef struct patricia_cb_leaf_s {
+    void        *data;
+    uint8_t     key[1];                     /* keylen bytes */
+} patricia_cb_leaf_t;
+
+typedef struct patricia_cb_tree_s {
+    void            *root;
+    size_t          keylen;
+    unsigned long   count;
+#ifdef PATRICIA_STATS_ON
+    unsigned long   total_mem;
+    unsigned long   total_nodes;
+#endif
+} patricia_cb_tree_t;
+
+typedef int (*patricia_cb_walk_fn) (const uint8_t *key, void *data, void *arg);
+
+/* Function Prototypes */
+
+void patricia_cb_key_from_u64 (uint64_t val, uint8_t *key);
+uint64_t patricia_cb_key_to_u64 (const uint8_t *key);
+void patricia_cb_print_stats (patricia_cb_tree_t *tree);
+int patricia_cb_walk (patricia_cb_tree_t *tree, patricia_cb_walk_fn fn,
+                      void *arg);
+int patricia_cb_lookup (patricia_cb_tree_t *tree, const uint8_t *key,
+                        void **data);
+int patricia_cb_delete (patricia_cb_tree_t *tree, const uint8_t *key,
+                        void **data);
+int patricia_cb_add (patricia_cb_tree_t *tree, const uint8_t *key, void *data);
+int patricia_cb_destroy (patricia_cb_tree_t *tree);
+patricia_cb_tree_t *patricia_cb_init (size_t keylen);
+
+#endif /* PATRICIA_CRITBIT_H */
@@ -0,0 +1,789 @@
+/*
+ * patricia_da.c
+ *
+ * This file converts a patricia tree into a double-array trie for frozen
+ * dictionaries. Every transition is one array access and one compare, and
+ * the part of a key below the point where it becomes unique is kept as a
+ * plain string in the tail buffer, so long unique suffixes cost one byte
+ * per character and no states. The arrays can be written to a file and
+ * mapped back read-only without any fixups.
+ *
+ * Like patricia_get_key_count, the keys of the tree are its leaves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "patricia_da.h"
+
+/* Defines */
+
+#define PATRICIA_DA_INIT_SIZE   1024
+#define PATRICIA_DA_CODES       257         /* End of key + 256 bytes */
+
+/* Datastructures */
+
+typedef struct patricia_da_keys_s {
+    char        **keys;
+    uint32_t    count;
+    uint32_t    cap;
+} patricia_da_keys_t;
+
+typedef struct patricia_da_builder_s {
+    patricia_da_t   *da;
+    uint32_t        tail_cap;
+    uint32_t        next_free;              /* No free slot below this */
+} patricia_da_builder_t;
+
+/*
+ * patricia_da_code
+ *
+ * Transition code of the byte. 0 is reserved for the end of the key.
+ */
+static inline int32_t
+patricia_da_code (char c)
+{
+    return (int32_t)(unsigned char)c + 1;
+}
+
+/*
+ * patricia_da_collect
+ *
+ * patricia_walk callback, stores a copy of every key
+ */
+static int
+patricia_da_collect (char *key, void *arg)
+{
+    patricia_da_keys_t *keys = (patricia_da_keys_t *)arg;
+    char **new_keys;
+
+    if (keys->count == keys->cap) {
+        keys->cap = keys->cap ? keys->cap * 2 : PATRICIA_DA_INIT_SIZE;
+        new_keys = (char **)realloc(keys->keys, keys->cap * sizeof(char *));
+        if (!new_keys) {
+            return -1;
+        }
+        keys->keys = new_keys;
+    }
+
+    keys->keys[keys->count] = strdup(key);
+    if (!keys->keys[keys->count]) {
+        return -1;
+    }
+    keys->count++;
+
+    return 0;
+}
+
+/*
+ * patricia_da_grow
+ *
+ * Make sure slot pos exists. New slots are free.
+ */
+static int
+patricia_da_grow (patricia_da_t *da, uint32_t pos)
+{
+    uint32_t new_size, i;
+    int32_t *base, *check;
+
+    if (pos < da->size) {
+        return 0;
+    }
+
+    new_size = da->size ? da->size : PATRICIA_DA_INIT_SIZE;
+    while (new_size <= pos) {
+        new_size *= 2;
+    }
+
+    base = (int32_t *)realloc(da->base, new_size * sizeof(int32_t));
+    if (!base) {
+        return -1;
+    }
+    da->base = base;
+
+    check = (int32_t *)realloc(da->check, new_size * sizeof(int32_t));
+    if (!check) {
+        return -1;
+    }
+    da->check = check;
+
+    for (i = da->size; i < new_size; i++) {
+        da->base[i] = 0;
+        da->check[i] = PATRICIA_DA_FREE;
+    }
+    da->size = new_size;
+
+    return 0;
+}
+
+/*
+ * patricia_da_add_tail
+ *
+ * Append a key suffix to the tail buffer and return its offset
+ */
+static int32_t
+patricia_da_add_tail (patricia_da_builder_t *b, const char *suffix)
+{
+    patricia_da_t *da = b->da;
+    uint32_t len = strlen(suffix) + 1;
+    int32_t offset;
+    char *tail;
+
+    /* All the keys ending exactly at a state share the empty string at 1 */
+    if (len == 1) {
+        return 1;
+    }
+
+    while (da->tail_size + len > b->tail_cap) {
+        b->tail_cap *= 2;
+        tail = (char *)realloc(da->tail, b->tail_cap);
+        if (!tail) {
+            return -1;
+        }
+        da->tail = tail;
+    }
+
+    offset = (int32_t)da->tail_size;
+    memcpy(da->tail + da->tail_size, suffix, len);
+    da->tail_size += len;
+
+    return offset;
+}
+
+/*
+ * patricia_da_find_base
+ *
+ * Find a base such that base + code is a free slot for all the given codes
+ * (in ascending order)
+ */
+static int32_t
+patricia_da_find_base (patricia_da_builder_t *b, const int32_t *codes,
+                       int ncodes)
+{
+    patricia_da_t *da = b->da;
+    uint32_t pos, used = 0, first;
+    int32_t base;
+    int i;
+
+    pos = b->next_free;
+    if (pos < (uint32_t)codes[0] + 1) {
+        pos = codes[0] + 1;
+    }
+    first = pos;
+
+    for (;; pos++) {
+        if (patricia_da_grow(da, pos) != 0) {
+            return -1;
+        }
+        if (da->check[pos] != PATRICIA_DA_FREE) {
+            used++;
+            continue;
+        }
+
+        base = (int32_t)pos - codes[0];
+        for (i = 1; i < ncodes; i++) {
+            if (patricia_da_grow(da, base + codes[i]) != 0) {
+                return -1;
+            }
+            if (da->check[base + codes[i]] != PATRICIA_DA_FREE) {
+                break;
+            }
+        }
+        if (i == ncodes) {
+            break;
+        }
+    }
+
+    /*
+     * If the region we just scanned is almost full, don't bother scanning
+     * it again for the next state
+     */
+    if (pos > first && used * 20 >= (pos - first) * 19) {
+        b->next_free = pos;
+    }
+
+    return base;
+}
+
+/*
+ * patricia_da_build_internal
+ *
+ * Recursively build the states for keys[lo..hi), which all share their
+ * first depth bytes, below state s
+ */
+static int
+patricia_da_build_internal (patricia_da_builder_t *b, char **keys,
+                            uint32_t lo, uint32_t hi, uint32_t depth,
+                            int32_t s)
+{
+    patricia_da_t *da = b->da;
+    int32_t codes[PATRICIA_DA_CODES];
+    uint32_t starts[PATRICIA_DA_CODES + 1];
+    int32_t base, offset, code;
+    int ncodes = 0, i;
+    uint32_t k;
+
+    /* Unique suffix, store it in the tail */
+    if (hi - lo == 1) {
+        offset = patricia_da_add_tail(b, keys[lo] + depth);
+        if (offset < 0) {
+            return -1;
+        }
+        da->base[s] = -offset;
+        return 0;
+    }
+
+    /* The keys are sorted, so the codes come out in ascending order */
+    for (k = lo; k < hi; k++) {
+        code = keys[k][depth] ? patricia_da_code(keys[k][depth]) : 0;
+        if (ncodes == 0 || codes[ncodes - 1] != code) {
+            codes[ncodes] = code;
+            starts[ncodes] = k;
+            ncodes++;
+        }
+    }
+    starts[ncodes] = hi;
+
+    base = patricia_da_find_base(b, codes, ncodes);
+    if (base < 0) {
+        return -1;
+    }
+
+    /* Claim all the slots before building the children */
+    da->base[s] = base;
+    for (i = 0; i < ncodes; i++) {
+        da->check[base + codes[i]] = s;
+    }
+    while (b->next_free < da->size &&
+           da->check[b->next_free] != PATRICIA_DA_FREE) {
+        b->next_free++;
+    }
+
+    for (i = 0; i < ncodes; i++) {
+        if (codes[i] == 0) {
+            da->base[base] = -1;
+            continue;
+        }
+        if (patricia_da_build_internal(b, keys, starts[i], starts[i + 1],
+                                       depth + 1, base + codes[i]) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_da_print_stats
+ *
+ * Dump the stats for the given double-array trie
+ */
+void
+patricia_da_print_stats (patricia_da_t *da)
+{
+#ifdef PATRICIA_STATS_ON
+    uint32_t i, used = 0;
+
+    for (i = 0; i < da->size; i++) {
+        if (da->check[i] != PATRICIA_DA_FREE) {
+            used++;
+        }
+    }
+
+    printf("\nTotal number of keys: %u\n", da->key_count);
+    printf("Total number of slots: %u (%u used)\n", da->size, used);
+    printf("Tail size: %u bytes\n", da->tail_size);
+    printf("Total memory used: %lu bytes\n\n",
+           (unsigned long)da->size * 2 * sizeof(int32_t) + da->tail_size);
+#endif
+}
+
+/*
+ * patricia_da_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 otherwise.
+ */
+int
+patricia_da_lookup (patricia_da_t *da, const char *key)
+{
+    int32_t s = PATRICIA_DA_ROOT;
+    uint32_t t;
+
+    /* Sanity check */
+    if (!da || !key) {
+        return 0;
+    }
+
+    for (;;) {
+        if (da->base[s] < 0) {
+            return strcmp(da->tail - da->base[s], key) == 0;
+        }
+
+        t = (uint32_t)da->base[s] + (*key ? patricia_da_code(*key) : 0);
+        if (t >= da->size || da->check[t] != s) {
+            return 0;
+        }
+        if (!*key) {
+            return 1;
+        }
+        s = (int32_t)t;
+        key++;
+    }
+}
+
+/*
+ * patricia_da_common_prefix
+ *
+ * Invoke fn for every key which is a prefix of the given key, shortest
+ * first. fn gets the given key and the length of the match. Returns the
+ * number of keys found.
+ */
+int
+patricia_da_common_prefix (patricia_da_t *da, const char *key,
+                           patricia_da_fn fn, void *arg)
+{
+    int32_t s = PATRICIA_DA_ROOT;
+    int depth = 0, count = 0, len;
+    const char *tail;
+    uint32_t t;
+
+    /* Sanity check */
+    if (!da || !key || !fn) {
+        return -1;
+    }
+
+    for (;;) {
+        if (da->base[s] < 0) {
+            tail = da->tail - da->base[s];
+            len = strlen(tail);
+            if (strncmp(tail, key + depth, len) == 0) {
+                count++;
+                fn(key, depth + len, arg);
+            }
+            return count;
+        }
+
+        /* A key ends here */
+        t = (uint32_t)da->base[s];
+        if (t < da->size && da->check[t] == s) {
+            count++;
+            if (fn(key, depth, arg) != 0) {
+                return count;
+            }
+        }
+
+        if (!key[depth]) {
+            return count;
+        }
+
+        t = (uint32_t)da->base[s] + patricia_da_code(key[depth]);
+        if (t >= da->size || da->check[t] != s) {
+            return count;
+        }
+        s = (int32_t)t;
+        depth++;
+    }
+}
+
+/*
+ * patricia_da_enumerate
+ *
+ * Recursively invoke fn on all the keys below state s. buf holds the first
+ * len bytes of the keys. Stops when fn returns non zero.
+ */
+static int
+patricia_da_enumerate (patricia_da_t *da, int32_t s, char *buf, int len,
+                       patricia_da_fn fn, void *arg, int *count)
+{
+    const char *tail;
+    uint32_t t;
+    int32_t c;
+    int tlen;
+
+    if (da->base[s] < 0) {
+        tail = da->tail - da->base[s];
+        tlen = strlen(tail);
+        memcpy(buf + len, tail, tlen + 1);
+        (*count)++;
+        return fn(buf, len + tlen, arg);
+    }
+
+    for (c = 0; c < PATRICIA_DA_CODES; c++) {
+        t = (uint32_t)da->base[s] + c;
+        if (t >= da->size) {
+            break;
+        }
+        if (da->check[t] != s) {
+            continue;
+        }
+        if (c == 0) {
+            buf[len] = 0;
+            (*count)++;
+            if (fn(buf, len, arg) != 0) {
+                return 1;
+            }
+            continue;
+        }
+        buf[len] = (char)(c - 1);
+        if (patricia_da_enumerate(da, (int32_t)t, buf, len + 1, fn, arg,
+                                  count) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_da_predictive
+ *
+ * Invoke fn for every key starting with prefix, in lexicographical order.
+ * Returns the number of keys found.
+ */
+int
+patricia_da_predictive (patricia_da_t *da, const char *prefix,
+                        patricia_da_fn fn, void *arg)
+{
+    int32_t s = PATRICIA_DA_ROOT;
+    int depth = 0, count = 0, len;
+    const char *tail;
+    char *buf;
+    uint32_t t;
+
+    /* Sanity check */
+    if (!da || !prefix || !fn) {
+        return -1;
+    }
+
+    len = strlen(prefix);
+    buf = (char *)malloc(len + da->max_keylen + 1);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(buf, prefix, len + 1);
+
+    while (prefix[depth]) {
+        if (da->base[s] < 0) {
+            /* A single key left, it has to continue the prefix */
+            tail = da->tail - da->base[s];
+            if (strncmp(tail, prefix + depth, len - depth) == 0) {
+                strcpy(buf + depth, tail);
+                count++;
+                fn(buf, strlen(buf), arg);
+            }
+            free(buf);
+            return count;
+        }
+
+        t = (uint32_t)da->base[s] + patricia_da_code(prefix[depth]);
+        if (t >= da->size || da->check[t] != s) {
+            free(buf);
+            return 0;
+        }
+        s = (int32_t)t;
+        depth++;
+    }
+
+    patricia_da_enumerate(da, s, buf, depth, fn, arg, &count);
+    free(buf);
+
+    return count;
+}
+
+/*
+ * patricia_da_save
+ *
+ * Write the trie to the given file. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_da_save (patricia_da_t *da, const char *path)
+{
+    patricia_da_header_t hdr;
+    FILE *fp;
+    int ret = 0;
+
+    /* Sanity check */
+    if (!da || !path) {
+        return -1;
+    }
+
+    fp = fopen(path, "wb");
+    if (!fp) {
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PATRICIA_DA_MAGIC, sizeof(hdr.magic));
+    hdr.version = PATRICIA_DA_VERSION;
+    hdr.size = da->size;
+    hdr.tail_size = da->tail_size;
+    hdr.key_count = da->key_count;
+    hdr.max_keylen = da->max_keylen;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(da->base, sizeof(int32_t), da->size, fp) != da->size ||
+        fwrite(da->check, sizeof(int32_t), da->size, fp) != da->size ||
+        fwrite(da->tail, 1, da->tail_size, fp) != da->tail_size) {
+        ret = -1;
+    }
+
+    if (fclose(fp) != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/*
+ * patricia_da_validate
+ *
+ * Check a trie read from a file before it is used. Every state reachable
+ * from the root is visited once: tail offsets have to fall inside the tail,
+ * and no key may be longer than max_keylen, which also rules out cycles.
+ * Transitions past the arrays are already checked by every lookup. Returns
+ * 0 if the trie is sound, -1 otherwise.
+ */
+static int
+patricia_da_validate (patricia_da_t *da)
+{
+    uint32_t *stack, *depth, sp, visited, t, d;
+    int32_t s, c;
+    int ret = 0;
+
+    if (da->size <= PATRICIA_DA_ROOT || da->tail_size < 2 ||
+        da->tail[1] != 0 || da->tail[da->tail_size - 1] != 0) {
+        return -1;
+    }
+
+    stack = (uint32_t *)malloc(da->size * sizeof(uint32_t));
+    depth = (uint32_t *)malloc(da->size * sizeof(uint32_t));
+    if (!stack || !depth) {
+        free(stack);
+        free(depth);
+        return -1;
+    }
+
+    sp = 0;
+    visited = 0;
+    stack[sp] = PATRICIA_DA_ROOT;
+    depth[sp++] = 0;
+    while (sp > 0 && ret == 0) {
+        sp--;
+        s = (int32_t)stack[sp];
+        d = depth[sp];
+        if (++visited > da->size) {
+            ret = -1;
+            break;
+        }
+
+        if (da->base[s] < 0) {
+            if (-(int64_t)da->base[s] >= da->tail_size) {
+                ret = -1;
+                break;
+            }
+            if (d + strlen(da->tail - da->base[s]) > da->max_keylen) {
+                ret = -1;
+            }
+            continue;
+        }
+
+        for (c = 0; c < PATRICIA_DA_CODES; c++) {
+            t = (uint32_t)da->base[s] + c;
+            if (t >= da->size) {
+                break;
+            }
+            if (da->check[t] != s) {
+                continue;
+            }
+            if (c == 0) {
+                /* The end of a key, see patricia_da_enumerate */
+                continue;
+            }
+            if (d + 1 > da->max_keylen || sp == da->size) {
+                ret = -1;
+                break;
+            }
+            stack[sp] = t;
+            depth[sp] = d + 1;
+            sp++;
+        }
+    }
+
+    free(stack);
+    free(depth);
+
+    return ret;
+}
+
+/*
+ * patricia_da_load
+ *
+ * Map a trie written by patricia_da_save. The arrays point straight into
+ * the read-only mapping.
+ */
+patricia_da_t *
+patricia_da_load (const char *path)
+{
+    patricia_da_header_t *hdr;
+    patricia_da_t *da;
+    struct stat st;
+    void *map;
+    int fd;
+
+    /* Sanity check */
+    if (!path) {
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    hdr = (patricia_da_header_t *)map;
+    if (memcmp(hdr->magic, PATRICIA_DA_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != PATRICIA_DA_VERSION ||
+        sizeof(*hdr) + (size_t)hdr->size * 2 * sizeof(int32_t) +
+        hdr->tail_size != (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    da = (patricia_da_t *)calloc(1, sizeof(patricia_da_t));
+    if (!da) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    da->size = hdr->size;
+    da->tail_size = hdr->tail_size;
+    da->key_count = hdr->key_count;
+    da->max_keylen = hdr->max_keylen;
+    da->base = (int32_t *)(hdr + 1);
+    da->check = da->base + da->size;
+    da->tail = (char *)(da->check + da->size);
+    da->map = map;
+    da->map_len = st.st_size;
+
+    if (patricia_da_validate(da) != 0) {
+        patricia_da_destroy(da);
+        return NULL;
+    }
+
+    return da;
+}
+
+/*
+ * patricia_da_destroy
+ *
+ * Free the given double-array trie
+ */
+int
+patricia_da_destroy (patricia_da_t *da)
+{
+    /* Sanity check */
+    if (!da) {
+        return -1;
+    }
+
+    if (da->map) {
+        munmap(da->map, da->map_len);
+    } else {
+        free(da->base);
+        free(da->check);
+        free(da->tail);
+    }
+    free(da);
+
+    return 0;
+}
+
+/*
+ * patricia_da_build
+ *
+ * Create a double-array trie holding all the keys of the given tree
+ */
+patricia_da_t *
+patricia_da_build (patricia_tree_t *tree)
+{
+    patricia_da_builder_t b;
+    patricia_da_keys_t keys;
+    patricia_da_t *da;
+    uint32_t i, len;
+    int ret;
+
+    /* Sanity check */
+    if (!tree) {
+        return NULL;
+    }
+
+    memset(&keys, 0, sizeof(keys));
+    ret = patricia_walk(tree, patricia_da_collect, &keys);
+
+    da = (patricia_da_t *)calloc(1, sizeof(patricia_da_t));
+    if (ret != 0 || !da) {
+        goto fail;
+    }
+
+    /* Offsets 0 and 1 of the tail are reserved, see patricia_da_add_tail */
+    b.da = da;
+    b.tail_cap = PATRICIA_DA_INIT_SIZE;
+    b.next_free = PATRICIA_DA_ROOT + 1;
+    da->tail = (char *)calloc(1, b.tail_cap);
+    if (!da->tail || patricia_da_grow(da, PATRICIA_DA_ROOT) != 0) {
+        goto fail;
+    }
+    da->tail_size = 2;
+    da->check[0] = 0;
+    da->check[PATRICIA_DA_ROOT] = 0;
+
+    da->key_count = keys.count;
+    for (i = 0; i < keys.count; i++) {
+        len = strlen(keys.keys[i]);
+        if (len > da->max_keylen) {
+            da->max_keylen = len;
+        }
+    }
+
+    if (keys.count > 0 &&
+        patricia_da_build_internal(&b, keys.keys, 0, keys.count, 0,
+                                   PATRICIA_DA_ROOT) != 0) {
+        goto fail;
+    }
+
+    for (i = 0; i < keys.count; i++) {
+        free(keys.keys[i]);
+    }
+    free(keys.keys);
+
+    return da;
+
+fail:
+    for (i = 0; i < keys.count; i++) {
+        free(keys.keys[i]);
+    }
+    free(keys.keys);
+    if (da) {
+        patricia_da_destroy(da);
+    }
+
+    return NULL;
+}
+
+/* End of File */
@@ -0,0 +1,66 @@
+/*
+ * patricia_da.h - Header file for the double-array trie export
+ *
+ * A frozen, read-only copy of a patricia tree stored as a double-array trie
+ * (base/check arrays) with unique key suffixes moved to a tail buffer.
+ */
+
+#ifndef PATRICIA_DA_H
+#define PATRICIA_DA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_DA_MAGIC       "PTDA"
+#define PATRICIA_DA_VERSION     1
+#define PATRICIA_DA_ROOT        1
+#define PATRICIA_DA_FREE        -1          /* check[] of an unused slot */
+
+/* Datastructures */
+
+/*
+ * State s has a transition on byte c to state t = base[s] + c + 1 if
+ * check[t] == s. The end of a key is a transition on code 0. A negative
+ * base[s] means the rest of the key is unique and stored at tail[-base[s]].
+ */
+typedef struct patricia_da_s {
+    int32_t     *base;
+    int32_t     *check;
+    char        *tail;
+    uint32_t    size;
+    uint32_t    tail_size;
+    uint32_t    key_count;
+    uint32_t    max_keylen;
+    void        *map;                       /* Set if loaded with mmap */
+    size_t      map_len;
+} patricia_da_t;
+
+/* On disk image: header, base[size], check[size], tail[tail_size] */
+typedef struct patricia_da_header_s {
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    size;
+    uint32_t    tail_size;
+    uint32_t    key_count;
+    uint32_t    max_keylen;
+} patricia_da_header_t;
+
+typedef int (*patricia_da_fn) (const char *key, int len, void *arg);
+
+/* Function Prototypes */
+
+void patricia_da_print_stats (patricia_da_t *da);
+int patricia_da_lookup (patricia_da_t *da, const char *key);
+int patricia_da_common_prefix (patricia_da_t *da, const char *key,
+                               patricia_da_fn fn, void *arg);
+int patricia_da_predictive (patricia_da_t *da, const char *prefix,
+                            patricia_da_fn fn, void *arg);
+int patricia_da_save (patricia_da_t *da, const char *path);
+patricia_da_t *patricia_da_load (const char *path);
+int patricia_da_destroy (patricia_da_t *da);
+patricia_da_t *patricia_da_build (patricia_tree_t *tree);
+
+#endif /* PATRICIA_DA_H */
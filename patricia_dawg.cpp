@@ -0,0 +1,624 @@
+/*
+ * patricia_dawg.c
+ *
+ * This file turns the keys of a patricia tree into a minimal acyclic
+ * automaton, a DAWG or DAFSA. A tree, like a trie, shares the beginnings
+ * of keys but repeats every ending, and key sets such as paths end in the
+ * same few ways (".log", "/index.html", dates) under many prefixes. Here
+ * states accepting the same set of endings are merged into one, so each
+ * distinct ending is stored once.
+ *
+ * The automaton is built with the incremental algorithm of Daciuk et al.
+ * for sorted input. Keys come in order from patricia_walk and are added as
+ * a trie branch off the longest prefix shared with the previous key. The
+ * states of the previous key below that prefix can no longer change, so
+ * they are merged, deepest first, with an equivalent state from the
+ * register if there is one, and registered otherwise. Two states are
+ * equivalent when both or neither end a key and their edges have the same
+ * labels and targets, which for states already minimized means they accept
+ * the same endings. Once every key is in, the states are renumbered and
+ * packed into flat arrays.
+ *
+ * Lookups and prefix enumeration follow the edges as in a trie. What a
+ * state is reached through is lost, so nothing can be attached to a key.
+ *
+ * Like patricia_get_key_count, the keys of the tree are its leaves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "patricia_dawg.h"
+
+/* Defines */
+
+#define PATRICIA_DAWG_INIT_SIZE 1024
+#define PATRICIA_DAWG_NONE      0xffffffff
+
+/* Datastructures */
+
+typedef struct patricia_dawg_edge_s {
+    uint32_t    target;
+    uint8_t     label;
+} patricia_dawg_edge_t;
+
+/* A state while building */
+typedef struct patricia_dawg_bstate_s {
+    patricia_dawg_edge_t    *edges;
+    uint16_t                count;
+    uint16_t                cap;
+    uint8_t                 final;
+    uint32_t                id;             /* Number once packed */
+} patricia_dawg_bstate_t;
+
+typedef struct patricia_dawg_builder_s {
+    patricia_dawg_bstate_t  *states;
+    uint32_t                state_count;
+    uint32_t                state_cap;
+    uint32_t                free_state;     /* Chain through id */
+    uint32_t                *reg;           /* Register, state + 1 */
+    uint32_t                reg_size;
+    uint32_t                reg_used;
+    uint32_t                path[PATRICIA_DEFAULT_KEYLEN + 1];
+    char                    prev[PATRICIA_DEFAULT_KEYLEN];
+    uint32_t                prev_len;
+    uint32_t                key_count;
+    uint32_t                max_keylen;
+    uint32_t                trie_states;
+} patricia_dawg_builder_t;
+
+/*
+ * patricia_dawg_new_state
+ *
+ * Return a new state without edges, PATRICIA_DAWG_NONE upon failure
+ */
+static uint32_t
+patricia_dawg_new_state (patricia_dawg_builder_t *b)
+{
+    patricia_dawg_bstate_t *states;
+    uint32_t s, cap;
+
+    if (b->free_state != PATRICIA_DAWG_NONE) {
+        s = b->free_state;
+        b->free_state = b->states[s].id;
+    } else {
+        if (b->state_count == b->state_cap) {
+            cap = b->state_cap ? b->state_cap * 2 : PATRICIA_DAWG_INIT_SIZE;
+            states = (patricia_dawg_bstate_t *)
+                     realloc(b->states, cap * sizeof(patricia_dawg_bstate_t));
+            if (!states) {
+                return PATRICIA_DAWG_NONE;
+            }
+            b->states = states;
+            b->state_cap = cap;
+        }
+        s = b->state_count++;
+    }
+
+    memset(&b->states[s], 0, sizeof(patricia_dawg_bstate_t));
+    b->states[s].id = PATRICIA_DAWG_NONE;
+    b->trie_states++;
+
+    return s;
+}
+
+/*
+ * patricia_dawg_free_state
+ *
+ * Put a merged state back for reuse
+ */
+static void
+patricia_dawg_free_state (patricia_dawg_builder_t *b, uint32_t s)
+{
+    free(b->states[s].edges);
+    b->states[s].edges = NULL;
+    b->states[s].id = b->free_state;
+    b->free_state = s;
+}
+
+/*
+ * patricia_dawg_add_edge
+ *
+ * Append an edge to state s. Labels come in ascending order. Returns 0
+ * upon success, -1 upon failure.
+ */
+static int
+patricia_dawg_add_edge (patricia_dawg_builder_t *b, uint32_t s,
+                        uint8_t label, uint32_t target)
+{
+    patricia_dawg_bstate_t *st = &b->states[s];
+    patricia_dawg_edge_t *edges;
+    uint16_t cap;
+
+    if (st->count == st->cap) {
+        cap = st->cap ? st->cap * 2 : 2;
+        edges = (patricia_dawg_edge_t *)
+                realloc(st->edges, cap * sizeof(patricia_dawg_edge_t));
+        if (!edges) {
+            return -1;
+        }
+        st->edges = edges;
+        st->cap = cap;
+    }
+    st->edges[st->count].label = label;
+    st->edges[st->count].target = target;
+    st->count++;
+
+    return 0;
+}
+
+/*
+ * patricia_dawg_hash
+ *
+ * FNV-1a over what makes two states equivalent
+ */
+static uint32_t
+patricia_dawg_hash (patricia_dawg_bstate_t *st)
+{
+    uint32_t h = 2166136261u, i;
+
+    h = (h ^ st->final) * 16777619u;
+    for (i = 0; i < st->count; i++) {
+        h = (h ^ st->edges[i].label) * 16777619u;
+        h = (h ^ st->edges[i].target) * 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * patricia_dawg_equal
+ *
+ * Check whether two states are equivalent
+ */
+static int
+patricia_dawg_equal (patricia_dawg_bstate_t *a, patricia_dawg_bstate_t *b)
+{
+    uint32_t i;
+
+    if (a->final != b->final || a->count != b->count) {
+        return 0;
+    }
+    for (i = 0; i < a->count; i++) {
+        if (a->edges[i].label != b->edges[i].label ||
+            a->edges[i].target != b->edges[i].target) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * patricia_dawg_register
+ *
+ * Look the state up in the register. Returns the equivalent state found
+ * or, after adding it, the state itself. PATRICIA_DAWG_NONE upon failure.
+ */
+static uint32_t
+patricia_dawg_register (patricia_dawg_builder_t *b, uint32_t s)
+{
+    uint32_t *reg, size, i, j, mask;
+
+    if (2 * (b->reg_used + 1) > b->reg_size) {
+        size = b->reg_size ? b->reg_size * 2 : PATRICIA_DAWG_INIT_SIZE;
+        reg = (uint32_t *)calloc(size, sizeof(uint32_t));
+        if (!reg) {
+            return PATRICIA_DAWG_NONE;
+        }
+        for (i = 0; i < b->reg_size; i++) {
+            if (!b->reg[i]) {
+                continue;
+            }
+            j = patricia_dawg_hash(&b->states[b->reg[i] - 1]) & (size - 1);
+            while (reg[j]) {
+                j = (j + 1) & (size - 1);
+            }
+            reg[j] = b->reg[i];
+        }
+        free(b->reg);
+        b->reg = reg;
+        b->reg_size = size;
+    }
+
+    mask = b->reg_size - 1;
+    for (i = patricia_dawg_hash(&b->states[s]) & mask; b->reg[i];
+         i = (i + 1) & mask) {
+        if (patricia_dawg_equal(&b->states[b->reg[i] - 1], &b->states[s])) {
+            return b->reg[i] - 1;
+        }
+    }
+    b->reg[i] = s + 1;
+    b->reg_used++;
+
+    return s;
+}
+
+/*
+ * patricia_dawg_minimize
+ *
+ * Merge or register the states of the previous key deeper than depth,
+ * deepest first. Returns 0 upon success, -1 upon failure.
+ */
+static int
+patricia_dawg_minimize (patricia_dawg_builder_t *b, uint32_t depth)
+{
+    patricia_dawg_bstate_t *parent;
+    uint32_t i, child, q;
+
+    for (i = b->prev_len; i > depth; i--) {
+        child = b->path[i];
+        q = patricia_dawg_register(b, child);
+        if (q == PATRICIA_DAWG_NONE) {
+            return -1;
+        }
+        if (q != child) {
+            /* The child is the newest edge of its parent */
+            parent = &b->states[b->path[i - 1]];
+            parent->edges[parent->count - 1].target = q;
+            patricia_dawg_free_state(b, child);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_dawg_add
+ *
+ * patricia_walk callback, adds the next key. The walk hands the keys over
+ * in sorted order.
+ */
+static int
+patricia_dawg_add (char *key, void *arg)
+{
+    patricia_dawg_builder_t *b = (patricia_dawg_builder_t *)arg;
+    uint32_t len, p, i, s;
+
+    len = strlen(key);
+    for (p = 0; p < len && p < b->prev_len && key[p] == b->prev[p]; p++);
+
+    if (patricia_dawg_minimize(b, p) != 0) {
+        return -1;
+    }
+
+    for (i = p; i < len; i++) {
+        s = patricia_dawg_new_state(b);
+        if (s == PATRICIA_DAWG_NONE ||
+            patricia_dawg_add_edge(b, b->path[i], (uint8_t)key[i], s) != 0) {
+            return -1;
+        }
+        b->path[i + 1] = s;
+    }
+    b->states[b->path[len]].final = 1;
+
+    memcpy(b->prev + p, key + p, len - p);
+    b->prev_len = len;
+    b->key_count++;
+    if (len > b->max_keylen) {
+        b->max_keylen = len;
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_dawg_pack
+ *
+ * Number the states reachable from the root breadth first and copy them
+ * into the flat arrays of dawg. Returns 0 upon success, -1 upon failure.
+ */
+static int
+patricia_dawg_pack (patricia_dawg_builder_t *b, patricia_dawg_t *dawg)
+{
+    patricia_dawg_bstate_t *st;
+    uint32_t *queue, head, tail, s, i, e;
+
+    queue = (uint32_t *)malloc(b->state_count * sizeof(uint32_t));
+    if (!queue) {
+        return -1;
+    }
+
+    /* Number the states and count the edges */
+    head = tail = 0;
+    queue[tail++] = b->path[0];
+    b->states[b->path[0]].id = 0;
+    dawg->edge_count = 0;
+    while (head < tail) {
+        st = &b->states[queue[head++]];
+        dawg->edge_count += st->count;
+        for (i = 0; i < st->count; i++) {
+            s = st->edges[i].target;
+            if (b->states[s].id == PATRICIA_DAWG_NONE) {
+                b->states[s].id = tail;
+                queue[tail++] = s;
+            }
+        }
+    }
+    dawg->state_count = tail;
+
+    dawg->state = (uint32_t *)malloc((tail + 1) * sizeof(uint32_t));
+    dawg->label = (uint8_t *)malloc(dawg->edge_count + 1);
+    dawg->target = (uint32_t *)malloc((dawg->edge_count + 1) *
+                                      sizeof(uint32_t));
+    if (!dawg->state || !dawg->label || !dawg->target) {
+        free(queue);
+        return -1;
+    }
+
+    /* The queue holds the states in their new order */
+    e = 0;
+    for (head = 0; head < tail; head++) {
+        st = &b->states[queue[head]];
+        dawg->state[head] = e | (st->final ? PATRICIA_DAWG_FINAL : 0);
+        for (i = 0; i < st->count; i++) {
+            dawg->label[e] = st->edges[i].label;
+            dawg->target[e] = b->states[st->edges[i].target].id;
+            e++;
+        }
+    }
+    dawg->state[tail] = e;
+    free(queue);
+
+    return 0;
+}
+
+/*
+ * patricia_dawg_node_bytes
+ *
+ * Recursively add up the memory the nodes under the given node take in
+ * the tree, counted as patricia_print_stats does
+ */
+static void
+patricia_dawg_node_bytes (patricia_node_t *root, uint64_t *bytes)
+{
+    patricia_node_t *child;
+
+    *bytes += sizeof(patricia_node_t) + strlen(root->key) + 1;
+    if (root->children) {
+        *bytes += sizeof(list_t);
+    }
+
+    child = PATRICIA_FIRST_CHILD(root);
+    while (child) {
+        patricia_dawg_node_bytes(child, bytes);
+        child = (patricia_node_t *)list_get_next(root->children, child);
+    }
+}
+
+/*
+ * patricia_dawg_step
+ *
+ * Follow the edge of state s on byte c. Returns the next state or
+ * PATRICIA_DAWG_NONE if there is no such edge.
+ */
+static inline uint32_t
+patricia_dawg_step (patricia_dawg_t *dawg, uint32_t s, uint8_t c)
+{
+    uint32_t lo, hi, mid;
+
+    lo = dawg->state[s] & ~PATRICIA_DAWG_FINAL;
+    hi = dawg->state[s + 1] & ~PATRICIA_DAWG_FINAL;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (dawg->label[mid] < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo < (dawg->state[s + 1] & ~PATRICIA_DAWG_FINAL) &&
+        dawg->label[lo] == c) {
+        return dawg->target[lo];
+    }
+    return PATRICIA_DAWG_NONE;
+}
+
+/*
+ * patricia_dawg_enumerate
+ *
+ * Recursively invoke fn on all the keys accepted from state s. buf holds
+ * the first len bytes of the keys. Stops when fn returns non zero.
+ */
+static int
+patricia_dawg_enumerate (patricia_dawg_t *dawg, uint32_t s, char *buf,
+                         int len, patricia_dawg_fn fn, void *arg, int *count)
+{
+    uint32_t e, end;
+
+    if (dawg->state[s] & PATRICIA_DAWG_FINAL) {
+        buf[len] = 0;
+        (*count)++;
+        if (fn(buf, len, arg) != 0) {
+            return 1;
+        }
+    }
+
+    end = dawg->state[s + 1] & ~PATRICIA_DAWG_FINAL;
+    for (e = dawg->state[s] & ~PATRICIA_DAWG_FINAL; e < end; e++) {
+        buf[len] = (char)dawg->label[e];
+        if (patricia_dawg_enumerate(dawg, dawg->target[e], buf, len + 1, fn,
+                                    arg, count) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_dawg_print_stats
+ *
+ * Dump the stats for the given DAWG
+ */
+void
+patricia_dawg_print_stats (patricia_dawg_t *dawg)
+{
+#ifdef PATRICIA_STATS_ON
+    unsigned long used;
+
+    /* Sanity check */
+    if (!dawg) {
+        return;
+    }
+
+    used = (unsigned long)(dawg->state_count + 1) * sizeof(uint32_t) +
+           (unsigned long)dawg->edge_count * (1 + sizeof(uint32_t));
+    printf("\nTotal number of keys: %u\n", dawg->key_count);
+    printf("Total number of states: %u (%u before merging)\n",
+           dawg->state_count, dawg->trie_states);
+    printf("Total number of edges: %u\n", dawg->edge_count);
+    printf("Total memory used: %lu bytes\n", used);
+    printf("Source tree: %lu bytes\n", (unsigned long)dawg->node_bytes);
+    if (used) {
+        printf("Reduction factor: %.2f\n", (double)dawg->node_bytes / used);
+    }
+    printf("\n");
+#endif
+}
+
+/*
+ * patricia_dawg_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 otherwise.
+ */
+int
+patricia_dawg_lookup (patricia_dawg_t *dawg, const char *key)
+{
+    uint32_t s = PATRICIA_DAWG_ROOT;
+
+    /* Sanity check */
+    if (!dawg || !key) {
+        return 0;
+    }
+
+    for (; *key; key++) {
+        s = patricia_dawg_step(dawg, s, (uint8_t)*key);
+        if (s == PATRICIA_DAWG_NONE) {
+            return 0;
+        }
+    }
+
+    return (dawg->state[s] & PATRICIA_DAWG_FINAL) ? 1 : 0;
+}
+
+/*
+ * patricia_dawg_predictive
+ *
+ * Invoke fn for every key starting with prefix, in lexicographical order.
+ * Stops when fn returns non zero. Returns the number of keys found.
+ */
+int
+patricia_dawg_predictive (patricia_dawg_t *dawg, const char *prefix,
+                          patricia_dawg_fn fn, void *arg)
+{
+    uint32_t s = PATRICIA_DAWG_ROOT;
+    int len, i, count = 0;
+    char *buf;
+
+    /* Sanity check */
+    if (!dawg || !prefix || !fn) {
+        return -1;
+    }
+
+    len = strlen(prefix);
+    for (i = 0; i < len; i++) {
+        s = patricia_dawg_step(dawg, s, (uint8_t)prefix[i]);
+        if (s == PATRICIA_DAWG_NONE) {
+            return 0;
+        }
+    }
+
+    buf = (char *)malloc(len + dawg->max_keylen + 1);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(buf, prefix, len);
+    patricia_dawg_enumerate(dawg, s, buf, len, fn, arg, &count);
+    free(buf);
+
+    return count;
+}
+
+/*
+ * patricia_dawg_destroy
+ *
+ * Free the given DAWG
+ */
+int
+patricia_dawg_destroy (patricia_dawg_t *dawg)
+{
+    /* Sanity check */
+    if (!dawg) {
+        return -1;
+    }
+
+    free(dawg->state);
+    free(dawg->label);
+    free(dawg->target);
+    free(dawg);
+
+    return 0;
+}
+
+/*
+ * patricia_dawg_build
+ *
+ * Create the minimal DAWG accepting all the keys of the given tree
+ */
+patricia_dawg_t *
+patricia_dawg_build (patricia_tree_t *tree)
+{
+    patricia_dawg_builder_t *b;
+    patricia_dawg_t *dawg;
+    uint32_t i;
+    int ret;
+
+    /* Sanity check */
+    if (!tree) {
+        return NULL;
+    }
+
+    /* The builder is large, it holds a path and a key */
+    b = (patricia_dawg_builder_t *)calloc(1, sizeof(patricia_dawg_builder_t));
+    dawg = (patricia_dawg_t *)calloc(1, sizeof(patricia_dawg_t));
+    if (!b || !dawg) {
+        free(b);
+        free(dawg);
+        return NULL;
+    }
+    b->free_state = PATRICIA_DAWG_NONE;
+
+    ret = -1;
+    b->path[0] = patricia_dawg_new_state(b);
+    if (b->path[0] != PATRICIA_DAWG_NONE &&
+        patricia_walk(tree, patricia_dawg_add, b) == 0 &&
+        patricia_dawg_minimize(b, 0) == 0) {
+        dawg->key_count = b->key_count;
+        dawg->max_keylen = b->max_keylen;
+        dawg->trie_states = b->trie_states;
+        ret = patricia_dawg_pack(b, dawg);
+    }
+
+    for (i = 0; i < b->state_count; i++) {
+        free(b->states[i].edges);
+    }
+    free(b->states);
+    free(b->reg);
+    free(b);
+
+    if (ret != 0) {
+        patricia_dawg_destroy(dawg);
+        return NULL;
+    }
+
+    /* The root stands for no key, see patricia_walk */
+    patricia_dawg_node_bytes(tree->root, &dawg->node_bytes);
+
+    return dawg;
+}
+
+/* End of File */
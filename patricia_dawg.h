@@ -0,0 +1,50 @@
+/*
+ * patricia_dawg.h - Header file for the minimized frozen tree
+ *
+ * A frozen, read-only copy of the keys of a patricia tree as a directed
+ * acyclic word graph (DAFSA), the minimal automaton accepting them, where
+ * keys ending the same way share the states for their endings.
+ */
+
+#ifndef PATRICIA_DAWG_H
+#define PATRICIA_DAWG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_DAWG_ROOT      0
+#define PATRICIA_DAWG_FINAL     0x80000000  /* In state[], a key ends here */
+
+/* Datastructures */
+
+/*
+ * The transitions of state s are edges state[s] to state[s + 1], without
+ * the final bit, sorted by label. Edge e goes to target[e] on label[e].
+ */
+typedef struct patricia_dawg_s {
+    uint32_t    *state;
+    uint8_t     *label;
+    uint32_t    *target;
+    uint32_t    state_count;
+    uint32_t    edge_count;
+    uint32_t    key_count;
+    uint32_t    max_keylen;
+    uint32_t    trie_states;                /* States before merging */
+    uint64_t    node_bytes;                 /* The source tree */
+} patricia_dawg_t;
+
+typedef int (*patricia_dawg_fn) (const char *key, int len, void *arg);
+
+/* Function Prototypes */
+
+void patricia_dawg_print_stats (patricia_dawg_t *dawg);
+int patricia_dawg_lookup (patricia_dawg_t *dawg, const char *key);
+int patricia_dawg_predictive (patricia_dawg_t *dawg, const char *prefix,
+                              patricia_dawg_fn fn, void *arg);
+int patricia_dawg_destroy (patricia_dawg_t *dawg);
+patricia_dawg_t *patricia_dawg_build (patricia_tree_t *tree);
+
+#endif /* PATRICIA_DAWG_H */
@@ -0,0 +1,628 @@
+/*
+ * patricia_fc.c
+ *
+ * This file packs the keys of a patricia tree into a frozen, front-coded
+ * store. Sorted keys next to each other tend to share long prefixes, even
+ * below the last branching point of the tree, and a tree pays a whole
+ * patricia_node_t and a separate label allocation for every leaf. Here the
+ * keys are cut into blocks of PATRICIA_FC_BLOCK_KEYS. The first key of a
+ * block is stored whole, the others only as the length of the prefix they
+ * share with the key before them and the rest of their bytes.
+ *
+ * A lookup binary searches the first keys of the blocks through the index,
+ * which needs no decoding, and then walks a single block. The walk only
+ * tracks how much of the key matches so far, so keys are never rebuilt.
+ * Prefix scans rebuild the keys one after the other from the block the
+ * prefix falls in. Like the double-array export, the store can be written
+ * to a file and mapped back read-only without any fixups.
+ *
+ * Like patricia_get_key_count, the keys of the tree are its leaves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "patricia_fc.h"
+
+/* Defines */
+
+#define PATRICIA_FC_INIT_SIZE   1024
+
+/* Datastructures */
+
+typedef struct patricia_fc_builder_s {
+    patricia_fc_t   *fc;
+    uint32_t        data_cap;
+    uint32_t        index_cap;
+    uint32_t        prev_len;
+    char            prev[PATRICIA_DEFAULT_KEYLEN];
+} patricia_fc_builder_t;
+
+/*
+ * patricia_fc_put_varint
+ *
+ * Store v as a varint at p. Returns the number of bytes used.
+ */
+static inline uint32_t
+patricia_fc_put_varint (char *p, uint32_t v)
+{
+    uint32_t n = 0;
+
+    while (v >= 0x80) {
+        p[n++] = (char)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (char)v;
+
+    return n;
+}
+
+/*
+ * patricia_fc_get_varint
+ *
+ * Read a varint at *p and move *p past it
+ */
+static inline uint32_t
+patricia_fc_get_varint (const char **p)
+{
+    uint32_t v = 0, shift = 0;
+    uint8_t c;
+
+    do {
+        c = (uint8_t)*(*p)++;
+        v |= (uint32_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return v;
+}
+
+/*
+ * patricia_fc_common
+ *
+ * Number of leading bytes a and b have in common
+ */
+static inline uint32_t
+patricia_fc_common (const char *a, uint32_t alen, const char *b,
+                    uint32_t blen)
+{
+    uint32_t i, n = (alen < blen) ? alen : blen;
+
+    for (i = 0; i < n && a[i] == b[i]; i++);
+
+    return i;
+}
+
+/*
+ * patricia_fc_block_keys
+ *
+ * Number of keys in block b
+ */
+static inline uint32_t
+patricia_fc_block_keys (patricia_fc_t *fc, uint32_t b)
+{
+    uint32_t left = fc->key_count - b * PATRICIA_FC_BLOCK_KEYS;
+
+    return (left < PATRICIA_FC_BLOCK_KEYS) ? left : PATRICIA_FC_BLOCK_KEYS;
+}
+
+/*
+ * patricia_fc_find_block
+ *
+ * Binary search the first keys of the blocks for the last one not greater
+ * than key. Returns 0 if key comes before every block.
+ */
+static uint32_t
+patricia_fc_find_block (patricia_fc_t *fc, const char *key, uint32_t klen)
+{
+    uint32_t lo = 0, hi = fc->block_count - 1, mid, len, m;
+    const char *p;
+
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        p = fc->data + fc->index[mid];
+        len = patricia_fc_get_varint(&p);
+        m = patricia_fc_common(p, len, key, klen);
+        if (m == len || (m < klen && (uint8_t)p[m] < (uint8_t)key[m])) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ * patricia_fc_append
+ *
+ * patricia_walk callback, front codes the next key. The walk hands the
+ * keys over in sorted order.
+ */
+static int
+patricia_fc_append (char *key, void *arg)
+{
+    patricia_fc_builder_t *b = (patricia_fc_builder_t *)arg;
+    patricia_fc_t *fc = b->fc;
+    uint32_t len, lcp, cap, *index;
+    char *data;
+
+    len = strlen(key);
+    if (fc->data_size + 2 * 5 + len > b->data_cap) {
+        cap = b->data_cap * 2 + len;
+        data = (char *)realloc(fc->data, cap);
+        if (!data) {
+            return -1;
+        }
+        fc->data = data;
+        b->data_cap = cap;
+    }
+
+    if (fc->key_count % PATRICIA_FC_BLOCK_KEYS == 0) {
+        if (fc->block_count == b->index_cap) {
+            cap = b->index_cap * 2;
+            index = (uint32_t *)realloc(fc->index, cap * sizeof(uint32_t));
+            if (!index) {
+                return -1;
+            }
+            fc->index = index;
+            b->index_cap = cap;
+        }
+        fc->index[fc->block_count++] = fc->data_size;
+        lcp = 0;
+    } else {
+        lcp = patricia_fc_common(b->prev, b->prev_len, key, len);
+        fc->data_size += patricia_fc_put_varint(fc->data + fc->data_size,
+                                                lcp);
+    }
+    fc->data_size += patricia_fc_put_varint(fc->data + fc->data_size,
+                                            len - lcp);
+    memcpy(fc->data + fc->data_size, key + lcp, len - lcp);
+    fc->data_size += len - lcp;
+
+    memcpy(b->prev + lcp, key + lcp, len - lcp);
+    b->prev_len = len;
+    if (len > fc->max_keylen) {
+        fc->max_keylen = len;
+    }
+    fc->key_count++;
+
+    return 0;
+}
+
+/*
+ * patricia_fc_leaf_bytes
+ *
+ * Recursively add up what the leaves under the given node take in the
+ * tree, the node and its label
+ */
+static void
+patricia_fc_leaf_bytes (patricia_node_t *root, uint64_t *bytes)
+{
+    patricia_node_t *child;
+
+    if (PATRICIA_IS_LEAF(root)) {
+        *bytes += sizeof(patricia_node_t) + strlen(root->key) + 1;
+        return;
+    }
+
+    child = PATRICIA_FIRST_CHILD(root);
+    while (child) {
+        patricia_fc_leaf_bytes(child, bytes);
+        child = (patricia_node_t *)list_get_next(root->children, child);
+    }
+}
+
+/*
+ * patricia_fc_print_stats
+ *
+ * Dump the stats for the given front-coded store
+ */
+void
+patricia_fc_print_stats (patricia_fc_t *fc)
+{
+#ifdef PATRICIA_STATS_ON
+    unsigned long used;
+
+    /* Sanity check */
+    if (!fc) {
+        return;
+    }
+
+    used = (unsigned long)fc->block_count * sizeof(uint32_t) + fc->data_size;
+    printf("\nTotal number of keys: %u\n", fc->key_count);
+    printf("Total number of blocks: %u\n", fc->block_count);
+    printf("Data size: %u bytes\n", fc->data_size);
+    printf("Total memory used: %lu bytes\n", used);
+    printf("Leaves in the source tree: %lu bytes\n",
+           (unsigned long)fc->node_bytes);
+    if (used) {
+        printf("Reduction factor: %.2f\n", (double)fc->node_bytes / used);
+    }
+    printf("\n");
+#endif
+}
+
+/*
+ * patricia_fc_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 otherwise.
+ */
+int
+patricia_fc_lookup (patricia_fc_t *fc, const char *key)
+{
+    uint32_t klen, b, n, i, len, lcp, m, j;
+    const char *p, *s;
+
+    /* Sanity check */
+    if (!fc || !key || fc->key_count == 0) {
+        return 0;
+    }
+
+    klen = strlen(key);
+    b = patricia_fc_find_block(fc, key, klen);
+    n = patricia_fc_block_keys(fc, b);
+
+    /* m bytes of the key match the last key passed, which is smaller */
+    p = fc->data + fc->index[b];
+    len = patricia_fc_get_varint(&p);
+    m = patricia_fc_common(p, len, key, klen);
+    if (m == len && m == klen) {
+        return 1;
+    }
+    if (m < len && (m == klen || (uint8_t)p[m] > (uint8_t)key[m])) {
+        return 0;
+    }
+    p += len;
+
+    for (i = 1; i < n; i++) {
+        lcp = patricia_fc_get_varint(&p);
+        len = patricia_fc_get_varint(&p);
+        s = p;
+        p += len;
+
+        /* Differs from the key where the last one did, still smaller */
+        if (lcp > m) {
+            continue;
+        }
+        /* Differs from the last one before the key does, greater */
+        if (lcp < m) {
+            return 0;
+        }
+
+        j = patricia_fc_common(s, len, key + m, klen - m);
+        if (j == len && j == klen - m) {
+            return 1;
+        }
+        if (j < len &&
+            (j == klen - m || (uint8_t)s[j] > (uint8_t)key[m + j])) {
+            return 0;
+        }
+        m += j;
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_fc_predictive
+ *
+ * Invoke fn for every key starting with prefix, in lexicographical order.
+ * Stops when fn returns non zero. Returns the number of keys found.
+ */
+int
+patricia_fc_predictive (patricia_fc_t *fc, const char *prefix,
+                        patricia_fc_fn fn, void *arg)
+{
+    uint32_t plen, b, n, i, len, lcp, m;
+    int count = 0;
+    const char *p;
+    char *buf;
+
+    /* Sanity check */
+    if (!fc || !prefix || !fn) {
+        return -1;
+    }
+    if (fc->key_count == 0) {
+        return 0;
+    }
+
+    buf = (char *)malloc(fc->max_keylen + 1);
+    if (!buf) {
+        return -1;
+    }
+
+    plen = strlen(prefix);
+    len = 0;
+    for (b = patricia_fc_find_block(fc, prefix, plen); b < fc->block_count;
+         b++) {
+        p = fc->data + fc->index[b];
+        n = patricia_fc_block_keys(fc, b);
+        for (i = 0; i < n; i++) {
+            lcp = (i == 0) ? 0 : patricia_fc_get_varint(&p);
+            len = patricia_fc_get_varint(&p);
+            memcpy(buf + lcp, p, len);
+            p += len;
+            len += lcp;
+            buf[len] = 0;
+
+            m = patricia_fc_common(buf, len, prefix, plen);
+            if (m == plen) {
+                count++;
+                if (fn(buf, len, arg) != 0) {
+                    goto done;
+                }
+            } else if (m == len || (uint8_t)buf[m] < (uint8_t)prefix[m]) {
+                continue;
+            } else {
+                goto done;
+            }
+        }
+    }
+
+done:
+    free(buf);
+
+    return count;
+}
+
+/*
+ * patricia_fc_save
+ *
+ * Write the store to the given file. Returns 0 upon success, -1 upon
+ * failure.
+ */
+int
+patricia_fc_save (patricia_fc_t *fc, const char *path)
+{
+    patricia_fc_header_t hdr;
+    FILE *fp;
+    int ret = 0;
+
+    /* Sanity check */
+    if (!fc || !path) {
+        return -1;
+    }
+
+    fp = fopen(path, "wb");
+    if (!fp) {
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PATRICIA_FC_MAGIC, sizeof(hdr.magic));
+    hdr.version = PATRICIA_FC_VERSION;
+    hdr.block_count = fc->block_count;
+    hdr.data_size = fc->data_size;
+    hdr.key_count = fc->key_count;
+    hdr.max_keylen = fc->max_keylen;
+    hdr.node_bytes = fc->node_bytes;
+
+    if (fwrite(&hdr, sizeof(hdr), 1, fp) != 1 ||
+        fwrite(fc->index, sizeof(uint32_t), fc->block_count, fp) !=
+        fc->block_count ||
+        fwrite(fc->data, 1, fc->data_size, fp) != fc->data_size) {
+        ret = -1;
+    }
+
+    if (fclose(fp) != 0) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/*
+ * patricia_fc_read_varint
+ *
+ * Read a varint at *p like patricia_fc_get_varint, without going past end.
+ * Returns 0 upon success, -1 if the varint is cut off or too long.
+ */
+static int
+patricia_fc_read_varint (const char **p, const char *end, uint32_t *v)
+{
+    uint32_t shift = 0;
+    uint8_t c;
+
+    *v = 0;
+    do {
+        if (*p == end || shift > 28) {
+            return -1;
+        }
+        c = (uint8_t)*(*p)++;
+        *v |= (uint32_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return 0;
+}
+
+/*
+ * patricia_fc_validate
+ *
+ * Check a store read from a file before it is used. Every block has to
+ * start where the one before it ends, and every key has to decode inside
+ * its block: a shared prefix no longer than the key before it, and no key
+ * longer than max_keylen, which is the size of the buffer predictive
+ * scans rebuild keys in. Returns 0 if the store is sound, -1 otherwise.
+ */
+static int
+patricia_fc_validate (patricia_fc_t *fc)
+{
+    uint32_t b, n, i, lcp, len, prev_len, next;
+    const char *p, *end;
+
+    p = fc->data;
+    for (b = 0; b < fc->block_count; b++) {
+        next = (b + 1 < fc->block_count) ? fc->index[b + 1] : fc->data_size;
+        if (fc->index[b] != (uint32_t)(p - fc->data) ||
+            next < fc->index[b] || next > fc->data_size) {
+            return -1;
+        }
+        end = fc->data + next;
+
+        prev_len = 0;
+        n = patricia_fc_block_keys(fc, b);
+        for (i = 0; i < n; i++) {
+            lcp = 0;
+            if ((i > 0 && patricia_fc_read_varint(&p, end, &lcp) != 0) ||
+                patricia_fc_read_varint(&p, end, &len) != 0) {
+                return -1;
+            }
+            if (lcp > prev_len || len > (uint32_t)(end - p) ||
+                len > fc->max_keylen - lcp) {
+                return -1;
+            }
+            p += len;
+            prev_len = lcp + len;
+        }
+    }
+
+    return (p == fc->data + fc->data_size) ? 0 : -1;
+}
+
+/*
+ * patricia_fc_load
+ *
+ * Map a store written by patricia_fc_save. The index and the blocks point
+ * straight into the read-only mapping.
+ */
+patricia_fc_t *
+patricia_fc_load (const char *path)
+{
+    patricia_fc_header_t *hdr;
+    patricia_fc_t *fc;
+    struct stat st;
+    void *map;
+    int fd;
+
+    /* Sanity check */
+    if (!path) {
+        return NULL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(*hdr)) {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    hdr = (patricia_fc_header_t *)map;
+    if (memcmp(hdr->magic, PATRICIA_FC_MAGIC, sizeof(hdr->magic)) != 0 ||
+        hdr->version != PATRICIA_FC_VERSION ||
+        sizeof(*hdr) + (size_t)hdr->block_count * sizeof(uint32_t) +
+        hdr->data_size != (size_t)st.st_size ||
+        hdr->block_count != (hdr->key_count + PATRICIA_FC_BLOCK_KEYS - 1) /
+                            PATRICIA_FC_BLOCK_KEYS) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    fc = (patricia_fc_t *)calloc(1, sizeof(patricia_fc_t));
+    if (!fc) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    fc->block_count = hdr->block_count;
+    fc->data_size = hdr->data_size;
+    fc->key_count = hdr->key_count;
+    fc->max_keylen = hdr->max_keylen;
+    fc->node_bytes = hdr->node_bytes;
+    fc->index = (uint32_t *)(hdr + 1);
+    fc->data = (char *)(fc->index + fc->block_count);
+    fc->map = map;
+    fc->map_len = st.st_size;
+
+    if (patricia_fc_validate(fc) != 0) {
+        patricia_fc_destroy(fc);
+        return NULL;
+    }
+
+    return fc;
+}
+
+/*
+ * patricia_fc_destroy
+ *
+ * Free the given front-coded store
+ */
+int
+patricia_fc_destroy (patricia_fc_t *fc)
+{
+    /* Sanity check */
+    if (!fc) {
+        return -1;
+    }
+
+    if (fc->map) {
+        munmap(fc->map, fc->map_len);
+    } else {
+        free(fc->index);
+        free(fc->data);
+    }
+    free(fc);
+
+    return 0;
+}
+
+/*
+ * patricia_fc_build
+ *
+ * Create a front-coded store holding all the keys of the given tree
+ */
+patricia_fc_t *
+patricia_fc_build (patricia_tree_t *tree)
+{
+    patricia_fc_builder_t b;
+    patricia_fc_t *fc;
+    patricia_node_t *child;
+
+    /* Sanity check */
+    if (!tree) {
+        return NULL;
+    }
+
+    fc = (patricia_fc_t *)calloc(1, sizeof(patricia_fc_t));
+    if (!fc) {
+        return NULL;
+    }
+
+    memset(&b, 0, sizeof(b));
+    b.fc = fc;
+    b.data_cap = PATRICIA_FC_INIT_SIZE;
+    b.index_cap = PATRICIA_FC_INIT_SIZE;
+    fc->data = (char *)malloc(b.data_cap);
+    fc->index = (uint32_t *)malloc(b.index_cap * sizeof(uint32_t));
+    if (!fc->data || !fc->index ||
+        patricia_walk(tree, patricia_fc_append, &b) != 0) {
+        patricia_fc_destroy(fc);
+        return NULL;
+    }
+
+    /* The root is not a key, see patricia_walk */
+    child = PATRICIA_FIRST_CHILD(tree->root);
+    while (child) {
+        patricia_fc_leaf_bytes(child, &fc->node_bytes);
+        child = (patricia_node_t *)list_get_next(tree->root->children, child);
+    }
+
+    return fc;
+}
+
+/* End of File */
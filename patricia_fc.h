@@ -0,0 +1,65 @@
+/*
+ * patricia_fc.h - Header file for the front-coded frozen key store
+ *
+ * A frozen, read-only copy of the keys of a patricia tree, sorted and
+ * packed into small front-coded blocks with an index of block offsets.
+ */
+
+#ifndef PATRICIA_FC_H
+#define PATRICIA_FC_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_FC_MAGIC       "PTFC"
+#define PATRICIA_FC_VERSION     1
+#define PATRICIA_FC_BLOCK_KEYS  16          /* Keys per block */
+
+/* Datastructures */
+
+/*
+ * Block i starts at data[index[i]]. Its first key is stored whole, as a
+ * varint length and the bytes. Every other key is a varint count of the
+ * bytes it shares with the key before it, a varint suffix length and the
+ * suffix.
+ */
+typedef struct patricia_fc_s {
+    uint32_t    *index;
+    char        *data;
+    uint32_t    block_count;
+    uint32_t    data_size;
+    uint32_t    key_count;
+    uint32_t    max_keylen;
+    uint64_t    node_bytes;                 /* Leaves of the source tree */
+    void        *map;                       /* Set if loaded with mmap */
+    size_t      map_len;
+} patricia_fc_t;
+
+/* On disk image: header, index[block_count], data[data_size] */
+typedef struct patricia_fc_header_s {
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    block_count;
+    uint32_t    data_size;
+    uint32_t    key_count;
+    uint32_t    max_keylen;
+    uint64_t    node_bytes;
+} patricia_fc_header_t;
+
+typedef int (*patricia_fc_fn) (const char *key, int len, void *arg);
+
+/* Function Prototypes */
+
+void patricia_fc_print_stats (patricia_fc_t *fc);
+int patricia_fc_lookup (patricia_fc_t *fc, const char *key);
+int patricia_fc_predictive (patricia_fc_t *fc, const char *prefix,
+                            patricia_fc_fn fn, void *arg);
+int patricia_fc_save (patricia_fc_t *fc, const char *path);
+patricia_fc_t *patricia_fc_load (const char *path);
+int patricia_fc_destroy (patricia_fc_t *fc);
+patricia_fc_t *patricia_fc_build (patricia_tree_t *tree);
+
+#endif /* PATRICIA_FC_H */
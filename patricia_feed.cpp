@@ -0,0 +1,404 @@
+/*
+ * patricia_feed.c
+ *
+ * This file implements a change feed for the patricia tree. The feed sets
+ * itself as the change function of the tree, so every add and delete that
+ * succeeds is appended to a batch as a record, in the order they happened.
+ * Records are numbered implicitly: a batch carries the sequence number of
+ * its first record and the count. Full batches, or whatever is pending when
+ * patricia_feed_flush is called, are written to the file descriptor in one
+ * go, which may be a pipe, a socket or a file.
+ *
+ * A follower reads the batches with patricia_feed_read, or hands buffers it
+ * received some other way to patricia_feed_apply, and replays the records
+ * on its own tree. The sequence numbers let it check that no batch was lost
+ * or replayed twice. A follower starting from an empty tree ends up with
+ * the same keys as the producer had after the last batch applied.
+ *
+ * The batch header is in the byte order of the producer.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "patricia_feed.h"
+
+/*
+ * patricia_feed_write_all
+ *
+ * Write len bytes to fd, going on after partial writes and interrupts.
+ * Returns 0 upon success, -1 upon failure.
+ */
+static int
+patricia_feed_write_all (int fd, const char *buf, size_t len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_feed_read_all
+ *
+ * Read len bytes from fd. Returns 1 upon success, 0 if the stream ends
+ * before the first byte and -1 upon failure, including a stream ending in
+ * the middle.
+ */
+static int
+patricia_feed_read_all (int fd, char *buf, size_t len)
+{
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        n = read(fd, buf + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (n == 0) {
+            return (done == 0) ? 0 : -1;
+        }
+        done += n;
+    }
+
+    return 1;
+}
+
+/*
+ * patricia_feed_append
+ *
+ * Change function set on the tree. Appends a record for the change and
+ * writes the batch out once it is full. A failure is remembered in err and
+ * stops the feed, since a follower can not skip a record.
+ */
+static void
+patricia_feed_append (int op, char *key, void *arg)
+{
+    patricia_feed_t *feed = (patricia_feed_t *)arg;
+    size_t klen, need, cap;
+    char *buf, *p;
+
+    if (feed->err) {
+        return;
+    }
+
+    klen = strlen(key);
+    need = 1 + 10 + klen;                   /* A varint is at most 10 bytes */
+    if (feed->len + need > feed->cap) {
+        cap = (feed->cap * 2 > feed->len + need) ? feed->cap * 2 :
+                                                   feed->len + need;
+        buf = (char *)realloc(feed->buf, cap);
+        if (!buf) {
+            feed->err = 1;
+            return;
+        }
+        feed->buf = buf;
+        feed->cap = cap;
+    }
+
+    p = feed->buf + feed->len;
+    *p++ = (char)op;
+    do {
+        *p++ = (char)((klen & 0x7f) | ((klen >> 7) ? 0x80 : 0));
+        klen >>= 7;
+    } while (klen);
+    klen = strlen(key);
+    memcpy(p, key, klen);
+    p += klen;
+    feed->len = p - feed->buf;
+    feed->count++;
+#ifdef PATRICIA_STATS_ON
+    feed->records++;
+#endif
+
+    if (feed->len - sizeof(patricia_feed_batch_t) >= feed->batch) {
+        patricia_feed_flush(feed);
+    }
+}
+
+/*
+ * patricia_feed_print_stats
+ *
+ * Dump the stats for the given feed
+ */
+void
+patricia_feed_print_stats (patricia_feed_t *feed)
+{
+#ifdef PATRICIA_STATS_ON
+    /* Sanity check */
+    if (!feed) {
+        return;
+    }
+
+    printf("\nTotal number of records: %lu\n", feed->records);
+    printf("Total number of batches: %lu\n", feed->batches);
+    printf("Total bytes written: %lu\n", feed->bytes);
+    if (feed->records) {
+        printf("Average bytes per record: %.2f\n",
+               (double)feed->bytes / feed->records);
+    }
+    printf("Next sequence number: %lu\n\n", (unsigned long)feed->seq);
+#endif
+}
+
+/*
+ * patricia_feed_read
+ *
+ * Read one batch from fd and apply it to the tree, as patricia_feed_apply
+ * does. Returns the number of records applied, 0 at the end of the stream
+ * and -1 upon failure.
+ */
+int
+patricia_feed_read (patricia_tree_t *tree, int fd, uint64_t *seq)
+{
+    patricia_feed_batch_t hdr;
+    char *buf;
+    int ret;
+
+    /* Sanity check */
+    if (!tree || fd < 0 || !seq) {
+        return -1;
+    }
+
+    ret = patricia_feed_read_all(fd, (char *)&hdr, sizeof(hdr));
+    if (ret <= 0) {
+        return ret;
+    }
+    if (hdr.magic != PATRICIA_FEED_MAGIC) {
+        return -1;
+    }
+
+    buf = (char *)malloc(sizeof(hdr) + hdr.len);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(buf, &hdr, sizeof(hdr));
+    if (patricia_feed_read_all(fd, buf + sizeof(hdr), hdr.len) != 1 ||
+        patricia_feed_apply(tree, buf, sizeof(hdr) + hdr.len, seq) < 0) {
+        free(buf);
+        return -1;
+    }
+    free(buf);
+
+    return hdr.count;
+}
+
+/*
+ * patricia_feed_apply
+ *
+ * Replay the complete batches at the start of buf on the tree. *seq holds
+ * the sequence number expected next, or 0 to take the first batch as it
+ * comes, and is moved past the records applied. Returns the number of
+ * bytes used, which leaves out a partial batch at the end, or -1 if the
+ * data is corrupt, a batch is out of sequence or a change fails.
+ */
+long
+patricia_feed_apply (patricia_tree_t *tree, const char *buf, size_t len,
+                     uint64_t *seq)
+{
+    patricia_feed_batch_t hdr;
+    const char *p, *end;
+    size_t pos, klen;
+    uint32_t i, shift;
+    char *key;
+    int op, ret;
+
+    /* Sanity check */
+    if (!tree || !buf || !seq) {
+        return -1;
+    }
+
+    pos = 0;
+    while (len - pos >= sizeof(hdr)) {
+        memcpy(&hdr, buf + pos, sizeof(hdr));
+        if (hdr.magic != PATRICIA_FEED_MAGIC) {
+            return -1;
+        }
+        if (len - pos - sizeof(hdr) < hdr.len) {
+            break;
+        }
+        if (*seq != 0 && hdr.seq != *seq) {
+            return -1;
+        }
+
+        /* A key is never longer than the batch */
+        key = (char *)malloc(hdr.len + 1);
+        if (!key) {
+            return -1;
+        }
+
+        p = buf + pos + sizeof(hdr);
+        end = p + hdr.len;
+        ret = 0;
+        for (i = 0; i < hdr.count && ret == 0; i++) {
+            if (p == end) {
+                ret = -1;
+                break;
+            }
+            op = (uint8_t)*p++;
+            klen = 0;
+            shift = 0;
+            do {
+                if (p == end || shift > 63) {
+                    ret = -1;
+                    break;
+                }
+                klen |= (size_t)(*p & 0x7f) << shift;
+                shift += 7;
+            } while (*p++ & 0x80);
+            if (ret != 0 || klen > (size_t)(end - p)) {
+                ret = -1;
+                break;
+            }
+            memcpy(key, p, klen);
+            key[klen] = 0;
+            p += klen;
+
+            if (op == PATRICIA_CHANGE_ADD) {
+                ret = patricia_add(tree, key);
+            } else if (op == PATRICIA_CHANGE_DELETE) {
+                ret = patricia_delete(tree, key);
+            } else {
+                ret = -1;
+            }
+        }
+        free(key);
+        if (ret != 0 || p != end) {
+            return -1;
+        }
+
+        *seq = hdr.seq + hdr.count;
+        pos += sizeof(hdr) + hdr.len;
+    }
+
+    return pos;
+}
+
+/*
+ * patricia_feed_flush
+ *
+ * Write out the pending records as a batch. Returns 0 upon success, -1
+ * upon failure or if an earlier append or flush failed.
+ */
+int
+patricia_feed_flush (patricia_feed_t *feed)
+{
+    patricia_feed_batch_t hdr;
+
+    /* Sanity check */
+    if (!feed) {
+        return -1;
+    }
+
+    if (feed->err) {
+        return -1;
+    }
+    if (feed->count == 0) {
+        return 0;
+    }
+
+    hdr.magic = PATRICIA_FEED_MAGIC;
+    hdr.count = feed->count;
+    hdr.seq = feed->seq;
+    hdr.len = feed->len - sizeof(hdr);
+    memcpy(feed->buf, &hdr, sizeof(hdr));
+
+    if (patricia_feed_write_all(feed->fd, feed->buf, feed->len) != 0) {
+        feed->err = 1;
+        return -1;
+    }
+
+#ifdef PATRICIA_STATS_ON
+    feed->batches++;
+    feed->bytes += feed->len;
+#endif
+    feed->seq += feed->count;
+    feed->count = 0;
+    feed->len = sizeof(hdr);
+
+    return 0;
+}
+
+/*
+ * patricia_feed_destroy
+ *
+ * Write out the pending records, detach the feed from its tree and free
+ * it. The file descriptor is left open. Returns the result of the last
+ * flush.
+ */
+int
+patricia_feed_destroy (patricia_feed_t *feed)
+{
+    int ret;
+
+    /* Sanity check */
+    if (!feed) {
+        return -1;
+    }
+
+    ret = patricia_feed_flush(feed);
+    patricia_set_change_fn(feed->tree, NULL, NULL);
+    free(feed->buf);
+    free(feed);
+
+    return ret;
+}
+
+/*
+ * patricia_feed_init
+ *
+ * Start reporting the changes on the given tree to fd, in batches of about
+ * batch bytes, PATRICIA_FEED_DEFAULT_BATCH if batch is 0. Records are
+ * numbered from 1. The tree must not have a change function already.
+ */
+patricia_feed_t *
+patricia_feed_init (patricia_tree_t *tree, int fd, size_t batch)
+{
+    patricia_feed_t *feed;
+
+    /* Sanity check */
+    if (!tree || fd < 0 || tree->change_fn) {
+        return NULL;
+    }
+
+    feed = (patricia_feed_t *)calloc(1, sizeof(patricia_feed_t));
+    if (!feed) {
+        return NULL;
+    }
+    feed->tree = tree;
+    feed->fd = fd;
+    feed->seq = 1;
+    feed->batch = batch ? batch : PATRICIA_FEED_DEFAULT_BATCH;
+    feed->len = sizeof(patricia_feed_batch_t);
+    feed->cap = feed->len + 1024;
+    feed->buf = (char *)malloc(feed->cap);
+    if (!feed->buf) {
+        free(feed);
+        return NULL;
+    }
+
+    patricia_set_change_fn(tree, patricia_feed_append, feed);
+
+    return feed;
+}
+
+/* End of File */
@@ -0,0 +1,62 @@
+/*
+ * patricia_feed.h - Header file for the patricia tree change feed
+ *
+ * A feed turns the adds and deletes done on a tree into a stream of
+ * numbered binary records, written in batches to a file descriptor. A
+ * follower reads the stream and replays it on its own tree.
+ */
+
+#ifndef PATRICIA_FEED_H
+#define PATRICIA_FEED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_FEED_MAGIC         0x44465450  /* "PTFD" */
+#define PATRICIA_FEED_DEFAULT_BATCH 65536       /* Bytes of records */
+
+/* Datastructures */
+
+/*
+ * Header of a batch. It is followed by len bytes holding count records,
+ * numbered from seq on. A record is the operation byte, the length of the
+ * key as a varint and the key, without its terminating NUL.
+ */
+typedef struct patricia_feed_batch_s {
+    uint32_t    magic;
+    uint32_t    count;
+    uint64_t    seq;
+    uint64_t    len;
+} patricia_feed_batch_t;
+
+/* Producer side, attached to the tree it reports on */
+typedef struct patricia_feed_s {
+    patricia_tree_t *tree;
+    int             fd;
+    int             err;                /* Set by a failed append */
+    uint64_t        seq;                /* Of the next record */
+    uint32_t        count;              /* Records pending */
+    size_t          batch;
+    char            *buf;               /* Batch header, then records */
+    size_t          len;
+    size_t          cap;
+    unsigned long   records;
+    unsigned long   batches;
+    unsigned long   bytes;
+} patricia_feed_t;
+
+/* Function Prototypes */
+
+void patricia_feed_print_stats (patricia_feed_t *feed);
+int patricia_feed_read (patricia_tree_t *tree, int fd, uint64_t *seq);
+long patricia_feed_apply (patricia_tree_t *tree, const char *buf, size_t len,
+                          uint64_t *seq);
+int patricia_feed_flush (patricia_feed_t *feed);
+int patricia_feed_destroy (patricia_feed_t *feed);
+patricia_feed_t *patricia_feed_init (patricia_tree_t *tree, int fd,
+                                     size_t batch);
+
+#endif /* PATRICIA_FEED_H */
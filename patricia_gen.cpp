@@ -0,0 +1,508 @@
+/*
+ * patricia_gen.c
+ *
+ * Code generator for static key sets. Reads a file with one key per line,
+ * builds the patricia tree with patricia_add and writes out a C++ source
+ * file containing the tree as constant arrays along with a lookup and a
+ * prefix enumeration function specialized for it. The arrays end up in
+ * .rodata, so the set costs nothing to load and its pages are shared by all
+ * the processes mapping the binary.
+ *
+ * Usage: patricia_gen <keyfile> <name> [<output.cpp>]
+ *
+ * The generated file defines
+ *
+ *     int <name>_lookup (const char *key);
+ *     int <name>_lookup_prefix (const char *prefix,
+ *                               void (*fn) (const char *key, void *arg),
+ *                               void *arg);
+ *
+ * <name>_lookup has the semantics of patricia_lookup. <name>_lookup_prefix
+ * invokes fn for every leaf key starting with prefix in lexicographical
+ * order, like patricia_lookup_prefix_full, and returns the number of keys
+ * found. Unlike patricia_lookup_prefix_full the prefix may end in the middle
+ * of a node's label.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_GEN_LINE_MAX   4096
+#define PATRICIA_GEN_LABEL_COLS 64          /* Label bytes per output line */
+
+/*
+ * Datastructures
+ *
+ * The nodes are numbered in breadth first order, so that the children of a
+ * node are contiguous in the generated array
+ */
+typedef struct patricia_gen_node_s {
+    patricia_node_t *node;
+    uint32_t        label;
+    uint32_t        first_child;
+    uint32_t        nchildren;
+} patricia_gen_node_t;
+
+typedef struct patricia_gen_s {
+    patricia_gen_node_t *nodes;
+    uint32_t            node_count;
+    uint32_t            label_size;
+    uint32_t            max_keylen;
+} patricia_gen_t;
+
+/*
+ * patricia_gen_count_nodes
+ *
+ * Recursively count the nodes under the given node, including itself, and
+ * the length of the longest key
+ */
+static uint32_t
+patricia_gen_count_nodes (patricia_node_t *node, uint32_t depth,
+                          uint32_t *max_keylen)
+{
+    patricia_node_t *child, *next_child;
+    uint32_t count = 1;
+
+    depth += strlen(node->key);
+    if (depth > *max_keylen) {
+        *max_keylen = depth;
+    }
+
+    child = PATRICIA_FIRST_CHILD(node);
+    while (child) {
+        next_child = (patricia_node_t *)list_get_next(node->children, child);
+        count += patricia_gen_count_nodes(child, depth, max_keylen);
+        child = next_child;
+    }
+
+    return count;
+}
+
+/*
+ * patricia_gen_layout
+ *
+ * Number the nodes of the tree in breadth first order and assign the label
+ * offsets
+ */
+static int
+patricia_gen_layout (patricia_tree_t *tree, patricia_gen_t *gen)
+{
+    patricia_node_t *child, *next_child;
+    patricia_gen_node_t *cur;
+    uint32_t head, tail;
+
+    gen->max_keylen = 0;
+    gen->node_count = patricia_gen_count_nodes(tree->root, 0,
+                                               &gen->max_keylen);
+    gen->nodes = (patricia_gen_node_t *)calloc(gen->node_count,
+                                               sizeof(patricia_gen_node_t));
+    if (!gen->nodes) {
+        return -1;
+    }
+
+    gen->label_size = 0;
+    gen->nodes[0].node = tree->root;
+    head = 0;
+    tail = 1;
+
+    while (head < tail) {
+        cur = &gen->nodes[head++];
+        cur->label = gen->label_size;
+        gen->label_size += strlen(cur->node->key);
+
+        cur->first_child = tail;
+        child = PATRICIA_FIRST_CHILD(cur->node);
+        while (child) {
+            next_child = (patricia_node_t *)list_get_next(cur->node->children,
+                                                          child);
+            gen->nodes[tail++].node = child;
+            cur->nchildren++;
+            child = next_child;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_gen_emit_labels
+ *
+ * Write all the labels as one string literal. Every byte is octal escaped
+ * unless it is a plain printable character.
+ */
+static void
+patricia_gen_emit_labels (FILE *out, const char *name, patricia_gen_t *gen)
+{
+    uint32_t i, col = 0;
+    unsigned char *p;
+
+    fprintf(out, "static const char %s_labels[%u] =\n    \"", name,
+            gen->label_size + 1);
+
+    for (i = 0; i < gen->node_count; i++) {
+        for (p = (unsigned char *)gen->nodes[i].node->key; *p; p++) {
+            if (col == PATRICIA_GEN_LABEL_COLS) {
+                fprintf(out, "\"\n    \"");
+                col = 0;
+            }
+            if (*p >= 0x20 && *p < 0x7f && *p != '"' && *p != '\\' &&
+                *p != '?') {
+                fputc(*p, out);
+            } else {
+                fprintf(out, "\\%03o", *p);
+            }
+            col++;
+        }
+    }
+
+    fprintf(out, "\";\n\n");
+}
+
+/*
+ * patricia_gen_emit_nodes
+ *
+ * Write the node array
+ */
+static void
+patricia_gen_emit_nodes (FILE *out, const char *name, patricia_gen_t *gen)
+{
+    patricia_gen_node_t *cur;
+    uint32_t i;
+
+    fprintf(out, "static const %s_node_t %s_nodes[%u] = {\n", name, name,
+            gen->node_count);
+
+    for (i = 0; i < gen->node_count; i++) {
+        cur = &gen->nodes[i];
+        fprintf(out, "    { %u, %u, %u, %u },\n", cur->label,
+                (unsigned)strlen(cur->node->key), cur->first_child,
+                cur->nchildren);
+    }
+
+    fprintf(out, "};\n\n");
+}
+
+/*
+ * patricia_gen_emit_code
+ *
+ * Write the lookup routines. They only depend on the name of the set.
+ */
+static void
+patricia_gen_emit_code (FILE *out, const char *name, patricia_gen_t *gen)
+{
+    fprintf(out,
+"/*\n"
+" * %s_find_child\n"
+" *\n"
+" * Binary search the children of node for the one starting with c\n"
+" */\n"
+"static int32_t\n"
+"%s_find_child (uint32_t node, unsigned char c)\n"
+"{\n"
+"    uint32_t lo, hi, mid;\n"
+"    unsigned char first;\n"
+"\n"
+"    lo = %s_nodes[node].first_child;\n"
+"    hi = lo + %s_nodes[node].nchildren;\n"
+"    while (lo < hi) {\n"
+"        mid = lo + (hi - lo) / 2;\n"
+"        first = (unsigned char)%s_labels[%s_nodes[mid].label];\n"
+"        if (first == c) {\n"
+"            return (int32_t)mid;\n"
+"        } else if (first < c) {\n"
+"            lo = mid + 1;\n"
+"        } else {\n"
+"            hi = mid;\n"
+"        }\n"
+"    }\n"
+"\n"
+"    return -1;\n"
+"}\n\n",
+            name, name, name, name, name, name);
+
+    fprintf(out,
+"/*\n"
+" * %s_lookup\n"
+" *\n"
+" * Returns 1 if key is in the set, 0 otherwise\n"
+" */\n"
+"int\n"
+"%s_lookup (const char *key)\n"
+"{\n"
+"    int32_t node = 0;\n"
+"    uint32_t len;\n"
+"\n"
+"    if (!key || !*key) {\n"
+"        return 0;\n"
+"    }\n"
+"\n"
+"    while (*key) {\n"
+"        node = %s_find_child((uint32_t)node, (unsigned char)*key);\n"
+"        if (node < 0) {\n"
+"            return 0;\n"
+"        }\n"
+"        len = %s_nodes[node].label_len;\n"
+"        if (strncmp(key, &%s_labels[%s_nodes[node].label], len) != 0) {\n"
+"            return 0;\n"
+"        }\n"
+"        key += len;\n"
+"    }\n"
+"\n"
+"    return 1;\n"
+"}\n\n",
+            name, name, name, name, name, name);
+
+    fprintf(out,
+"/*\n"
+" * %s_walk\n"
+" *\n"
+" * Recursively invoke fn on all the keys under node. buf holds the key\n"
+" * of the parent, len bytes long.\n"
+" */\n"
+"static int\n"
+"%s_walk (uint32_t node, char *buf, uint32_t len,\n"
+"         void (*fn) (const char *key, void *arg), void *arg)\n"
+"{\n"
+"    uint32_t i, end;\n"
+"    int count = 0;\n"
+"\n"
+"    memcpy(buf + len, &%s_labels[%s_nodes[node].label],\n"
+"           %s_nodes[node].label_len);\n"
+"    len += %s_nodes[node].label_len;\n"
+"\n"
+"    if (%s_nodes[node].nchildren == 0) {\n"
+"        buf[len] = 0;\n"
+"        fn(buf, arg);\n"
+"        return 1;\n"
+"    }\n"
+"\n"
+"    end = %s_nodes[node].first_child + %s_nodes[node].nchildren;\n"
+"    for (i = %s_nodes[node].first_child; i < end; i++) {\n"
+"        count += %s_walk(i, buf, len, fn, arg);\n"
+"    }\n"
+"\n"
+"    return count;\n"
+"}\n\n",
+            name, name, name, name, name, name, name, name, name, name, name);
+
+    fprintf(out,
+"/*\n"
+" * %s_lookup_prefix\n"
+" *\n"
+" * Invoke fn on every key starting with prefix, in lexicographical order.\n"
+" * Returns the number of keys found.\n"
+" */\n"
+"int\n"
+"%s_lookup_prefix (const char *prefix,\n"
+"                  void (*fn) (const char *key, void *arg), void *arg)\n"
+"{\n"
+"    char buf[%u];\n"
+"    const char *p = prefix, *base = prefix;\n"
+"    int32_t node = 0;\n"
+"    uint32_t len, i;\n"
+"\n"
+"    if (!prefix || !fn) {\n"
+"        return -1;\n"
+"    }\n"
+"\n"
+"    /* The prefix may end in the middle of a label */\n"
+"    while (*p) {\n"
+"        node = %s_find_child((uint32_t)node, (unsigned char)*p);\n"
+"        if (node < 0) {\n"
+"            return 0;\n"
+"        }\n"
+"        base = p;\n"
+"        len = %s_nodes[node].label_len;\n"
+"        for (i = 0; i < len && p[i]; i++) {\n"
+"            if (p[i] != %s_labels[%s_nodes[node].label + i]) {\n"
+"                return 0;\n"
+"            }\n"
+"        }\n"
+"        if (i < len) {\n"
+"            break;\n"
+"        }\n"
+"        p += len;\n"
+"    }\n"
+"\n"
+"    if (node == 0 && %s_nodes[0].nchildren == 0) {\n"
+"        return 0;\n"
+"    }\n"
+"\n"
+"    /* Rebuild the key of the parent of node in buf */\n"
+"    len = (uint32_t)(base - prefix);\n"
+"    memcpy(buf, prefix, len);\n"
+"\n"
+"    return %s_walk((uint32_t)node, buf, len, fn, arg);\n"
+"}\n",
+            name, name, gen->max_keylen + 1, name, name, name, name, name,
+            name);
+}
+
+/*
+ * patricia_gen_emit
+ *
+ * Write the complete source file for the given tree
+ */
+static int
+patricia_gen_emit (FILE *out, const char *name, patricia_tree_t *tree)
+{
+    patricia_gen_t gen;
+
+    if (patricia_gen_layout(tree, &gen) != 0) {
+        return -1;
+    }
+
+    fprintf(out,
+"/*\n"
+" * %s - Generated by patricia_gen. Do not edit.\n"
+" *\n"
+" * %u nodes, %u label bytes\n"
+" */\n"
+"\n"
+"#include <stdint.h>\n"
+"#include <string.h>\n"
+"\n"
+"typedef struct %s_node_s {\n"
+"    uint32_t    label;\n"
+"    uint32_t    label_len;\n"
+"    uint32_t    first_child;\n"
+"    uint32_t    nchildren;\n"
+"} %s_node_t;\n"
+"\n",
+            name, gen.node_count, gen.label_size, name, name);
+
+    patricia_gen_emit_labels(out, name, &gen);
+    patricia_gen_emit_nodes(out, name, &gen);
+    patricia_gen_emit_code(out, name, &gen);
+
+    fprintf(out, "\n/* End of File */\n");
+    free(gen.nodes);
+
+    return ferror(out) ? -1 : 0;
+}
+
+/*
+ * patricia_gen_load
+ *
+ * Add all the keys of the given file to the tree
+ */
+static int
+patricia_gen_load (patricia_tree_t *tree, FILE *in)
+{
+    char line[PATRICIA_GEN_LINE_MAX];
+    int len;
+
+    while (fgets(line, sizeof(line), in)) {
+        len = strlen(line);
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = 0;
+        }
+        if (len == 0) {
+            continue;
+        }
+        if (patricia_add(tree, line) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_gen_valid_name
+ *
+ * The name ends up in C identifiers, check that it is one
+ */
+static int
+patricia_gen_valid_name (const char *name)
+{
+    const char *p;
+
+    if (!((*name >= 'A' && *name <= 'Z') || (*name >= 'a' && *name <= 'z') ||
+          *name == '_')) {
+        return 0;
+    }
+
+    for (p = name + 1; *p; p++) {
+        if (!((*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') ||
+              (*p >= '0' && *p <= '9') || *p == '_')) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+int
+main (int argc, char **argv)
+{
+    patricia_tree_t *tree;
+    FILE *in, *out = stdout;
+    int ret;
+
+    if (argc < 3 || argc > 4) {
+        fprintf(stderr, "Usage: %s <keyfile> <name> [<output.cpp>]\n",
+                argv[0]);
+        return 1;
+    }
+
+    if (!patricia_gen_valid_name(argv[2])) {
+        fprintf(stderr, "%s: not a valid C identifier\n", argv[2]);
+        return 1;
+    }
+
+    in = fopen(argv[1], "r");
+    if (!in) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    tree = patricia_init();
+    if (!tree) {
+        fclose(in);
+        return 1;
+    }
+
+    ret = patricia_gen_load(tree, in);
+    fclose(in);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to build the tree\n");
+        patricia_destroy(tree);
+        return 1;
+    }
+
+    if (argc == 4) {
+        out = fopen(argv[3], "w");
+        if (!out) {
+            perror(argv[3]);
+            patricia_destroy(tree);
+            return 1;
+        }
+    }
+
+    ret = patricia_gen_emit(out, argv[2], tree);
+    patricia_destroy(tree);
+
+    /* A write error may only show up when the buffer is flushed */
+    if (out != stdout) {
+        if (fclose(out) != 0) {
+            perror(argv[3]);
+            ret = -1;
+        }
+        if (ret != 0) {
+            remove(argv[3]);
+        }
+    } else if (fflush(out) != 0) {
+        perror("stdout");
+        ret = -1;
+    }
+
+    return (ret == 0) ? 0 : 1;
+}
+
+/* End of File */
@@ -0,0 +1,704 @@
+/*
+ * patricia_hat.c
+ *
+ * This file implements a burst trie in the style of the HAT-trie. Deep
+ * subtrees with only a few keys each would otherwise turn into long chains
+ * of tiny nodes. Here they are stored as buckets: one contiguous, sorted
+ * array of key suffixes, scanned linearly, which touches a few cache lines
+ * instead of chasing a pointer per node. Once a bucket holds more than
+ * tree->burst suffixes it bursts into a trie node whose children are new
+ * buckets, split by the first byte of the suffixes.
+ *
+ * A node only keeps the bytes that occur below it, in a sorted array next
+ * to an array of children, instead of a 256 entry table. Burst nodes deep
+ * in the trie have few children, so this keeps them at a few dozen bytes
+ * rather than 2 KB, and the byte is found with one memchr.
+ *
+ * Since the buckets and the bytes of the trie nodes are kept sorted, prefix
+ * enumeration still returns the keys in lexicographical order.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "patricia_hat.h"
+
+#define PATRICIA_HAT_LEN_SIZE   sizeof(uint16_t)
+
+/*
+ * patricia_hat_entry_len
+ *
+ * Length of the suffix stored at data
+ */
+static inline uint32_t
+patricia_hat_entry_len (const char *data)
+{
+    uint16_t len;
+
+    memcpy(&len, data, sizeof(len));
+    return len;
+}
+
+/*
+ * patricia_hat_compare
+ *
+ * Compare two byte strings the way strcmp would
+ */
+static inline int
+patricia_hat_compare (const char *a, uint32_t alen, const char *b,
+                      uint32_t blen)
+{
+    int ret;
+
+    ret = memcmp(a, b, alen < blen ? alen : blen);
+    if (ret != 0) {
+        return ret;
+    }
+
+    return (alen > blen) - (alen < blen);
+}
+
+/*
+ * patricia_hat_bucket_init
+ *
+ * Create an empty bucket with room for cap bytes of suffixes
+ */
+static patricia_hat_bucket_t *
+patricia_hat_bucket_init (patricia_hat_tree_t *tree, uint32_t cap)
+{
+    patricia_hat_bucket_t *bucket;
+
+    bucket = (patricia_hat_bucket_t *)malloc(
+                 offsetof(patricia_hat_bucket_t, data) + cap);
+    if (!bucket) {
+        return NULL;
+    }
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem += offsetof(patricia_hat_bucket_t, data) + cap;
+    tree->total_buckets++;
+#endif
+
+    bucket->type = PATRICIA_HAT_BUCKET;
+    bucket->count = 0;
+    bucket->size = 0;
+    bucket->cap = cap;
+
+    return bucket;
+}
+
+/*
+ * patricia_hat_bucket_free
+ *
+ * Free a bucket
+ */
+static void
+patricia_hat_bucket_free (patricia_hat_tree_t *tree,
+                          patricia_hat_bucket_t *bucket)
+{
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem -= offsetof(patricia_hat_bucket_t, data) + bucket->cap;
+    tree->total_buckets--;
+#endif
+    free(bucket);
+}
+
+/*
+ * patricia_hat_bucket_find
+ *
+ * Look for key in the bucket. Returns 1 if found. pos is set to the offset
+ * of the key, or of the first suffix greater than the key.
+ */
+static int
+patricia_hat_bucket_find (patricia_hat_bucket_t *bucket, const char *key,
+                          uint32_t keylen, uint32_t *pos)
+{
+    uint32_t off = 0, len;
+    int cmp;
+
+    while (off < bucket->size) {
+        len = patricia_hat_entry_len(bucket->data + off);
+        cmp = patricia_hat_compare(bucket->data + off + PATRICIA_HAT_LEN_SIZE,
+                                   len, key, keylen);
+        if (cmp >= 0) {
+            *pos = off;
+            return cmp == 0;
+        }
+        off += PATRICIA_HAT_LEN_SIZE + len;
+    }
+
+    *pos = off;
+    return 0;
+}
+
+/*
+ * patricia_hat_bucket_insert
+ *
+ * Insert key at offset pos of the bucket referenced by slot. The bucket may
+ * move, slot is updated.
+ */
+static int
+patricia_hat_bucket_insert (patricia_hat_tree_t *tree, void **slot,
+                            uint32_t pos, const char *key, uint32_t keylen)
+{
+    patricia_hat_bucket_t *bucket = (patricia_hat_bucket_t *)*slot;
+    uint32_t need = PATRICIA_HAT_LEN_SIZE + keylen, cap;
+    uint16_t len = (uint16_t)keylen;
+
+    if (bucket->size + need > bucket->cap) {
+        cap = bucket->cap * 2;
+        while (bucket->size + need > cap) {
+            cap *= 2;
+        }
+        bucket = (patricia_hat_bucket_t *)realloc(bucket,
+                     offsetof(patricia_hat_bucket_t, data) + cap);
+        if (!bucket) {
+            return -1;
+        }
+#ifdef PATRICIA_STATS_ON
+        tree->total_mem += cap - bucket->cap;
+#endif
+        bucket->cap = cap;
+        *slot = bucket;
+    }
+
+    memmove(bucket->data + pos + need, bucket->data + pos,
+            bucket->size - pos);
+    memcpy(bucket->data + pos, &len, sizeof(len));
+    memcpy(bucket->data + pos + PATRICIA_HAT_LEN_SIZE, key, keylen);
+    bucket->size += need;
+    bucket->count++;
+
+    return 0;
+}
+
+/*
+ * patricia_hat_child
+ *
+ * Return the slot of the child of node for byte c, or NULL if there is none
+ */
+static inline void **
+patricia_hat_child (patricia_hat_node_t *node, uint8_t c)
+{
+    const uint8_t *b;
+
+    if (!node->count) {
+        return NULL;
+    }
+    b = (const uint8_t *)memchr(node->bytes, c, node->count);
+    return b ? &node->child[b - node->bytes] : NULL;
+}
+
+/*
+ * patricia_hat_add_child
+ *
+ * Insert child for byte c, which node does not have yet, keeping the bytes
+ * sorted. Returns the slot of the child, or NULL upon failure, in which
+ * case node is unchanged.
+ */
+static void **
+patricia_hat_add_child (patricia_hat_tree_t *tree, patricia_hat_node_t *node,
+                        uint8_t c, void *child)
+{
+    uint8_t *bytes;
+    void **children;
+    uint32_t i, cap;
+
+    if (node->count == node->cap) {
+        cap = node->cap ? node->cap * 2 : PATRICIA_HAT_INIT_CHILDREN;
+        bytes = (uint8_t *)realloc(node->bytes, cap);
+        if (!bytes) {
+            return NULL;
+        }
+        node->bytes = bytes;
+        children = (void **)realloc(node->child, cap * sizeof(void *));
+        if (!children) {
+            return NULL;
+        }
+        node->child = children;
+#ifdef PATRICIA_STATS_ON
+        tree->total_mem += (cap - node->cap) * (1 + sizeof(void *));
+#endif
+        node->cap = cap;
+    }
+
+    for (i = node->count; i > 0 && node->bytes[i - 1] > c; i--) {
+        node->bytes[i] = node->bytes[i - 1];
+        node->child[i] = node->child[i - 1];
+    }
+    node->bytes[i] = c;
+    node->child[i] = child;
+    node->count++;
+
+    return &node->child[i];
+}
+
+/*
+ * patricia_hat_remove_child
+ *
+ * Remove the child at the given slot of node
+ */
+static void
+patricia_hat_remove_child (patricia_hat_node_t *node, void **slot)
+{
+    uint32_t i = slot - node->child;
+
+    memmove(&node->bytes[i], &node->bytes[i + 1], node->count - i - 1);
+    memmove(&node->child[i], &node->child[i + 1],
+            (node->count - i - 1) * sizeof(void *));
+    node->count--;
+}
+
+/*
+ * patricia_hat_destroy_internal
+ *
+ * Recursively free everything under p
+ */
+static void
+patricia_hat_destroy_internal (patricia_hat_tree_t *tree, void *p)
+{
+    patricia_hat_node_t *node;
+    uint32_t i;
+
+    if (*(uint8_t *)p == PATRICIA_HAT_BUCKET) {
+        patricia_hat_bucket_free(tree, (patricia_hat_bucket_t *)p);
+        return;
+    }
+
+    node = (patricia_hat_node_t *)p;
+    for (i = 0; i < node->count; i++) {
+        patricia_hat_destroy_internal(tree, node->child[i]);
+    }
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem -= sizeof(patricia_hat_node_t) +
+                       node->cap * (1 + sizeof(void *));
+    tree->total_nodes--;
+#endif
+    free(node->bytes);
+    free(node->child);
+    free(node);
+}
+
+/*
+ * patricia_hat_burst
+ *
+ * Replace the bucket referenced by slot with a trie node. Every suffix moves
+ * to the bucket of its first byte, minus that byte. The suffixes are
+ * visited in order, so appending keeps the new buckets sorted, and the
+ * children are added in the order of their bytes. The node is
+ * complete before it replaces the bucket, so upon failure the bucket is
+ * left as it was and still valid, only larger than tree->burst. Returns 0
+ * upon success, -1 upon failure.
+ */
+static int
+patricia_hat_burst (patricia_hat_tree_t *tree, void **slot)
+{
+    patricia_hat_bucket_t *bucket = (patricia_hat_bucket_t *)*slot;
+    patricia_hat_bucket_t *child;
+    patricia_hat_node_t *node;
+    uint32_t off, len, i;
+    const char *suffix;
+    void **cslot;
+    uint8_t c;
+
+    node = (patricia_hat_node_t *)calloc(1, sizeof(patricia_hat_node_t));
+    if (!node) {
+        return -1;
+    }
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem += sizeof(patricia_hat_node_t);
+    tree->total_nodes++;
+#endif
+    node->type = PATRICIA_HAT_NODE;
+
+    for (off = 0; off < bucket->size; off += PATRICIA_HAT_LEN_SIZE + len) {
+        len = patricia_hat_entry_len(bucket->data + off);
+        suffix = bucket->data + off + PATRICIA_HAT_LEN_SIZE;
+        if (len == 0) {
+            node->has_key = 1;
+            continue;
+        }
+
+        c = (uint8_t)suffix[0];
+        cslot = patricia_hat_child(node, c);
+        if (!cslot) {
+            child = patricia_hat_bucket_init(tree, PATRICIA_HAT_BUCKET_SIZE);
+            if (!child) {
+                patricia_hat_destroy_internal(tree, node);
+                return -1;
+            }
+            cslot = patricia_hat_add_child(tree, node, c, child);
+            if (!cslot) {
+                patricia_hat_bucket_free(tree, child);
+                patricia_hat_destroy_internal(tree, node);
+                return -1;
+            }
+        }
+        child = (patricia_hat_bucket_t *)*cslot;
+        if (patricia_hat_bucket_insert(tree, cslot, child->size,
+                                       suffix + 1, len - 1) != 0) {
+            patricia_hat_destroy_internal(tree, node);
+            return -1;
+        }
+    }
+
+    patricia_hat_bucket_free(tree, bucket);
+    *slot = node;
+
+    /*
+     * All the suffixes may have gone to the same child. A child that
+     * cannot burst stays a valid bucket, so this is not an error.
+     */
+    for (i = 0; i < node->count; i++) {
+        child = (patricia_hat_bucket_t *)node->child[i];
+        if (child->count > tree->burst) {
+            patricia_hat_burst(tree, &node->child[i]);
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_hat_walk
+ *
+ * Recursively invoke fn on all the keys under p. buf holds the first len
+ * bytes of the keys. Returns non zero if fn asked to stop.
+ */
+static int
+patricia_hat_walk (void *p, char *buf, uint32_t len, patricia_hat_fn fn,
+                   void *arg, int *count)
+{
+    patricia_hat_bucket_t *bucket;
+    patricia_hat_node_t *node;
+    uint32_t off, elen, i;
+
+    if (*(uint8_t *)p == PATRICIA_HAT_NODE) {
+        node = (patricia_hat_node_t *)p;
+        if (node->has_key) {
+            buf[len] = 0;
+            (*count)++;
+            if (fn(buf, arg) != 0) {
+                return 1;
+            }
+        }
+        for (i = 0; i < node->count; i++) {
+            buf[len] = (char)node->bytes[i];
+            if (patricia_hat_walk(node->child[i], buf, len + 1, fn, arg,
+                                  count) != 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    bucket = (patricia_hat_bucket_t *)p;
+    for (off = 0; off < bucket->size; off += PATRICIA_HAT_LEN_SIZE + elen) {
+        elen = patricia_hat_entry_len(bucket->data + off);
+        memcpy(buf + len, bucket->data + off + PATRICIA_HAT_LEN_SIZE, elen);
+        buf[len + elen] = 0;
+        (*count)++;
+        if (fn(buf, arg) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_hat_print_stats
+ *
+ * Dump the stats for the given tree
+ */
+void
+patricia_hat_print_stats (patricia_hat_tree_t *tree)
+{
+#ifdef PATRICIA_STATS_ON
+    printf("\nTotal number of keys: %lu\n", tree->count);
+    printf("Total number of nodes: %lu\n", tree->total_nodes);
+    printf("Total number of buckets: %lu\n", tree->total_buckets);
+    printf("Total memory used: %lu bytes\n\n", tree->total_mem);
+#endif
+}
+
+/*
+ * patricia_hat_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 otherwise.
+ */
+int
+patricia_hat_lookup (patricia_hat_tree_t *tree, const char *key)
+{
+    patricia_hat_node_t *node;
+    uint32_t pos;
+    void **slot;
+    void *p;
+
+    /* Sanity check */
+    if (!tree || !key) {
+        return 0;
+    }
+
+    p = tree->root;
+    while (*(uint8_t *)p == PATRICIA_HAT_NODE) {
+        node = (patricia_hat_node_t *)p;
+        if (!*key) {
+            return node->has_key;
+        }
+        slot = patricia_hat_child(node, (uint8_t)*key++);
+        if (!slot) {
+            return 0;
+        }
+        p = *slot;
+    }
+
+    return patricia_hat_bucket_find((patricia_hat_bucket_t *)p, key,
+                                    strlen(key), &pos);
+}
+
+/*
+ * patricia_hat_lookup_prefix
+ *
+ * Invoke fn on every key starting with prefix, in lexicographical order.
+ * Returns the number of keys found, -1 on error.
+ */
+int
+patricia_hat_lookup_prefix (patricia_hat_tree_t *tree, const char *prefix,
+                            patricia_hat_fn fn, void *arg)
+{
+    patricia_hat_bucket_t *bucket;
+    uint32_t depth = 0, rest, off, len;
+    int count = 0;
+    char *buf;
+    void **slot;
+    void *p;
+
+    /* Sanity check */
+    if (!tree || !prefix || !fn) {
+        return -1;
+    }
+
+    buf = (char *)malloc(strlen(prefix) + tree->max_keylen + 1);
+    if (!buf) {
+        return -1;
+    }
+
+    p = tree->root;
+    while (prefix[depth] && *(uint8_t *)p == PATRICIA_HAT_NODE) {
+        slot = patricia_hat_child((patricia_hat_node_t *)p,
+                                  (uint8_t)prefix[depth]);
+        if (!slot) {
+            free(buf);
+            return 0;
+        }
+        p = *slot;
+        buf[depth] = prefix[depth];
+        depth++;
+    }
+
+    if (!prefix[depth]) {
+        patricia_hat_walk(p, buf, depth, fn, arg, &count);
+        free(buf);
+        return count;
+    }
+
+    /* The rest of the prefix is matched against the sorted suffixes */
+    bucket = (patricia_hat_bucket_t *)p;
+    rest = strlen(prefix + depth);
+    patricia_hat_bucket_find(bucket, prefix + depth, rest, &off);
+    for (; off < bucket->size; off += PATRICIA_HAT_LEN_SIZE + len) {
+        len = patricia_hat_entry_len(bucket->data + off);
+        if (len < rest ||
+            memcmp(bucket->data + off + PATRICIA_HAT_LEN_SIZE,
+                   prefix + depth, rest) != 0) {
+            break;
+        }
+        memcpy(buf + depth, bucket->data + off + PATRICIA_HAT_LEN_SIZE, len);
+        buf[depth + len] = 0;
+        count++;
+        if (fn(buf, arg) != 0) {
+            break;
+        }
+    }
+
+    free(buf);
+    return count;
+}
+
+/*
+ * patricia_hat_delete
+ *
+ * Remove the given key. Returns 0 upon success, -1 if the key is not
+ * present. Buckets which become empty are freed, nodes are kept.
+ */
+int
+patricia_hat_delete (patricia_hat_tree_t *tree, const char *key)
+{
+    patricia_hat_bucket_t *bucket;
+    patricia_hat_node_t *node = NULL;
+    uint32_t keylen, pos, need;
+    void **slot;
+
+    /* Sanity check */
+    if (!tree || !key) {
+        return -1;
+    }
+
+    slot = &tree->root;
+    while (*(uint8_t *)*slot == PATRICIA_HAT_NODE) {
+        node = (patricia_hat_node_t *)*slot;
+        if (!*key) {
+            if (!node->has_key) {
+                return -1;
+            }
+            node->has_key = 0;
+            tree->count--;
+            return 0;
+        }
+        slot = patricia_hat_child(node, (uint8_t)*key++);
+        if (!slot) {
+            return -1;
+        }
+    }
+
+    bucket = (patricia_hat_bucket_t *)*slot;
+    keylen = strlen(key);
+    if (!patricia_hat_bucket_find(bucket, key, keylen, &pos)) {
+        return -1;
+    }
+
+    need = PATRICIA_HAT_LEN_SIZE + keylen;
+    memmove(bucket->data + pos, bucket->data + pos + need,
+            bucket->size - pos - need);
+    bucket->size -= need;
+    bucket->count--;
+    tree->count--;
+
+    if (bucket->count == 0 && node) {
+        patricia_hat_bucket_free(tree, bucket);
+        patricia_hat_remove_child(node, slot);
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_hat_add
+ *
+ * Add a key to the tree. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_hat_add (patricia_hat_tree_t *tree, const char *key)
+{
+    patricia_hat_bucket_t *bucket, *child;
+    patricia_hat_node_t *node;
+    uint32_t keylen, pos;
+    void **slot;
+
+    /* Sanity check */
+    if (!tree || !key || strlen(key) > PATRICIA_HAT_MAX_KEYLEN) {
+        return -1;
+    }
+
+    if (strlen(key) > tree->max_keylen) {
+        tree->max_keylen = strlen(key);
+    }
+
+    slot = &tree->root;
+    while (*(uint8_t *)*slot == PATRICIA_HAT_NODE) {
+        node = (patricia_hat_node_t *)*slot;
+        if (!*key) {
+            if (!node->has_key) {
+                node->has_key = 1;
+                tree->count++;
+            }
+            return 0;
+        }
+        slot = patricia_hat_child(node, (uint8_t)*key);
+        if (!slot) {
+            child = patricia_hat_bucket_init(tree, PATRICIA_HAT_BUCKET_SIZE);
+            if (!child) {
+                return -1;
+            }
+            slot = patricia_hat_add_child(tree, node, (uint8_t)*key, child);
+            if (!slot) {
+                patricia_hat_bucket_free(tree, child);
+                return -1;
+            }
+        }
+        key++;
+    }
+
+    bucket = (patricia_hat_bucket_t *)*slot;
+    keylen = strlen(key);
+    if (patricia_hat_bucket_find(bucket, key, keylen, &pos)) {
+        /* Already present */
+        return 0;
+    }
+
+    if (patricia_hat_bucket_insert(tree, slot, pos, key, keylen) != 0) {
+        return -1;
+    }
+    tree->count++;
+
+    /* The key is in, if the bucket cannot burst now it will next time */
+    bucket = (patricia_hat_bucket_t *)*slot;
+    if (bucket->count > tree->burst) {
+        patricia_hat_burst(tree, slot);
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_hat_destroy
+ *
+ * Cleanup the given tree instance
+ */
+int
+patricia_hat_destroy (patricia_hat_tree_t *tree)
+{
+    /* Sanity check */
+    if (!tree) {
+        return -1;
+    }
+
+    patricia_hat_destroy_internal(tree, tree->root);
+    free(tree);
+
+    return 0;
+}
+
+/*
+ * patricia_hat_init
+ *
+ * Create a tree whose buckets burst once they hold more than burst
+ * suffixes. 0 selects the default.
+ */
+patricia_hat_tree_t *
+patricia_hat_init (uint32_t burst)
+{
+    patricia_hat_tree_t *tree;
+
+    tree = (patricia_hat_tree_t *)calloc(1, sizeof(patricia_hat_tree_t));
+    if (!tree) {
+        return NULL;
+    }
+
+    tree->burst = burst ? burst : PATRICIA_HAT_DEFAULT_BURST;
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem = sizeof(patricia_hat_tree_t);
+#endif
+
+    tree->root = patricia_hat_bucket_init(tree, PATRICIA_HAT_BUCKET_SIZE);
+    if (!tree->root) {
+        free(tree);
+        return NULL;
+    }
+
+    return tree;
+}
+
+/* End of File */
@@ -0,0 +1,80 @@
+/*
+ * patricia_hat.h - Header file for the burst trie (HAT-trie style) hybrid
+ *
+ * Small subtrees are kept as sorted, contiguous buckets of key suffixes and
+ * only turned into trie nodes once they grow past a threshold. This is a
+ * container of its own next to patricia_tree_t, the buckets replace the
+ * chains of small nodes that tree would build for such subtrees.
+ */
+
+#ifndef PATRICIA_HAT_H
+#define PATRICIA_HAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_HAT_DEFAULT_BURST  128         /* Suffixes per bucket */
+#define PATRICIA_HAT_BUCKET_SIZE    256         /* Initial bucket bytes */
+#define PATRICIA_HAT_MAX_KEYLEN     65535
+#define PATRICIA_HAT_INIT_CHILDREN  4           /* Initial child slots */
+
+#define PATRICIA_HAT_NODE           1
+#define PATRICIA_HAT_BUCKET         2
+
+/* Datastructures */
+
+/*
+ * Trie node. Only the bytes that occur are kept, sorted: child[i] is either
+ * a node or a bucket holding the suffixes of the keys continuing with byte
+ * bytes[i]. Both arrays have room for cap entries and grow by doubling.
+ */
+typedef struct patricia_hat_node_s {
+    uint8_t     type;
+    uint8_t     has_key;                    /* A key ends at this node */
+    uint16_t    count;                      /* Children in use */
+    uint16_t    cap;
+    uint8_t     *bytes;
+    void        **child;
+} patricia_hat_node_t;
+
+/*
+ * Bucket. Suffixes are stored back to back in sorted order, each one as a
+ * 16-bit length followed by the bytes.
+ */
+typedef struct patricia_hat_bucket_s {
+    uint8_t     type;
+    uint32_t    count;
+    uint32_t    size;
+    uint32_t    cap;
+    char        data[1];
+} patricia_hat_bucket_t;
+
+typedef struct patricia_hat_tree_s {
+    void            *root;
+    uint32_t        burst;
+    uint32_t        max_keylen;
+    unsigned long   count;
+#ifdef PATRICIA_STATS_ON
+    unsigned long   total_mem;
+    unsigned long   total_nodes;
+    unsigned long   total_buckets;
+#endif
+} patricia_hat_tree_t;
+
+typedef int (*patricia_hat_fn) (const char *key, void *arg);
+
+/* Function Prototypes */
+
+void patricia_hat_print_stats (patricia_hat_tree_t *tree);
+int patricia_hat_lookup (patricia_hat_tree_t *tree, const char *key);
+int patricia_hat_lookup_prefix (patricia_hat_tree_t *tree, const char *prefix,
+                                patricia_hat_fn fn, void *arg);
+int patricia_hat_delete (patricia_hat_tree_t *tree, const char *key);
+int patricia_hat_add (patricia_hat_tree_t *tree, const char *key);
+int patricia_hat_destroy (patricia_hat_tree_t *tree);
+patricia_hat_tree_t *patricia_hat_init (uint32_t burst);
+
+#endif /* PATRICIA_HAT_H */
@@ -0,0 +1,643 @@
+/*
+ * patricia_hope.c
+ *
+ * This file implements an order-preserving key encoder in the manner of
+ * HOPE (High-speed Order-Preserving Encoder). Keys with a skewed byte
+ * distribution, like URL paths, repeat the same substrings over and over.
+ * Replacing those with short codes makes the keys, and with them the
+ * labels and the depth of the tree, shorter.
+ *
+ * Training counts the substrings of 2 to PATRICIA_HOPE_MAX_SYMBOL bytes in
+ * a sample of keys and keeps the dict_size ones saving the most bytes.
+ * Each kept string s, and each single byte, owns the range of strings
+ * starting with it, from s up to s with its last byte incremented. These
+ * ranges nest, and their bounds cut the strings into intervals, each in
+ * the range of the longest symbol it starts with. Encoding finds the
+ * interval holding the rest of the key, emits its code and drops the
+ * symbol from the key. Codes are handed out in interval order and none is
+ * the prefix of another, so comparing encoded keys gives the same answer
+ * as comparing the keys, prefixes included.
+ *
+ * The codes are one or two bytes, never 0. The intervals the sample used
+ * most get one byte codes, the others share a first byte in groups of up
+ * to 255.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "patricia_hope.h"
+
+/* Defines */
+
+#define PATRICIA_HOPE_INIT_SIZE     4096
+#define PATRICIA_HOPE_GROUP         255         /* Second bytes 1 to 255 */
+#define PATRICIA_HOPE_PAIRS         65536       /* First two bytes */
+
+/* Datastructures */
+
+/*
+ * Substring counts. A substring of up to 8 non zero bytes is packed into
+ * a uint64_t, the unused bytes 0, so 0 marks a free slot.
+ */
+typedef struct patricia_hope_counts_s {
+    uint64_t    *keys;
+    uint32_t    *counts;
+    uint32_t    size;
+    uint32_t    used;
+} patricia_hope_counts_t;
+
+/* A substring and the bytes it saves, or an interval and its use */
+typedef struct patricia_hope_cand_s {
+    uint64_t    packed;
+    uint64_t    score;
+} patricia_hope_cand_t;
+
+/*
+ * patricia_hope_pack
+ *
+ * Pack len bytes of s into a uint64_t
+ */
+static inline uint64_t
+patricia_hope_pack (const char *s, uint32_t len)
+{
+    uint64_t v = 0;
+
+    memcpy(&v, s, len);
+    return v;
+}
+
+/*
+ * patricia_hope_slot
+ *
+ * Find the slot of the packed string in the table, or the free slot it
+ * goes to
+ */
+static uint32_t
+patricia_hope_slot (patricia_hope_counts_t *t, uint64_t packed)
+{
+    uint64_t h = packed * 0x9e3779b97f4a7c15ULL;
+    uint32_t i = (uint32_t)(h >> 32) & (t->size - 1);
+
+    while (t->keys[i] && t->keys[i] != packed) {
+        i = (i + 1) & (t->size - 1);
+    }
+
+    return i;
+}
+
+/*
+ * patricia_hope_count
+ *
+ * Add n to the count of the packed string, growing the table once it is
+ * half full. Returns 0 upon success, -1 upon failure.
+ */
+static int
+patricia_hope_count (patricia_hope_counts_t *t, uint64_t packed, uint32_t n)
+{
+    patricia_hope_counts_t old;
+    uint32_t i, j;
+
+    if (2 * (t->used + 1) > t->size) {
+        old = *t;
+        t->size = old.size ? old.size * 2 : PATRICIA_HOPE_INIT_SIZE;
+        t->keys = (uint64_t *)calloc(t->size, sizeof(uint64_t));
+        t->counts = (uint32_t *)calloc(t->size, sizeof(uint32_t));
+        if (!t->keys || !t->counts) {
+            free(t->keys);
+            free(t->counts);
+            *t = old;
+            return -1;
+        }
+        for (i = 0; i < old.size; i++) {
+            if (old.keys[i]) {
+                j = patricia_hope_slot(t, old.keys[i]);
+                t->keys[j] = old.keys[i];
+                t->counts[j] = old.counts[i];
+            }
+        }
+        free(old.keys);
+        free(old.counts);
+    }
+
+    i = patricia_hope_slot(t, packed);
+    if (!t->keys[i]) {
+        t->keys[i] = packed;
+        t->used++;
+    }
+    t->counts[i] += n;
+
+    return 0;
+}
+
+/*
+ * patricia_hope_cand_cmp
+ *
+ * qsort callback, highest score first
+ */
+static int
+patricia_hope_cand_cmp (const void *a, const void *b)
+{
+    const patricia_hope_cand_t *x = (const patricia_hope_cand_t *)a;
+    const patricia_hope_cand_t *y = (const patricia_hope_cand_t *)b;
+
+    if (x->score != y->score) {
+        return (x->score > y->score) ? -1 : 1;
+    }
+    return (x->packed < y->packed) ? -1 : (x->packed > y->packed);
+}
+
+/*
+ * patricia_hope_str_cmp
+ *
+ * qsort callback for an array of strings
+ */
+static int
+patricia_hope_str_cmp (const void *a, const void *b)
+{
+    return strcmp(*(const char **)a, *(const char **)b);
+}
+
+/*
+ * patricia_hope_pair
+ *
+ * The first two bytes of a non empty string as an index into first, 0
+ * standing for the end of the string
+ */
+static inline uint32_t
+patricia_hope_pair (const char *s)
+{
+    return ((uint32_t)(uint8_t)s[0] << 8) | (uint8_t)s[1];
+}
+
+/*
+ * patricia_hope_find
+ *
+ * Index of the interval holding the string s, which is not empty
+ */
+static inline uint32_t
+patricia_hope_find (patricia_hope_t *hope, const char *s)
+{
+    uint32_t pair = patricia_hope_pair(s);
+    int32_t lo, hi, mid;
+
+    /*
+     * Intervals starting before the pair hold smaller strings, those
+     * starting after it bigger ones. The last one before the pair is the
+     * answer unless one of those starting with the pair is not bigger.
+     */
+    lo = (int32_t)hope->first[pair] - 1;
+    hi = (int32_t)hope->first[pair + 1] - 1;
+    while (lo < hi) {
+        mid = lo + (hi - lo + 1) / 2;
+        if (strcmp(hope->pool + hope->intervals[mid].start, s) <= 0) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    return lo;
+}
+
+/*
+ * patricia_hope_assign
+ *
+ * Hand out the codes. The intervals with the highest use get one byte
+ * codes, as many as leave enough first bytes for the groups of two byte
+ * codes in between. Returns 0 upon success, -1 if the codes run out.
+ */
+static int
+patricia_hope_assign (patricia_hope_t *hope, const uint32_t *use)
+{
+    patricia_hope_cand_t *order;
+    uint32_t i, t, best, need, run, f, second;
+    uint8_t *one;
+
+    order = (patricia_hope_cand_t *)malloc(hope->interval_count *
+                                           sizeof(patricia_hope_cand_t));
+    one = (uint8_t *)calloc(hope->interval_count, 1);
+    if (!order || !one) {
+        free(order);
+        free(one);
+        return -1;
+    }
+
+    /* Intervals by use, most used first */
+    for (i = 0; i < hope->interval_count; i++) {
+        order[i].packed = i;
+        order[i].score = use[i];
+    }
+    qsort(order, hope->interval_count, sizeof(patricia_hope_cand_t),
+          patricia_hope_cand_cmp);
+
+    /* Take the most one byte codes that still fit in 255 first bytes */
+    best = 0;
+    for (t = 0; t <= 255 && t <= hope->interval_count; t++) {
+        if (t > 0) {
+            one[order[t - 1].packed] = 1;
+        }
+        need = t;
+        run = 0;
+        for (i = 0; i <= hope->interval_count; i++) {
+            if (i < hope->interval_count && !one[i]) {
+                run++;
+                continue;
+            }
+            need += (run + PATRICIA_HOPE_GROUP - 1) / PATRICIA_HOPE_GROUP;
+            run = 0;
+        }
+        if (need <= 255) {
+            best = t;
+        }
+    }
+    memset(one, 0, hope->interval_count);
+    for (t = 0; t < best; t++) {
+        one[order[t].packed] = 1;
+    }
+    free(order);
+
+    /* Walk the intervals in order, grouping the two byte codes */
+    f = 1;
+    second = 0;
+    for (i = 0; i < hope->interval_count; i++) {
+        if (one[i] || second == PATRICIA_HOPE_GROUP) {
+            if (second) {
+                f++;
+                second = 0;
+            }
+        }
+        if (f > 255) {
+            free(one);
+            return -1;
+        }
+        if (one[i]) {
+            hope->intervals[i].code_len = 1;
+            hope->intervals[i].code[0] = f;
+            hope->decode[f].base = i;
+            hope->decode[f].two_byte = 0;
+            hope->one_byte_codes++;
+            f++;
+            continue;
+        }
+        if (second == 0) {
+            hope->decode[f].base = i;
+            hope->decode[f].two_byte = 1;
+        }
+        hope->intervals[i].code_len = 2;
+        hope->intervals[i].code[0] = f;
+        hope->intervals[i].code[1] = ++second;
+    }
+    free(one);
+
+    return 0;
+}
+
+/*
+ * patricia_hope_print_stats
+ *
+ * Dump the stats for the given encoder
+ */
+void
+patricia_hope_print_stats (patricia_hope_t *hope)
+{
+#ifdef PATRICIA_STATS_ON
+    /* Sanity check */
+    if (!hope) {
+        return;
+    }
+
+    printf("\nDictionary substrings: %u\n", hope->dict_count);
+    printf("Total number of intervals: %u (%u one byte codes)\n",
+           hope->interval_count, hope->one_byte_codes);
+    printf("Sample encoded: %lu bytes into %lu\n", hope->sample_in,
+           hope->sample_out);
+    if (hope->sample_out) {
+        printf("Compression ratio: %.2f\n",
+               (double)hope->sample_in / hope->sample_out);
+    }
+    printf("\n");
+#endif
+}
+
+/*
+ * patricia_hope_encode
+ *
+ * Codec function, see patricia_set_codec. arg is the encoder.
+ */
+int
+patricia_hope_encode (const char *in, char *out, int size, void *arg)
+{
+    patricia_hope_t *hope = (patricia_hope_t *)arg;
+    patricia_hope_interval_t *iv;
+    const char *p = in;
+    int len = 0;
+
+    /* Sanity check */
+    if (!in || !out || !hope) {
+        return -1;
+    }
+
+    while (*p) {
+        iv = &hope->intervals[patricia_hope_find(hope, p)];
+        if (len + iv->code_len >= size) {
+            return -1;
+        }
+        out[len++] = (char)iv->code[0];
+        if (iv->code_len == 2) {
+            out[len++] = (char)iv->code[1];
+        }
+        p += iv->symbol_len;
+    }
+    out[len] = 0;
+
+    return len;
+}
+
+/*
+ * patricia_hope_decode
+ *
+ * Codec function, see patricia_set_codec. arg is the encoder.
+ */
+int
+patricia_hope_decode (const char *in, char *out, int size, void *arg)
+{
+    patricia_hope_t *hope = (patricia_hope_t *)arg;
+    patricia_hope_interval_t *iv;
+    patricia_hope_decode_t *d;
+    const uint8_t *p = (const uint8_t *)in;
+    uint32_t i;
+    int len = 0;
+
+    /* Sanity check */
+    if (!in || !out || !hope) {
+        return -1;
+    }
+
+    while (*p) {
+        d = &hope->decode[*p++];
+        i = d->base;
+        if (d->two_byte) {
+            if (!*p) {
+                return -1;
+            }
+            i += *p++ - 1;
+        }
+        if (i >= hope->interval_count) {
+            return -1;
+        }
+        iv = &hope->intervals[i];
+        if (len + iv->symbol_len >= size) {
+            return -1;
+        }
+        memcpy(out + len, hope->pool + iv->start, iv->symbol_len);
+        len += iv->symbol_len;
+    }
+    out[len] = 0;
+
+    return len;
+}
+
+/*
+ * patricia_hope_destroy
+ *
+ * Free the given encoder
+ */
+void
+patricia_hope_destroy (patricia_hope_t *hope)
+{
+    /* Sanity check */
+    if (!hope) {
+        return;
+    }
+
+    free(hope->intervals);
+    free(hope->pool);
+    free(hope->first);
+    free(hope);
+}
+
+/*
+ * patricia_hope_train
+ *
+ * Build an encoder for keys like the count given ones, with up to
+ * dict_size substrings, PATRICIA_HOPE_DICT_SIZE if 0. Trees using it must
+ * only see keys encoded with it.
+ */
+patricia_hope_t *
+patricia_hope_train (const char **keys, uint32_t count, uint32_t dict_size)
+{
+    patricia_hope_counts_t sub, dict;
+    patricia_hope_cand_t *cand;
+    patricia_hope_t *hope;
+    uint32_t i, j, k, len, n, nb, plen, *use;
+    uint64_t packed;
+    char **bounds, *b, sym[PATRICIA_HOPE_MAX_SYMBOL + 1];
+    const char *p;
+
+    /* Sanity check */
+    if (!keys) {
+        return NULL;
+    }
+
+    dict_size = dict_size ? dict_size : PATRICIA_HOPE_DICT_SIZE;
+    if (dict_size > 16384) {
+        dict_size = 16384;              /* Codes for up to 33023 intervals */
+    }
+
+    hope = (patricia_hope_t *)calloc(1, sizeof(patricia_hope_t));
+    if (!hope) {
+        return NULL;
+    }
+    memset(&sub, 0, sizeof(sub));
+    memset(&dict, 0, sizeof(dict));
+    cand = NULL;
+    bounds = NULL;
+    use = NULL;
+
+    /* Count the substrings of the sample */
+    for (i = 0; i < count; i++) {
+        len = strlen(keys[i]);
+        for (j = 0; j < len; j++) {
+            for (k = 2; k <= PATRICIA_HOPE_MAX_SYMBOL && j + k <= len; k++) {
+                if (patricia_hope_count(&sub, patricia_hope_pack(keys[i] + j,
+                                                                 k), 1) != 0) {
+                    goto fail;
+                }
+            }
+        }
+    }
+
+    /*
+     * Keep those saving the most, counted as bytes beyond the first. A
+     * string ending in 0xff has no successor to bound its range.
+     */
+    cand = (patricia_hope_cand_t *)malloc((sub.used + 1) *
+                                          sizeof(patricia_hope_cand_t));
+    if (!cand) {
+        goto fail;
+    }
+    n = 0;
+    for (i = 0; i < sub.size; i++) {
+        if (!sub.keys[i] || sub.counts[i] < 2) {
+            continue;
+        }
+        memcpy(sym, &sub.keys[i], sizeof(uint64_t));
+        sym[PATRICIA_HOPE_MAX_SYMBOL] = 0;
+        len = strlen(sym);
+        if ((uint8_t)sym[len - 1] == 0xff) {
+            continue;
+        }
+        cand[n].packed = sub.keys[i];
+        cand[n].score = (uint64_t)sub.counts[i] * (len - 1);
+        n++;
+    }
+    qsort(cand, n, sizeof(patricia_hope_cand_t), patricia_hope_cand_cmp);
+    if (n > dict_size) {
+        n = dict_size;
+    }
+    for (i = 0; i < n; i++) {
+        if (patricia_hope_count(&dict, cand[i].packed, 1) != 0) {
+            goto fail;
+        }
+    }
+    hope->dict_count = n;
+
+    /*
+     * The bounds of the ranges: every single byte, every substring and the
+     * string just past the strings starting with it. A substring and its
+     * successor take at most 2 * 9 bytes of the pool.
+     */
+    nb = 255 + 2 * n;
+    bounds = (char **)malloc(nb * sizeof(char *));
+    hope->pool = (char *)malloc(2 * 255 +
+                                2 * n * (PATRICIA_HOPE_MAX_SYMBOL + 1));
+    if (!bounds || !hope->pool) {
+        goto fail;
+    }
+    plen = 0;
+    nb = 0;
+    for (i = 1; i <= 255; i++) {
+        b = hope->pool + plen;
+        b[0] = (char)i;
+        b[1] = 0;
+        bounds[nb++] = b;
+        plen += 2;
+    }
+    for (i = 0; i < n; i++) {
+        for (j = 0; j < 2; j++) {
+            b = hope->pool + plen;
+            memcpy(b, &cand[i].packed, sizeof(uint64_t));
+            b[PATRICIA_HOPE_MAX_SYMBOL] = 0;
+            len = strlen(b);
+            if (j == 1) {
+                b[len - 1]++;
+            }
+            bounds[nb++] = b;
+            plen += len + 1;
+        }
+    }
+    qsort(bounds, nb, sizeof(char *), patricia_hope_str_cmp);
+
+    hope->intervals = (patricia_hope_interval_t *)
+                      calloc(nb, sizeof(patricia_hope_interval_t));
+    if (!hope->intervals) {
+        goto fail;
+    }
+
+    /* Drop the duplicates, each bound opens one interval */
+    hope->interval_count = 0;
+    for (i = 0; i < nb; i++) {
+        if (i > 0 && strcmp(bounds[i], bounds[i - 1]) == 0) {
+            continue;
+        }
+        hope->intervals[hope->interval_count++].start = bounds[i] -
+                                                        hope->pool;
+    }
+    hope->pool_size = plen;
+
+    /* The symbol is the longest kept string the interval starts with */
+    for (i = 0; i < hope->interval_count; i++) {
+        p = hope->pool + hope->intervals[i].start;
+        len = strlen(p);
+        if (len > PATRICIA_HOPE_MAX_SYMBOL) {
+            len = PATRICIA_HOPE_MAX_SYMBOL;
+        }
+        for (; len > 1; len--) {
+            packed = patricia_hope_pack(p, len);
+            if (dict.used && dict.keys[patricia_hope_slot(&dict, packed)]) {
+                break;
+            }
+        }
+        hope->intervals[i].symbol_len = len;
+    }
+
+    /* The intervals starting with the pair j are first[j] to first[j + 1] */
+    hope->first = (uint32_t *)malloc((PATRICIA_HOPE_PAIRS + 1) *
+                                     sizeof(uint32_t));
+    if (!hope->first) {
+        goto fail;
+    }
+    for (i = 0, j = 0; j <= PATRICIA_HOPE_PAIRS; j++) {
+        while (i < hope->interval_count &&
+               patricia_hope_pair(hope->pool + hope->intervals[i].start) <
+               j) {
+            i++;
+        }
+        hope->first[j] = i;
+    }
+
+    /* Encode the sample once to see which intervals deserve short codes */
+    use = (uint32_t *)calloc(hope->interval_count, sizeof(uint32_t));
+    if (!use) {
+        goto fail;
+    }
+    for (i = 0; i < count; i++) {
+        p = keys[i];
+        while (*p) {
+            k = patricia_hope_find(hope, p);
+            use[k]++;
+            p += hope->intervals[k].symbol_len;
+        }
+    }
+    if (patricia_hope_assign(hope, use) != 0) {
+        goto fail;
+    }
+
+    /* What the sample encodes to with those codes, the expected ratio */
+    for (i = 0; i < count; i++) {
+        p = keys[i];
+        while (*p) {
+            k = patricia_hope_find(hope, p);
+            hope->sample_in += hope->intervals[k].symbol_len;
+            hope->sample_out += hope->intervals[k].code_len;
+            p += hope->intervals[k].symbol_len;
+        }
+    }
+
+    free(use);
+    free(bounds);
+    free(cand);
+    free(sub.keys);
+    free(sub.counts);
+    free(dict.keys);
+    free(dict.counts);
+
+    return hope;
+
+fail:
+    free(use);
+    free(bounds);
+    free(cand);
+    free(sub.keys);
+    free(sub.counts);
+    free(dict.keys);
+    free(dict.counts);
+    patricia_hope_destroy(hope);
+
+    return NULL;
+}
+
+/* End of File */
@@ -0,0 +1,66 @@
+/*
+ * patricia_hope.h - Header file for the order-preserving key encoder
+ *
+ * A HOPE style encoder trained on a sample of keys. Common substrings are
+ * replaced with one or two byte codes that sort like the strings they
+ * stand for, so a tree storing the encoded keys keeps its order, ranges
+ * and prefix walks. Plug it into a tree with patricia_set_codec.
+ */
+
+#ifndef PATRICIA_HOPE_H
+#define PATRICIA_HOPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_HOPE_DICT_SIZE     1024        /* Substrings trained */
+#define PATRICIA_HOPE_MAX_SYMBOL    8           /* Longest substring */
+
+/* Datastructures */
+
+/*
+ * The strings are cut into intervals, in order. Interval i holds the
+ * strings from the one at pool[start] up to the start of interval i + 1,
+ * and all of them begin with the same symbol, its first symbol_len bytes.
+ * A key is encoded one symbol at a time: the interval holding what is
+ * left of it gives the code and the bytes consumed.
+ */
+typedef struct patricia_hope_interval_s {
+    uint32_t    start;
+    uint8_t     symbol_len;
+    uint8_t     code_len;
+    uint8_t     code[2];
+} patricia_hope_interval_t;
+
+/* Intervals whose code starts with a byte, all of them for a two byte code */
+typedef struct patricia_hope_decode_s {
+    uint32_t    base;
+    uint8_t     two_byte;
+} patricia_hope_decode_t;
+
+typedef struct patricia_hope_s {
+    patricia_hope_interval_t    *intervals;
+    uint32_t                    interval_count;
+    char                        *pool;
+    uint32_t                    pool_size;
+    uint32_t                    *first;         /* By the first two bytes */
+    patricia_hope_decode_t      decode[256];
+    uint32_t                    dict_count;
+    uint32_t                    one_byte_codes;
+    unsigned long               sample_in;      /* The sample, encoded */
+    unsigned long               sample_out;
+} patricia_hope_t;
+
+/* Function Prototypes */
+
+void patricia_hope_print_stats (patricia_hope_t *hope);
+int patricia_hope_encode (const char *in, char *out, int size, void *arg);
+int patricia_hope_decode (const char *in, char *out, int size, void *arg);
+void patricia_hope_destroy (patricia_hope_t *hope);
+patricia_hope_t *patricia_hope_train (const char **keys, uint32_t count,
+                                      uint32_t dict_size);
+
+#endif /* PATRICIA_HOPE_H */
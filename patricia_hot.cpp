@@ -0,0 +1,405 @@
+/*
+ * patricia_hot.c
+ *
+ * This file implements a read-only tree layout built from an arena tree,
+ * with the fields read on a descent packed into 64-byte blocks. Walking down
+ * one level reads the parent's block to find the child by its first byte,
+ * then the child's block to match its label, so a lookup touches one cache
+ * line per node as long as labels fit in PATRICIA_HOT_LABEL_INLINE bytes.
+ * The longer labels, which are rare below the top levels of the tree, spill
+ * their remaining bytes to the cold buffer.
+ *
+ * Blocks are laid out in depth first order, with the overflow blocks of a
+ * node right after it, so that a subtree occupies a contiguous range of
+ * blocks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "patricia_hot.h"
+
+/* A block must be exactly one cache line */
+typedef char patricia_hot_block_check[
+    (sizeof(patricia_hot_block_t) == PATRICIA_HOT_BLOCK_SIZE) ? 1 : -1];
+
+/*
+ * patricia_hot_count
+ *
+ * Count the blocks and cold bytes needed for the subtree under ref
+ */
+static void
+patricia_hot_count (patricia_arena_t *arena, patricia_ref_t ref,
+                    uint64_t *blocks, uint64_t *cold)
+{
+    patricia_arena_node_t *node;
+    patricia_ref_t child;
+    uint32_t n = 0;
+
+    node = PATRICIA_ARENA_NODE(arena, ref);
+    if (node->label_len > PATRICIA_HOT_LABEL_INLINE) {
+        *cold += node->label_len - PATRICIA_HOT_LABEL_INLINE;
+    }
+
+    for (child = node->first_child; child;
+         child = PATRICIA_ARENA_NODE(arena, child)->next_sibling) {
+        patricia_hot_count(arena, child, blocks, cold);
+        n++;
+    }
+
+    *blocks += 1;
+    if (n > PATRICIA_HOT_FANOUT) {
+        *blocks += (n - 1) / PATRICIA_HOT_FANOUT;
+    }
+}
+
+/*
+ * patricia_hot_fill
+ *
+ * Lay out the subtree under ref starting at the next free block. Returns
+ * the block of the node.
+ */
+static uint32_t
+patricia_hot_fill (patricia_hot_t *hot, patricia_arena_t *arena,
+                   patricia_ref_t ref, uint32_t *next_block)
+{
+    patricia_arena_node_t *node;
+    patricia_hot_block_t *block;
+    patricia_ref_t child;
+    uint32_t idx, cur, n, i, extra, child_idx;
+
+    node = PATRICIA_ARENA_NODE(arena, ref);
+
+    n = 0;
+    for (child = node->first_child; child;
+         child = PATRICIA_ARENA_NODE(arena, child)->next_sibling) {
+        n++;
+    }
+    extra = (n > PATRICIA_HOT_FANOUT) ? (n - 1) / PATRICIA_HOT_FANOUT : 0;
+
+    /* The node and its overflow blocks go first */
+    idx = *next_block;
+    *next_block += 1 + extra;
+    for (i = 0; i <= extra; i++) {
+        block = &hot->blocks[idx + i];
+        memset(block, 0, sizeof(patricia_hot_block_t));
+        if (i < extra) {
+            block->flags = PATRICIA_HOT_MORE;
+            block->next = idx + i + 1;
+        }
+    }
+
+    block = &hot->blocks[idx];
+    block->label_len = node->label_len;
+    if (node->flags & PATRICIA_ARENA_KEY) {
+        block->flags |= PATRICIA_HOT_KEY;
+    }
+    if (node->label_len > PATRICIA_HOT_LABEL_INLINE) {
+        memcpy(block->label, node->label, PATRICIA_HOT_LABEL_INLINE);
+        block->label_off = hot->cold_size;
+        memcpy(hot->cold + hot->cold_size,
+               node->label + PATRICIA_HOT_LABEL_INLINE,
+               node->label_len - PATRICIA_HOT_LABEL_INLINE);
+        hot->cold_size += node->label_len - PATRICIA_HOT_LABEL_INLINE;
+    } else {
+        memcpy(block->label, node->label, node->label_len);
+    }
+
+    cur = idx;
+    for (child = node->first_child; child;
+         child = PATRICIA_ARENA_NODE(arena, child)->next_sibling) {
+        if (hot->blocks[cur].nchildren == PATRICIA_HOT_FANOUT) {
+            cur++;
+        }
+        child_idx = patricia_hot_fill(hot, arena, child, next_block);
+
+        /* The recursion does not move the blocks, they are preallocated */
+        block = &hot->blocks[cur];
+        block->first[block->nchildren] =
+            (uint8_t)PATRICIA_ARENA_NODE(arena, child)->label[0];
+        block->child[block->nchildren] = child_idx;
+        block->nchildren++;
+    }
+
+    return idx;
+}
+
+/*
+ * patricia_hot_walk_internal
+ *
+ * Recursive routine which invokes fn on every key under the given block.
+ * buf holds the key of the parent node, len bytes long.
+ */
+static int
+patricia_hot_walk_internal (patricia_hot_t *hot, uint32_t idx, char *buf,
+                            uint32_t len, patricia_hot_fn fn, void *arg)
+{
+    patricia_hot_block_t *block;
+    uint32_t i;
+    int ret;
+
+    block = &hot->blocks[idx];
+    if (block->label_len > PATRICIA_HOT_LABEL_INLINE) {
+        memcpy(buf + len, block->label, PATRICIA_HOT_LABEL_INLINE);
+        memcpy(buf + len + PATRICIA_HOT_LABEL_INLINE,
+               hot->cold + block->label_off,
+               block->label_len - PATRICIA_HOT_LABEL_INLINE);
+    } else {
+        memcpy(buf + len, block->label, block->label_len);
+    }
+    len += block->label_len;
+
+    if (block->flags & PATRICIA_HOT_KEY) {
+        buf[len] = 0;
+        ret = fn(buf, len, arg);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    while (1) {
+        for (i = 0; i < block->nchildren; i++) {
+            ret = patricia_hot_walk_internal(hot, block->child[i], buf, len,
+                                             fn, arg);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+        if (!(block->flags & PATRICIA_HOT_MORE)) {
+            break;
+        }
+        block = &hot->blocks[block->next];
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_hot_print_stats
+ *
+ * Dump the stats for the given tree
+ */
+void
+patricia_hot_print_stats (patricia_hot_t *hot)
+{
+#ifdef PATRICIA_STATS_ON
+    /* Sanity check */
+    if (!hot) {
+        return;
+    }
+
+    printf("\nTotal number of keys: %u\n", hot->key_count);
+    printf("Total number of blocks: %u\n", hot->block_count);
+    printf("Hot size: %lu bytes\n",
+           (unsigned long)hot->block_count * PATRICIA_HOT_BLOCK_SIZE);
+    printf("Cold size: %u bytes\n\n", hot->cold_size);
+#endif
+}
+
+/*
+ * patricia_hot_find
+ *
+ * Look up the given key and, if blocks is not NULL, count the blocks read
+ * on the way into it. Inlined into the callers, so that the counting is
+ * compiled out of patricia_hot_lookup.
+ */
+static inline int
+patricia_hot_find (patricia_hot_t *hot, const char *key, uint32_t *blocks)
+{
+    patricia_hot_block_t *block, *child;
+    uint32_t len, pos, i, n;
+    uint8_t c;
+
+    len = strlen(key);
+    pos = 0;
+    block = &hot->blocks[PATRICIA_HOT_ROOT];
+    if (blocks) {
+        (*blocks)++;
+    }
+
+    while (pos < len) {
+        /* Find the child starting with the next byte of the key */
+        c = (uint8_t)key[pos];
+        while (1) {
+            for (i = 0; i < block->nchildren; i++) {
+                if (block->first[i] == c) {
+                    break;
+                }
+            }
+            if (i < block->nchildren || !(block->flags & PATRICIA_HOT_MORE)) {
+                break;
+            }
+            block = &hot->blocks[block->next];
+            if (blocks) {
+                (*blocks)++;
+            }
+        }
+        if (i == block->nchildren) {
+            return 0;
+        }
+
+        child = &hot->blocks[block->child[i]];
+        if (blocks) {
+            (*blocks)++;
+        }
+        if (len - pos < child->label_len) {
+            return 0;
+        }
+        n = (child->label_len > PATRICIA_HOT_LABEL_INLINE) ?
+            PATRICIA_HOT_LABEL_INLINE : child->label_len;
+        if (memcmp(child->label, key + pos, n) != 0) {
+            return 0;
+        }
+        if (child->label_len > n &&
+            memcmp(hot->cold + child->label_off, key + pos + n,
+                   child->label_len - n) != 0) {
+            return 0;
+        }
+
+        pos += child->label_len;
+        block = child;
+    }
+
+    return (block->flags & PATRICIA_HOT_KEY) ? 1 : 0;
+}
+
+/*
+ * patricia_hot_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 otherwise.
+ */
+int
+patricia_hot_lookup (patricia_hot_t *hot, const char *key)
+{
+    /* Sanity check */
+    if (!hot || !key) {
+        return 0;
+    }
+
+    return patricia_hot_find(hot, key, NULL);
+}
+
+/*
+ * patricia_hot_blocks_read
+ *
+ * Return the number of 64-byte blocks a lookup of the given key reads,
+ * found or not, which bounds the cache misses it can take. Meant for
+ * measurements, lookups themselves count nothing.
+ */
+uint32_t
+patricia_hot_blocks_read (patricia_hot_t *hot, const char *key)
+{
+    uint32_t blocks = 0;
+
+    /* Sanity check */
+    if (!hot || !key) {
+        return 0;
+    }
+
+    patricia_hot_find(hot, key, &blocks);
+    return blocks;
+}
+
+/*
+ * patricia_hot_walk
+ *
+ * Invoke fn on every key in lexicographical order. Stops as soon as fn
+ * returns a non zero value and returns that value.
+ */
+int
+patricia_hot_walk (patricia_hot_t *hot, patricia_hot_fn fn, void *arg)
+{
+    char *buf;
+    int ret;
+
+    /* Sanity check */
+    if (!hot || !fn) {
+        return -1;
+    }
+
+    buf = (char *)malloc(hot->max_keylen + 1);
+    if (!buf) {
+        return -1;
+    }
+
+    ret = patricia_hot_walk_internal(hot, PATRICIA_HOT_ROOT, buf, 0, fn, arg);
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * patricia_hot_destroy
+ *
+ * Free the tree
+ */
+int
+patricia_hot_destroy (patricia_hot_t *hot)
+{
+    /* Sanity check */
+    if (!hot) {
+        return -1;
+    }
+
+    free(hot->blocks);
+    free(hot->cold);
+    free(hot);
+
+    return 0;
+}
+
+/*
+ * patricia_hot_build
+ *
+ * Create the blocked layout for the keys of the given arena
+ */
+patricia_hot_t *
+patricia_hot_build (patricia_arena_t *arena)
+{
+    patricia_arena_header_t *hdr;
+    patricia_hot_t *hot;
+    uint64_t blocks = 0, cold = 0;
+    uint32_t next_block = 0;
+    void *mem;
+
+    /* Sanity check */
+    if (!arena) {
+        return NULL;
+    }
+
+    hdr = PATRICIA_ARENA_HDR(arena);
+    patricia_hot_count(arena, hdr->root, &blocks, &cold);
+    if (blocks > UINT32_MAX || cold > UINT32_MAX) {
+        return NULL;
+    }
+
+    hot = (patricia_hot_t *)calloc(1, sizeof(patricia_hot_t));
+    if (!hot) {
+        return NULL;
+    }
+
+    if (posix_memalign(&mem, PATRICIA_HOT_BLOCK_SIZE,
+                       blocks * sizeof(patricia_hot_block_t)) != 0) {
+        free(hot);
+        return NULL;
+    }
+    hot->blocks = (patricia_hot_block_t *)mem;
+
+    hot->cold = (char *)malloc(cold ? cold : 1);
+    if (!hot->cold) {
+        free(hot->blocks);
+        free(hot);
+        return NULL;
+    }
+
+    hot->block_count = blocks;
+    hot->key_count = hdr->key_count;
+    hot->max_keylen = hdr->max_keylen;
+    patricia_hot_fill(hot, arena, hdr->root, &next_block);
+
+    return hot;
+}
+
+/* End of File */
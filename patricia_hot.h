@@ -0,0 +1,66 @@
+/*
+ * patricia_hot.h - Header file for the cache line blocked tree layout
+ *
+ * A frozen copy of an arena tree where everything a lookup reads at a node
+ * (flags, the head of the label, the first byte and block of each child)
+ * sits in one 64-byte aligned block. Label bytes that do not fit are kept
+ * out of line in a cold buffer.
+ */
+
+#ifndef PATRICIA_HOT_H
+#define PATRICIA_HOT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia_arena.h"
+
+/* Defines */
+
+#define PATRICIA_HOT_BLOCK_SIZE     64          /* One cache line */
+#define PATRICIA_HOT_LABEL_INLINE   12          /* Label bytes in the block */
+#define PATRICIA_HOT_FANOUT         8           /* Children per block */
+#define PATRICIA_HOT_ROOT           0
+
+/* Block flags */
+#define PATRICIA_HOT_KEY            0x01        /* A key ends at this node */
+#define PATRICIA_HOT_MORE           0x02        /* More children in next */
+
+/* Datastructures */
+
+/*
+ * Block. A node with more than PATRICIA_HOT_FANOUT children continues in
+ * overflow blocks chained through next, which only use the child fields.
+ * Label bytes past PATRICIA_HOT_LABEL_INLINE are at cold[label_off].
+ */
+typedef struct patricia_hot_block_s {
+    uint16_t    label_len;
+    uint8_t     nchildren;                  /* Children in this block */
+    uint8_t     flags;
+    uint32_t    next;
+    uint32_t    label_off;
+    char        label[PATRICIA_HOT_LABEL_INLINE];
+    uint8_t     first[PATRICIA_HOT_FANOUT];     /* First byte of each child */
+    uint32_t    child[PATRICIA_HOT_FANOUT];     /* Block of each child */
+} patricia_hot_block_t;
+
+typedef struct patricia_hot_s {
+    patricia_hot_block_t    *blocks;
+    char                    *cold;
+    uint32_t                block_count;
+    uint32_t                cold_size;
+    uint32_t                key_count;
+    uint32_t                max_keylen;
+} patricia_hot_t;
+
+typedef int (*patricia_hot_fn) (const char *key, int len, void *arg);
+
+/* Function Prototypes */
+
+void patricia_hot_print_stats (patricia_hot_t *hot);
+uint32_t patricia_hot_blocks_read (patricia_hot_t *hot, const char *key);
+int patricia_hot_lookup (patricia_hot_t *hot, const char *key);
+int patricia_hot_walk (patricia_hot_t *hot, patricia_hot_fn fn, void *arg);
+int patricia_hot_destroy (patricia_hot_t *hot);
+patricia_hot_t *patricia_hot_build (patricia_arena_t *arena);
+
+#endif /* PATRICIA_HOT_H */
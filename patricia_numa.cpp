@@ -0,0 +1,485 @@
+/*
+ * patricia_numa.c
+ *
+ * This file implements NUMA local replicas of an arena tree. Since an arena
+ * holds no absolute addresses, a replica is a plain copy of the arena image
+ * made into memory bound to the node with mbind(2). Lookups find the node
+ * of the CPU they run on and search that node's replica, so they never read
+ * tree memory across the interconnect.
+ *
+ * Replicas are read-only. The writer applies adds and deletes to its own
+ * copy of the tree, the master, and every batch updates publishes a fresh
+ * replica on each node. The old replica is freed once the readers that may
+ * still be using it are gone. Readers announce themselves in one of two
+ * counters of the node's slot, picked by the slot's epoch, and the writer
+ * bumps the epoch and waits for the counter of the previous one to drain.
+ *
+ * Only the raw mbind and get_mempolicy system calls are used, there is no
+ * dependency on libnuma. On a kernel without NUMA support the replicas
+ * still work, they just all end up wherever the writer runs.
+ *
+ * A single writer is assumed, lookups may run from any number of threads.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "patricia_numa.h"
+
+/*
+ * patricia_numa_read_list
+ *
+ * Parse a sysfs list such as "0-3,8-11" and set the entries of set that are
+ * in it. Returns 0 upon success, -1 upon failure.
+ */
+static int
+patricia_numa_read_list (const char *path, uint8_t *set, int max)
+{
+    char buf[4096], *p, *end;
+    long lo, hi, i;
+    FILE *fp;
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        return -1;
+    }
+    if (!fgets(buf, sizeof(buf), fp)) {
+        fclose(fp);
+        return -1;
+    }
+    fclose(fp);
+
+    p = buf;
+    while (*p && *p != '\n') {
+        lo = strtol(p, &end, 10);
+        if (end == p) {
+            return -1;
+        }
+        hi = lo;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p) {
+                return -1;
+            }
+        }
+        for (i = lo; i <= hi && i < max; i++) {
+            set[i] = 1;
+        }
+        p = end;
+        if (*p == ',') {
+            p++;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_numa_node
+ *
+ * Return the node of the CPU the caller runs on
+ */
+static inline uint32_t
+patricia_numa_node (patricia_numa_t *numa)
+{
+    int cpu;
+
+    cpu = sched_getcpu();
+    if (cpu < 0 || cpu >= PATRICIA_NUMA_MAX_CPUS) {
+        cpu = 0;
+    }
+
+    return numa->cpu_node[cpu];
+}
+
+/*
+ * patricia_numa_replica_destroy
+ *
+ * Free a replica
+ */
+static void
+patricia_numa_replica_destroy (patricia_numa_replica_t *rep)
+{
+    if (!rep) {
+        return;
+    }
+
+    patricia_arena_destroy(rep->arena);
+    munmap(rep->buf, rep->len);
+    free(rep);
+}
+
+/*
+ * patricia_numa_replica_create
+ *
+ * Copy the arena image of len bytes into memory bound to the given node
+ */
+static patricia_numa_replica_t *
+patricia_numa_replica_create (void *image, size_t len, uint32_t node)
+{
+    unsigned long mask[PATRICIA_NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    patricia_numa_replica_t *rep;
+    long page;
+
+    rep = (patricia_numa_replica_t *)calloc(1, sizeof(patricia_numa_replica_t));
+    if (!rep) {
+        return NULL;
+    }
+
+    page = sysconf(_SC_PAGESIZE);
+    rep->len = (len + page - 1) / page * page;
+    rep->buf = (char *)mmap(NULL, rep->len, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (rep->buf == MAP_FAILED) {
+        free(rep);
+        return NULL;
+    }
+
+    /*
+     * Bind the range before the pages are touched, so that the copy below
+     * allocates them on the node. A failure is not fatal, the replica is
+     * still correct, only not local.
+     */
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8 * sizeof(unsigned long))] |=
+        1UL << (node % (8 * sizeof(unsigned long)));
+    syscall(SYS_mbind, rep->buf, rep->len, MPOL_BIND, mask,
+            PATRICIA_NUMA_MAX_NODES + 1, 0);
+
+    memcpy(rep->buf, image, len);
+    mprotect(rep->buf, rep->len, PROT_READ);
+
+    rep->arena = patricia_arena_open(rep->buf, len);
+    if (!rep->arena) {
+        munmap(rep->buf, rep->len);
+        free(rep);
+        return NULL;
+    }
+
+    return rep;
+}
+
+/*
+ * patricia_numa_swap
+ *
+ * Make rep the replica of the given slot and free the previous one once
+ * no reader can be using it anymore
+ */
+static void
+patricia_numa_swap (patricia_numa_slot_t *slot, patricia_numa_replica_t *rep)
+{
+    patricia_numa_replica_t *old;
+    unsigned long epoch;
+
+    old = __atomic_exchange_n(&slot->cur, rep, __ATOMIC_SEQ_CST);
+
+    /*
+     * Readers that registered under the old epoch may hold old. Readers
+     * that see the new epoch load cur after the exchange above.
+     */
+    epoch = __atomic_load_n(&slot->epoch, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&slot->readers[epoch & 1], __ATOMIC_SEQ_CST)) {
+        sched_yield();
+    }
+
+    patricia_numa_replica_destroy(old);
+}
+
+/*
+ * patricia_numa_print_stats
+ *
+ * Dump the stats for the given tree
+ */
+void
+patricia_numa_print_stats (patricia_numa_t *numa)
+{
+#ifdef PATRICIA_STATS_ON
+    patricia_numa_replica_t *rep;
+    uint32_t node;
+    int where;
+
+    /* Sanity check */
+    if (!numa) {
+        return;
+    }
+
+    printf("\nTotal number of nodes: %u\n", numa->node_count);
+    printf("Total number of publishes: %lu\n", numa->publishes);
+    printf("Pending updates: %u\n", numa->pending);
+    for (node = 0; node < PATRICIA_NUMA_MAX_NODES; node++) {
+        if (!numa->online[node]) {
+            continue;
+        }
+        rep = numa->slot[node].cur;
+        if (!rep) {
+            printf("Node %u: %lu lookups, no replica\n", node,
+                   numa->slot[node].lookups);
+            continue;
+        }
+
+        /* Ask the kernel where the replica really is */
+        where = -1;
+        syscall(SYS_get_mempolicy, &where, NULL, 0, rep->buf,
+                MPOL_F_NODE | MPOL_F_ADDR);
+        printf("Node %u: %lu lookups, replica of %zu bytes on node %d\n",
+               node, numa->slot[node].lookups, rep->len, where);
+    }
+    patricia_arena_print_stats(numa->master);
+#endif
+}
+
+/*
+ * patricia_numa_lookup
+ *
+ * Look up the given key in the replica local to the caller. Returns 1 if
+ * found, 0 otherwise.
+ */
+int
+patricia_numa_lookup (patricia_numa_t *numa, const char *key)
+{
+    patricia_numa_slot_t *slot;
+    patricia_numa_replica_t *rep;
+    unsigned long epoch;
+    int ret;
+
+    /* Sanity check */
+    if (!numa || !key) {
+        return 0;
+    }
+
+    slot = &numa->slot[patricia_numa_node(numa)];
+    while (1) {
+        epoch = __atomic_load_n(&slot->epoch, __ATOMIC_ACQUIRE);
+        __atomic_fetch_add(&slot->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&slot->epoch, __ATOMIC_SEQ_CST) == epoch) {
+            break;
+        }
+        __atomic_fetch_sub(&slot->readers[epoch & 1], 1, __ATOMIC_RELEASE);
+    }
+
+    rep = __atomic_load_n(&slot->cur, __ATOMIC_ACQUIRE);
+    ret = patricia_arena_lookup(rep->arena, key);
+
+    __atomic_fetch_sub(&slot->readers[epoch & 1], 1, __ATOMIC_RELEASE);
+#ifdef PATRICIA_STATS_ON
+    __atomic_fetch_add(&slot->lookups, 1, __ATOMIC_RELAXED);
+#endif
+
+    return ret;
+}
+
+/*
+ * patricia_numa_delete
+ *
+ * Delete the given key from the master. It disappears from the replicas
+ * with the next publish. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_numa_delete (patricia_numa_t *numa, const char *key)
+{
+    /* Sanity check */
+    if (!numa || !key) {
+        return -1;
+    }
+
+    if (patricia_arena_delete(numa->master, key) != 0) {
+        return -1;
+    }
+
+    if (++numa->pending >= numa->batch) {
+        return patricia_numa_publish(numa);
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_numa_add
+ *
+ * Add the given key to the master. It shows up in the replicas with the
+ * next publish. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_numa_add (patricia_numa_t *numa, const char *key)
+{
+    /* Sanity check */
+    if (!numa || !key) {
+        return -1;
+    }
+
+    if (patricia_arena_add(numa->master, key) != 0) {
+        return -1;
+    }
+
+    if (++numa->pending >= numa->batch) {
+        return patricia_numa_publish(numa);
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_numa_publish
+ *
+ * Copy the master to every node and switch the lookups over to the new
+ * replicas. Either every node moves to the new copy or, if a replica
+ * cannot be made, none does and the updates stay pending. Returns 0 upon
+ * success, -1 upon failure.
+ */
+int
+patricia_numa_publish (patricia_numa_t *numa)
+{
+    patricia_numa_replica_t *reps[PATRICIA_NUMA_MAX_NODES];
+    uint32_t node;
+    void *image;
+    size_t len;
+
+    /* Sanity check */
+    if (!numa) {
+        return -1;
+    }
+
+    /* Do not copy the dead space to every node */
+    if (PATRICIA_ARENA_HDR(numa->master)->dead &&
+        patricia_arena_compact(numa->master) != 0) {
+        return -1;
+    }
+    image = patricia_arena_image(numa->master, &len);
+
+    /* Build all the replicas before any node is switched */
+    memset(reps, 0, sizeof(reps));
+    for (node = 0; node < PATRICIA_NUMA_MAX_NODES; node++) {
+        if (!numa->online[node]) {
+            continue;
+        }
+        reps[node] = patricia_numa_replica_create(image, len, node);
+        if (!reps[node]) {
+            for (node = 0; node < PATRICIA_NUMA_MAX_NODES; node++) {
+                patricia_numa_replica_destroy(reps[node]);
+            }
+            return -1;
+        }
+    }
+
+    for (node = 0; node < PATRICIA_NUMA_MAX_NODES; node++) {
+        if (reps[node]) {
+            patricia_numa_swap(&numa->slot[node], reps[node]);
+        }
+    }
+    numa->pending = 0;
+    numa->publishes++;
+
+    return 0;
+}
+
+/*
+ * patricia_numa_destroy
+ *
+ * Free the replicas and the master. There must be no lookups in flight.
+ */
+int
+patricia_numa_destroy (patricia_numa_t *numa)
+{
+    uint32_t node;
+
+    /* Sanity check */
+    if (!numa) {
+        return -1;
+    }
+
+    for (node = 0; node < PATRICIA_NUMA_MAX_NODES; node++) {
+        patricia_numa_replica_destroy(numa->slot[node].cur);
+    }
+    patricia_arena_destroy(numa->master);
+    free(numa);
+
+    return 0;
+}
+
+/*
+ * patricia_numa_init
+ *
+ * Replicate the given arena on every NUMA node. The arena becomes the
+ * master and is freed with the tree. Updates are published every batch
+ * updates, or with PATRICIA_NUMA_DEFAULT_BATCH if batch is 0.
+ */
+patricia_numa_t *
+patricia_numa_init (patricia_arena_t *arena, uint32_t batch)
+{
+    uint8_t cpus[PATRICIA_NUMA_MAX_CPUS];
+    patricia_numa_t *numa;
+    char path[128];
+    uint32_t node, first, cpu;
+    void *mem;
+
+    /* Sanity check */
+    if (!arena || !arena->owned) {
+        return NULL;
+    }
+
+    if (posix_memalign(&mem, 64, sizeof(patricia_numa_t)) != 0) {
+        return NULL;
+    }
+    numa = (patricia_numa_t *)mem;
+    memset(numa, 0, sizeof(patricia_numa_t));
+    numa->batch = batch ? batch : PATRICIA_NUMA_DEFAULT_BATCH;
+
+    /* Without NUMA sysfs there is a single node */
+    if (patricia_numa_read_list("/sys/devices/system/node/online",
+                                numa->online, PATRICIA_NUMA_MAX_NODES) != 0) {
+        memset(numa->online, 0, sizeof(numa->online));
+        numa->online[0] = 1;
+    }
+
+    first = PATRICIA_NUMA_MAX_NODES;
+    for (node = 0; node < PATRICIA_NUMA_MAX_NODES; node++) {
+        if (!numa->online[node]) {
+            continue;
+        }
+        numa->node_count++;
+        if (first == PATRICIA_NUMA_MAX_NODES) {
+            first = node;
+        }
+    }
+    memset(numa->cpu_node, first, sizeof(numa->cpu_node));
+
+    /* Map every CPU to its node once, lookups only need sched_getcpu */
+    for (node = 0; node < PATRICIA_NUMA_MAX_NODES; node++) {
+        if (!numa->online[node]) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%u/cpulist",
+                 node);
+        memset(cpus, 0, sizeof(cpus));
+        if (patricia_numa_read_list(path, cpus, PATRICIA_NUMA_MAX_CPUS) != 0) {
+            continue;
+        }
+        for (cpu = 0; cpu < PATRICIA_NUMA_MAX_CPUS; cpu++) {
+            if (cpus[cpu]) {
+                numa->cpu_node[cpu] = node;
+            }
+        }
+    }
+
+    numa->master = arena;
+    if (patricia_numa_publish(numa) != 0) {
+        for (node = 0; node < PATRICIA_NUMA_MAX_NODES; node++) {
+            patricia_numa_replica_destroy(numa->slot[node].cur);
+        }
+        free(numa);
+        return NULL;
+    }
+
+    return numa;
+}
+
+/* End of File */
@@ -0,0 +1,67 @@
+/*
+ * patricia_numa.h - Header file for the NUMA replicated arena tree
+ *
+ * Read-only copies of an arena tree are kept in the memory of every NUMA
+ * node and each lookup is served from the copy local to the CPU it runs
+ * on. A single writer changes a private copy and publishes it to all the
+ * nodes in batches.
+ */
+
+#ifndef PATRICIA_NUMA_H
+#define PATRICIA_NUMA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia_arena.h"
+
+/* Defines */
+
+#define PATRICIA_NUMA_MAX_NODES     64
+#define PATRICIA_NUMA_MAX_CPUS      1024
+#define PATRICIA_NUMA_DEFAULT_BATCH 1024        /* Updates per publish */
+
+/* Datastructures */
+
+/* One published copy of the tree, in the memory of one node */
+typedef struct patricia_numa_replica_s {
+    patricia_arena_t    *arena;
+    char                *buf;
+    size_t              len;
+} patricia_numa_replica_t;
+
+/*
+ * Per node slot, padded to a cache line. Readers register in
+ * readers[epoch & 1] before they load cur, so the writer knows when the
+ * previous replica is no longer in use.
+ */
+typedef struct patricia_numa_slot_s {
+    patricia_numa_replica_t *cur;
+    unsigned long           epoch;
+    unsigned long           readers[2];
+    unsigned long           lookups;
+    char                    pad[24];
+} patricia_numa_slot_t;
+
+/* Allocated cache line aligned, slot[] comes first to stay aligned */
+typedef struct patricia_numa_s {
+    patricia_numa_slot_t    slot[PATRICIA_NUMA_MAX_NODES];
+    patricia_arena_t        *master;        /* The writer's copy */
+    uint32_t                node_count;
+    uint32_t                batch;
+    uint32_t                pending;        /* Updates not published yet */
+    unsigned long           publishes;
+    uint8_t                 online[PATRICIA_NUMA_MAX_NODES];
+    uint8_t                 cpu_node[PATRICIA_NUMA_MAX_CPUS];
+} patricia_numa_t;
+
+/* Function Prototypes */
+
+void patricia_numa_print_stats (patricia_numa_t *numa);
+int patricia_numa_lookup (patricia_numa_t *numa, const char *key);
+int patricia_numa_delete (patricia_numa_t *numa, const char *key);
+int patricia_numa_add (patricia_numa_t *numa, const char *key);
+int patricia_numa_publish (patricia_numa_t *numa);
+int patricia_numa_destroy (patricia_numa_t *numa);
+patricia_numa_t *patricia_numa_init (patricia_arena_t *arena, uint32_t batch);
+
+#endif /* PATRICIA_NUMA_H */
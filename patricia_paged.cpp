@@ -0,0 +1,1220 @@
+/*
+ * patricia_paged.c
+ *
+ * This file implements a trie stored in a file of fixed-size pages, for
+ * key sets larger than memory. It follows the B-trie: the top of the trie
+ * is made of trie pages, each holding one node with a slot per byte, and
+ * the keys below them are kept in bucket pages as sorted strings. A bucket
+ * serves a range of consecutive slots of its parent. When it fills up, the
+ * range is split in two, and a bucket serving a single slot is burst into
+ * a new trie node with the first byte of its strings stripped. Lookups
+ * read one page per trie level and then binary search a single bucket.
+ *
+ * As in the in-memory tree, a trie node carries a label with the bytes
+ * all the keys under it share, so a long common prefix takes one page
+ * instead of one per byte. A key leaving a label in the middle splits the
+ * node in two.
+ *
+ * Pages are accessed through a buffer pool of a fixed number of frames,
+ * replaced with the clock algorithm. Dirty pages are written back when
+ * they are evicted or on patricia_paged_flush. A page is pinned while it is
+ * being used, so the pool needs a few frames for the pages an add holds at
+ * once.
+ *
+ * A key reaching a bucket at depth d, with d of its bytes consumed by the
+ * trie nodes above, is stored from its byte d - 1 on, the byte that picked
+ * the slot, since one bucket can hold keys for several slots.
+ *
+ * Keys can be added, looked up and scanned by prefix. There is no delete.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "patricia_paged.h"
+
+#define PATRICIA_PAGED_DIR_START    offsetof(patricia_paged_bucket_t, off)
+
+/*
+ * patricia_paged_io
+ *
+ * Read or write one page. Returns 0 upon success, -1 upon failure.
+ */
+static int
+patricia_paged_io (patricia_paged_t *pt, uint32_t page, char *data,
+                   int write)
+{
+    off_t pos = (off_t)page * PATRICIA_PAGED_PAGE_SIZE;
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < PATRICIA_PAGED_PAGE_SIZE) {
+        if (write) {
+            n = pwrite(pt->fd, data + done, PATRICIA_PAGED_PAGE_SIZE - done,
+                       pos + done);
+        } else {
+            n = pread(pt->fd, data + done, PATRICIA_PAGED_PAGE_SIZE - done,
+                      pos + done);
+        }
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        done += n;
+    }
+
+#ifdef PATRICIA_STATS_ON
+    if (write) {
+        pt->writes++;
+    } else {
+        pt->reads++;
+    }
+#endif
+
+    return 0;
+}
+
+/*
+ * patricia_paged_evict
+ *
+ * Pick a frame to reuse with the clock algorithm, writing its page back if
+ * it is dirty. Returns the frame, empty and unpinned, or NULL upon failure
+ * or when every frame is pinned.
+ */
+static patricia_paged_frame_t *
+patricia_paged_evict (patricia_paged_t *pt)
+{
+    patricia_paged_frame_t *frame;
+    uint32_t i;
+
+    /* Skip pinned frames, give referenced ones a second chance */
+    frame = NULL;
+    for (i = 0; i < 2 * pt->frame_count + 1; i++) {
+        frame = &pt->frames[pt->hand];
+        pt->hand = (pt->hand + 1) % pt->frame_count;
+        if (frame->pins) {
+            frame = NULL;
+            continue;
+        }
+        if (frame->ref) {
+            frame->ref = 0;
+            frame = NULL;
+            continue;
+        }
+        break;
+    }
+    if (!frame) {
+        return NULL;
+    }
+
+    if (frame->page) {
+        if (frame->dirty &&
+            patricia_paged_io(pt, frame->page, frame->data, 1) != 0) {
+            return NULL;
+        }
+        pt->where[frame->page] = 0;
+        frame->page = 0;
+        frame->dirty = 0;
+    }
+
+    return frame;
+}
+
+/*
+ * patricia_paged_get
+ *
+ * Pin the given page in the pool and return its frame. A fresh page is
+ * zeroed instead of read. Returns NULL upon failure or when every frame is
+ * pinned.
+ */
+static patricia_paged_frame_t *
+patricia_paged_get (patricia_paged_t *pt, uint32_t page, int fresh)
+{
+    patricia_paged_frame_t *frame;
+
+    if (page >= pt->where_size) {
+        return NULL;
+    }
+
+    if (pt->where[page]) {
+        frame = &pt->frames[pt->where[page] - 1];
+        frame->pins++;
+        frame->ref = 1;
+#ifdef PATRICIA_STATS_ON
+        pt->hits++;
+#endif
+        return frame;
+    }
+
+    frame = patricia_paged_evict(pt);
+    if (!frame) {
+        return NULL;
+    }
+
+    if (fresh) {
+        memset(frame->data, 0, PATRICIA_PAGED_PAGE_SIZE);
+    } else if (patricia_paged_io(pt, page, frame->data, 0) != 0) {
+        return NULL;
+    }
+
+    frame->page = page;
+    frame->pins = 1;
+    frame->ref = 1;
+    pt->where[page] = frame - pt->frames + 1;
+
+    return frame;
+}
+
+/*
+ * patricia_paged_put
+ *
+ * Unpin a frame, marking it dirty if it was changed
+ */
+static inline void
+patricia_paged_put (patricia_paged_frame_t *frame, int dirty)
+{
+    if (frame) {
+        frame->pins--;
+        frame->dirty |= dirty;
+    }
+}
+
+/*
+ * patricia_paged_new
+ *
+ * Append a page to the file and return its frame, pinned and dirty, with
+ * the page number in *page
+ */
+static patricia_paged_frame_t *
+patricia_paged_new (patricia_paged_t *pt, uint32_t *page)
+{
+    patricia_paged_frame_t *frame;
+    uint32_t *where, size;
+
+    if (pt->meta.page_count == pt->where_size) {
+        size = pt->where_size * 2;
+        where = (uint32_t *)realloc(pt->where, size * sizeof(uint32_t));
+        if (!where) {
+            return NULL;
+        }
+        memset(where + pt->where_size, 0,
+               (size - pt->where_size) * sizeof(uint32_t));
+        pt->where = where;
+        pt->where_size = size;
+    }
+
+    frame = patricia_paged_get(pt, pt->meta.page_count, 1);
+    if (!frame) {
+        return NULL;
+    }
+    frame->dirty = 1;
+    *page = pt->meta.page_count++;
+
+    return frame;
+}
+
+/*
+ * patricia_paged_entry
+ *
+ * Return the bytes of entry i of the bucket and its length in *len
+ */
+static inline const char *
+patricia_paged_entry (patricia_paged_bucket_t *b, uint32_t i, uint32_t *len)
+{
+    uint16_t l;
+
+    memcpy(&l, (char *)b + b->off[i], sizeof(l));
+    *len = l;
+    return (char *)b + b->off[i] + sizeof(l);
+}
+
+/*
+ * patricia_paged_bucket_init
+ *
+ * Make the page an empty bucket for the slots lo to hi
+ */
+static void
+patricia_paged_bucket_init (patricia_paged_bucket_t *b, uint8_t lo,
+                            uint8_t hi)
+{
+    b->type = PATRICIA_PAGED_BUCKET;
+    b->count = 0;
+    b->heap = PATRICIA_PAGED_PAGE_SIZE;
+    b->lo = lo;
+    b->hi = hi;
+}
+
+/*
+ * patricia_paged_bucket_find
+ *
+ * Binary search the bucket for the string. Returns 1 if found, 0 if not,
+ * with the position it goes to in *pos either way.
+ */
+static int
+patricia_paged_bucket_find (patricia_paged_bucket_t *b, const char *s,
+                            uint32_t len, uint32_t *pos)
+{
+    const char *e;
+    uint32_t lo, hi, mid, elen;
+    int cmp;
+
+    lo = 0;
+    hi = b->count;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        e = patricia_paged_entry(b, mid, &elen);
+        cmp = memcmp(e, s, (elen < len) ? elen : len);
+        if (cmp == 0) {
+            cmp = (elen < len) ? -1 : (elen > len);
+        }
+        if (cmp == 0) {
+            *pos = mid;
+            return 1;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    *pos = lo;
+    return 0;
+}
+
+/*
+ * patricia_paged_bucket_insert
+ *
+ * Insert the string at position pos of the bucket. Returns 0 upon success,
+ * -1 if it does not fit.
+ */
+static int
+patricia_paged_bucket_insert (patricia_paged_bucket_t *b, uint32_t pos,
+                              const char *s, uint32_t len)
+{
+    uint16_t l = len;
+
+    if (b->heap < PATRICIA_PAGED_DIR_START + (b->count + 1) * sizeof(uint16_t) +
+                  sizeof(l) + len) {
+        return -1;
+    }
+
+    b->heap -= sizeof(l) + len;
+    memcpy((char *)b + b->heap, &l, sizeof(l));
+    memcpy((char *)b + b->heap + sizeof(l), s, len);
+    memmove(&b->off[pos + 1], &b->off[pos],
+            (b->count - pos) * sizeof(uint16_t));
+    b->off[pos] = b->heap;
+    b->count++;
+
+    return 0;
+}
+
+/*
+ * patricia_paged_split
+ *
+ * Make room in the full bucket in frame, whose parent trie node is in
+ * pframe. A bucket for several slots is split in two, one for a single
+ * slot is burst into a trie node. The caller retries its add afterwards.
+ * Returns 0 upon success, -1 upon failure.
+ */
+static int
+patricia_paged_split (patricia_paged_t *pt, patricia_paged_frame_t *pframe,
+                      patricia_paged_frame_t *frame)
+{
+    patricia_paged_bucket_t *b, *nb, *old;
+    patricia_paged_trie_t *parent, *t;
+    patricia_paged_frame_t *nframe;
+    uint32_t counts[256], i, c, len, left, best, best_left, page, skip, llen;
+    uint8_t lo, hi, first, last;
+    char tmp[PATRICIA_PAGED_PAGE_SIZE];
+    const char *e, *l;
+    long diff, best_diff;
+
+    parent = (patricia_paged_trie_t *)pframe->data;
+    b = (patricia_paged_bucket_t *)frame->data;
+    memcpy(tmp, b, PATRICIA_PAGED_PAGE_SIZE);
+    old = (patricia_paged_bucket_t *)tmp;
+    lo = old->lo;
+    hi = old->hi;
+
+    if (lo < hi) {
+        /* Split the range where it halves the strings best */
+        memset(counts, 0, sizeof(counts));
+        for (i = 0; i < old->count; i++) {
+            e = patricia_paged_entry(old, i, &len);
+            counts[(uint8_t)e[0]]++;
+        }
+        best = lo + 1;
+        best_left = 0;
+        best_diff = -1;
+        left = 0;
+        for (c = lo + 1; c <= hi; c++) {
+            left += counts[c - 1];
+            diff = labs(2 * (long)left - (long)old->count);
+            if (best_diff < 0 || diff < best_diff) {
+                best = c;
+                best_left = left;
+                best_diff = diff;
+            }
+        }
+
+        /*
+         * All the strings start with the same byte. Narrow the bucket to
+         * that slot, so that the next attempt bursts it.
+         */
+        if (best_left == 0 || best_left == old->count) {
+            e = patricia_paged_entry(old, 0, &len);
+            first = (uint8_t)e[0];
+            for (c = lo; c <= hi; c++) {
+                if (c != first) {
+                    parent->child[c] = 0;
+                }
+            }
+            b->lo = first;
+            b->hi = first;
+            return 0;
+        }
+
+        nframe = patricia_paged_new(pt, &page);
+        if (!nframe) {
+            return -1;
+        }
+        nb = (patricia_paged_bucket_t *)nframe->data;
+        patricia_paged_bucket_init(b, lo, best - 1);
+        patricia_paged_bucket_init(nb, best, hi);
+        for (i = 0; i < old->count; i++) {
+            e = patricia_paged_entry(old, i, &len);
+            if ((uint8_t)e[0] < best) {
+                patricia_paged_bucket_insert(b, b->count, e, len);
+            } else {
+                patricia_paged_bucket_insert(nb, nb->count, e, len);
+            }
+        }
+        for (c = best; c <= hi; c++) {
+            parent->child[c] = page;
+        }
+        patricia_paged_put(nframe, 1);
+        return 0;
+    }
+
+    /*
+     * Burst. All the strings start with the slot byte, a trie node takes
+     * the place of the bucket and the bucket keeps the strings minus that
+     * byte, for the slots their next byte picks. Bytes all the strings
+     * share after it go to the label of the node, as in a patricia tree,
+     * so that a long common prefix does not turn into a chain of pages.
+     * The strings are sorted, the first and the last bound what is shared.
+     */
+    nframe = patricia_paged_new(pt, &page);
+    if (!nframe) {
+        return -1;
+    }
+    t = (patricia_paged_trie_t *)nframe->data;
+    t->type = PATRICIA_PAGED_TRIE;
+
+    e = patricia_paged_entry(old, 0, &len);
+    l = patricia_paged_entry(old, old->count - 1, &llen);
+    skip = 1;
+    while (skip < len && skip < llen && e[skip] == l[skip]) {
+        skip++;
+    }
+    t->label_len = skip - 1;
+    memcpy(t->label, e + 1, skip - 1);
+
+    first = 255;
+    last = 0;
+    for (i = 0; i < old->count; i++) {
+        e = patricia_paged_entry(old, i, &len);
+        if (len > skip) {
+            first = ((uint8_t)e[skip] < first) ? (uint8_t)e[skip] : first;
+            last = ((uint8_t)e[skip] > last) ? (uint8_t)e[skip] : last;
+        }
+    }
+    patricia_paged_bucket_init(b, first, last);
+    for (i = 0; i < old->count; i++) {
+        e = patricia_paged_entry(old, i, &len);
+        if (len == skip) {
+            t->eos = 1;
+        } else {
+            patricia_paged_bucket_insert(b, b->count, e + skip, len - skip);
+        }
+    }
+    for (c = first; c <= last; c++) {
+        t->child[c] = frame->page;
+    }
+    parent->child[lo] = page;
+    patricia_paged_put(nframe, 1);
+
+    return 0;
+}
+
+/*
+ * patricia_paged_split_label
+ *
+ * Add a key that leaves the label of the trie page in frame after m bytes.
+ * A new trie page with the first m bytes of the label takes its place in
+ * slot pc of the parent. The old page keeps the label past the byte that
+ * now selects it, the key gets a bucket of its own unless it ends at the
+ * new node. key and klen are the rest of the key from the label on.
+ * Returns 0 upon success, -1 upon failure.
+ */
+static int
+patricia_paged_split_label (patricia_paged_t *pt,
+                            patricia_paged_frame_t *pframe, uint8_t pc,
+                            patricia_paged_frame_t *frame, uint32_t m,
+                            const char *key, uint32_t klen)
+{
+    patricia_paged_frame_t *nframe, *bframe;
+    patricia_paged_trie_t *parent, *t, *nt;
+    patricia_paged_bucket_t *b;
+    uint32_t page, bpage;
+    uint8_t c;
+
+    nframe = patricia_paged_new(pt, &page);
+    if (!nframe) {
+        return -1;
+    }
+    bframe = NULL;
+    if (m < klen) {
+        bframe = patricia_paged_new(pt, &bpage);
+        if (!bframe) {
+            patricia_paged_put(nframe, 1);
+            return -1;
+        }
+    }
+
+    parent = (patricia_paged_trie_t *)pframe->data;
+    t = (patricia_paged_trie_t *)frame->data;
+    nt = (patricia_paged_trie_t *)nframe->data;
+    nt->type = PATRICIA_PAGED_TRIE;
+    nt->label_len = m;
+    memcpy(nt->label, t->label, m);
+    c = (uint8_t)t->label[m];
+    nt->child[c] = frame->page;
+    memmove(t->label, t->label + m + 1, t->label_len - m - 1);
+    t->label_len -= m + 1;
+
+    if (bframe) {
+        c = (uint8_t)key[m];
+        b = (patricia_paged_bucket_t *)bframe->data;
+        patricia_paged_bucket_init(b, c, c);
+        patricia_paged_bucket_insert(b, 0, key + m, klen - m);
+        nt->child[c] = bpage;
+        patricia_paged_put(bframe, 1);
+    } else {
+        nt->eos = 1;
+    }
+    parent->child[pc] = page;
+    pt->meta.key_count++;
+    patricia_paged_put(nframe, 1);
+
+    return 0;
+}
+
+/*
+ * patricia_paged_add_internal
+ *
+ * Try to add the key. Returns 0 when done, 1 if a bucket had to be split
+ * and the add must be retried, -1 upon failure.
+ */
+static int
+patricia_paged_add_internal (patricia_paged_t *pt, const char *key,
+                             uint32_t klen)
+{
+    patricia_paged_frame_t *frame, *pframe, *nframe;
+    patricia_paged_bucket_t *b;
+    patricia_paged_trie_t *t;
+    uint32_t depth, child, pos, page, m;
+    uint8_t c, pc;
+    int ret;
+
+    pframe = NULL;
+    pc = 0;
+    frame = patricia_paged_get(pt, pt->meta.root, 0);
+    if (!frame) {
+        return -1;
+    }
+
+    depth = 0;
+    while (*(uint16_t *)frame->data == PATRICIA_PAGED_TRIE) {
+        t = (patricia_paged_trie_t *)frame->data;
+        m = 0;
+        while (m < t->label_len && depth + m < klen &&
+               t->label[m] == key[depth + m]) {
+            m++;
+        }
+        if (m < t->label_len) {
+            /* The root has no label, so there is a parent here */
+            ret = patricia_paged_split_label(pt, pframe, pc, frame, m,
+                                             key + depth, klen - depth);
+            patricia_paged_put(pframe, 1);
+            patricia_paged_put(frame, 1);
+            return ret;
+        }
+        depth += m;
+
+        if (depth == klen) {
+            if (!t->eos) {
+                t->eos = 1;
+                pt->meta.key_count++;
+            }
+            patricia_paged_put(pframe, 0);
+            patricia_paged_put(frame, 1);
+            return 0;
+        }
+
+        /* Nothing under this slot yet, give it a bucket of its own */
+        c = (uint8_t)key[depth];
+        child = t->child[c];
+        if (!child) {
+            nframe = patricia_paged_new(pt, &page);
+            ret = -1;
+            if (nframe) {
+                b = (patricia_paged_bucket_t *)nframe->data;
+                patricia_paged_bucket_init(b, c, c);
+                patricia_paged_bucket_insert(b, 0, key + depth,
+                                             klen - depth);
+                t->child[c] = page;
+                pt->meta.key_count++;
+                patricia_paged_put(nframe, 1);
+                ret = 0;
+            }
+            patricia_paged_put(pframe, 0);
+            patricia_paged_put(frame, 1);
+            return ret;
+        }
+
+        patricia_paged_put(pframe, 0);
+        pframe = frame;
+        pc = c;
+        depth++;
+        frame = patricia_paged_get(pt, child, 0);
+        if (!frame) {
+            patricia_paged_put(pframe, 0);
+            return -1;
+        }
+    }
+
+    b = (patricia_paged_bucket_t *)frame->data;
+    if (patricia_paged_bucket_find(b, key + depth - 1, klen - depth + 1,
+                                   &pos)) {
+        ret = 0;
+    } else if (patricia_paged_bucket_insert(b, pos, key + depth - 1,
+                                            klen - depth + 1) == 0) {
+        pt->meta.key_count++;
+        ret = 0;
+    } else {
+        ret = (patricia_paged_split(pt, pframe, frame) == 0) ? 1 : -1;
+    }
+    patricia_paged_put(pframe, ret == 1);
+    patricia_paged_put(frame, 1);
+
+    return ret;
+}
+
+/*
+ * patricia_paged_walk_internal
+ *
+ * Recursive routine which invokes fn on every key under the trie page at
+ * the given depth. buf[0..depth] holds the bytes leading to it, up to its
+ * label. No page is kept pinned across the recursion.
+ */
+static int
+patricia_paged_walk_internal (patricia_paged_t *pt, uint32_t page,
+                              uint32_t depth, char *buf,
+                              patricia_paged_fn fn, void *arg)
+{
+    patricia_paged_frame_t *frame;
+    patricia_paged_bucket_t *b;
+    patricia_paged_trie_t *t;
+    uint32_t *kids, prev, i, c, len;
+    const char *e;
+    int ret;
+
+    kids = (uint32_t *)malloc(256 * sizeof(uint32_t));
+    if (!kids) {
+        return -1;
+    }
+
+    frame = patricia_paged_get(pt, page, 0);
+    if (!frame) {
+        free(kids);
+        return -1;
+    }
+    t = (patricia_paged_trie_t *)frame->data;
+    memcpy(kids, t->child, 256 * sizeof(uint32_t));
+    memcpy(buf + depth, t->label, t->label_len);
+    depth += t->label_len;
+    ret = 0;
+    if (t->eos) {
+        buf[depth] = 0;
+        ret = fn(buf, depth, arg);
+    }
+    patricia_paged_put(frame, 0);
+
+    /* A bucket shared by consecutive slots is visited once */
+    prev = 0;
+    for (c = 0; c < 256 && ret == 0; c++) {
+        if (!kids[c] || kids[c] == prev) {
+            continue;
+        }
+        prev = kids[c];
+
+        frame = patricia_paged_get(pt, kids[c], 0);
+        if (!frame) {
+            ret = -1;
+            break;
+        }
+        if (*(uint16_t *)frame->data == PATRICIA_PAGED_TRIE) {
+            patricia_paged_put(frame, 0);
+            buf[depth] = c;
+            ret = patricia_paged_walk_internal(pt, kids[c], depth + 1, buf,
+                                               fn, arg);
+            continue;
+        }
+
+        b = (patricia_paged_bucket_t *)frame->data;
+        for (i = 0; i < b->count && ret == 0; i++) {
+            e = patricia_paged_entry(b, i, &len);
+            memcpy(buf + depth, e, len);
+            buf[depth + len] = 0;
+            ret = fn(buf, depth + len, arg);
+        }
+        patricia_paged_put(frame, 0);
+    }
+    free(kids);
+
+    return ret;
+}
+
+/*
+ * patricia_paged_descend
+ *
+ * One step of a lookup, on the pinned page in frame with *depth bytes of
+ * the key consumed. Returns 1 if the page shows the key is there, 0 if it
+ * is not, or PATRICIA_PAGED_MORE with the page to go on with in *page.
+ */
+static int
+patricia_paged_descend (patricia_paged_frame_t *frame, const char *key,
+                        uint32_t klen, uint32_t *depth, uint32_t *page)
+{
+    patricia_paged_bucket_t *b;
+    patricia_paged_trie_t *t;
+    uint32_t pos;
+
+    if (*(uint16_t *)frame->data == PATRICIA_PAGED_BUCKET) {
+        b = (patricia_paged_bucket_t *)frame->data;
+        return patricia_paged_bucket_find(b, key + *depth - 1,
+                                          klen - *depth + 1, &pos);
+    }
+
+    t = (patricia_paged_trie_t *)frame->data;
+    if (klen - *depth < t->label_len ||
+        memcmp(key + *depth, t->label, t->label_len) != 0) {
+        return 0;
+    }
+    *depth += t->label_len;
+    if (*depth == klen) {
+        return t->eos;
+    }
+    *page = t->child[(uint8_t)key[*depth]];
+    if (!*page) {
+        return 0;
+    }
+    (*depth)++;
+
+    return PATRICIA_PAGED_MORE;
+}
+
+/*
+ * patricia_paged_free
+ *
+ * Free the tree without writing anything out
+ */
+static void
+patricia_paged_free (patricia_paged_t *pt)
+{
+    if (pt->fd >= 0) {
+        close(pt->fd);
+    }
+    if (pt->frames) {
+        free(pt->frames[0].data);
+    }
+    free(pt->frames);
+    free(pt->where);
+    free(pt);
+}
+
+/*
+ * patricia_paged_print_stats
+ *
+ * Dump the stats for the given tree
+ */
+void
+patricia_paged_print_stats (patricia_paged_t *pt)
+{
+#ifdef PATRICIA_STATS_ON
+    /* Sanity check */
+    if (!pt) {
+        return;
+    }
+
+    printf("\nTotal number of keys: %lu\n",
+           (unsigned long)pt->meta.key_count);
+    printf("Total number of pages: %u (%lu bytes)\n", pt->meta.page_count,
+           (unsigned long)pt->meta.page_count * PATRICIA_PAGED_PAGE_SIZE);
+    printf("Buffer pool frames: %u\n", pt->frame_count);
+    printf("Total number of operations: %lu\n", pt->ops);
+    printf("Total number of pool hits: %lu\n", pt->hits);
+    printf("Total number of page reads: %lu\n", pt->reads);
+    printf("Total number of page writes: %lu\n", pt->writes);
+    if (pt->ops) {
+        printf("Page reads per operation: %.3f\n",
+               (double)pt->reads / pt->ops);
+    }
+    printf("\n");
+#endif
+}
+
+/*
+ * patricia_paged_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 if not, -1 upon failure.
+ */
+int
+patricia_paged_lookup (patricia_paged_t *pt, const char *key)
+{
+    patricia_paged_frame_t *frame;
+    uint32_t klen, depth, page;
+    int ret;
+
+    /* Sanity check */
+    if (!pt || !key) {
+        return -1;
+    }
+
+#ifdef PATRICIA_STATS_ON
+    pt->ops++;
+#endif
+    klen = strlen(key);
+    depth = 0;
+    page = pt->meta.root;
+    do {
+        frame = patricia_paged_get(pt, page, 0);
+        if (!frame) {
+            return -1;
+        }
+        ret = patricia_paged_descend(frame, key, klen, &depth, &page);
+        patricia_paged_put(frame, 0);
+    } while (ret == PATRICIA_PAGED_MORE);
+
+    return ret;
+}
+
+/*
+ * patricia_paged_lookup_step
+ *
+ * Take one step of a lookup without doing any I/O, for callers that read
+ * the pages themselves. *depth and *page start at 0 and the root. Returns
+ * 1 or 0 once the key is found or not, PATRICIA_PAGED_MORE after moving
+ * *page one level down and PATRICIA_PAGED_MISS if *page is not in the
+ * pool, in which case it has to be read with patricia_paged_reserve and
+ * patricia_paged_install first.
+ */
+int
+patricia_paged_lookup_step (patricia_paged_t *pt, const char *key,
+                            uint32_t klen, uint32_t *depth, uint32_t *page)
+{
+    patricia_paged_frame_t *frame;
+    int ret;
+
+    /* Sanity check */
+    if (!pt || !key || !depth || !page || *page >= pt->where_size) {
+        return -1;
+    }
+
+    if (!pt->where[*page]) {
+        return PATRICIA_PAGED_MISS;
+    }
+    frame = patricia_paged_get(pt, *page, 0);
+    ret = patricia_paged_descend(frame, key, klen, depth, page);
+    patricia_paged_put(frame, 0);
+
+    return ret;
+}
+
+/*
+ * patricia_paged_reserve
+ *
+ * Take a frame for a page that is not in the pool, for the caller to read
+ * it into frame->data. The frame stays pinned and the page unknown to the
+ * pool until patricia_paged_install. Returns NULL upon failure, when the
+ * page is already in the pool or when every frame is pinned.
+ */
+patricia_paged_frame_t *
+patricia_paged_reserve (patricia_paged_t *pt, uint32_t page)
+{
+    patricia_paged_frame_t *frame;
+
+    /* Sanity check */
+    if (!pt || page >= pt->meta.page_count || pt->where[page]) {
+        return NULL;
+    }
+
+    frame = patricia_paged_evict(pt);
+    if (!frame) {
+        return NULL;
+    }
+    frame->page = page;
+    frame->pins = 1;
+    frame->ref = 1;
+
+    return frame;
+}
+
+/*
+ * patricia_paged_install
+ *
+ * Hand a reserved frame back to the pool. If ok is set its data now holds
+ * the page and the page joins the pool, still pinned until
+ * patricia_paged_release, otherwise the frame is freed.
+ */
+void
+patricia_paged_install (patricia_paged_t *pt, patricia_paged_frame_t *frame,
+                        int ok)
+{
+    /* Sanity check */
+    if (!pt || !frame) {
+        return;
+    }
+
+    if (ok) {
+        pt->where[frame->page] = frame - pt->frames + 1;
+#ifdef PATRICIA_STATS_ON
+        pt->reads++;
+#endif
+        return;
+    }
+    frame->page = 0;
+    frame->ref = 0;
+    frame->pins--;
+}
+
+/*
+ * patricia_paged_release
+ *
+ * Unpin a frame installed with patricia_paged_install
+ */
+void
+patricia_paged_release (patricia_paged_frame_t *frame)
+{
+    patricia_paged_put(frame, 0);
+}
+
+/*
+ * patricia_paged_walk_prefix
+ *
+ * Invoke fn on every key starting with the given prefix, in lexicographical
+ * order. fn must not call back into the tree. Stops as soon as fn returns
+ * a non zero value and returns that value, or -1 upon failure.
+ */
+int
+patricia_paged_walk_prefix (patricia_paged_t *pt, const char *prefix,
+                            patricia_paged_fn fn, void *arg)
+{
+    patricia_paged_frame_t *frame;
+    patricia_paged_bucket_t *b;
+    patricia_paged_trie_t *t;
+    uint32_t plen, depth, page, pos, len;
+    char buf[PATRICIA_PAGED_MAX_KEYLEN + 1];
+    const char *e;
+    int ret;
+
+    /* Sanity check */
+    if (!pt || !prefix || !fn) {
+        return -1;
+    }
+
+    plen = strlen(prefix);
+    if (plen > PATRICIA_PAGED_MAX_KEYLEN) {
+        return 0;
+    }
+#ifdef PATRICIA_STATS_ON
+    pt->ops++;
+#endif
+    memcpy(buf, prefix, plen);
+
+    depth = 0;
+    page = pt->meta.root;
+    while (1) {
+        frame = patricia_paged_get(pt, page, 0);
+        if (!frame) {
+            return -1;
+        }
+        if (*(uint16_t *)frame->data == PATRICIA_PAGED_BUCKET) {
+            break;
+        }
+
+        /* The prefix may end inside the label */
+        t = (patricia_paged_trie_t *)frame->data;
+        len = (plen - depth < t->label_len) ? plen - depth : t->label_len;
+        if (memcmp(prefix + depth, t->label, len) != 0) {
+            patricia_paged_put(frame, 0);
+            return 0;
+        }
+        if (depth + len == plen) {
+            patricia_paged_put(frame, 0);
+            return patricia_paged_walk_internal(pt, page, depth, buf, fn,
+                                                arg);
+        }
+        depth += len;
+        page = t->child[(uint8_t)prefix[depth]];
+        patricia_paged_put(frame, 0);
+        if (!page) {
+            return 0;
+        }
+        depth++;
+    }
+
+    /* The strings with the rest of the prefix are consecutive */
+    b = (patricia_paged_bucket_t *)frame->data;
+    patricia_paged_bucket_find(b, prefix + depth - 1, plen - depth + 1, &pos);
+    ret = 0;
+    for (; pos < b->count && ret == 0; pos++) {
+        e = patricia_paged_entry(b, pos, &len);
+        if (len < plen - depth + 1 ||
+            memcmp(e, prefix + depth - 1, plen - depth + 1) != 0) {
+            break;
+        }
+        memcpy(buf + depth - 1, e, len);
+        buf[depth - 1 + len] = 0;
+        ret = fn(buf, depth - 1 + len, arg);
+    }
+    patricia_paged_put(frame, 0);
+
+    return ret;
+}
+
+/*
+ * patricia_paged_add
+ *
+ * Add the given key. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_paged_add (patricia_paged_t *pt, const char *key)
+{
+    uint32_t klen;
+    int ret;
+
+    /* Sanity check */
+    if (!pt || !key) {
+        return -1;
+    }
+
+    klen = strlen(key);
+    if (klen > PATRICIA_PAGED_MAX_KEYLEN) {
+        return -1;
+    }
+
+#ifdef PATRICIA_STATS_ON
+    pt->ops++;
+#endif
+    do {
+        ret = patricia_paged_add_internal(pt, key, klen);
+    } while (ret == 1);
+
+    return ret;
+}
+
+/*
+ * patricia_paged_flush
+ *
+ * Write all the dirty pages and the meta data to the file. Returns 0 upon
+ * success, -1 upon failure.
+ */
+int
+patricia_paged_flush (patricia_paged_t *pt)
+{
+    patricia_paged_frame_t *frame;
+    char *page;
+    uint32_t i;
+    void *mem;
+    int ret = 0;
+
+    /* Sanity check */
+    if (!pt) {
+        return -1;
+    }
+
+    for (i = 0; i < pt->frame_count; i++) {
+        frame = &pt->frames[i];
+        if (frame->page && frame->dirty) {
+            if (patricia_paged_io(pt, frame->page, frame->data, 1) != 0) {
+                return -1;
+            }
+            frame->dirty = 0;
+        }
+    }
+
+    /* The meta data goes last, once everything it refers to is written */
+    if (posix_memalign(&mem, PATRICIA_PAGED_PAGE_SIZE,
+                       PATRICIA_PAGED_PAGE_SIZE) != 0) {
+        return -1;
+    }
+    page = (char *)mem;
+    memset(page, 0, PATRICIA_PAGED_PAGE_SIZE);
+    memcpy(page, &pt->meta, sizeof(pt->meta));
+    if (fdatasync(pt->fd) != 0 ||
+        patricia_paged_io(pt, PATRICIA_PAGED_META, page, 1) != 0 ||
+        fdatasync(pt->fd) != 0) {
+        ret = -1;
+    }
+    free(page);
+
+    return ret;
+}
+
+/*
+ * patricia_paged_close
+ *
+ * Flush the tree and free it. Returns the result of the flush.
+ */
+int
+patricia_paged_close (patricia_paged_t *pt)
+{
+    int ret;
+
+    /* Sanity check */
+    if (!pt) {
+        return -1;
+    }
+
+    ret = patricia_paged_flush(pt);
+    patricia_paged_free(pt);
+
+    return ret;
+}
+
+/*
+ * patricia_paged_open
+ *
+ * Open the tree stored at path, or create it with PATRICIA_PAGED_CREATE,
+ * with a buffer pool of pool pages. PATRICIA_PAGED_DIRECT asks for
+ * O_DIRECT, so that page reads go to the device instead of the page cache,
+ * where the file system supports it.
+ */
+patricia_paged_t *
+patricia_paged_open (const char *path, uint32_t pool, uint32_t flags)
+{
+    patricia_paged_frame_t *frame;
+    patricia_paged_trie_t *t;
+    patricia_paged_t *pt;
+    uint32_t i, size;
+    int oflags;
+    char *data;
+    void *mem;
+
+    /* Sanity check */
+    if (!path) {
+        return NULL;
+    }
+
+    if (pool < PATRICIA_PAGED_MIN_POOL) {
+        pool = PATRICIA_PAGED_MIN_POOL;
+    }
+
+    pt = (patricia_paged_t *)calloc(1, sizeof(patricia_paged_t));
+    if (!pt) {
+        return NULL;
+    }
+    pt->fd = -1;
+
+    oflags = O_RDWR;
+    if (flags & PATRICIA_PAGED_CREATE) {
+        oflags |= O_CREAT | O_TRUNC;
+    }
+#ifdef O_DIRECT
+    if (flags & PATRICIA_PAGED_DIRECT) {
+        pt->fd = open(path, oflags | O_DIRECT, 0644);
+    }
+#endif
+    if (pt->fd < 0) {
+        pt->fd = open(path, oflags, 0644);
+    }
+    if (pt->fd < 0) {
+        free(pt);
+        return NULL;
+    }
+
+    pt->frame_count = pool;
+    pt->frames = (patricia_paged_frame_t *)calloc(pool,
+                                                  sizeof(patricia_paged_frame_t));
+    if (!pt->frames ||
+        posix_memalign(&mem, PATRICIA_PAGED_PAGE_SIZE,
+                       (size_t)pool * PATRICIA_PAGED_PAGE_SIZE) != 0) {
+        free(pt->frames);
+        pt->frames = NULL;
+        patricia_paged_free(pt);
+        return NULL;
+    }
+    data = (char *)mem;
+    for (i = 0; i < pool; i++) {
+        pt->frames[i].data = data + (size_t)i * PATRICIA_PAGED_PAGE_SIZE;
+    }
+
+    if (flags & PATRICIA_PAGED_CREATE) {
+        memcpy(pt->meta.magic, PATRICIA_PAGED_MAGIC, 4);
+        pt->meta.version = PATRICIA_PAGED_VERSION;
+        pt->meta.page_size = PATRICIA_PAGED_PAGE_SIZE;
+        pt->meta.page_count = 1;
+    } else {
+        /* Borrow a frame to read the meta data page */
+        if (patricia_paged_io(pt, PATRICIA_PAGED_META, data, 0) != 0) {
+            patricia_paged_free(pt);
+            return NULL;
+        }
+        memcpy(&pt->meta, data, sizeof(pt->meta));
+        if (memcmp(pt->meta.magic, PATRICIA_PAGED_MAGIC, 4) != 0 ||
+            pt->meta.version != PATRICIA_PAGED_VERSION ||
+            pt->meta.page_size != PATRICIA_PAGED_PAGE_SIZE ||
+            pt->meta.root == 0 || pt->meta.root >= pt->meta.page_count) {
+            patricia_paged_free(pt);
+            return NULL;
+        }
+    }
+
+    size = 1024;
+    while (size <= pt->meta.page_count) {
+        size *= 2;
+    }
+    pt->where = (uint32_t *)calloc(size, sizeof(uint32_t));
+    if (!pt->where) {
+        patricia_paged_free(pt);
+        return NULL;
+    }
+    pt->where_size = size;
+
+    /* A new tree starts with an empty trie node as its root */
+    if (flags & PATRICIA_PAGED_CREATE) {
+        frame = patricia_paged_new(pt, &pt->meta.root);
+        if (!frame) {
+            patricia_paged_free(pt);
+            return NULL;
+        }
+        t = (patricia_paged_trie_t *)frame->data;
+        t->type = PATRICIA_PAGED_TRIE;
+        patricia_paged_put(frame, 1);
+    }
+
+    return pt;
+}
+
+/* End of File */
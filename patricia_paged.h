@@ -0,0 +1,125 @@
+/*
+ * patricia_paged.h - Header file for the disk backed paged trie
+ *
+ * A trie kept in a file of fixed-size pages, B-trie style: the upper
+ * levels are pages holding one 256-way trie node, the keys themselves live
+ * in sorted bucket pages. Pages are read through a bounded buffer pool, so
+ * the key set can be much larger than memory.
+ */
+
+#ifndef PATRICIA_PAGED_H
+#define PATRICIA_PAGED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_PAGED_MAGIC        "PTPG"
+#define PATRICIA_PAGED_VERSION      1
+#define PATRICIA_PAGED_PAGE_SIZE    4096
+#define PATRICIA_PAGED_MAX_KEYLEN   1024
+#define PATRICIA_PAGED_MIN_POOL     8           /* Frames in the pool */
+#define PATRICIA_PAGED_META         0           /* Page of the meta data */
+
+/* Open flags */
+#define PATRICIA_PAGED_CREATE       0x01        /* Start a new file */
+#define PATRICIA_PAGED_DIRECT       0x02        /* Bypass the page cache */
+
+/* Page types */
+#define PATRICIA_PAGED_TRIE         1
+#define PATRICIA_PAGED_BUCKET       2
+
+/* Lookup step results, besides 1 and 0 */
+#define PATRICIA_PAGED_MORE         2           /* Go on with the next page */
+#define PATRICIA_PAGED_MISS         3           /* Page not in the pool */
+
+/* Datastructures */
+
+/* Page 0 */
+typedef struct patricia_paged_meta_s {
+    char        magic[4];
+    uint32_t    version;
+    uint32_t    page_size;
+    uint32_t    page_count;
+    uint32_t    root;
+    uint32_t    pad;
+    uint64_t    key_count;
+} patricia_paged_meta_t;
+
+/*
+ * Trie page. All the keys under the node go on with its label. Slot c then
+ * leads to the page for the keys that continue with byte c, 0 if there is
+ * none. A bucket may serve a range of consecutive slots.
+ */
+typedef struct patricia_paged_trie_s {
+    uint16_t    type;
+    uint16_t    eos;                        /* A key ends after the label */
+    uint16_t    label_len;
+    uint16_t    pad;
+    uint32_t    child[256];
+    char        label[PATRICIA_PAGED_MAX_KEYLEN];
+} patricia_paged_trie_t;
+
+/*
+ * Bucket page. Holds the rest of the keys, from the byte that selected the
+ * slot on, for the slots lo to hi of its parent. The sorted offsets grow
+ * from the header, the entries (a 16-bit length and the bytes) from the
+ * end of the page down to heap.
+ */
+typedef struct patricia_paged_bucket_s {
+    uint16_t    type;
+    uint16_t    count;
+    uint16_t    heap;
+    uint8_t     lo;
+    uint8_t     hi;
+    uint16_t    off[1];
+} patricia_paged_bucket_t;
+
+/* Buffer pool frame */
+typedef struct patricia_paged_frame_s {
+    uint32_t    page;                       /* 0 if the frame is free */
+    uint8_t     ref;                        /* Clock reference bit */
+    uint8_t     dirty;
+    uint16_t    pins;
+    char        *data;
+} patricia_paged_frame_t;
+
+typedef struct patricia_paged_s {
+    int                     fd;
+    patricia_paged_meta_t   meta;
+    patricia_paged_frame_t  *frames;
+    uint32_t                frame_count;
+    uint32_t                hand;           /* Clock hand */
+    uint32_t                *where;         /* Page to frame + 1 */
+    uint32_t                where_size;
+    unsigned long           ops;
+    unsigned long           hits;
+    unsigned long           reads;
+    unsigned long           writes;
+} patricia_paged_t;
+
+typedef int (*patricia_paged_fn) (const char *key, int len, void *arg);
+
+/* Function Prototypes */
+
+void patricia_paged_print_stats (patricia_paged_t *pt);
+int patricia_paged_lookup (patricia_paged_t *pt, const char *key);
+int patricia_paged_lookup_step (patricia_paged_t *pt, const char *key,
+                                uint32_t klen, uint32_t *depth,
+                                uint32_t *page);
+patricia_paged_frame_t *patricia_paged_reserve (patricia_paged_t *pt,
+                                                uint32_t page);
+void patricia_paged_install (patricia_paged_t *pt,
+                             patricia_paged_frame_t *frame, int ok);
+void patricia_paged_release (patricia_paged_frame_t *frame);
+int patricia_paged_walk_prefix (patricia_paged_t *pt, const char *prefix,
+                                patricia_paged_fn fn, void *arg);
+int patricia_paged_add (patricia_paged_t *pt, const char *key);
+int patricia_paged_flush (patricia_paged_t *pt);
+int patricia_paged_close (patricia_paged_t *pt);
+patricia_paged_t *patricia_paged_open (const char *path, uint32_t pool,
+                                       uint32_t flags);
+
+#endif /* PATRICIA_PAGED_H */
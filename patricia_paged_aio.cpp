@@ -0,0 +1,565 @@
+/*
+ * patricia_paged_aio.c
+ *
+ * This file implements batch lookups on a paged trie with asynchronous
+ * page reads. A plain lookup that misses in the buffer pool blocks on a
+ * pread, so a thread doing lookups keeps one read in flight and the
+ * device mostly idles. Here every lookup of the batch descends as far as
+ * the pool lets it, using patricia_paged_lookup_step. At the first page
+ * that is not there a frame is reserved and a read for it is queued, and
+ * the next lookup goes on. Queued reads are submitted together, and as
+ * each one completes, the page joins the pool and the lookups waiting on
+ * it resume. Lookups needing a page that is already being read wait on
+ * that read instead of issuing another.
+ *
+ * The reads go through io_uring, set up with the raw system calls. When
+ * it is not available, or PATRICIA_PAGED_AIO_NO_URING is given, a pool of
+ * threads doing pread takes its place. Either way the buffer pool is only
+ * touched by the thread calling patricia_paged_aio_lookup, the readers
+ * only fill the data of frames reserved for them.
+ *
+ * A page that was read stays pinned until the lookups waiting on it have
+ * taken their step, or the reads issued meanwhile could evict it again.
+ * With each read pinning a frame as well, the depth given at init is
+ * capped at half the frames of the pool.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "patricia_paged_aio.h"
+
+/*
+ * patricia_paged_aio_pread
+ *
+ * Read the page of a request, going on after partial reads and
+ * interrupts. Returns the bytes read or -errno.
+ */
+static int
+patricia_paged_aio_pread (int fd, patricia_paged_aio_req_t *req)
+{
+    off_t pos = (off_t)req->page * PATRICIA_PAGED_PAGE_SIZE;
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < PATRICIA_PAGED_PAGE_SIZE) {
+        n = pread(fd, req->frame->data + done,
+                  PATRICIA_PAGED_PAGE_SIZE - done, pos + done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -errno;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+
+    return done;
+}
+
+/*
+ * patricia_paged_aio_worker
+ *
+ * Thread pool reader. Takes requests off the todo list and moves them to
+ * the finished list once read.
+ */
+static void *
+patricia_paged_aio_worker (void *arg)
+{
+    patricia_paged_aio_t *aio = (patricia_paged_aio_t *)arg;
+    patricia_paged_aio_req_t *req;
+
+    pthread_mutex_lock(&aio->lock);
+    while (1) {
+        while (!aio->todo && !aio->stop) {
+            pthread_cond_wait(&aio->work, &aio->lock);
+        }
+        if (aio->stop) {
+            break;
+        }
+        req = aio->todo;
+        aio->todo = req->next;
+        pthread_mutex_unlock(&aio->lock);
+
+        req->res = patricia_paged_aio_pread(aio->pt->fd, req);
+
+        pthread_mutex_lock(&aio->lock);
+        req->next = aio->finished;
+        aio->finished = req;
+        pthread_cond_signal(&aio->done);
+    }
+    pthread_mutex_unlock(&aio->lock);
+
+    return NULL;
+}
+
+/*
+ * patricia_paged_aio_ring_init
+ *
+ * Set up an io_uring with room for depth requests and map its rings.
+ * Returns 0 upon success, -1 if io_uring can not be used.
+ */
+static int
+patricia_paged_aio_ring_init (patricia_paged_aio_t *aio)
+{
+    struct io_uring_params p;
+    char *sq, *cq;
+    int fd;
+
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, aio->depth, &p);
+    if (fd < 0) {
+        return -1;
+    }
+
+    aio->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(uint32_t);
+    aio->cq_ring_size = p.cq_off.cqes +
+                        p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (aio->cq_ring_size > aio->sq_ring_size) {
+            aio->sq_ring_size = aio->cq_ring_size;
+        }
+        aio->cq_ring_size = 0;
+    }
+    aio->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    sq = (char *)mmap(NULL, aio->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+    cq = sq;
+    if (aio->cq_ring_size) {
+        cq = (char *)mmap(NULL, aio->cq_ring_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) {
+            munmap(sq, aio->sq_ring_size);
+            close(fd);
+            return -1;
+        }
+    }
+    aio->sqes = mmap(NULL, aio->sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (aio->sqes == MAP_FAILED) {
+        if (aio->cq_ring_size) {
+            munmap(cq, aio->cq_ring_size);
+        }
+        munmap(sq, aio->sq_ring_size);
+        close(fd);
+        return -1;
+    }
+
+    aio->ring_fd = fd;
+    aio->sq_ring = sq;
+    aio->cq_ring = cq;
+    aio->sq_tail = (uint32_t *)(sq + p.sq_off.tail);
+    aio->sq_mask = (uint32_t *)(sq + p.sq_off.ring_mask);
+    aio->sq_array = (uint32_t *)(sq + p.sq_off.array);
+    aio->cq_head = (uint32_t *)(cq + p.cq_off.head);
+    aio->cq_tail = (uint32_t *)(cq + p.cq_off.tail);
+    aio->cq_mask = (uint32_t *)(cq + p.cq_off.ring_mask);
+    aio->cqes = cq + p.cq_off.cqes;
+
+    return 0;
+}
+
+/*
+ * patricia_paged_aio_submit
+ *
+ * Queue the read of a request. With io_uring it is only placed in the
+ * submission ring, patricia_paged_aio_wait hands the queued reads to the
+ * kernel together.
+ */
+static void
+patricia_paged_aio_submit (patricia_paged_aio_t *aio,
+                           patricia_paged_aio_req_t *req)
+{
+    struct io_uring_sqe *sqe;
+    uint32_t tail, idx;
+
+#ifdef PATRICIA_STATS_ON
+    aio->reads++;
+#endif
+    if (aio->ring_fd < 0) {
+        pthread_mutex_lock(&aio->lock);
+        req->next = aio->todo;
+        aio->todo = req;
+        pthread_cond_signal(&aio->work);
+        pthread_mutex_unlock(&aio->lock);
+        return;
+    }
+
+    /* Only this thread moves the tail, the kernel reads it */
+    tail = *aio->sq_tail;
+    idx = tail & *aio->sq_mask;
+    sqe = &((struct io_uring_sqe *)aio->sqes)[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    req->iov.iov_base = req->frame->data;
+    req->iov.iov_len = PATRICIA_PAGED_PAGE_SIZE;
+    sqe->opcode = IORING_OP_READV;
+    sqe->fd = aio->pt->fd;
+    sqe->addr = (uint64_t)(uintptr_t)&req->iov;
+    sqe->len = 1;
+    sqe->off = (uint64_t)req->page * PATRICIA_PAGED_PAGE_SIZE;
+    sqe->user_data = (uint64_t)(uintptr_t)req;
+    aio->sq_array[idx] = idx;
+    __atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    aio->to_submit++;
+}
+
+/*
+ * patricia_paged_aio_wait
+ *
+ * Submit the queued reads and wait until at least one read completes.
+ * Returns the list of completed requests, linked through next, or NULL
+ * upon failure.
+ */
+static patricia_paged_aio_req_t *
+patricia_paged_aio_wait (patricia_paged_aio_t *aio)
+{
+    patricia_paged_aio_req_t *list, *req;
+    struct io_uring_cqe *cqe;
+    uint32_t head, tail;
+    int ret;
+
+#ifdef PATRICIA_STATS_ON
+    aio->waits++;
+#endif
+    if (aio->ring_fd < 0) {
+        pthread_mutex_lock(&aio->lock);
+        while (!aio->finished) {
+            pthread_cond_wait(&aio->done, &aio->lock);
+        }
+        list = aio->finished;
+        aio->finished = NULL;
+        pthread_mutex_unlock(&aio->lock);
+        return list;
+    }
+
+    list = NULL;
+    while (!list) {
+        ret = syscall(__NR_io_uring_enter, aio->ring_fd, aio->to_submit, 1,
+                      IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0 && errno != EINTR) {
+            return NULL;
+        }
+        if (ret > 0) {
+            aio->to_submit -= ret;
+        }
+
+        head = *aio->cq_head;
+        tail = __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            cqe = &((struct io_uring_cqe *)aio->cqes)[head & *aio->cq_mask];
+            req = (patricia_paged_aio_req_t *)(uintptr_t)cqe->user_data;
+            req->res = cqe->res;
+            req->next = list;
+            list = req;
+        }
+        __atomic_store_n(aio->cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    return list;
+}
+
+/*
+ * patricia_paged_aio_print_stats
+ *
+ * Dump the stats for the given batch reader
+ */
+void
+patricia_paged_aio_print_stats (patricia_paged_aio_t *aio)
+{
+#ifdef PATRICIA_STATS_ON
+    /* Sanity check */
+    if (!aio) {
+        return;
+    }
+
+    printf("\nReader: %s, depth %u\n",
+           (aio->ring_fd >= 0) ? "io_uring" : "thread pool", aio->depth);
+    printf("Total number of lookups: %lu\n", aio->lookups);
+    printf("Total number of batches: %lu\n", aio->batches);
+    printf("Total number of page reads: %lu\n", aio->reads);
+    printf("Total number of waits: %lu\n", aio->waits);
+    if (aio->waits) {
+        printf("Page reads per wait: %.2f\n",
+               (double)aio->reads / aio->waits);
+    }
+    printf("\n");
+#endif
+}
+
+/*
+ * patricia_paged_aio_lookup
+ *
+ * Look up n keys, with the result for keys[i], as patricia_paged_lookup
+ * returns it, in results[i]. The order in which the lookups finish is not
+ * that of the keys. Returns 0 upon success, -1 if any lookup failed.
+ */
+int
+patricia_paged_aio_lookup (patricia_paged_aio_t *aio, const char **keys,
+                           uint32_t n, int *results)
+{
+    patricia_paged_t *pt;
+    patricia_paged_aio_req_t *req, *done;
+    patricia_paged_frame_t *frame, **held;
+    uint32_t *mem, *klen, *depth, *page, *ready, *stalled;
+    uint32_t nready, nstalled, nheld, inflight, i, j;
+    int32_t *next, w;
+    int ret, err;
+
+    /* Sanity check */
+    if (!aio || !keys || !results) {
+        return -1;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    mem = (uint32_t *)malloc(6 * (size_t)n * sizeof(uint32_t) +
+                             aio->depth * sizeof(patricia_paged_frame_t *));
+    if (!mem) {
+        return -1;
+    }
+    klen = mem;
+    depth = klen + n;
+    page = depth + n;
+    next = (int32_t *)(page + n);
+    ready = (uint32_t *)(next + n);
+    stalled = ready + n;
+    held = (patricia_paged_frame_t **)(stalled + n);
+
+    pt = aio->pt;
+    for (i = 0; i < n; i++) {
+        klen[i] = strlen(keys[i]);
+        depth[i] = 0;
+        page[i] = pt->meta.root;
+        ready[i] = n - 1 - i;
+    }
+#ifdef PATRICIA_STATS_ON
+    aio->batches++;
+    aio->lookups += n;
+    pt->ops += n;
+#endif
+
+    nready = n;
+    nstalled = 0;
+    nheld = 0;
+    inflight = 0;
+    err = 0;
+    while (1) {
+        /* Take every runnable lookup as far as the pool allows */
+        while (nready) {
+            i = ready[--nready];
+            do {
+                ret = patricia_paged_lookup_step(pt, keys[i], klen[i],
+                                                 &depth[i], &page[i]);
+            } while (ret == PATRICIA_PAGED_MORE);
+            if (ret != PATRICIA_PAGED_MISS) {
+                results[i] = ret;
+                err |= (ret < 0);
+                continue;
+            }
+
+            /* Wait on a read of the page already in flight */
+            for (j = 0; j < aio->depth; j++) {
+                req = &aio->reqs[j];
+                if (req->frame && req->page == page[i]) {
+                    break;
+                }
+            }
+            if (j < aio->depth) {
+                next[i] = req->waiters;
+                req->waiters = i;
+                continue;
+            }
+
+            req = aio->free_reqs;
+            frame = req ? patricia_paged_reserve(pt, page[i]) : NULL;
+            if (!frame) {
+                if (inflight) {
+                    stalled[nstalled++] = i;
+                } else {
+                    results[i] = -1;
+                    err = 1;
+                }
+                continue;
+            }
+            aio->free_reqs = req->next;
+            req->page = page[i];
+            req->frame = frame;
+            req->waiters = i;
+            next[i] = -1;
+            inflight++;
+            patricia_paged_aio_submit(aio, req);
+        }
+
+        /* Every lookup waiting on a page read has stepped past it now */
+        while (nheld) {
+            patricia_paged_release(held[--nheld]);
+        }
+        if (!inflight) {
+            break;
+        }
+
+        done = patricia_paged_aio_wait(aio);
+        if (!done) {
+            /* The ring is unusable, the reads in flight can not be reaped */
+            free(mem);
+            return -1;
+        }
+        while (done) {
+            req = done;
+            done = req->next;
+            ret = (req->res == PATRICIA_PAGED_PAGE_SIZE);
+            patricia_paged_install(pt, req->frame, ret);
+            if (ret) {
+                held[nheld++] = req->frame;
+            }
+            for (w = req->waiters; w >= 0; w = next[w]) {
+                if (ret) {
+                    ready[nready++] = w;
+                } else {
+                    results[w] = -1;
+                    err = 1;
+                }
+            }
+            req->frame = NULL;
+            req->next = aio->free_reqs;
+            aio->free_reqs = req;
+            inflight--;
+        }
+
+        /* Lookups that found no request or frame free try again */
+        while (nstalled) {
+            ready[nready++] = stalled[--nstalled];
+        }
+    }
+    free(mem);
+
+    return err ? -1 : 0;
+}
+
+/*
+ * patricia_paged_aio_destroy
+ *
+ * Stop the readers and free the batch reader. No batch may be running.
+ */
+void
+patricia_paged_aio_destroy (patricia_paged_aio_t *aio)
+{
+    uint32_t i;
+
+    /* Sanity check */
+    if (!aio) {
+        return;
+    }
+
+    if (aio->ring_fd >= 0) {
+        munmap(aio->sqes, aio->sqes_size);
+        if (aio->cq_ring_size) {
+            munmap(aio->cq_ring, aio->cq_ring_size);
+        }
+        munmap(aio->sq_ring, aio->sq_ring_size);
+        close(aio->ring_fd);
+    } else {
+        pthread_mutex_lock(&aio->lock);
+        aio->stop = 1;
+        pthread_cond_broadcast(&aio->work);
+        pthread_mutex_unlock(&aio->lock);
+        for (i = 0; i < aio->thread_count; i++) {
+            pthread_join(aio->threads[i], NULL);
+        }
+        free(aio->threads);
+        pthread_cond_destroy(&aio->done);
+        pthread_cond_destroy(&aio->work);
+        pthread_mutex_destroy(&aio->lock);
+    }
+    free(aio->reqs);
+    free(aio);
+}
+
+/*
+ * patricia_paged_aio_init
+ *
+ * Set up batch lookups on the given tree with up to depth reads in
+ * flight, PATRICIA_PAGED_AIO_DEPTH if depth is 0. The depth is capped
+ * at half the frames of the pool. io_uring is used unless it is
+ * unavailable or flags ask for the thread pool.
+ */
+patricia_paged_aio_t *
+patricia_paged_aio_init (patricia_paged_t *pt, uint32_t depth,
+                         uint32_t flags)
+{
+    patricia_paged_aio_t *aio;
+    uint32_t i;
+
+    /* Sanity check */
+    if (!pt || pt->frame_count < 3) {
+        return NULL;
+    }
+
+    aio = (patricia_paged_aio_t *)calloc(1, sizeof(patricia_paged_aio_t));
+    if (!aio) {
+        return NULL;
+    }
+    aio->pt = pt;
+    aio->ring_fd = -1;
+    aio->depth = depth ? depth : PATRICIA_PAGED_AIO_DEPTH;
+    if (aio->depth > (pt->frame_count - 1) / 2) {
+        aio->depth = (pt->frame_count - 1) / 2;
+    }
+
+    aio->reqs = (patricia_paged_aio_req_t *)
+                calloc(aio->depth, sizeof(patricia_paged_aio_req_t));
+    if (!aio->reqs) {
+        free(aio);
+        return NULL;
+    }
+    for (i = 0; i < aio->depth; i++) {
+        aio->reqs[i].next = aio->free_reqs;
+        aio->free_reqs = &aio->reqs[i];
+    }
+
+    if (!(flags & PATRICIA_PAGED_AIO_NO_URING) &&
+        patricia_paged_aio_ring_init(aio) == 0) {
+        return aio;
+    }
+
+    aio->thread_count = (aio->depth < PATRICIA_PAGED_AIO_THREADS) ?
+                        aio->depth : PATRICIA_PAGED_AIO_THREADS;
+    aio->threads = (pthread_t *)calloc(aio->thread_count, sizeof(pthread_t));
+    if (!aio->threads) {
+        free(aio->reqs);
+        free(aio);
+        return NULL;
+    }
+    pthread_mutex_init(&aio->lock, NULL);
+    pthread_cond_init(&aio->work, NULL);
+    pthread_cond_init(&aio->done, NULL);
+    for (i = 0; i < aio->thread_count; i++) {
+        if (pthread_create(&aio->threads[i], NULL, patricia_paged_aio_worker,
+                           aio) != 0) {
+            aio->thread_count = i;
+            patricia_paged_aio_destroy(aio);
+            return NULL;
+        }
+    }
+
+    return aio;
+}
+
+/* End of File */
@@ -0,0 +1,87 @@
+/*
+ * patricia_paged_aio.h - Header file for asynchronous paged trie lookups
+ *
+ * Batch lookups on a paged trie that keep many page reads in flight at
+ * once, through io_uring or, where it is not available, a pool of threads
+ * doing pread.
+ */
+
+#ifndef PATRICIA_PAGED_AIO_H
+#define PATRICIA_PAGED_AIO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "patricia_paged.h"
+
+/* Defines */
+
+#define PATRICIA_PAGED_AIO_DEPTH    64          /* Reads in flight */
+#define PATRICIA_PAGED_AIO_THREADS  8           /* Fallback readers */
+
+/* Init flags */
+#define PATRICIA_PAGED_AIO_NO_URING 0x01        /* Use the thread pool */
+
+/* Datastructures */
+
+/* One page read in flight */
+typedef struct patricia_paged_aio_req_s {
+    uint32_t                        page;
+    int32_t                         waiters;    /* First lookup waiting */
+    patricia_paged_frame_t          *frame;
+    struct iovec                    iov;
+    int                             res;        /* Bytes read or -errno */
+    struct patricia_paged_aio_req_s *next;
+} patricia_paged_aio_req_t;
+
+typedef struct patricia_paged_aio_s {
+    patricia_paged_t            *pt;
+    uint32_t                    depth;
+    patricia_paged_aio_req_t    *reqs;
+    patricia_paged_aio_req_t    *free_reqs;
+
+    /* io_uring, ring_fd is -1 when the thread pool is used */
+    int                         ring_fd;
+    void                        *sq_ring;
+    size_t                      sq_ring_size;
+    void                        *cq_ring;
+    size_t                      cq_ring_size;
+    void                        *sqes;
+    size_t                      sqes_size;
+    uint32_t                    *sq_tail;
+    uint32_t                    *sq_mask;
+    uint32_t                    *sq_array;
+    uint32_t                    *cq_head;
+    uint32_t                    *cq_tail;
+    uint32_t                    *cq_mask;
+    void                        *cqes;
+    uint32_t                    to_submit;
+
+    /* Thread pool */
+    pthread_t                   *threads;
+    uint32_t                    thread_count;
+    pthread_mutex_t             lock;
+    pthread_cond_t              work;
+    pthread_cond_t              done;
+    patricia_paged_aio_req_t    *todo;
+    patricia_paged_aio_req_t    *finished;
+    uint8_t                     stop;
+
+    unsigned long               lookups;
+    unsigned long               batches;
+    unsigned long               reads;
+    unsigned long               waits;
+} patricia_paged_aio_t;
+
+/* Function Prototypes */
+
+void patricia_paged_aio_print_stats (patricia_paged_aio_t *aio);
+int patricia_paged_aio_lookup (patricia_paged_aio_t *aio, const char **keys,
+                               uint32_t n, int *results);
+void patricia_paged_aio_destroy (patricia_paged_aio_t *aio);
+patricia_paged_aio_t *patricia_paged_aio_init (patricia_paged_t *pt,
+                                               uint32_t depth,
+                                               uint32_t flags);
+
+#endif /* PATRICIA_PAGED_AIO_H */
@@ -0,0 +1,1419 @@
+/*
+ * patricia_persist.c
+ *
+ * This file implements a persistent (immutable) patricia tree. Nodes that
+ * any snapshot can see are never changed. An add or a delete builds new
+ * copies of such nodes from the root down to the key and points them at the
+ * untouched subtrees of the previous version, then publishes the new root.
+ * A snapshot is a counted reference to a root, taken in O(1). It stays
+ * valid, and unchanged, for as long as the holder keeps it, so a long scan
+ * over a snapshot neither blocks writers nor sees half an update.
+ *
+ * Nodes are reference counted. A node is freed when the last parent or
+ * snapshot referring to it goes away, which also releases its children.
+ *
+ * Copies are only needed for nodes some other version can reach. A node
+ * whose reference count is 1, reached through nodes that are all in the
+ * same situation, belongs to the current version alone and is changed in
+ * place. So a clone (patricia_pt_clone) costs one reference, the first
+ * update of a path after a clone or snapshot copies it, and the updates
+ * after that touch only the nodes that really change shape.
+ *
+ * The tree keeps the usual invariant of a patricia tree: a node other than
+ * the root either holds a key or has at least two children. A delete that
+ * would break it merges the node with its only child.
+ *
+ * Union, intersection and difference walk two versions side by side. Both
+ * keep their children sorted, so this is a merge of the two child lists at
+ * every node where both trees go on. A subtree only one side has is taken
+ * whole or dropped whole, and a node both versions share is not entered at
+ * all, so the cost follows the parts where the trees differ. Whenever the
+ * result of a subtree comes out the same as one of the inputs, that input
+ * node is reused instead of a copy.
+ *
+ * With PATRICIA_PT_MERKLE_ON every node carries a hash of its subtree,
+ * computed from its label, key, data and the hashes of its children when
+ * the node is built or changed, so an update only rehashes its own path.
+ * The tree shape depends only on the set of keys, so two trees holding the
+ * same keys and data have the same root hash however they were built, and
+ * patricia_pt_diff skips every subtree whose hash matches on both sides.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "patricia_persist.h"
+
+static patricia_pt_stats_t stats;
+
+/*
+ * Context of patricia_pt_diff, for the keys of a subtree only one side has
+ */
+typedef struct patricia_pt_diff_ctx_s {
+    patricia_pt_diff_fn fn;
+    void                *arg;
+    int                 side;
+} patricia_pt_diff_ctx_t;
+
+/* Set operations */
+#define PATRICIA_PT_UNION           1
+#define PATRICIA_PT_INTERSECT       2
+#define PATRICIA_PT_DIFFERENCE      3
+
+#define PATRICIA_PT_STAT_ADD(field, n) \
+    __atomic_add_fetch(&stats.field, (n), __ATOMIC_RELAXED)
+#define PATRICIA_PT_STAT_SUB(field, n) \
+    __atomic_sub_fetch(&stats.field, (n), __ATOMIC_RELAXED)
+
+/*
+ * patricia_pt_ref
+ *
+ * Take a reference to the given node
+ */
+static inline patricia_pt_node_t *
+patricia_pt_ref (patricia_pt_node_t *node)
+{
+    if (node) {
+        __atomic_add_fetch(&node->refcnt, 1, __ATOMIC_RELAXED);
+    }
+
+    return node;
+}
+
+/*
+ * patricia_pt_hash
+ *
+ * Compute the hash of the given node from its label, key, data and the
+ * hashes of its children, which must be up to date. The data pointer is
+ * hashed as is. Returns node.
+ */
+static inline patricia_pt_node_t *
+patricia_pt_hash (patricia_pt_node_t *node)
+{
+#ifdef PATRICIA_PT_MERKLE_ON
+    const uint8_t *label;
+    uint64_t h;
+    uint32_t i;
+
+    if (!node) {
+        return NULL;
+    }
+
+    /* FNV-1a over the label and the rest, then a final mix */
+    h = 14695981039346656037ULL;
+    label = (const uint8_t *)PATRICIA_PT_LABEL(node);
+    for (i = 0; i < node->label_len; i++) {
+        h = (h ^ label[i]) * 1099511628211ULL;
+    }
+    h = (h ^ node->label_len) * 1099511628211ULL;
+    if (node->is_key) {
+        h = (h ^ 1) * 1099511628211ULL;
+        h = (h ^ (uint64_t)(uintptr_t)node->data) * 1099511628211ULL;
+    }
+    for (i = 0; i < node->nchildren; i++) {
+        h = (h ^ PATRICIA_PT_CHILDREN(node)[i]->hash) * 1099511628211ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+
+    node->hash = h;
+#endif
+
+    return node;
+}
+
+/*
+ * patricia_pt_alloc
+ *
+ * Create a node with the given label and room for nchildren children. The
+ * caller fills in the children.
+ */
+static patricia_pt_node_t *
+patricia_pt_alloc (const char *label, uint32_t len, uint32_t nchildren)
+{
+    patricia_pt_node_t *node;
+    size_t size;
+
+    size = sizeof(patricia_pt_node_t) +
+           nchildren * sizeof(patricia_pt_node_t *) + len;
+    node = (patricia_pt_node_t *)malloc(size);
+    if (!node) {
+        return NULL;
+    }
+
+    node->refcnt = 1;
+    node->label_len = len;
+    node->nchildren = nchildren;
+    node->is_key = 0;
+    node->keys = 0;
+    node->data = NULL;
+    if (label) {
+        memcpy(PATRICIA_PT_LABEL(node), label, len);
+    }
+
+#ifdef PATRICIA_STATS_ON
+    PATRICIA_PT_STAT_ADD(total_nodes, 1);
+    PATRICIA_PT_STAT_ADD(total_mem, size);
+    PATRICIA_PT_STAT_ADD(total_copies, 1);
+#endif
+
+    return node;
+}
+
+/*
+ * patricia_pt_copy
+ *
+ * Create a copy of the given node, minus the first off bytes of its label.
+ * The children are shared with the original except the one at index skip,
+ * which the caller fills in. Pass skip = nchildren to share them all.
+ */
+static patricia_pt_node_t *
+patricia_pt_copy (patricia_pt_node_t *node, uint32_t off, uint32_t skip)
+{
+    patricia_pt_node_t *copy;
+    uint32_t i;
+
+    copy = patricia_pt_alloc(PATRICIA_PT_LABEL(node) + off,
+                             node->label_len - off, node->nchildren);
+    if (!copy) {
+        return NULL;
+    }
+    copy->is_key = node->is_key;
+    copy->keys = node->keys;
+    copy->data = node->data;
+    for (i = 0; i < node->nchildren; i++) {
+        PATRICIA_PT_CHILDREN(copy)[i] = (i == skip) ? NULL :
+            patricia_pt_ref(PATRICIA_PT_CHILDREN(node)[i]);
+    }
+
+    return copy;
+}
+
+/*
+ * patricia_pt_merge
+ *
+ * Create a node that replaces node and its only child child, with the
+ * concatenated label and the key, data and children of child
+ */
+static patricia_pt_node_t *
+patricia_pt_merge (patricia_pt_node_t *node, patricia_pt_node_t *child)
+{
+    patricia_pt_node_t *merged;
+    uint32_t i;
+
+    merged = patricia_pt_alloc(NULL, node->label_len + child->label_len,
+                               child->nchildren);
+    if (!merged) {
+        return NULL;
+    }
+    memcpy(PATRICIA_PT_LABEL(merged), PATRICIA_PT_LABEL(node),
+           node->label_len);
+    memcpy(PATRICIA_PT_LABEL(merged) + node->label_len,
+           PATRICIA_PT_LABEL(child), child->label_len);
+    merged->is_key = child->is_key;
+    merged->keys = child->keys;
+    merged->data = child->data;
+    for (i = 0; i < child->nchildren; i++) {
+        PATRICIA_PT_CHILDREN(merged)[i] =
+            patricia_pt_ref(PATRICIA_PT_CHILDREN(child)[i]);
+    }
+
+    return merged;
+}
+
+/*
+ * patricia_pt_find_child
+ *
+ * Binary search the children of node for the one starting with c. Returns
+ * its index, or -1 and the index to insert it at in *pos.
+ */
+static int
+patricia_pt_find_child (patricia_pt_node_t *node, uint8_t c, uint32_t *pos)
+{
+    patricia_pt_node_t **children;
+    uint32_t lo, hi, mid;
+    uint8_t first;
+
+    children = PATRICIA_PT_CHILDREN(node);
+    lo = 0;
+    hi = node->nchildren;
+    while (lo < hi) {
+        mid = (lo + hi) / 2;
+        first = (uint8_t)PATRICIA_PT_LABEL(children[mid])[0];
+        if (first == c) {
+            return mid;
+        }
+        if (first < c) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (pos) {
+        *pos = lo;
+    }
+    return -1;
+}
+
+/*
+ * patricia_pt_insert
+ *
+ * Return a new version of the subtree under node with the key added, or
+ * its data replaced if already present. *added tells which. excl is set if
+ * the current version is the only one that can reach node, in which case
+ * node may be updated in place and returned with an extra reference.
+ * Returns NULL upon failure.
+ */
+static patricia_pt_node_t *
+patricia_pt_insert (patricia_pt_node_t *node, const char *key, uint32_t klen,
+                    void *data, int excl, int *added)
+{
+    patricia_pt_node_t *new_node, *tail, *leaf, *child;
+    uint32_t m, i, pos;
+    char *label;
+    int idx;
+
+    if (!node) {
+        *added = 1;
+        leaf = patricia_pt_alloc(key, klen, 0);
+        if (leaf) {
+            leaf->is_key = 1;
+            leaf->keys = 1;
+            leaf->data = data;
+        }
+        return patricia_pt_hash(leaf);
+    }
+
+    label = PATRICIA_PT_LABEL(node);
+    m = 0;
+    while (m < node->label_len && m < klen && label[m] == key[m]) {
+        m++;
+    }
+
+    /*
+     * The key diverges inside the label. A new node with the common part
+     * takes the rest of this node, and a leaf for the rest of the key.
+     */
+    if (m < node->label_len) {
+        *added = 1;
+        tail = patricia_pt_copy(node, m, node->nchildren);
+        if (!tail) {
+            return NULL;
+        }
+        patricia_pt_hash(tail);
+
+        if (m == klen) {
+            new_node = patricia_pt_alloc(key, m, 1);
+            if (!new_node) {
+                patricia_pt_release(tail);
+                return NULL;
+            }
+            new_node->is_key = 1;
+            new_node->keys = tail->keys + 1;
+            new_node->data = data;
+            PATRICIA_PT_CHILDREN(new_node)[0] = tail;
+            return patricia_pt_hash(new_node);
+        }
+
+        leaf = patricia_pt_alloc(key + m, klen - m, 0);
+        new_node = patricia_pt_alloc(key, m, 2);
+        if (!leaf || !new_node) {
+            if (new_node) {
+                new_node->nchildren = 0;
+            }
+            patricia_pt_release(tail);
+            patricia_pt_release(leaf);
+            patricia_pt_release(new_node);
+            return NULL;
+        }
+        leaf->is_key = 1;
+        leaf->keys = 1;
+        leaf->data = data;
+        patricia_pt_hash(leaf);
+        new_node->keys = tail->keys + 1;
+        if ((uint8_t)key[m] < (uint8_t)label[m]) {
+            PATRICIA_PT_CHILDREN(new_node)[0] = leaf;
+            PATRICIA_PT_CHILDREN(new_node)[1] = tail;
+        } else {
+            PATRICIA_PT_CHILDREN(new_node)[0] = tail;
+            PATRICIA_PT_CHILDREN(new_node)[1] = leaf;
+        }
+        return patricia_pt_hash(new_node);
+    }
+
+    /* The key ends at this node */
+    if (m == klen) {
+        *added = !node->is_key;
+        if (excl) {
+            node->is_key = 1;
+            node->keys += *added;
+            node->data = data;
+            return patricia_pt_ref(patricia_pt_hash(node));
+        }
+        new_node = patricia_pt_copy(node, 0, node->nchildren);
+        if (new_node) {
+            new_node->is_key = 1;
+            new_node->keys += *added;
+            new_node->data = data;
+        }
+        return patricia_pt_hash(new_node);
+    }
+
+    /* Go down to the child starting with the next byte, if any */
+    idx = patricia_pt_find_child(node, (uint8_t)key[m], &pos);
+    if (idx >= 0) {
+        child = PATRICIA_PT_CHILDREN(node)[idx];
+        child = patricia_pt_insert(child, key + m, klen - m, data,
+                                   excl && child->refcnt == 1, added);
+        if (!child) {
+            return NULL;
+        }
+        if (excl) {
+            patricia_pt_release(PATRICIA_PT_CHILDREN(node)[idx]);
+            PATRICIA_PT_CHILDREN(node)[idx] = child;
+            node->keys += *added;
+            return patricia_pt_ref(patricia_pt_hash(node));
+        }
+        new_node = patricia_pt_copy(node, 0, idx);
+        if (!new_node) {
+            patricia_pt_release(child);
+            return NULL;
+        }
+        PATRICIA_PT_CHILDREN(new_node)[idx] = child;
+        new_node->keys += *added;
+        return patricia_pt_hash(new_node);
+    }
+
+    *added = 1;
+    leaf = patricia_pt_alloc(key + m, klen - m, 0);
+    new_node = patricia_pt_alloc(label, node->label_len, node->nchildren + 1);
+    if (!leaf || !new_node) {
+        if (new_node) {
+            new_node->nchildren = 0;
+        }
+        patricia_pt_release(leaf);
+        patricia_pt_release(new_node);
+        return NULL;
+    }
+    leaf->is_key = 1;
+    leaf->keys = 1;
+    leaf->data = data;
+    patricia_pt_hash(leaf);
+    new_node->is_key = node->is_key;
+    new_node->keys = node->keys + 1;
+    new_node->data = node->data;
+    for (i = 0; i < node->nchildren; i++) {
+        PATRICIA_PT_CHILDREN(new_node)[i < pos ? i : i + 1] =
+            patricia_pt_ref(PATRICIA_PT_CHILDREN(node)[i]);
+    }
+    PATRICIA_PT_CHILDREN(new_node)[pos] = leaf;
+
+    return patricia_pt_hash(new_node);
+}
+
+/*
+ * patricia_pt_remove
+ *
+ * Return a new version of the subtree under node without the key, NULL if
+ * nothing is left of it. *found is set to 1 if the key was there, 0 if not
+ * (node itself is returned then) and -1 upon failure. excl is as for
+ * patricia_pt_insert.
+ */
+static patricia_pt_node_t *
+patricia_pt_remove (patricia_pt_node_t *node, const char *key, uint32_t klen,
+                    void **data, int excl, int *found)
+{
+    patricia_pt_node_t *new_node, *child, *other;
+    uint32_t m, i, j;
+    char *label;
+    int idx;
+
+    *found = 0;
+    if (!node) {
+        return NULL;
+    }
+
+    label = PATRICIA_PT_LABEL(node);
+    m = 0;
+    while (m < node->label_len && m < klen && label[m] == key[m]) {
+        m++;
+    }
+    if (m < node->label_len) {
+        return patricia_pt_ref(node);
+    }
+
+    if (m == klen) {
+        if (!node->is_key) {
+            return patricia_pt_ref(node);
+        }
+        *found = 1;
+        if (data) {
+            *data = node->data;
+        }
+
+        if (node->nchildren == 0) {
+            return NULL;
+        }
+        if (node->nchildren == 1) {
+            new_node = patricia_pt_merge(node, PATRICIA_PT_CHILDREN(node)[0]);
+        } else if (excl) {
+            node->is_key = 0;
+            node->keys--;
+            node->data = NULL;
+            return patricia_pt_ref(patricia_pt_hash(node));
+        } else {
+            new_node = patricia_pt_copy(node, 0, node->nchildren);
+            if (new_node) {
+                new_node->is_key = 0;
+                new_node->keys--;
+                new_node->data = NULL;
+            }
+        }
+        if (!new_node) {
+            *found = -1;
+        }
+        return patricia_pt_hash(new_node);
+    }
+
+    idx = patricia_pt_find_child(node, (uint8_t)key[m], NULL);
+    if (idx < 0) {
+        return patricia_pt_ref(node);
+    }
+
+    child = PATRICIA_PT_CHILDREN(node)[idx];
+    child = patricia_pt_remove(child, key + m, klen - m, data,
+                               excl && child->refcnt == 1, found);
+    if (*found != 1) {
+        patricia_pt_release(child);
+        return (*found == 0) ? patricia_pt_ref(node) : NULL;
+    }
+
+    if (child && excl) {
+        patricia_pt_release(PATRICIA_PT_CHILDREN(node)[idx]);
+        PATRICIA_PT_CHILDREN(node)[idx] = child;
+        node->keys--;
+        return patricia_pt_ref(patricia_pt_hash(node));
+    }
+    if (child) {
+        new_node = patricia_pt_copy(node, 0, idx);
+        if (!new_node) {
+            patricia_pt_release(child);
+            *found = -1;
+            return NULL;
+        }
+        PATRICIA_PT_CHILDREN(new_node)[idx] = child;
+        new_node->keys--;
+        return patricia_pt_hash(new_node);
+    }
+
+    /* The child is gone. Drop it, and this node too if it becomes empty. */
+    if (node->nchildren == 1 && !node->is_key) {
+        return NULL;
+    }
+    if (node->nchildren == 2 && !node->is_key) {
+        other = PATRICIA_PT_CHILDREN(node)[idx == 0 ? 1 : 0];
+        new_node = patricia_pt_merge(node, other);
+    } else {
+        new_node = patricia_pt_alloc(label, node->label_len,
+                                     node->nchildren - 1);
+        if (new_node) {
+            new_node->is_key = node->is_key;
+            new_node->keys = node->keys - 1;
+            new_node->data = node->data;
+            for (i = 0, j = 0; i < node->nchildren; i++) {
+                if ((int)i != idx) {
+                    PATRICIA_PT_CHILDREN(new_node)[j++] =
+                        patricia_pt_ref(PATRICIA_PT_CHILDREN(node)[i]);
+                }
+            }
+        }
+    }
+    if (!new_node) {
+        *found = -1;
+    }
+
+    return patricia_pt_hash(new_node);
+}
+
+/*
+ * patricia_pt_tail
+ *
+ * Return the subtree under node minus the first off bytes of its label,
+ * node itself if off is 0. Sets *err upon failure.
+ */
+static patricia_pt_node_t *
+patricia_pt_tail (patricia_pt_node_t *node, uint32_t off, int *err)
+{
+    patricia_pt_node_t *tail;
+
+    if (off == 0) {
+        return patricia_pt_ref(node);
+    }
+
+    tail = patricia_pt_copy(node, off, node->nchildren);
+    if (!tail) {
+        *err = 1;
+    }
+
+    return patricia_pt_hash(tail);
+}
+
+/*
+ * patricia_pt_setop_build
+ *
+ * Create the node for a set operation result out of its label, key and the
+ * n children in kids, whose references it takes over. Returns NULL if the
+ * node would be empty, or merges it with its only child, so the result
+ * keeps the invariant. orig, when not NULL, is an input node with the same
+ * label which is returned instead if it has the same content. Sets *err
+ * upon failure.
+ */
+static patricia_pt_node_t *
+patricia_pt_setop_build (patricia_pt_node_t *orig, const char *label,
+                         uint32_t len, uint8_t is_key, void *data,
+                         patricia_pt_node_t **kids, uint32_t n, int *err)
+{
+    patricia_pt_node_t *node, *child;
+    uint32_t i;
+
+    if (orig && orig->is_key == is_key && orig->data == data &&
+        orig->nchildren == n) {
+        for (i = 0; i < n; i++) {
+            if (PATRICIA_PT_CHILDREN(orig)[i] != kids[i]) {
+                break;
+            }
+        }
+        if (i == n) {
+            for (i = 0; i < n; i++) {
+                patricia_pt_release(kids[i]);
+            }
+            return patricia_pt_ref(orig);
+        }
+    }
+
+    if (n == 0 && !is_key) {
+        return NULL;
+    }
+
+    if (n == 1 && !is_key) {
+        child = kids[0];
+        node = patricia_pt_alloc(NULL, len + child->label_len,
+                                 child->nchildren);
+        if (!node) {
+            patricia_pt_release(child);
+            *err = 1;
+            return NULL;
+        }
+        memcpy(PATRICIA_PT_LABEL(node), label, len);
+        memcpy(PATRICIA_PT_LABEL(node) + len, PATRICIA_PT_LABEL(child),
+               child->label_len);
+        node->is_key = child->is_key;
+        node->keys = child->keys;
+        node->data = child->data;
+        for (i = 0; i < child->nchildren; i++) {
+            PATRICIA_PT_CHILDREN(node)[i] =
+                patricia_pt_ref(PATRICIA_PT_CHILDREN(child)[i]);
+        }
+        patricia_pt_release(child);
+        return patricia_pt_hash(node);
+    }
+
+    node = patricia_pt_alloc(label, len, n);
+    if (!node) {
+        for (i = 0; i < n; i++) {
+            patricia_pt_release(kids[i]);
+        }
+        *err = 1;
+        return NULL;
+    }
+    node->is_key = is_key;
+    node->keys = is_key;
+    node->data = data;
+    for (i = 0; i < n; i++) {
+        PATRICIA_PT_CHILDREN(node)[i] = kids[i];
+        node->keys += kids[i]->keys;
+    }
+
+    return patricia_pt_hash(node);
+}
+
+/*
+ * patricia_pt_setop
+ *
+ * Recursive routine which applies op to the subtrees under a and b, minus
+ * the first aoff and boff bytes of their labels. Both start at the same
+ * depth. For a key in both, the data of a is kept. Returns the result,
+ * NULL if it is empty or upon failure, in which case *err is set.
+ */
+static patricia_pt_node_t *
+patricia_pt_setop (int op, patricia_pt_node_t *a, uint32_t aoff,
+                   patricia_pt_node_t *b, uint32_t boff, int *err)
+{
+    patricia_pt_node_t **kids, *ka, *kb, *child, *orig;
+    uint32_t alen, blen, m, na, nb, i, j, n;
+    uint32_t aoff2, boff2;
+    uint8_t ca, cb, is_key;
+    char *alabel, *blabel;
+    void *data;
+
+    /* A shared node gives the same on both sides */
+    if (a == b && aoff == boff) {
+        if (op == PATRICIA_PT_DIFFERENCE) {
+            return NULL;
+        }
+        return patricia_pt_tail(a, aoff, err);
+    }
+
+    alabel = PATRICIA_PT_LABEL(a) + aoff;
+    blabel = PATRICIA_PT_LABEL(b) + boff;
+    alen = a->label_len - aoff;
+    blen = b->label_len - boff;
+    m = 0;
+    while (m < alen && m < blen && alabel[m] == blabel[m]) {
+        m++;
+    }
+
+    /*
+     * Past the common part, a side whose label ended goes on with its
+     * children, the other one with the rest of its label as its only child
+     */
+    na = (m == alen) ? a->nchildren : 1;
+    nb = (m == blen) ? b->nchildren : 1;
+    aoff2 = (m == alen) ? 0 : aoff + m;
+    boff2 = (m == blen) ? 0 : boff + m;
+
+    kids = (patricia_pt_node_t **)malloc((na + nb + 1) *
+                                         sizeof(patricia_pt_node_t *));
+    if (!kids) {
+        *err = 1;
+        return NULL;
+    }
+
+    n = 0;
+    i = 0;
+    j = 0;
+    while ((i < na || j < nb) && !*err) {
+        ka = (i < na) ? ((m == alen) ? PATRICIA_PT_CHILDREN(a)[i] : a) : NULL;
+        kb = (j < nb) ? ((m == blen) ? PATRICIA_PT_CHILDREN(b)[j] : b) : NULL;
+        ca = ka ? (uint8_t)PATRICIA_PT_LABEL(ka)[aoff2] : 0;
+        cb = kb ? (uint8_t)PATRICIA_PT_LABEL(kb)[boff2] : 0;
+
+        if (ka && kb && ca == cb) {
+            child = patricia_pt_setop(op, ka, aoff2, kb, boff2, err);
+            i++;
+            j++;
+        } else if (ka && (!kb || ca < cb)) {
+            child = (op == PATRICIA_PT_INTERSECT) ? NULL :
+                    patricia_pt_tail(ka, aoff2, err);
+            i++;
+        } else {
+            child = (op == PATRICIA_PT_UNION) ?
+                    patricia_pt_tail(kb, boff2, err) : NULL;
+            j++;
+        }
+        if (child) {
+            kids[n++] = child;
+        }
+    }
+    if (*err) {
+        for (i = 0; i < n; i++) {
+            patricia_pt_release(kids[i]);
+        }
+        free(kids);
+        return NULL;
+    }
+
+    ka = (m == alen && a->is_key) ? a : NULL;
+    kb = (m == blen && b->is_key) ? b : NULL;
+    if (op == PATRICIA_PT_UNION) {
+        is_key = ka || kb;
+    } else if (op == PATRICIA_PT_INTERSECT) {
+        is_key = ka && kb;
+    } else {
+        is_key = ka && !kb;
+    }
+    data = !is_key ? NULL : (ka ? ka->data : kb->data);
+
+    /* Only a node the result ends at, from its first byte, can be reused */
+    orig = NULL;
+    if (m == alen && aoff == 0) {
+        orig = a;
+    } else if (m == blen && boff == 0) {
+        orig = b;
+    }
+
+    child = patricia_pt_setop_build(orig, alabel, m, is_key, data, kids, n,
+                                    err);
+    free(kids);
+
+    return child;
+}
+
+/*
+ * patricia_pt_setop_tree
+ *
+ * Apply op to snapshots of the two trees and return the result as a new
+ * tree, NULL upon failure
+ */
+static patricia_pt_tree_t *
+patricia_pt_setop_tree (int op, patricia_pt_tree_t *a, patricia_pt_tree_t *b)
+{
+    patricia_pt_node_t *ra, *rb, *root;
+    patricia_pt_tree_t *tree;
+    int err = 0;
+
+    tree = patricia_pt_init();
+    if (!tree) {
+        return NULL;
+    }
+
+    ra = patricia_pt_snapshot(a);
+    rb = patricia_pt_snapshot(b);
+    if (!ra || !rb) {
+        if (op == PATRICIA_PT_UNION) {
+            root = patricia_pt_ref(ra ? ra : rb);
+        } else if (op == PATRICIA_PT_DIFFERENCE) {
+            root = patricia_pt_ref(ra);
+        } else {
+            root = NULL;
+        }
+    } else {
+        root = patricia_pt_setop(op, ra, 0, rb, 0, &err);
+    }
+    patricia_pt_release(ra);
+    patricia_pt_release(rb);
+
+    if (err) {
+        patricia_pt_destroy(tree);
+        return NULL;
+    }
+    tree->root = root;
+    tree->count = root ? root->keys : 0;
+
+    return tree;
+}
+
+/*
+ * patricia_pt_walk_internal
+ *
+ * Recursive routine which invokes fn on every key under the given node.
+ * (*buf)[0..len] holds the key of the parent node, the buffer is grown as
+ * needed.
+ */
+static int
+patricia_pt_walk_internal (patricia_pt_node_t *node, char **buf, size_t *cap,
+                           size_t len, patricia_pt_fn fn, void *arg)
+{
+    size_t new_cap;
+    char *new_buf;
+    uint32_t i;
+    int ret;
+
+    if (len + node->label_len + 1 > *cap) {
+        new_cap = (*cap * 2 > len + node->label_len + 1) ? *cap * 2 :
+                                                           len + node->label_len + 1;
+        new_buf = (char *)realloc(*buf, new_cap);
+        if (!new_buf) {
+            return -1;
+        }
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    memcpy(*buf + len, PATRICIA_PT_LABEL(node), node->label_len);
+    len += node->label_len;
+
+    if (node->is_key) {
+        (*buf)[len] = 0;
+        ret = fn(*buf, len, node->data, arg);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    for (i = 0; i < node->nchildren; i++) {
+        ret = patricia_pt_walk_internal(PATRICIA_PT_CHILDREN(node)[i], buf, cap,
+                                        len, fn, arg);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_pt_diff_side
+ *
+ * patricia_pt_walk_internal callback which reports a key of a subtree only
+ * one side has
+ */
+static int
+patricia_pt_diff_side (const char *key, int len, void *data, void *arg)
+{
+    patricia_pt_diff_ctx_t *ctx = (patricia_pt_diff_ctx_t *)arg;
+
+    (void)data;
+    return ctx->fn(key, len, ctx->side, ctx->arg);
+}
+
+/*
+ * patricia_pt_diff_internal
+ *
+ * Recursive routine which reports the differences between the subtrees
+ * under a and b, minus the first aoff and boff bytes of their labels, as
+ * for patricia_pt_setop. (*buf)[0..len] holds the key down to there.
+ * Subtrees with equal hashes are taken to be equal and skipped.
+ */
+static int
+patricia_pt_diff_internal (patricia_pt_node_t *a, uint32_t aoff,
+                           patricia_pt_node_t *b, uint32_t boff, char **buf,
+                           size_t *cap, size_t len, patricia_pt_diff_ctx_t *ctx)
+{
+    patricia_pt_node_t *ka, *kb;
+    uint32_t alen, blen, m, na, nb, i, j;
+    uint32_t aoff2, boff2;
+    uint8_t ca, cb;
+    size_t new_cap;
+    char *new_buf;
+    int ret;
+
+    if (aoff == boff && a == b) {
+        return 0;
+    }
+#ifdef PATRICIA_PT_MERKLE_ON
+    if (aoff == 0 && boff == 0 && a->hash == b->hash) {
+        return 0;
+    }
+#endif
+#ifdef PATRICIA_STATS_ON
+    PATRICIA_PT_STAT_ADD(total_diff_nodes, 1);
+#endif
+
+    alen = a->label_len - aoff;
+    blen = b->label_len - boff;
+    m = 0;
+    while (m < alen && m < blen &&
+           PATRICIA_PT_LABEL(a)[aoff + m] == PATRICIA_PT_LABEL(b)[boff + m]) {
+        m++;
+    }
+
+    if (len + m + 1 > *cap) {
+        new_cap = (*cap * 2 > len + m + 1) ? *cap * 2 : len + m + 1;
+        new_buf = (char *)realloc(*buf, new_cap);
+        if (!new_buf) {
+            return -1;
+        }
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    memcpy(*buf + len, PATRICIA_PT_LABEL(a) + aoff, m);
+    len += m;
+    (*buf)[len] = 0;
+
+    /* The key ending here, if either side has it */
+    ka = (m == alen && a->is_key) ? a : NULL;
+    kb = (m == blen && b->is_key) ? b : NULL;
+    ret = 0;
+    if (ka && kb) {
+        if (ka->data != kb->data) {
+            ret = ctx->fn(*buf, len, PATRICIA_PT_DIFF_DATA, ctx->arg);
+        }
+    } else if (ka) {
+        ret = ctx->fn(*buf, len, PATRICIA_PT_DIFF_A, ctx->arg);
+    } else if (kb) {
+        ret = ctx->fn(*buf, len, PATRICIA_PT_DIFF_B, ctx->arg);
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    /* Then the children, merged as in patricia_pt_setop */
+    na = (m == alen) ? a->nchildren : 1;
+    nb = (m == blen) ? b->nchildren : 1;
+    aoff2 = (m == alen) ? 0 : aoff + m;
+    boff2 = (m == blen) ? 0 : boff + m;
+
+    i = 0;
+    j = 0;
+    while (i < na || j < nb) {
+        ka = (i < na) ? ((m == alen) ? PATRICIA_PT_CHILDREN(a)[i] : a) : NULL;
+        kb = (j < nb) ? ((m == blen) ? PATRICIA_PT_CHILDREN(b)[j] : b) : NULL;
+        ca = ka ? (uint8_t)PATRICIA_PT_LABEL(ka)[aoff2] : 0;
+        cb = kb ? (uint8_t)PATRICIA_PT_LABEL(kb)[boff2] : 0;
+
+        /*
+         * The first aoff2 bytes of a label are already in the buffer, so
+         * walking from len - aoff2 rewrites them with the same bytes
+         */
+        if (ka && kb && ca == cb) {
+            ret = patricia_pt_diff_internal(ka, aoff2, kb, boff2, buf, cap,
+                                            len, ctx);
+            i++;
+            j++;
+        } else if (ka && (!kb || ca < cb)) {
+            ctx->side = PATRICIA_PT_DIFF_A;
+            ret = patricia_pt_walk_internal(ka, buf, cap, len - aoff2,
+                                            patricia_pt_diff_side, ctx);
+            i++;
+        } else {
+            ctx->side = PATRICIA_PT_DIFF_B;
+            ret = patricia_pt_walk_internal(kb, buf, cap, len - boff2,
+                                            patricia_pt_diff_side, ctx);
+            j++;
+        }
+        if (ret != 0) {
+            return ret;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_pt_print_stats
+ *
+ * Dump the stats for the given tree
+ */
+void
+patricia_pt_print_stats (patricia_pt_tree_t *tree)
+{
+#ifdef PATRICIA_STATS_ON
+    /* Sanity check */
+    if (!tree) {
+        return;
+    }
+
+    printf("\nTotal number of keys: %lu\n", tree->count);
+    printf("Total number of nodes: %lu\n", stats.total_nodes);
+    printf("Total number of node copies: %lu\n", stats.total_copies);
+    printf("Total number of nodes visited by diffs: %lu\n",
+           stats.total_diff_nodes);
+    printf("Total memory used: %lu bytes\n\n", stats.total_mem);
+#endif
+}
+
+/*
+ * patricia_pt_get_stats
+ *
+ * Copy the stats, which are shared by all the persistent trees, to out
+ */
+void
+patricia_pt_get_stats (patricia_pt_stats_t *out)
+{
+    /* Sanity check */
+    if (!out) {
+        return;
+    }
+
+    out->total_nodes = __atomic_load_n(&stats.total_nodes, __ATOMIC_RELAXED);
+    out->total_mem = __atomic_load_n(&stats.total_mem, __ATOMIC_RELAXED);
+    out->total_copies = __atomic_load_n(&stats.total_copies,
+                                        __ATOMIC_RELAXED);
+    out->total_diff_nodes = __atomic_load_n(&stats.total_diff_nodes,
+                                            __ATOMIC_RELAXED);
+}
+
+/*
+ * patricia_pt_lookup
+ *
+ * Look up the given key in the version under root. The data of the key is
+ * returned in *data if data is not NULL. Returns 1 if found, 0 otherwise.
+ * root must be a snapshot when writers may run at the same time, since the
+ * nodes of the current version alone are updated in place.
+ */
+int
+patricia_pt_lookup (patricia_pt_node_t *root, const char *key, void **data)
+{
+    patricia_pt_node_t *node;
+    uint32_t len, pos;
+    int idx;
+
+    /* Sanity check */
+    if (!root || !key) {
+        return 0;
+    }
+
+    len = strlen(key);
+    pos = 0;
+    node = root;
+    while (1) {
+        if (len - pos < node->label_len ||
+            memcmp(PATRICIA_PT_LABEL(node), key + pos, node->label_len) != 0) {
+            return 0;
+        }
+        pos += node->label_len;
+        if (pos == len) {
+            break;
+        }
+
+        idx = patricia_pt_find_child(node, (uint8_t)key[pos], NULL);
+        if (idx < 0) {
+            return 0;
+        }
+        node = PATRICIA_PT_CHILDREN(node)[idx];
+    }
+
+    if (!node->is_key) {
+        return 0;
+    }
+    if (data) {
+        *data = node->data;
+    }
+
+    return 1;
+}
+
+/*
+ * patricia_pt_walk
+ *
+ * Invoke fn on every key starting with the given prefix in the version
+ * under root, in lexicographical order. Stops as soon as fn returns a non
+ * zero value and returns that value.
+ */
+int
+patricia_pt_walk (patricia_pt_node_t *root, const char *prefix,
+                  patricia_pt_fn fn, void *arg)
+{
+    patricia_pt_node_t *node;
+    size_t len, pos, n, cap;
+    char *buf;
+    int idx, ret;
+
+    /* Sanity check */
+    if (!prefix || !fn) {
+        return -1;
+    }
+
+    /* Find the highest node whose key starts with the prefix */
+    len = strlen(prefix);
+    pos = 0;
+    node = root;
+    while (node) {
+        n = (len - pos < node->label_len) ? len - pos : node->label_len;
+        if (memcmp(PATRICIA_PT_LABEL(node), prefix + pos, n) != 0) {
+            return 0;
+        }
+        if (pos + node->label_len >= len) {
+            break;
+        }
+        pos += node->label_len;
+
+        idx = patricia_pt_find_child(node, (uint8_t)prefix[pos], NULL);
+        if (idx < 0) {
+            return 0;
+        }
+        node = PATRICIA_PT_CHILDREN(node)[idx];
+    }
+    if (!node) {
+        return 0;
+    }
+
+    cap = len + 64;
+    buf = (char *)malloc(cap);
+    if (!buf) {
+        return -1;
+    }
+    memcpy(buf, prefix, pos);
+
+    ret = patricia_pt_walk_internal(node, &buf, &cap, pos, fn, arg);
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * patricia_pt_diff
+ *
+ * Invoke fn, in lexicographical order, on every key present in only one of
+ * the versions under a and b, or in both with different data, with side
+ * telling which. Only the subtrees whose hashes differ are visited, so the
+ * cost follows the number of differences rather than the size of the
+ * trees. Stops as soon as fn returns a non zero value and returns that
+ * value.
+ */
+int
+patricia_pt_diff (patricia_pt_node_t *a, patricia_pt_node_t *b,
+                  patricia_pt_diff_fn fn, void *arg)
+{
+    patricia_pt_diff_ctx_t ctx;
+    size_t cap;
+    char *buf;
+    int ret;
+
+    /* Sanity check */
+    if (!fn) {
+        return -1;
+    }
+
+    if (!a && !b) {
+        return 0;
+    }
+
+    ctx.fn = fn;
+    ctx.arg = arg;
+    cap = 64;
+    buf = (char *)malloc(cap);
+    if (!buf) {
+        return -1;
+    }
+
+    if (!a || !b) {
+        ctx.side = a ? PATRICIA_PT_DIFF_A : PATRICIA_PT_DIFF_B;
+        ret = patricia_pt_walk_internal(a ? a : b, &buf, &cap, 0,
+                                        patricia_pt_diff_side, &ctx);
+    } else {
+        ret = patricia_pt_diff_internal(a, 0, b, 0, &buf, &cap, 0, &ctx);
+    }
+    free(buf);
+
+    return ret;
+}
+
+/*
+ * patricia_pt_snapshot
+ *
+ * Return a reference to the current version, NULL if the tree is empty.
+ * The caller gives it back with patricia_pt_release.
+ */
+patricia_pt_node_t *
+patricia_pt_snapshot (patricia_pt_tree_t *tree)
+{
+    patricia_pt_node_t *root;
+
+    /* Sanity check */
+    if (!tree) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&tree->lock);
+    root = patricia_pt_ref(tree->root);
+    pthread_mutex_unlock(&tree->lock);
+
+    return root;
+}
+
+/*
+ * patricia_pt_clone
+ *
+ * Create a new tree holding the same keys as the given one. All the nodes
+ * are shared, each tree copies the ones it changes on its first write.
+ */
+patricia_pt_tree_t *
+patricia_pt_clone (patricia_pt_tree_t *tree)
+{
+    patricia_pt_tree_t *clone;
+
+    /* Sanity check */
+    if (!tree) {
+        return NULL;
+    }
+
+    clone = patricia_pt_init();
+    if (!clone) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&tree->lock);
+    clone->root = patricia_pt_ref(tree->root);
+    clone->count = tree->count;
+    pthread_mutex_unlock(&tree->lock);
+
+    return clone;
+}
+
+/*
+ * patricia_pt_union
+ *
+ * Create a new tree with the keys of either tree. The data of a key in
+ * both comes from a.
+ */
+patricia_pt_tree_t *
+patricia_pt_union (patricia_pt_tree_t *a, patricia_pt_tree_t *b)
+{
+    /* Sanity check */
+    if (!a || !b) {
+        return NULL;
+    }
+
+    return patricia_pt_setop_tree(PATRICIA_PT_UNION, a, b);
+}
+
+/*
+ * patricia_pt_intersect
+ *
+ * Create a new tree with the keys present in both trees, and their data
+ * from a
+ */
+patricia_pt_tree_t *
+patricia_pt_intersect (patricia_pt_tree_t *a, patricia_pt_tree_t *b)
+{
+    /* Sanity check */
+    if (!a || !b) {
+        return NULL;
+    }
+
+    return patricia_pt_setop_tree(PATRICIA_PT_INTERSECT, a, b);
+}
+
+/*
+ * patricia_pt_difference
+ *
+ * Create a new tree with the keys of a which are not in b
+ */
+patricia_pt_tree_t *
+patricia_pt_difference (patricia_pt_tree_t *a, patricia_pt_tree_t *b)
+{
+    /* Sanity check */
+    if (!a || !b) {
+        return NULL;
+    }
+
+    return patricia_pt_setop_tree(PATRICIA_PT_DIFFERENCE, a, b);
+}
+
+/*
+ * patricia_pt_release
+ *
+ * Drop a reference to the given node, freeing it and releasing its
+ * children when it was the last one
+ */
+void
+patricia_pt_release (patricia_pt_node_t *node)
+{
+    uint32_t i;
+
+    if (!node) {
+        return;
+    }
+
+    if (__atomic_sub_fetch(&node->refcnt, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    for (i = 0; i < node->nchildren; i++) {
+        patricia_pt_release(PATRICIA_PT_CHILDREN(node)[i]);
+    }
+#ifdef PATRICIA_STATS_ON
+    PATRICIA_PT_STAT_SUB(total_nodes, 1);
+    PATRICIA_PT_STAT_SUB(total_mem, sizeof(patricia_pt_node_t) +
+                         node->nchildren * sizeof(patricia_pt_node_t *) +
+                         node->label_len);
+#endif
+    free(node);
+}
+
+/*
+ * patricia_pt_delete
+ *
+ * Delete the given key, returning its data in *data if data is not NULL.
+ * Returns 0 upon success, -1 if the key is not present or upon failure.
+ */
+int
+patricia_pt_delete (patricia_pt_tree_t *tree, const char *key, void **data)
+{
+    patricia_pt_node_t *old, *root;
+    int found;
+
+    /* Sanity check */
+    if (!tree || !key) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&tree->lock);
+    root = patricia_pt_remove(tree->root, key, strlen(key), data,
+                              tree->root && tree->root->refcnt == 1, &found);
+    if (found != 1) {
+        patricia_pt_release(root);
+        pthread_mutex_unlock(&tree->lock);
+        return -1;
+    }
+    old = tree->root;
+    tree->root = root;
+    tree->count--;
+    pthread_mutex_unlock(&tree->lock);
+
+    patricia_pt_release(old);
+
+    return 0;
+}
+
+/*
+ * patricia_pt_add
+ *
+ * Add the given key, or replace its data if it is already present. Returns
+ * 0 upon success, -1 upon failure.
+ */
+int
+patricia_pt_add (patricia_pt_tree_t *tree, const char *key, void *data)
+{
+    patricia_pt_node_t *old, *root;
+    int added = 0;
+
+    /* Sanity check */
+    if (!tree || !key) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&tree->lock);
+    root = patricia_pt_insert(tree->root, key, strlen(key), data,
+                              tree->root && tree->root->refcnt == 1, &added);
+    if (!root) {
+        pthread_mutex_unlock(&tree->lock);
+        return -1;
+    }
+    old = tree->root;
+    tree->root = root;
+    if (added) {
+        tree->count++;
+    }
+    pthread_mutex_unlock(&tree->lock);
+
+    patricia_pt_release(old);
+
+    return 0;
+}
+
+/*
+ * patricia_pt_destroy
+ *
+ * Free the tree. Snapshots taken from it stay valid until released.
+ */
+int
+patricia_pt_destroy (patricia_pt_tree_t *tree)
+{
+    /* Sanity check */
+    if (!tree) {
+        return -1;
+    }
+
+    patricia_pt_release(tree->root);
+    pthread_mutex_destroy(&tree->lock);
+    free(tree);
+
+    return 0;
+}
+
+/*
+ * patricia_pt_init
+ *
+ * Create an empty tree
+ */
+patricia_pt_tree_t *
+patricia_pt_init (void)
+{
+    patricia_pt_tree_t *tree;
+
+    tree = (patricia_pt_tree_t *)calloc(1, sizeof(patricia_pt_tree_t));
+    if (!tree) {
+        return NULL;
+    }
+    pthread_mutex_init(&tree->lock, NULL);
+
+    return tree;
+}
+
+/* End of File */
@@ -0,0 +1,102 @@
+/*
+ * patricia_persist.h - Header file for the persistent patricia tree
+ *
+ * Nodes are immutable once shared. An add or a delete copies the shared
+ * nodes on the path to the key and shares everything else with the previous
+ * version, so every version of the tree stays valid for as long as it is
+ * referenced. A clone shares the whole tree and copies on write.
+ */
+
+#ifndef PATRICIA_PERSIST_H
+#define PATRICIA_PERSIST_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_PT_MERKLE_ON               /* Node hashes, for patricia_pt_diff */
+
+/* Sides of a difference reported by patricia_pt_diff */
+#define PATRICIA_PT_DIFF_A          1       /* Only in a */
+#define PATRICIA_PT_DIFF_B          2       /* Only in b */
+#define PATRICIA_PT_DIFF_DATA       3       /* In both, with different data */
+
+/*
+ * The children pointers and then the label follow the node header in the
+ * same allocation
+ */
+#define PATRICIA_PT_CHILDREN(node) \
+    ((patricia_pt_node_t **)((node) + 1))
+#define PATRICIA_PT_LABEL(node) \
+    ((char *)(PATRICIA_PT_CHILDREN(node) + (node)->nchildren))
+
+/* Datastructures */
+
+/*
+ * Node. Children are sorted by the first byte of their label. A node is
+ * shared by all the versions that reach it, refcnt counts the parents and
+ * snapshots holding it.
+ */
+typedef struct patricia_pt_node_s {
+    uint32_t    refcnt;
+    uint32_t    label_len;
+    uint16_t    nchildren;
+    uint8_t     is_key;
+    uint32_t    keys;                   /* Keys in the subtree */
+    void        *data;
+#ifdef PATRICIA_PT_MERKLE_ON
+    uint64_t    hash;                   /* Of the whole subtree */
+#endif
+} patricia_pt_node_t;
+
+/*
+ * The current version. Writers are serialized by lock, which also covers
+ * taking a reference to root for a snapshot.
+ */
+typedef struct patricia_pt_tree_s {
+    patricia_pt_node_t  *root;
+    unsigned long       count;
+    pthread_mutex_t     lock;
+} patricia_pt_tree_t;
+
+typedef struct patricia_pt_stats_s {
+    unsigned long   total_nodes;
+    unsigned long   total_mem;
+    unsigned long   total_copies;
+    unsigned long   total_diff_nodes;
+} patricia_pt_stats_t;
+
+typedef int (*patricia_pt_fn) (const char *key, int len, void *data,
+                               void *arg);
+typedef int (*patricia_pt_diff_fn) (const char *key, int len, int side,
+                                    void *arg);
+
+/* Function Prototypes */
+
+void patricia_pt_print_stats (patricia_pt_tree_t *tree);
+void patricia_pt_get_stats (patricia_pt_stats_t *out);
+int patricia_pt_lookup (patricia_pt_node_t *root, const char *key,
+                        void **data);
+int patricia_pt_walk (patricia_pt_node_t *root, const char *prefix,
+                      patricia_pt_fn fn, void *arg);
+int patricia_pt_diff (patricia_pt_node_t *a, patricia_pt_node_t *b,
+                      patricia_pt_diff_fn fn, void *arg);
+patricia_pt_node_t *patricia_pt_snapshot (patricia_pt_tree_t *tree);
+patricia_pt_tree_t *patricia_pt_clone (patricia_pt_tree_t *tree);
+patricia_pt_tree_t *patricia_pt_union (patricia_pt_tree_t *a,
+                                       patricia_pt_tree_t *b);
+patricia_pt_tree_t *patricia_pt_intersect (patricia_pt_tree_t *a,
+                                           patricia_pt_tree_t *b);
+patricia_pt_tree_t *patricia_pt_difference (patricia_pt_tree_t *a,
+                                            patricia_pt_tree_t *b);
+void patricia_pt_release (patricia_pt_node_t *node);
+int patricia_pt_delete (patricia_pt_tree_t *tree, const char *key,
+                        void **data);
+int patricia_pt_add (patricia_pt_tree_t *tree, const char *key, void *data);
+int patricia_pt_destroy (patricia_pt_tree_t *tree);
+patricia_pt_tree_t *patricia_pt_init (void);
+
+#endif /* PATRICIA_PERSIST_H */
@@ -0,0 +1,711 @@
+/*
+ * patricia_route.c
+ *
+ * This file implements a routing table for IPv4/IPv6 CIDR prefixes on top of
+ * a bit-level PATRICIA tree. Every node tests a single bit of the address.
+ * Nodes carrying a route sit at the depth given by the prefix length, glue
+ * nodes are created where two prefixes diverge. A longest-prefix-match
+ * lookup walks down the tree once, remembering the last route whose prefix
+ * matches the address.
+ *
+ * Optionally the table keeps a direct index on the first 16 bits of the
+ * address (in the spirit of DIR-24-8). Each slot caches the best route of
+ * length <= 16 and the number of longer routes below it, so addresses that
+ * are only covered by short routes are resolved with one memory access.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include "patricia_route.h"
+
+/*
+ * patricia_rt_bit_test
+ *
+ * Return the value of the given bit of the address, MSB first. Bits past
+ * the end of the address read as 0.
+ */
+static inline int
+patricia_rt_bit_test (patricia_rt_tree_t *tree, const uint8_t *addr,
+                      uint32_t bit)
+{
+    if (bit >= tree->addrlen * 8) {
+        return 0;
+    }
+
+    return (addr[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+/*
+ * patricia_rt_comp_with_mask
+ *
+ * Returns 1 if the first len bits of addr1 and addr2 are equal
+ */
+static int
+patricia_rt_comp_with_mask (const uint8_t *addr1, const uint8_t *addr2,
+                            uint32_t len)
+{
+    uint32_t bytes = len >> 3;
+    uint8_t mask;
+
+    if (memcmp(addr1, addr2, bytes) != 0) {
+        return 0;
+    }
+
+    if (len & 7) {
+        mask = (uint8_t)(0xff << (8 - (len & 7)));
+        if ((addr1[bytes] ^ addr2[bytes]) & mask) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*
+ * patricia_rt_mask
+ *
+ * Copy the prefix into out, clearing all the bits past len
+ */
+static void
+patricia_rt_mask (patricia_rt_tree_t *tree, const uint8_t *prefix,
+                  uint32_t len, uint8_t *out)
+{
+    uint32_t i;
+
+    memset(out, 0, PATRICIA_RT_MAX_ADDRLEN);
+    memcpy(out, prefix, tree->addrlen);
+
+    for (i = len; i < tree->addrlen * 8; i++) {
+        out[i >> 3] &= (uint8_t)~(0x80 >> (i & 7));
+    }
+}
+
+/*
+ * patricia_rt_accel_index
+ *
+ * Slot of the direct index table for the given address
+ */
+static inline uint32_t
+patricia_rt_accel_index (const uint8_t *addr)
+{
+    return ((uint32_t)addr[0] << 8) | addr[1];
+}
+
+/*
+ * patricia_rt_node_init
+ *
+ * Create a new node testing the given bit
+ */
+static patricia_rt_node_t *
+patricia_rt_node_init (patricia_rt_tree_t *tree, const uint8_t *prefix,
+                       uint32_t bit)
+{
+    patricia_rt_node_t *node;
+
+    node = (patricia_rt_node_t *)malloc(sizeof(patricia_rt_node_t));
+    if (!node) {
+        return NULL;
+    }
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem += sizeof(patricia_rt_node_t);
+    tree->total_nodes++;
+#endif
+
+    node->child[0] = NULL;
+    node->child[1] = NULL;
+    node->parent = NULL;
+    node->bit = bit;
+    node->has_route = 0;
+    node->data = NULL;
+    patricia_rt_mask(tree, prefix, bit, node->prefix);
+
+    return node;
+}
+
+/*
+ * patricia_rt_node_free
+ *
+ * Free a single node
+ */
+static void
+patricia_rt_node_free (patricia_rt_tree_t *tree, patricia_rt_node_t *node)
+{
+    free(node);
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem -= sizeof(patricia_rt_node_t);
+    tree->total_nodes--;
+#endif
+}
+
+/*
+ * patricia_rt_replace_child
+ *
+ * Make new_node take the place of node under node's parent
+ */
+static void
+patricia_rt_replace_child (patricia_rt_tree_t *tree, patricia_rt_node_t *node,
+                           patricia_rt_node_t *new_node)
+{
+    patricia_rt_node_t *parent = node->parent;
+
+    if (new_node) {
+        new_node->parent = parent;
+    }
+
+    if (!parent) {
+        tree->root = new_node;
+    } else if (parent->child[1] == node) {
+        parent->child[1] = new_node;
+    } else {
+        parent->child[0] = new_node;
+    }
+}
+
+/*
+ * patricia_rt_search_best
+ *
+ * Return the longest route of length <= maxlen matching addr, NULL if there
+ * is none. All routes in a subtree share the first bits of the route at its
+ * top, so we can stop at the first route that does not match.
+ */
+static patricia_rt_node_t *
+patricia_rt_search_best (patricia_rt_tree_t *tree, const uint8_t *addr,
+                         uint32_t maxlen)
+{
+    patricia_rt_node_t *node, *best = NULL;
+
+    node = tree->root;
+    while (node && node->bit <= maxlen) {
+        if (node->has_route) {
+            if (!patricia_rt_comp_with_mask(node->prefix, addr, node->bit)) {
+                break;
+            }
+            best = node;
+        }
+        node = node->child[patricia_rt_bit_test(tree, addr, node->bit)];
+    }
+
+    return best;
+}
+
+/*
+ * patricia_rt_search_exact
+ *
+ * Return the node carrying exactly the given route, NULL if there is none
+ */
+static patricia_rt_node_t *
+patricia_rt_search_exact (patricia_rt_tree_t *tree, const uint8_t *prefix,
+                          uint32_t len)
+{
+    patricia_rt_node_t *node;
+
+    node = tree->root;
+    while (node && node->bit < len) {
+        node = node->child[patricia_rt_bit_test(tree, prefix, node->bit)];
+    }
+
+    if (!node || node->bit != len || !node->has_route) {
+        return NULL;
+    }
+
+    if (!patricia_rt_comp_with_mask(node->prefix, prefix, len)) {
+        return NULL;
+    }
+
+    return node;
+}
+
+/*
+ * patricia_rt_accel_add
+ *
+ * Update the direct index table for a newly added route
+ */
+static void
+patricia_rt_accel_add (patricia_rt_tree_t *tree, patricia_rt_node_t *node)
+{
+    uint32_t base, span, i;
+
+    if (!tree->accel) {
+        return;
+    }
+
+    base = patricia_rt_accel_index(node->prefix);
+    if (node->bit > PATRICIA_RT_ACCEL_BITS) {
+        tree->accel[base].longer++;
+        return;
+    }
+
+    /* A route covers a range of slots. Keep the more specific one. */
+    span = 1 << (PATRICIA_RT_ACCEL_BITS - node->bit);
+    for (i = base; i < base + span; i++) {
+        if (!tree->accel[i].best || tree->accel[i].best->bit < node->bit) {
+            tree->accel[i].best = node;
+        }
+    }
+}
+
+/*
+ * patricia_rt_accel_delete
+ *
+ * Update the direct index table for a route that has just been removed
+ * from the tree. The slots that pointed to it fall back to the next less
+ * specific route covering the same range.
+ */
+static void
+patricia_rt_accel_delete (patricia_rt_tree_t *tree, patricia_rt_node_t *node,
+                          const uint8_t *prefix, uint32_t len)
+{
+    patricia_rt_node_t *replace;
+    uint32_t base, span, i;
+
+    if (!tree->accel) {
+        return;
+    }
+
+    base = patricia_rt_accel_index(prefix);
+    if (len > PATRICIA_RT_ACCEL_BITS) {
+        tree->accel[base].longer--;
+        return;
+    }
+
+    replace = patricia_rt_search_best(tree, prefix, len);
+    span = 1 << (PATRICIA_RT_ACCEL_BITS - len);
+    for (i = base; i < base + span; i++) {
+        if (tree->accel[i].best == node) {
+            tree->accel[i].best = replace;
+        }
+    }
+}
+
+/*
+ * patricia_rt_parse
+ *
+ * Parse "a.b.c.d/len" or "x:y::z/len" into addr and len. A missing length
+ * means a host route. Returns the address length in bytes, -1 on error.
+ */
+int
+patricia_rt_parse (const char *str, uint8_t *addr, uint32_t *len)
+{
+    char buf[INET6_ADDRSTRLEN + 8];
+    char *slash, *end;
+    unsigned long bits;
+    int addrlen;
+
+    /* Sanity check */
+    if (!str || !addr || !len || strlen(str) >= sizeof(buf)) {
+        return -1;
+    }
+
+    strcpy(buf, str);
+    slash = strchr(buf, '/');
+    if (slash) {
+        *slash++ = 0;
+    }
+
+    memset(addr, 0, PATRICIA_RT_MAX_ADDRLEN);
+    if (inet_pton(AF_INET, buf, addr) == 1) {
+        addrlen = PATRICIA_RT_IPV4_ADDRLEN;
+    } else if (inet_pton(AF_INET6, buf, addr) == 1) {
+        addrlen = PATRICIA_RT_IPV6_ADDRLEN;
+    } else {
+        return -1;
+    }
+
+    if (!slash) {
+        *len = addrlen * 8;
+        return addrlen;
+    }
+
+    bits = strtoul(slash, &end, 10);
+    if (end == slash || *end != 0 || bits > (unsigned long)addrlen * 8) {
+        return -1;
+    }
+    *len = (uint32_t)bits;
+
+    return addrlen;
+}
+
+/*
+ * patricia_rt_print_stats
+ *
+ * Dump the stats for the given routing table
+ */
+void
+patricia_rt_print_stats (patricia_rt_tree_t *tree)
+{
+#ifdef PATRICIA_STATS_ON
+    uint32_t i, alone;
+
+    printf("\nTotal number of routes: %lu\n", tree->count);
+    printf("Total number of nodes: %lu\n", tree->total_nodes);
+    printf("Total memory used: %lu bytes\n", tree->total_mem);
+    if (tree->accel) {
+        alone = 0;
+        for (i = 0; i < PATRICIA_RT_ACCEL_SIZE; i++) {
+            alone += (tree->accel[i].longer == 0);
+        }
+        printf("Direct index slots answered alone: %u of %u\n", alone,
+               PATRICIA_RT_ACCEL_SIZE);
+    }
+    printf("\n");
+#endif
+}
+
+/*
+ * patricia_rt_accel_hit
+ *
+ * Returns 1 if the direct index answers a lookup of the given address
+ * without touching the tree, 0 otherwise or if there is no index. Meant
+ * for measurements, lookups themselves count nothing.
+ */
+int
+patricia_rt_accel_hit (patricia_rt_tree_t *tree, const uint8_t *addr)
+{
+    /* Sanity check */
+    if (!tree || !addr || !tree->accel) {
+        return 0;
+    }
+
+    return tree->accel[patricia_rt_accel_index(addr)].longer == 0;
+}
+
+/*
+ * patricia_rt_lookup
+ *
+ * Longest prefix match of the given address. Returns 1 if a route matches,
+ * 0 otherwise. The data of the route is returned through data if non NULL.
+ */
+int
+patricia_rt_lookup (patricia_rt_tree_t *tree, const uint8_t *addr, void **data)
+{
+    patricia_rt_accel_t *slot;
+    patricia_rt_node_t *node;
+
+    /* Sanity check */
+    if (!tree || !addr) {
+        return 0;
+    }
+
+    if (tree->accel) {
+        slot = &tree->accel[patricia_rt_accel_index(addr)];
+        if (slot->longer == 0) {
+            node = slot->best;
+            if (!node) {
+                return 0;
+            }
+            if (data) {
+                *data = node->data;
+            }
+            return 1;
+        }
+    }
+
+    node = patricia_rt_search_best(tree, addr, tree->addrlen * 8);
+    if (!node) {
+        return 0;
+    }
+
+    if (data) {
+        *data = node->data;
+    }
+
+    return 1;
+}
+
+/*
+ * patricia_rt_lookup_exact
+ *
+ * Look up the given route. Returns 1 if found, 0 otherwise.
+ */
+int
+patricia_rt_lookup_exact (patricia_rt_tree_t *tree, const uint8_t *prefix,
+                          uint32_t len, void **data)
+{
+    patricia_rt_node_t *node;
+
+    /* Sanity check */
+    if (!tree || !prefix || len > tree->addrlen * 8) {
+        return 0;
+    }
+
+    node = patricia_rt_search_exact(tree, prefix, len);
+    if (!node) {
+        return 0;
+    }
+
+    if (data) {
+        *data = node->data;
+    }
+
+    return 1;
+}
+
+/*
+ * patricia_rt_delete
+ *
+ * Remove a route from the table. Returns 0 upon success, -1 if the route
+ * is not present.
+ */
+int
+patricia_rt_delete (patricia_rt_tree_t *tree, const uint8_t *prefix,
+                    uint32_t len, void **data)
+{
+    patricia_rt_node_t *node, *parent, *child;
+    uint8_t addr[PATRICIA_RT_MAX_ADDRLEN];
+
+    /* Sanity check */
+    if (!tree || !prefix || len > tree->addrlen * 8) {
+        return -1;
+    }
+
+    patricia_rt_mask(tree, prefix, len, addr);
+    node = patricia_rt_search_exact(tree, addr, len);
+    if (!node) {
+        return -1;
+    }
+
+    if (data) {
+        *data = node->data;
+    }
+    tree->count--;
+
+    if (node->child[0] && node->child[1]) {
+        /* Still needed for branching. Turn it into a glue node. */
+        node->has_route = 0;
+        node->data = NULL;
+
+    } else if (!node->child[0] && !node->child[1]) {
+        /* Leaf. If the parent is a glue node, it goes away as well. */
+        parent = node->parent;
+        patricia_rt_replace_child(tree, node, NULL);
+        patricia_rt_node_free(tree, node);
+
+        if (parent && !parent->has_route) {
+            child = parent->child[0] ? parent->child[0] : parent->child[1];
+            patricia_rt_replace_child(tree, parent, child);
+            patricia_rt_node_free(tree, parent);
+        }
+
+    } else {
+        /* One child. It takes the place of the node. */
+        child = node->child[0] ? node->child[0] : node->child[1];
+        patricia_rt_replace_child(tree, node, child);
+        patricia_rt_node_free(tree, node);
+    }
+
+    /* node is only compared against, never dereferenced */
+    patricia_rt_accel_delete(tree, node, addr, len);
+
+    return 0;
+}
+
+/*
+ * patricia_rt_add
+ *
+ * Add a route to the table. If the route is already present, its data is
+ * replaced. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_rt_add (patricia_rt_tree_t *tree, const uint8_t *prefix,
+                 uint32_t len, void *data)
+{
+    patricia_rt_node_t *node, *next, *new_node, *glue;
+    uint8_t addr[PATRICIA_RT_MAX_ADDRLEN];
+    uint32_t check_bit, differ_bit, i, j;
+    uint8_t r;
+
+    /* Sanity check */
+    if (!tree || !prefix || len > tree->addrlen * 8) {
+        return -1;
+    }
+
+    patricia_rt_mask(tree, prefix, len, addr);
+
+    if (!tree->root) {
+        new_node = patricia_rt_node_init(tree, addr, len);
+        if (!new_node) {
+            return -1;
+        }
+        new_node->has_route = 1;
+        new_node->data = data;
+        tree->root = new_node;
+        tree->count++;
+        patricia_rt_accel_add(tree, new_node);
+        return 0;
+    }
+
+    /*
+     * Walk down as far as the new prefix goes, to a node carrying a route.
+     * Glue nodes always have two children, so we never stop on one.
+     */
+    node = tree->root;
+    while (node->bit < len || !node->has_route) {
+        next = node->child[patricia_rt_bit_test(tree, addr, node->bit)];
+        if (!next) {
+            break;
+        }
+        node = next;
+    }
+
+    /* Find the first bit where the new prefix and that route differ */
+    check_bit = (node->bit < len) ? node->bit : len;
+    differ_bit = 0;
+    for (i = 0; i * 8 < check_bit; i++) {
+        r = addr[i] ^ node->prefix[i];
+        if (r == 0) {
+            differ_bit = (i + 1) * 8;
+            continue;
+        }
+        for (j = 0; j < 8; j++) {
+            if (r & (0x80 >> j)) {
+                break;
+            }
+        }
+        differ_bit = i * 8 + j;
+        break;
+    }
+    if (differ_bit > check_bit) {
+        differ_bit = check_bit;
+    }
+
+    /* Move back up to the place where the new prefix branches off */
+    while (node->parent && node->parent->bit >= differ_bit) {
+        node = node->parent;
+    }
+
+    if (differ_bit == len && node->bit == len) {
+        if (!node->has_route) {
+            /* Glue node at the right place, turn it into a route */
+            node->has_route = 1;
+            node->data = data;
+            tree->count++;
+            patricia_rt_accel_add(tree, node);
+            return 0;
+        }
+        node->data = data;
+        return 0;
+    }
+
+    new_node = patricia_rt_node_init(tree, addr, len);
+    if (!new_node) {
+        return -1;
+    }
+    new_node->has_route = 1;
+    new_node->data = data;
+
+    if (node->bit == differ_bit) {
+        /* The new route hangs off node */
+        new_node->parent = node;
+        node->child[patricia_rt_bit_test(tree, addr, node->bit)] = new_node;
+
+    } else if (len == differ_bit) {
+        /* The new route is a less specific route of node */
+        patricia_rt_replace_child(tree, node, new_node);
+        new_node->child[patricia_rt_bit_test(tree, node->prefix, len)] = node;
+        node->parent = new_node;
+
+    } else {
+        /* Both branch off a new glue node */
+        glue = patricia_rt_node_init(tree, addr, differ_bit);
+        if (!glue) {
+            patricia_rt_node_free(tree, new_node);
+            return -1;
+        }
+        patricia_rt_replace_child(tree, node, glue);
+        i = patricia_rt_bit_test(tree, addr, differ_bit);
+        glue->child[i] = new_node;
+        glue->child[1 - i] = node;
+        new_node->parent = glue;
+        node->parent = glue;
+    }
+
+    tree->count++;
+    patricia_rt_accel_add(tree, new_node);
+
+    return 0;
+}
+
+/*
+ * patricia_rt_destroy_internal
+ *
+ * Recursively free all the nodes under the given node
+ */
+static void
+patricia_rt_destroy_internal (patricia_rt_tree_t *tree,
+                              patricia_rt_node_t *node)
+{
+    if (!node) {
+        return;
+    }
+
+    patricia_rt_destroy_internal(tree, node->child[0]);
+    patricia_rt_destroy_internal(tree, node->child[1]);
+    patricia_rt_node_free(tree, node);
+}
+
+/*
+ * patricia_rt_destroy
+ *
+ * Cleanup the given routing table
+ */
+int
+patricia_rt_destroy (patricia_rt_tree_t *tree)
+{
+    /* Sanity check */
+    if (!tree) {
+        return -1;
+    }
+
+    patricia_rt_destroy_internal(tree, tree->root);
+    free(tree->accel);
+    free(tree);
+
+    return 0;
+}
+
+/*
+ * patricia_rt_init
+ *
+ * Create a routing table for addresses of addrlen bytes (4 or 16)
+ */
+patricia_rt_tree_t *
+patricia_rt_init (size_t addrlen, int flags)
+{
+    patricia_rt_tree_t *tree;
+
+    /* Sanity check */
+    if (addrlen != PATRICIA_RT_IPV4_ADDRLEN &&
+        addrlen != PATRICIA_RT_IPV6_ADDRLEN) {
+        return NULL;
+    }
+
+    tree = (patricia_rt_tree_t *)calloc(1, sizeof(patricia_rt_tree_t));
+    if (!tree) {
+        return NULL;
+    }
+    tree->addrlen = addrlen;
+
+    if (flags & PATRICIA_RT_ACCEL) {
+        tree->accel = (patricia_rt_accel_t *)calloc(PATRICIA_RT_ACCEL_SIZE,
+                                                    sizeof(patricia_rt_accel_t));
+        if (!tree->accel) {
+            free(tree);
+            return NULL;
+        }
+    }
+
+#ifdef PATRICIA_STATS_ON
+    tree->total_mem = sizeof(patricia_rt_tree_t);
+    if (tree->accel) {
+        tree->total_mem += PATRICIA_RT_ACCEL_SIZE * sizeof(patricia_rt_accel_t);
+    }
+#endif
+
+    return tree;
+}
+
+/* End of File */
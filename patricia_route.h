@@ -0,0 +1,80 @@
+/*
+ * patricia_route.h - Header file for the longest-prefix-match routing table
+ *
+ * Routing table front end for IPv4/IPv6 CIDR prefixes, built on a bit-level
+ * PATRICIA tree.
+ */
+
+#ifndef PATRICIA_ROUTE_H
+#define PATRICIA_ROUTE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_RT_IPV4_ADDRLEN    4
+#define PATRICIA_RT_IPV6_ADDRLEN    16
+#define PATRICIA_RT_MAX_ADDRLEN     16
+
+#define PATRICIA_RT_ACCEL_BITS      16      /* Direct index on the first 16 bits */
+#define PATRICIA_RT_ACCEL_SIZE      (1 << PATRICIA_RT_ACCEL_BITS)
+
+/* Flags for patricia_rt_init */
+#define PATRICIA_RT_ACCEL           0x1     /* Enable the direct index table */
+
+/* Datastructures */
+
+/*
+ * A node either carries a route (prefix/bit bits of prefix are significant)
+ * or is a glue node which only exists to branch on bit. Glue nodes always
+ * have two children.
+ */
+typedef struct patricia_rt_node_s {
+    struct patricia_rt_node_s   *child[2];
+    struct patricia_rt_node_s   *parent;
+    uint32_t                    bit;
+    uint8_t                     has_route;
+    void                        *data;
+    uint8_t                     prefix[PATRICIA_RT_MAX_ADDRLEN];
+} patricia_rt_node_t;
+
+/*
+ * Direct index entry. best is the longest route of length <= 16 covering
+ * the slot, longer counts the routes more specific than /16 inside it. If
+ * there are none, best is the answer and the tree is not touched at all.
+ */
+typedef struct patricia_rt_accel_s {
+    patricia_rt_node_t  *best;
+    uint32_t            longer;
+} patricia_rt_accel_t;
+
+typedef struct patricia_rt_tree_s {
+    patricia_rt_node_t  *root;
+    patricia_rt_accel_t *accel;
+    size_t              addrlen;
+    unsigned long       count;
+#ifdef PATRICIA_STATS_ON
+    unsigned long       total_mem;
+    unsigned long       total_nodes;
+#endif
+} patricia_rt_tree_t;
+
+/* Function Prototypes */
+
+int patricia_rt_parse (const char *str, uint8_t *addr, uint32_t *len);
+void patricia_rt_print_stats (patricia_rt_tree_t *tree);
+int patricia_rt_accel_hit (patricia_rt_tree_t *tree, const uint8_t *addr);
+int patricia_rt_lookup (patricia_rt_tree_t *tree, const uint8_t *addr,
+                        void **data);
+int patricia_rt_lookup_exact (patricia_rt_tree_t *tree, const uint8_t *prefix,
+                              uint32_t len, void **data);
+int patricia_rt_delete (patricia_rt_tree_t *tree, const uint8_t *prefix,
+                        uint32_t len, void **data);
+int patricia_rt_add (patricia_rt_tree_t *tree, const uint8_t *prefix,
+                     uint32_t len, void *data);
+int patricia_rt_destroy (patricia_rt_tree_t *tree);
+patricia_rt_tree_t *patricia_rt_init (size_t addrlen, int flags);
+
+#endif /* PATRICIA_ROUTE_H */
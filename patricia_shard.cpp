@@ -0,0 +1,462 @@
+/*
+ * patricia_shard.c
+ *
+ * This file implements a container that spreads keys over several patricia
+ * trees. Every key belongs to exactly one shard, chosen either by a hash of
+ * the key or by its first byte, and each shard has its own read/write lock.
+ * Adds and deletes on different shards run in parallel, lookups on the same
+ * shard share its lock.
+ *
+ * With PATRICIA_SHARD_PREFIX the shards hold consecutive ranges of the first
+ * byte, which keeps prefix scans on few shards but can leave the shards
+ * unbalanced. The ranges split printable ASCII evenly unless the caller
+ * sets bounds that match its keys. With PATRICIA_SHARD_HASH the load is
+ * even, and an ordered walk has to merge the keys of all the shards.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "patricia_shard.h"
+
+/*
+ * Keys of one shard collected by patricia_shard_walk, stored back to back
+ * with their terminating NUL, in order.
+ */
+typedef struct patricia_shard_keys_s {
+    char        *buf;
+    size_t      len;
+    size_t      cap;
+    size_t      pos;                        /* Merge cursor */
+} patricia_shard_keys_t;
+
+/*
+ * patricia_shard_hash
+ *
+ * FNV-1a hash of the key
+ */
+static inline uint32_t
+patricia_shard_hash (const char *key)
+{
+    uint32_t h = 2166136261u;
+
+    while (*key) {
+        h ^= (uint8_t)*key++;
+        h *= 16777619u;
+    }
+
+    return h;
+}
+
+/*
+ * patricia_shard_get
+ *
+ * Return the shard the given key belongs to
+ */
+static inline patricia_shard_t *
+patricia_shard_get (patricia_shard_tree_t *st, const char *key)
+{
+    uint32_t idx;
+
+    if (st->mode == PATRICIA_SHARD_PREFIX) {
+        idx = st->map[(uint8_t)key[0]];
+    } else {
+        idx = patricia_shard_hash(key) % st->count;
+    }
+
+    return st->shard[idx];
+}
+
+/*
+ * patricia_shard_collect
+ *
+ * patricia_walk_prefix callback which appends the key to those of the
+ * shard
+ */
+static int
+patricia_shard_collect (char *key, void *arg)
+{
+    patricia_shard_keys_t *keys = (patricia_shard_keys_t *)arg;
+    size_t len;
+    char *buf;
+
+    len = strlen(key) + 1;
+    if (keys->len + len > keys->cap) {
+        keys->cap = (keys->cap * 2 > keys->len + len) ? keys->cap * 2 :
+                                                        keys->len + len;
+        buf = (char *)realloc(keys->buf, keys->cap);
+        if (!buf) {
+            return -1;
+        }
+        keys->buf = buf;
+    }
+    memcpy(keys->buf + keys->len, key, len);
+    keys->len += len;
+
+    return 0;
+}
+
+/*
+ * patricia_shard_count_key
+ *
+ * patricia_walk callback used to count the keys of a shard
+ */
+static int
+patricia_shard_count_key (char *key, void *arg)
+{
+    (void)key;
+    (*(unsigned long *)arg)++;
+    return 0;
+}
+
+/*
+ * patricia_shard_print_stats
+ *
+ * Dump the stats for the given tree
+ */
+void
+patricia_shard_print_stats (patricia_shard_tree_t *st)
+{
+#ifdef PATRICIA_STATS_ON
+    patricia_shard_t *shard;
+    unsigned long keys, adds, deletes, lookups, total = 0;
+    uint32_t i;
+
+    /* Sanity check */
+    if (!st) {
+        return;
+    }
+
+    printf("\nTotal number of shards: %u (%s)\n", st->count,
+           (st->mode == PATRICIA_SHARD_PREFIX) ? "prefix" : "hash");
+    for (i = 0; i < st->count; i++) {
+        shard = st->shard[i];
+        keys = 0;
+
+        /*
+         * Adds and deletes only change under the write lock. Lookups count
+         * under the read lock, so that counter is read atomically.
+         */
+        pthread_rwlock_rdlock(&shard->lock);
+        patricia_walk(shard->tree, patricia_shard_count_key, &keys);
+        adds = shard->adds;
+        deletes = shard->deletes;
+        lookups = __atomic_load_n(&shard->lookups, __ATOMIC_RELAXED);
+        pthread_rwlock_unlock(&shard->lock);
+        total += keys;
+        printf("Shard %u: %lu keys, %lu adds, %lu deletes, %lu lookups\n", i,
+               keys, adds, deletes, lookups);
+    }
+    printf("Total number of keys: %lu\n\n", total);
+#endif
+}
+
+/*
+ * patricia_shard_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 otherwise.
+ */
+int
+patricia_shard_lookup (patricia_shard_tree_t *st, char *key)
+{
+    patricia_shard_t *shard;
+    int ret;
+
+    /* Sanity check */
+    if (!st || !key) {
+        return 0;
+    }
+
+    shard = patricia_shard_get(st, key);
+    pthread_rwlock_rdlock(&shard->lock);
+    ret = patricia_lookup(shard->tree, key);
+    pthread_rwlock_unlock(&shard->lock);
+#ifdef PATRICIA_STATS_ON
+    __atomic_fetch_add(&shard->lookups, 1, __ATOMIC_RELAXED);
+#endif
+
+    return ret;
+}
+
+/*
+ * patricia_shard_walk
+ *
+ * Invoke fn on every key starting with the given prefix, in lexicographical
+ * order across all the shards. The keys of each shard are copied out under
+ * its lock and then merged, so fn runs without any lock held. Each shard is
+ * seen at one point in time, but not all of them at the same one. Stops as
+ * soon as fn returns a non zero value and returns that value.
+ */
+int
+patricia_shard_walk (patricia_shard_tree_t *st, const char *prefix,
+                     patricia_walk_fn fn, void *arg)
+{
+    patricia_shard_keys_t *keys;
+    patricia_shard_t *shard;
+    uint32_t i, lo, hi, best;
+    int ret = 0;
+
+    /* Sanity check */
+    if (!st || !prefix || !fn) {
+        return -1;
+    }
+
+    keys = (patricia_shard_keys_t *)calloc(st->count,
+                                           sizeof(patricia_shard_keys_t));
+    if (!keys) {
+        return -1;
+    }
+
+    /* In prefix mode only the shard holding the first byte can match */
+    lo = 0;
+    hi = st->count;
+    if (st->mode == PATRICIA_SHARD_PREFIX && prefix[0]) {
+        lo = st->map[(uint8_t)prefix[0]];
+        hi = lo + 1;
+    }
+
+    /* Only the subtrees under the prefix are visited in each shard */
+    for (i = lo; i < hi; i++) {
+        shard = st->shard[i];
+        pthread_rwlock_rdlock(&shard->lock);
+        if (patricia_walk_prefix(shard->tree, (char *)prefix,
+                                 patricia_shard_collect, &keys[i]) != 0) {
+            ret = -1;
+        }
+        pthread_rwlock_unlock(&shard->lock);
+        if (ret != 0) {
+            goto done;
+        }
+    }
+
+    /* Merge, always taking the smallest key at the head of a shard */
+    while (1) {
+        best = st->count;
+        for (i = lo; i < hi; i++) {
+            if (keys[i].pos == keys[i].len) {
+                continue;
+            }
+            if (best == st->count ||
+                strcmp(keys[i].buf + keys[i].pos,
+                       keys[best].buf + keys[best].pos) < 0) {
+                best = i;
+            }
+        }
+        if (best == st->count) {
+            break;
+        }
+
+        ret = fn(keys[best].buf + keys[best].pos, arg);
+        if (ret != 0) {
+            break;
+        }
+        keys[best].pos += strlen(keys[best].buf + keys[best].pos) + 1;
+    }
+
+done:
+    for (i = 0; i < st->count; i++) {
+        free(keys[i].buf);
+    }
+    free(keys);
+
+    return ret;
+}
+
+/*
+ * patricia_shard_delete
+ *
+ * Delete the given key from its shard
+ */
+int
+patricia_shard_delete (patricia_shard_tree_t *st, char *key)
+{
+    patricia_shard_t *shard;
+    int ret;
+
+    /* Sanity check */
+    if (!st || !key) {
+        return -1;
+    }
+
+    shard = patricia_shard_get(st, key);
+    pthread_rwlock_wrlock(&shard->lock);
+    ret = patricia_delete(shard->tree, key);
+#ifdef PATRICIA_STATS_ON
+    if (ret == 0) {
+        shard->deletes++;
+    }
+#endif
+    pthread_rwlock_unlock(&shard->lock);
+
+    return ret;
+}
+
+/*
+ * patricia_shard_add
+ *
+ * Add the given key to its shard
+ */
+int
+patricia_shard_add (patricia_shard_tree_t *st, char *key)
+{
+    patricia_shard_t *shard;
+    int ret;
+
+    /* Sanity check */
+    if (!st || !key) {
+        return -1;
+    }
+
+    shard = patricia_shard_get(st, key);
+    pthread_rwlock_wrlock(&shard->lock);
+    ret = patricia_add(shard->tree, key);
+#ifdef PATRICIA_STATS_ON
+    if (ret == 0) {
+        shard->adds++;
+    }
+#endif
+    pthread_rwlock_unlock(&shard->lock);
+
+    return ret;
+}
+
+/*
+ * patricia_shard_set_bounds
+ *
+ * Set the ranges of first bytes for PATRICIA_SHARD_PREFIX. bounds holds
+ * count - 1 strictly ascending bytes, shard i takes the first bytes from
+ * bounds[i - 1] up to but not including bounds[i]. Must be called before
+ * any key is added. Returns 0 upon success, -1 upon failure.
+ */
+int
+patricia_shard_set_bounds (patricia_shard_tree_t *st, const char *bounds)
+{
+    uint32_t i, c;
+
+    /* Sanity check */
+    if (!st || !bounds || st->mode != PATRICIA_SHARD_PREFIX ||
+        strlen(bounds) != st->count - 1) {
+        return -1;
+    }
+
+    for (i = 0; i < st->count; i++) {
+        if (!PATRICIA_IS_LEAF(st->shard[i]->tree->root)) {
+            return -1;
+        }
+    }
+    for (i = 1; i + 1 < st->count; i++) {
+        if ((uint8_t)bounds[i] <= (uint8_t)bounds[i - 1]) {
+            return -1;
+        }
+    }
+
+    i = 0;
+    for (c = 0; c < 256; c++) {
+        while (i + 1 < st->count && c >= (uint8_t)bounds[i]) {
+            i++;
+        }
+        st->map[c] = i;
+    }
+
+    return 0;
+}
+
+/*
+ * patricia_shard_destroy
+ *
+ * Free all the shards. There must be no other users left.
+ */
+int
+patricia_shard_destroy (patricia_shard_tree_t *st)
+{
+    patricia_shard_t *shard;
+    uint32_t i;
+
+    /* Sanity check */
+    if (!st) {
+        return -1;
+    }
+
+    for (i = 0; i < st->count; i++) {
+        shard = st->shard[i];
+        if (!shard) {
+            continue;
+        }
+        if (shard->tree) {
+            patricia_destroy(shard->tree);
+        }
+        pthread_rwlock_destroy(&shard->lock);
+        free(shard);
+    }
+    free(st);
+
+    return 0;
+}
+
+/*
+ * patricia_shard_init
+ *
+ * Create a tree of count shards, PATRICIA_SHARD_DEFAULT if count is 0,
+ * partitioned according to mode
+ */
+patricia_shard_tree_t *
+patricia_shard_init (uint32_t count, uint32_t mode)
+{
+    patricia_shard_tree_t *st;
+    patricia_shard_t *shard;
+    size_t size;
+    uint32_t i;
+    void *mem;
+
+    if (count == 0) {
+        count = PATRICIA_SHARD_DEFAULT;
+    }
+
+    /* Sanity check */
+    if (count > PATRICIA_SHARD_MAX ||
+        (mode != PATRICIA_SHARD_HASH && mode != PATRICIA_SHARD_PREFIX)) {
+        return NULL;
+    }
+
+    st = (patricia_shard_tree_t *)calloc(1, sizeof(patricia_shard_tree_t));
+    if (!st) {
+        return NULL;
+    }
+    st->count = count;
+    st->mode = mode;
+
+    /* Default prefix ranges, even over printable ASCII */
+    for (i = 0; i < 256; i++) {
+        if (i < 0x20) {
+            st->map[i] = 0;
+        } else if (i >= 0x7f) {
+            st->map[i] = count - 1;
+        } else {
+            st->map[i] = (i - 0x20) * count / (0x7f - 0x20);
+        }
+    }
+
+    size = (sizeof(patricia_shard_t) + 63) & ~(size_t)63;
+    for (i = 0; i < count; i++) {
+        if (posix_memalign(&mem, 64, size) != 0) {
+            patricia_shard_destroy(st);
+            return NULL;
+        }
+        shard = (patricia_shard_t *)mem;
+        memset(shard, 0, size);
+        pthread_rwlock_init(&shard->lock, NULL);
+        st->shard[i] = shard;
+
+        shard->tree = patricia_init();
+        if (!shard->tree) {
+            patricia_shard_destroy(st);
+            return NULL;
+        }
+    }
+
+    return st;
+}
+
+/* End of File */
@@ -0,0 +1,58 @@
+/*
+ * patricia_shard.h - Header file for the sharded patricia tree
+ *
+ * Keys are spread over a fixed number of independent patricia trees, each
+ * behind its own lock, so writers to different shards do not contend.
+ */
+
+#ifndef PATRICIA_SHARD_H
+#define PATRICIA_SHARD_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "patricia.h"
+
+/* Defines */
+
+#define PATRICIA_SHARD_MAX          256
+#define PATRICIA_SHARD_DEFAULT      16
+
+/* Partitioning modes */
+#define PATRICIA_SHARD_HASH         1           /* Hash of the whole key */
+#define PATRICIA_SHARD_PREFIX       2           /* Ranges of the first byte */
+
+/* Datastructures */
+
+/*
+ * One shard. Each is allocated on its own cache lines, so that the locks of
+ * neighbouring shards do not share one.
+ */
+typedef struct patricia_shard_s {
+    pthread_rwlock_t    lock;
+    patricia_tree_t     *tree;
+    unsigned long       adds;
+    unsigned long       deletes;
+    unsigned long       lookups;
+} patricia_shard_t;
+
+typedef struct patricia_shard_tree_s {
+    uint32_t            count;
+    uint32_t            mode;
+    uint8_t             map[256];           /* First byte to shard */
+    patricia_shard_t    *shard[PATRICIA_SHARD_MAX];
+} patricia_shard_tree_t;
+
+/* Function Prototypes */
+
+void patricia_shard_print_stats (patricia_shard_tree_t *st);
+int patricia_shard_lookup (patricia_shard_tree_t *st, char *key);
+int patricia_shard_walk (patricia_shard_tree_t *st, const char *prefix,
+                         patricia_walk_fn fn, void *arg);
+int patricia_shard_delete (patricia_shard_tree_t *st, char *key);
+int patricia_shard_add (patricia_shard_tree_t *st, char *key);
+int patricia_shard_set_bounds (patricia_shard_tree_t *st, const char *bounds);
+int patricia_shard_destroy (patricia_shard_tree_t *st);
+patricia_shard_tree_t *patricia_shard_init (uint32_t count, uint32_t mode);
+
+#endif /* PATRICIA_SHARD_H */
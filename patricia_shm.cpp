@@ -0,0 +1,444 @@
+/*
+ * patricia_shm.c
+ *
+ * This file implements an arena tree shared between processes through a
+ * POSIX shared memory segment. Arena nodes refer to each other by offsets
+ * from the start of the arena, so the same segment works wherever each
+ * process happens to map it and a process that attaches can serve lookups
+ * right away, without building or copying the tree.
+ *
+ * The process that creates the segment is the only writer. Its adds and
+ * deletes change the arena in place, inside a sequence lock: the counter
+ * in the segment header is odd while a change is under way. A reader notes
+ * the counter, searches the tree, and starts over if the counter was odd or
+ * has moved since. Readers never write to the segment, they map it
+ * read-only.
+ *
+ * A reader may see the tree half way through a change, so its search does
+ * not trust anything it reads: every ref is checked against the arena
+ * bounds, and sibling lists must be strictly ascending, which caps them at
+ * 256 entries. A search that finds the tree inconsistent just retries.
+ *
+ * The segment is sized when it is created and the arena does not grow.
+ * An add that does not fit fails. Space freed by deletes is only reclaimed
+ * by creating the segment again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "patricia_shm.h"
+
+#define PATRICIA_SHM_HDR(shm) \
+    ((patricia_shm_header_t *)(shm)->base)
+
+/*
+ * patricia_shm_search
+ *
+ * Look up the key in the arena image at base, len bytes long, trusting
+ * nothing in it. Returns 1 if found, 0 if not, and -1 if the image is not
+ * consistent.
+ */
+static int
+patricia_shm_search (const char *base, uint64_t len, const char *key)
+{
+    const patricia_arena_header_t *hdr;
+    const patricia_arena_node_t *node, *child;
+    patricia_ref_t next;
+    uint64_t limit;
+    uint32_t klen, pos;
+    int last;
+
+    hdr = (const patricia_arena_header_t *)base;
+    limit = (uint64_t)hdr->used * PATRICIA_ARENA_ALIGN;
+    if (limit > len) {
+        return -1;
+    }
+
+/* The node at ref, label included, must lie within the used part */
+#define PATRICIA_SHM_CHECK(ref) \
+    ((ref) != PATRICIA_ARENA_NULL && \
+     (uint64_t)(ref) * PATRICIA_ARENA_ALIGN + \
+     offsetof(patricia_arena_node_t, label) <= limit && \
+     (uint64_t)(ref) * PATRICIA_ARENA_ALIGN + \
+     offsetof(patricia_arena_node_t, label) + \
+     ((const patricia_arena_node_t *)(base + (uint64_t)(ref) * \
+                                      PATRICIA_ARENA_ALIGN))->label_len <= limit)
+
+    if (!PATRICIA_SHM_CHECK(hdr->root)) {
+        return -1;
+    }
+    node = (const patricia_arena_node_t *)(base + (uint64_t)hdr->root *
+                                           PATRICIA_ARENA_ALIGN);
+
+    klen = strlen(key);
+    pos = 0;
+    while (pos < klen) {
+        child = NULL;
+        last = -1;
+        for (next = node->first_child; next; next = child->next_sibling) {
+            if (!PATRICIA_SHM_CHECK(next)) {
+                return -1;
+            }
+            child = (const patricia_arena_node_t *)(base + (uint64_t)next *
+                                                    PATRICIA_ARENA_ALIGN);
+            if (child->label_len == 0 || (uint8_t)child->label[0] <= last) {
+                return -1;
+            }
+            last = (uint8_t)child->label[0];
+            if (last >= (uint8_t)key[pos]) {
+                break;
+            }
+        }
+        if (!next || child->label[0] != key[pos]) {
+            return 0;
+        }
+
+        if (klen - pos < child->label_len ||
+            memcmp(child->label, key + pos, child->label_len) != 0) {
+            return 0;
+        }
+        pos += child->label_len;
+        node = child;
+    }
+
+#undef PATRICIA_SHM_CHECK
+
+    return (node->flags & PATRICIA_ARENA_KEY) ? 1 : 0;
+}
+
+/*
+ * patricia_shm_map
+ *
+ * Map the segment open on fd and check its header. Returns NULL upon
+ * failure.
+ */
+static patricia_shm_t *
+patricia_shm_map (int fd, uint8_t writer)
+{
+    patricia_shm_header_t *hdr;
+    patricia_shm_t *shm;
+    struct stat st;
+    void *base;
+
+    if (fstat(fd, &st) != 0 ||
+        (uint64_t)st.st_size < sizeof(patricia_shm_header_t)) {
+        return NULL;
+    }
+
+    base = mmap(NULL, st.st_size, writer ? PROT_READ | PROT_WRITE : PROT_READ,
+                MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    hdr = (patricia_shm_header_t *)base;
+    if (!writer &&
+        (memcmp(hdr->magic, PATRICIA_SHM_MAGIC, 4) != 0 ||
+         hdr->version != PATRICIA_SHM_VERSION ||
+         hdr->size != (uint64_t)st.st_size ||
+         hdr->arena_off < sizeof(patricia_shm_header_t) ||
+         hdr->arena_off % PATRICIA_ARENA_ALIGN != 0 ||
+         hdr->arena_off + sizeof(patricia_arena_header_t) > hdr->size)) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+
+    shm = (patricia_shm_t *)calloc(1, sizeof(patricia_shm_t));
+    if (!shm) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    shm->base = (char *)base;
+    shm->len = st.st_size;
+    shm->writer = writer;
+
+    return shm;
+}
+
+/*
+ * patricia_shm_print_stats
+ *
+ * Dump the stats for the given segment
+ */
+void
+patricia_shm_print_stats (patricia_shm_t *shm)
+{
+#ifdef PATRICIA_STATS_ON
+    patricia_shm_header_t *hdr;
+
+    /* Sanity check */
+    if (!shm) {
+        return;
+    }
+
+    hdr = PATRICIA_SHM_HDR(shm);
+    printf("\nSegment size: %lu bytes (%s)\n", (unsigned long)shm->len,
+           shm->writer ? "writer" : "reader");
+    printf("Sequence number: %lu\n",
+           (unsigned long)__atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE));
+    printf("Total number of lookups: %lu\n", shm->lookups);
+    printf("Total number of lookup retries: %lu\n", shm->retries);
+    if (shm->arena) {
+        patricia_arena_print_stats(shm->arena);
+    }
+#endif
+}
+
+/*
+ * patricia_shm_lookup
+ *
+ * Look up the given key. Returns 1 if found, 0 if not, and -1 if no
+ * consistent view of the tree could be had, which only happens when the
+ * writer died in the middle of a change.
+ */
+int
+patricia_shm_lookup (patricia_shm_t *shm, const char *key)
+{
+    patricia_shm_header_t *hdr;
+    uint64_t seq;
+    uint32_t tries;
+    int ret;
+
+    /* Sanity check */
+    if (!shm || !key) {
+        return 0;
+    }
+
+    hdr = PATRICIA_SHM_HDR(shm);
+#ifdef PATRICIA_STATS_ON
+    shm->lookups++;
+#endif
+
+    /* The writer's own view is never stale */
+    if (shm->writer) {
+        return patricia_arena_lookup(shm->arena, key);
+    }
+
+    for (tries = 0; tries < PATRICIA_SHM_MAX_RETRIES; tries++) {
+        seq = __atomic_load_n(&hdr->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            sched_yield();
+            continue;
+        }
+
+        ret = patricia_shm_search(shm->base + hdr->arena_off,
+                                  shm->len - hdr->arena_off, key);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (ret >= 0 && __atomic_load_n(&hdr->seq, __ATOMIC_RELAXED) == seq) {
+            return ret;
+        }
+#ifdef PATRICIA_STATS_ON
+        shm->retries++;
+#endif
+    }
+
+    return -1;
+}
+
+/*
+ * patricia_shm_delete
+ *
+ * Delete the given key. Writer only. Returns 0 upon success, -1 upon
+ * failure.
+ */
+int
+patricia_shm_delete (patricia_shm_t *shm, const char *key)
+{
+    patricia_shm_header_t *hdr;
+    uint64_t seq;
+    int ret;
+
+    /* Sanity check */
+    if (!shm || !shm->writer || !key) {
+        return -1;
+    }
+
+    hdr = PATRICIA_SHM_HDR(shm);
+    seq = hdr->seq;
+    __atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ret = patricia_arena_delete(shm->arena, key);
+    __atomic_store_n(&hdr->seq, seq + 2, __ATOMIC_RELEASE);
+
+    return ret;
+}
+
+/*
+ * patricia_shm_add
+ *
+ * Add the given key. Writer only. Returns 0 upon success, -1 upon failure,
+ * including when the segment is full.
+ */
+int
+patricia_shm_add (patricia_shm_t *shm, const char *key)
+{
+    patricia_shm_header_t *hdr;
+    uint64_t seq;
+    int ret;
+
+    /* Sanity check */
+    if (!shm || !shm->writer || !key) {
+        return -1;
+    }
+
+    hdr = PATRICIA_SHM_HDR(shm);
+    seq = hdr->seq;
+    __atomic_store_n(&hdr->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ret = patricia_arena_add(shm->arena, key);
+    __atomic_store_n(&hdr->seq, seq + 2, __ATOMIC_RELEASE);
+
+    return ret;
+}
+
+/*
+ * patricia_shm_unlink
+ *
+ * Remove the segment name. Processes that have it mapped keep using it.
+ */
+int
+patricia_shm_unlink (const char *name)
+{
+    /* Sanity check */
+    if (!name) {
+        return -1;
+    }
+
+    return shm_unlink(name);
+}
+
+/*
+ * patricia_shm_detach
+ *
+ * Unmap the segment from this process. The segment itself stays until it
+ * is unlinked and the last process detaches.
+ */
+int
+patricia_shm_detach (patricia_shm_t *shm)
+{
+    /* Sanity check */
+    if (!shm) {
+        return -1;
+    }
+
+    if (shm->arena) {
+        patricia_arena_destroy(shm->arena);
+    }
+    munmap(shm->base, shm->len);
+    free(shm);
+
+    return 0;
+}
+
+/*
+ * patricia_shm_attach
+ *
+ * Map an existing segment read-only, for lookups
+ */
+patricia_shm_t *
+patricia_shm_attach (const char *name)
+{
+    patricia_shm_t *shm;
+    int fd;
+
+    /* Sanity check */
+    if (!name) {
+        return NULL;
+    }
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        return NULL;
+    }
+    shm = patricia_shm_map(fd, 0);
+    close(fd);
+
+    return shm;
+}
+
+/*
+ * patricia_shm_create
+ *
+ * Create the named segment of size bytes and become its writer. The tree
+ * in it starts with the keys of the given patricia tree, or empty if tree
+ * is NULL. Fails if the segment already exists.
+ */
+patricia_shm_t *
+patricia_shm_create (const char *name, size_t size, patricia_tree_t *tree)
+{
+    patricia_shm_header_t *hdr;
+    patricia_arena_t *arena;
+    patricia_shm_t *shm;
+    uint64_t off;
+    size_t len;
+    void *image;
+    int fd;
+
+    /* Sanity check */
+    if (!name) {
+        return NULL;
+    }
+
+    arena = tree ? patricia_arena_build(tree, 0) : patricia_arena_init(0, 0);
+    if (!arena) {
+        return NULL;
+    }
+    image = patricia_arena_image(arena, &len);
+
+    off = PATRICIA_ARENA_UNITS(sizeof(patricia_shm_header_t)) *
+          PATRICIA_ARENA_ALIGN;
+    if (size < off + len) {
+        patricia_arena_destroy(arena);
+        return NULL;
+    }
+
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        patricia_arena_destroy(arena);
+        return NULL;
+    }
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        shm_unlink(name);
+        patricia_arena_destroy(arena);
+        return NULL;
+    }
+    shm = patricia_shm_map(fd, 1);
+    close(fd);
+    if (!shm) {
+        shm_unlink(name);
+        patricia_arena_destroy(arena);
+        return NULL;
+    }
+
+    /* The arena image goes in first, then the header makes it valid */
+    memcpy(shm->base + off, image, len);
+    patricia_arena_destroy(arena);
+    shm->arena = patricia_arena_open(shm->base + off, size - off);
+    if (!shm->arena) {
+        patricia_shm_detach(shm);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    hdr = PATRICIA_SHM_HDR(shm);
+    hdr->version = PATRICIA_SHM_VERSION;
+    hdr->seq = 0;
+    hdr->size = size;
+    hdr->arena_off = off;
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(hdr->magic, PATRICIA_SHM_MAGIC, 4);
+
+    return shm;
+}
+
+/* End of File */
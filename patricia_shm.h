@@ -0,0 +1,59 @@
+/*
+ * patricia_shm.h - Header file for the shared memory patricia tree
+ *
+ * An arena tree placed in a POSIX shared memory segment. One process
+ * creates the segment and changes the tree, any number of processes attach
+ * to it read-only and look keys up without copying anything.
+ */
+
+#ifndef PATRICIA_SHM_H
+#define PATRICIA_SHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "patricia_arena.h"
+
+/* Defines */
+
+#define PATRICIA_SHM_MAGIC          "PTSM"
+#define PATRICIA_SHM_VERSION        1
+#define PATRICIA_SHM_MAX_RETRIES    1000000     /* Reader attempts per lookup */
+
+/* Datastructures */
+
+/*
+ * Segment header. The arena image follows at arena_off. seq is the
+ * sequence lock, odd while the writer is changing the arena.
+ */
+typedef struct patricia_shm_header_s {
+    char            magic[4];
+    uint32_t        version;
+    uint64_t        seq;
+    uint64_t        size;                   /* Segment bytes */
+    uint64_t        arena_off;
+    uint8_t         pad[32];
+} patricia_shm_header_t;
+
+/* One process' view of a segment */
+typedef struct patricia_shm_s {
+    char                    *base;
+    uint64_t                len;
+    uint8_t                 writer;
+    patricia_arena_t        *arena;         /* Writer only */
+    unsigned long           lookups;
+    unsigned long           retries;
+} patricia_shm_t;
+
+/* Function Prototypes */
+
+void patricia_shm_print_stats (patricia_shm_t *shm);
+int patricia_shm_lookup (patricia_shm_t *shm, const char *key);
+int patricia_shm_delete (patricia_shm_t *shm, const char *key);
+int patricia_shm_add (patricia_shm_t *shm, const char *key);
+int patricia_shm_unlink (const char *name);
+int patricia_shm_detach (patricia_shm_t *shm);
+patricia_shm_t *patricia_shm_attach (const char *name);
+patricia_shm_t *patricia_shm_create (const char *name, size_t size,
+                                     patricia_tree_t *tree);
+
+#endif /* PATRICIA_SHM_H */
@@ -0,0 +1,344 @@
+/*
+ * patricia_static.h - Compile-time patricia trie for fixed keyword sets
+ *
+ * patricia::StaticSet builds a trie from a list of keywords known at compile
+ * time and turns it into code. A level where the keywords branch becomes a
+ * chain of comparisons of one input byte against constants, in ascending
+ * order, nested once per branching byte. Whether the compiler turns such a
+ * chain into a switch is up to it. Runs of bytes that all the keywords left
+ * share, and where none of them ends, are compared as one block, the way a
+ * path compressed trie keeps them in one label. Nothing is stored at
+ * runtime, a lookup costs a handful of compares and branches. The set must
+ * not be empty and must not list a keyword twice.
+ *
+ * Usage:
+ *
+ *     static constexpr char kw_get[] = "GET";
+ *     static constexpr char kw_put[] = "PUT";
+ *     using verbs = patricia::StaticSet<patricia::literal_of<kw_get>,
+ *                                       patricia::literal_of<kw_put>>;
+ *
+ *     int id = verbs::lookup(str, len);    // 0, 1 or -1
+ */
+
+#ifndef PATRICIA_STATIC_H
+#define PATRICIA_STATIC_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace patricia {
+
+/*
+ * literal
+ *
+ * A keyword as a pack of chars
+ */
+template <char... Cs>
+struct literal {
+    static constexpr std::size_t size = sizeof...(Cs);
+    static constexpr char chars[sizeof...(Cs) + 1] = { Cs..., 0 };
+};
+
+namespace detail {
+
+constexpr std::size_t
+static_strlen (const char *str)
+{
+    std::size_t len = 0;
+
+    while (str[len]) {
+        len++;
+    }
+    return len;
+}
+
+template <const char *Str, std::size_t... I>
+constexpr literal<Str[I]...> make_literal (std::index_sequence<I...>);
+
+/* Shortest and longest of the keywords, 0 for an empty set */
+template <typename... Literals>
+constexpr std::size_t
+min_size ()
+{
+    const std::size_t sizes[] = { Literals::size..., 0 };
+    std::size_t min = sizes[0];
+
+    for (std::size_t i = 1; i < sizeof...(Literals); i++) {
+        min = std::min(min, sizes[i]);
+    }
+    return min;
+}
+
+template <typename... Literals>
+constexpr std::size_t
+max_size ()
+{
+    const std::size_t sizes[] = { Literals::size..., 0 };
+
+    return *std::max_element(sizes, sizes + sizeof...(Literals) + 1);
+}
+
+/* Whether no keyword is listed twice */
+template <typename... Literals>
+constexpr bool
+distinct ()
+{
+    const std::size_t sizes[] = { Literals::size..., 0 };
+    const char *chars[] = { Literals::chars..., nullptr };
+    std::size_t i = 0, j = 0, k = 0;
+
+    for (i = 0; i < sizeof...(Literals); i++) {
+        for (j = i + 1; j < sizeof...(Literals); j++) {
+            if (sizes[i] != sizes[j]) {
+                continue;
+            }
+            k = 0;
+            while (k < sizes[i] && chars[i][k] == chars[j][k]) {
+                k++;
+            }
+            if (k == sizes[i]) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+/* A keyword together with its position in the StaticSet */
+template <int Index, typename Literal>
+struct entry {
+    static constexpr int index = Index;
+    using lit = Literal;
+};
+
+/* Byte at position Depth of the keyword, only valid if it is long enough */
+template <std::size_t Depth, typename Entry>
+constexpr char
+byte_at ()
+{
+    return Entry::lit::chars[Depth < Entry::lit::size ? Depth : 0];
+}
+
+/*
+ * branches
+ *
+ * The distinct bytes found at position Depth among the keywords that are
+ * longer than Depth, in ascending order
+ */
+template <std::size_t Depth, typename... Entries>
+struct branches {
+    struct table_t {
+        std::array<char, sizeof...(Entries) + 1> bytes;
+        std::size_t count;
+    };
+
+    static constexpr table_t compute ()
+    {
+        table_t table{};
+        const bool valid[] = { (Depth < Entries::lit::size)..., false };
+        const char bytes[] = { byte_at<Depth, Entries>()..., 0 };
+        std::size_t i = 0, j = 0, k = 0;
+        bool seen = false;
+        char tmp = 0;
+
+        table.count = 0;
+        for (i = 0; i < sizeof...(Entries); i++) {
+            if (!valid[i]) {
+                continue;
+            }
+            seen = false;
+            for (j = 0; j < table.count; j++) {
+                if (table.bytes[j] == bytes[i]) {
+                    seen = true;
+                }
+            }
+            if (!seen) {
+                table.bytes[table.count++] = bytes[i];
+            }
+        }
+
+        /* Insertion sort, only to keep the generated code in key order */
+        for (i = 1; i < table.count; i++) {
+            for (k = i; k > 0 && (unsigned char)table.bytes[k - 1] >
+                                 (unsigned char)table.bytes[k]; k--) {
+                tmp = table.bytes[k];
+                table.bytes[k] = table.bytes[k - 1];
+                table.bytes[k - 1] = tmp;
+            }
+        }
+
+        return table;
+    }
+
+    static constexpr table_t table = compute();
+};
+
+/* Keep the entries whose byte at Depth is B */
+template <std::size_t Depth, char B, typename Entry>
+using select_t = std::conditional_t<(Depth < Entry::lit::size &&
+                                     byte_at<Depth, Entry>() == B),
+                                    std::tuple<Entry>, std::tuple<>>;
+
+template <std::size_t Depth, typename Tuple>
+struct node_of;
+
+/*
+ * node
+ *
+ * The trie node reached after matching Depth bytes. All the Entries share
+ * the same first Depth bytes.
+ */
+template <std::size_t Depth, typename... Entries>
+struct node {
+    using branch_t = branches<Depth, Entries...>;
+    using first_t = std::tuple_element_t<0, std::tuple<Entries...>>;
+
+    template <char B>
+    using child = typename node_of<Depth + 1,
+                  decltype(std::tuple_cat(
+                      std::declval<select_t<Depth, B, Entries>>()...))>::type;
+
+    /* Index of the keyword ending exactly here, -1 if there is none */
+    static constexpr int terminal ()
+    {
+        int index = -1;
+        const int found[] = { (Entries::lit::size == Depth ?
+                               Entries::index : -1)..., -1 };
+
+        for (int f : found) {
+            if (f >= 0) {
+                index = f;
+            }
+        }
+        return index;
+    }
+
+    /*
+     * Number of bytes from Depth on that all the Entries share without any
+     * of them ending, which can be compared as one block
+     */
+    static constexpr std::size_t run ()
+    {
+        const std::size_t sizes[] = { Entries::lit::size... };
+        const char *chars[] = { Entries::lit::chars... };
+        std::size_t n = 0;
+
+        while (1) {
+            for (std::size_t i = 0; i < sizeof...(Entries); i++) {
+                if (sizes[i] <= Depth + n ||
+                    chars[i][Depth + n] != chars[0][Depth + n]) {
+                    return n;
+                }
+            }
+            n++;
+        }
+    }
+
+    static constexpr std::size_t run_len = run();
+
+    template <std::size_t... I>
+    static inline int dispatch (const char *str, std::size_t len,
+                                std::index_sequence<I...>)
+    {
+        int ret = -1;
+        const char c = str[Depth];
+
+        (void)((c == branch_t::table.bytes[I] ?
+                (ret = child<branch_t::table.bytes[I]>::match(str, len),
+                 true) : false) || ...);
+        return ret;
+    }
+
+    static inline int match (const char *str, std::size_t len)
+    {
+        if (len == Depth) {
+            return terminal();
+        }
+
+        if constexpr (run_len > 1) {
+            if (len - Depth < run_len ||
+                std::memcmp(str + Depth, first_t::lit::chars + Depth,
+                            run_len) != 0) {
+                return -1;
+            }
+            return node<Depth + run_len, Entries...>::match(str, len);
+        } else if constexpr (branch_t::table.count == 0) {
+            return -1;
+        } else {
+            return dispatch(str, len,
+                            std::make_index_sequence<branch_t::table.count>());
+        }
+    }
+};
+
+template <std::size_t Depth, typename... Entries>
+struct node_of<Depth, std::tuple<Entries...>> {
+    using type = node<Depth, Entries...>;
+};
+
+template <typename Seq, typename... Literals>
+struct root_of;
+
+template <std::size_t... I, typename... Literals>
+struct root_of<std::index_sequence<I...>, Literals...> {
+    using type = node<0, entry<(int)I, Literals>...>;
+};
+
+} /* namespace detail */
+
+/*
+ * literal_of
+ *
+ * Turn a constexpr char array with static storage into a literal
+ */
+template <const char *Str>
+using literal_of = decltype(detail::make_literal<Str>(
+                            std::make_index_sequence<
+                                detail::static_strlen(Str)>()));
+
+/*
+ * StaticSet
+ *
+ * lookup() returns the position of the key in the list of Literals, or -1
+ * if the key is not one of them.
+ */
+template <typename... Literals>
+struct StaticSet {
+    static_assert(sizeof...(Literals) > 0, "StaticSet needs a keyword");
+    static_assert(detail::distinct<Literals...>(),
+                  "StaticSet lists a keyword twice");
+
+    static constexpr std::size_t size = sizeof...(Literals);
+    static constexpr std::size_t min_len = detail::min_size<Literals...>();
+    static constexpr std::size_t max_len = detail::max_size<Literals...>();
+
+    static inline int lookup (const char *str, std::size_t len)
+    {
+        if (len < min_len || len > max_len) {
+            return -1;
+        }
+        return detail::root_of<std::index_sequence_for<Literals...>,
+                               Literals...>::type::match(str, len);
+    }
+
+    static inline int lookup (std::string_view key)
+    {
+        return lookup(key.data(), key.size());
+    }
+
+    static inline bool contains (std::string_view key)
+    {
+        return lookup(key.data(), key.size()) >= 0;
+    }
+};
+
+} /* namespace patricia */
+
+#endif /* PATRICIA_STATIC_H */
@@ -0,0 +1,700 @@
+/*
+ * patricia_tree.h - Header-only C++ template interface to the patricia tree
+ *
+ * patricia::Tree<Value, Allocator, KeyTraits> is a radix tree keyed by
+ * std::string_view which stores a Value inline in every node carrying a key.
+ * It uses the same layout as patricia_tree_t (a label per node, children
+ * kept in lexicographical order of their first byte) but needs no NUL
+ * terminated copies of the keys, supports move-only values, allocates
+ * through the given allocator and frees everything in its destructor.
+ */
+
+#ifndef PATRICIA_TREE_H
+#define PATRICIA_TREE_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+namespace patricia {
+
+/*
+ * DefaultKeyTraits
+ *
+ * Orders key bytes as unsigned chars, which is the order strcmp() gives
+ * and the order the C tree keeps its children in.
+ */
+struct DefaultKeyTraits {
+    static bool less (char a, char b)
+    {
+        return (unsigned char)a < (unsigned char)b;
+    }
+};
+
+template <typename Value,
+          typename Allocator = std::allocator<Value>,
+          typename KeyTraits = DefaultKeyTraits>
+class Tree {
+private:
+    struct Node {
+        Node                    *parent;
+        Node                    *first_child;
+        Node                    *next_sibling;
+        char                    *label;
+        std::size_t             label_len;
+        std::optional<Value>    value;
+    };
+
+    using node_alloc_t = typename std::allocator_traits<Allocator>::
+                         template rebind_alloc<Node>;
+    using node_traits = std::allocator_traits<node_alloc_t>;
+    using char_alloc_t = typename std::allocator_traits<Allocator>::
+                         template rebind_alloc<char>;
+    using char_traits = std::allocator_traits<char_alloc_t>;
+
+    /*
+     * basic_iterator
+     *
+     * Walks the keys in lexicographical order. The key of the current
+     * element is only built once it is asked for, from the labels on the
+     * way up to the root, and then kept up to date as the iterator moves.
+     * find() and the insertions thus hand out iterators without copying
+     * the key. Dereferencing yields a (key, value&) pair by value. Use
+     * auto && in range based for loops.
+     */
+    template <bool Const>
+    class basic_iterator {
+    public:
+        using value_ref = std::conditional_t<Const, const Value &, Value &>;
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type = std::ptrdiff_t;
+        using value_type = std::pair<std::string_view, value_ref>;
+        using reference = value_type;
+
+        struct pointer {
+            value_type pair;
+            const value_type *operator-> () const { return &pair; }
+        };
+
+        basic_iterator () : node_(nullptr), has_key_(false) {}
+
+        /* iterator converts to const_iterator */
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        basic_iterator (const basic_iterator<false> &other)
+            : node_(other.node_), key_(other.key_),
+              has_key_(other.has_key_) {}
+
+        std::string_view key () const { return build_key(); }
+        value_ref value () const { return *node_->value; }
+
+        reference operator* () const
+        {
+            return reference(build_key(), *node_->value);
+        }
+        pointer operator-> () const { return pointer{**this}; }
+
+        basic_iterator &operator++ ()
+        {
+            advance();
+            return *this;
+        }
+
+        basic_iterator operator++ (int)
+        {
+            basic_iterator tmp = *this;
+            advance();
+            return tmp;
+        }
+
+        friend bool operator== (const basic_iterator &a,
+                                const basic_iterator &b)
+        {
+            return a.node_ == b.node_;
+        }
+
+        friend bool operator!= (const basic_iterator &a,
+                                const basic_iterator &b)
+        {
+            return a.node_ != b.node_;
+        }
+
+    private:
+        friend class Tree;
+
+        explicit basic_iterator (Node *node)
+            : node_(node), has_key_(false) {}
+
+        /* Rebuild the key from the labels on the way up to the root */
+        const std::string &build_key () const
+        {
+            Node *node;
+            std::size_t len = 0;
+
+            if (has_key_) {
+                return key_;
+            }
+
+            for (node = node_; node; node = node->parent) {
+                len += node->label_len;
+            }
+            key_.resize(len);
+            for (node = node_; node; node = node->parent) {
+                len -= node->label_len;
+                if (node->label_len) {
+                    std::memcpy(&key_[len], node->label, node->label_len);
+                }
+            }
+            has_key_ = true;
+            return key_;
+        }
+
+        /* Move to the next node carrying a value, depth first */
+        void advance ()
+        {
+            do {
+                step();
+            } while (node_ && !node_->value);
+        }
+
+        /* Move to the next node in depth first order, ignoring values */
+        void step ()
+        {
+            if (node_->first_child) {
+                node_ = node_->first_child;
+                if (has_key_) {
+                    key_.append(node_->label, node_->label_len);
+                }
+                return;
+            }
+            step_over();
+        }
+
+        /* Move to the next node which is not in the current subtree */
+        void step_over ()
+        {
+            while (node_) {
+                if (has_key_) {
+                    key_.resize(key_.size() - node_->label_len);
+                }
+                if (node_->next_sibling) {
+                    node_ = node_->next_sibling;
+                    if (has_key_) {
+                        key_.append(node_->label, node_->label_len);
+                    }
+                    return;
+                }
+                node_ = node_->parent;
+            }
+        }
+
+        /* Move to the first key after the current subtree */
+        void skip_subtree ()
+        {
+            step_over();
+            if (node_ && !node_->value) {
+                advance();
+            }
+        }
+
+        Node                *node_;
+        mutable std::string key_;           /* Valid if has_key_ */
+        mutable bool        has_key_;
+    };
+
+public:
+    using key_type = std::string_view;
+    using mapped_type = Value;
+    using size_type = std::size_t;
+    using allocator_type = Allocator;
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    explicit Tree (const Allocator &alloc = Allocator())
+        : node_alloc_(alloc), char_alloc_(alloc), root_(nullptr), size_(0)
+    {
+        root_ = make_node(nullptr, std::string_view());
+    }
+
+    Tree (const Tree &) = delete;
+    Tree &operator= (const Tree &) = delete;
+
+    /*
+     * A moved-from tree is left empty and without a root node. It is still
+     * usable, the root is created again by the first insertion.
+     */
+    Tree (Tree &&other) noexcept
+        : node_alloc_(std::move(other.node_alloc_)),
+          char_alloc_(std::move(other.char_alloc_)),
+          root_(other.root_), size_(other.size_)
+    {
+        other.root_ = nullptr;
+        other.size_ = 0;
+    }
+
+    /*
+     * Take over the nodes of other if the allocators propagate or compare
+     * equal. Otherwise our allocator cannot free them, so the values are
+     * moved over one by one into nodes of our own.
+     */
+    Tree &operator= (Tree &&other) noexcept(
+        node_traits::propagate_on_container_move_assignment::value ||
+        node_traits::is_always_equal::value)
+    {
+        if (this == &other) {
+            return *this;
+        }
+
+        if constexpr (node_traits::propagate_on_container_move_assignment::
+                      value) {
+            destroy_subtree(root_);
+            node_alloc_ = std::move(other.node_alloc_);
+            char_alloc_ = std::move(other.char_alloc_);
+        } else {
+            if (!(node_alloc_ == other.node_alloc_) ||
+                !(char_alloc_ == other.char_alloc_)) {
+                clear();
+                for (iterator it = other.begin(); it != other.end(); ++it) {
+                    emplace(it.key(), std::move(it.value()));
+                }
+                other.clear();
+                return *this;
+            }
+            destroy_subtree(root_);
+        }
+
+        root_ = other.root_;
+        size_ = other.size_;
+        other.root_ = nullptr;
+        other.size_ = 0;
+        return *this;
+    }
+
+    ~Tree ()
+    {
+        destroy_subtree(root_);
+    }
+
+    size_type size () const { return size_; }
+    bool empty () const { return size_ == 0; }
+    allocator_type get_allocator () const { return allocator_type(node_alloc_); }
+
+    iterator begin () { return first_in(root_); }
+    iterator end () { return iterator(); }
+    const_iterator begin () const { return cbegin(); }
+    const_iterator end () const { return cend(); }
+    const_iterator cbegin () const { return first_in(root_); }
+    const_iterator cend () const { return const_iterator(); }
+
+    /*
+     * emplace
+     *
+     * Insert key with a value constructed from args. Does nothing if the key
+     * is already present. Returns the iterator to the key and whether it was
+     * inserted.
+     */
+    template <typename... Args>
+    std::pair<iterator, bool> emplace (std::string_view key, Args &&...args)
+    {
+        Node *node = insert_node(key);
+
+        if (node->value) {
+            return std::make_pair(iterator(node), false);
+        }
+
+        node->value.emplace(std::forward<Args>(args)...);
+        size_++;
+        return std::make_pair(iterator(node), true);
+    }
+
+    std::pair<iterator, bool> insert (std::string_view key, Value value)
+    {
+        return emplace(key, std::move(value));
+    }
+
+    /*
+     * insert_or_assign
+     *
+     * Insert key, replacing the value if the key is already present
+     */
+    std::pair<iterator, bool> insert_or_assign (std::string_view key,
+                                                Value value)
+    {
+        Node *node = insert_node(key);
+        bool inserted = !node->value;
+
+        node->value = std::move(value);
+        if (inserted) {
+            size_++;
+        }
+        return std::make_pair(iterator(node), inserted);
+    }
+
+    Value &operator[] (std::string_view key)
+    {
+        return emplace(key).first.value();
+    }
+
+    iterator find (std::string_view key)
+    {
+        Node *node = find_node(key);
+
+        if (!node || !node->value) {
+            return end();
+        }
+        return iterator(node);
+    }
+
+    const_iterator find (std::string_view key) const
+    {
+        Node *node = find_node(key);
+
+        if (!node || !node->value) {
+            return cend();
+        }
+        return const_iterator(node);
+    }
+
+    bool contains (std::string_view key) const
+    {
+        Node *node = find_node(key);
+
+        return node && node->value;
+    }
+
+    /*
+     * prefix_range
+     *
+     * Return the range of all the keys starting with prefix
+     */
+    std::pair<iterator, iterator> prefix_range (std::string_view prefix)
+    {
+        Node *node = find_prefix_node(prefix);
+
+        if (!node) {
+            return std::make_pair(end(), end());
+        }
+
+        iterator first = first_in(node);
+        iterator last(node);
+        last.skip_subtree();
+        return std::make_pair(first, last);
+    }
+
+    /*
+     * erase
+     *
+     * Remove the given key. Nodes which no longer carry a value and have at
+     * most one child are merged away. Returns the number of keys removed.
+     */
+    size_type erase (std::string_view key)
+    {
+        Node *node = find_node(key);
+        Node *parent;
+
+        if (!node || !node->value) {
+            return 0;
+        }
+
+        node->value.reset();
+        size_--;
+
+        if (node == root_) {
+            return 1;
+        }
+
+        parent = node->parent;
+        if (!node->first_child) {
+            unlink_child(parent, node);
+            free_node(node);
+            if (parent != root_ && !parent->value) {
+                merge_with_child(parent);
+            }
+        } else {
+            merge_with_child(node);
+        }
+
+        return 1;
+    }
+
+    void clear ()
+    {
+        Node *child, *next;
+
+        if (!root_) {
+            return;
+        }
+
+        child = root_->first_child;
+        while (child) {
+            next = child->next_sibling;
+            destroy_subtree(child);
+            child = next;
+        }
+        root_->first_child = nullptr;
+        root_->value.reset();
+        size_ = 0;
+    }
+
+private:
+    template <bool> friend class basic_iterator;
+
+    Node *make_node (Node *parent, std::string_view label)
+    {
+        Node *node = node_traits::allocate(node_alloc_, 1);
+        char *buf = nullptr;
+
+        if (!label.empty()) {
+            try {
+                buf = char_traits::allocate(char_alloc_, label.size());
+            } catch (...) {
+                node_traits::deallocate(node_alloc_, node, 1);
+                throw;
+            }
+            std::memcpy(buf, label.data(), label.size());
+        }
+
+        node_traits::construct(node_alloc_, node,
+                               Node{parent, nullptr, nullptr, buf,
+                                    label.size(), std::nullopt});
+        return node;
+    }
+
+    void free_node (Node *node)
+    {
+        if (node->label) {
+            char_traits::deallocate(char_alloc_, node->label, node->label_len);
+        }
+        node_traits::destroy(node_alloc_, node);
+        node_traits::deallocate(node_alloc_, node, 1);
+    }
+
+    void destroy_subtree (Node *node)
+    {
+        Node *child, *next;
+
+        if (!node) {
+            return;
+        }
+
+        child = node->first_child;
+        while (child) {
+            next = child->next_sibling;
+            destroy_subtree(child);
+            child = next;
+        }
+        free_node(node);
+    }
+
+    void set_label (Node *node, std::string_view label)
+    {
+        char *buf = nullptr;
+
+        if (!label.empty()) {
+            buf = char_traits::allocate(char_alloc_, label.size());
+            std::memcpy(buf, label.data(), label.size());
+        }
+        if (node->label) {
+            char_traits::deallocate(char_alloc_, node->label, node->label_len);
+        }
+        node->label = buf;
+        node->label_len = label.size();
+    }
+
+    /* Link child into parent's children, keeping them in order */
+    void link_child (Node *parent, Node *child)
+    {
+        Node **where = &parent->first_child;
+
+        while (*where && KeyTraits::less((*where)->label[0], child->label[0])) {
+            where = &(*where)->next_sibling;
+        }
+        child->next_sibling = *where;
+        child->parent = parent;
+        *where = child;
+    }
+
+    void unlink_child (Node *parent, Node *child)
+    {
+        Node **where = &parent->first_child;
+
+        while (*where != child) {
+            where = &(*where)->next_sibling;
+        }
+        *where = child->next_sibling;
+    }
+
+    /* Replace old_child by new_child at the same place among the siblings */
+    void replace_child (Node *parent, Node *old_child, Node *new_child)
+    {
+        Node **where = &parent->first_child;
+
+        while (*where != old_child) {
+            where = &(*where)->next_sibling;
+        }
+        new_child->next_sibling = old_child->next_sibling;
+        new_child->parent = parent;
+        *where = new_child;
+    }
+
+    Node *find_child (Node *node, char c) const
+    {
+        Node *child = node->first_child;
+
+        while (child && child->label[0] != c) {
+            child = child->next_sibling;
+        }
+        return child;
+    }
+
+    /*
+     * If node has a single child and no value, fold the child into it so
+     * that the tree stays path compressed
+     */
+    void merge_with_child (Node *node)
+    {
+        Node *child = node->first_child;
+        Node *grandchild;
+
+        if (!child || child->next_sibling || node->value) {
+            return;
+        }
+
+        std::string label(node->label, node->label_len);
+        label.append(child->label, child->label_len);
+        set_label(node, label);
+
+        node->value = std::move(child->value);
+        node->first_child = child->first_child;
+        for (grandchild = node->first_child; grandchild;
+             grandchild = grandchild->next_sibling) {
+            grandchild->parent = node;
+        }
+        child->first_child = nullptr;
+        free_node(child);
+    }
+
+    /* Return the node for key, creating and splitting nodes as needed */
+    Node *insert_node (std::string_view key)
+    {
+        Node *node, *child, *mid;
+        std::size_t pos = 0, common;
+
+        /* The tree was moved from */
+        if (!root_) {
+            root_ = make_node(nullptr, std::string_view());
+        }
+        node = root_;
+
+        while (pos < key.size()) {
+            child = find_child(node, key[pos]);
+            if (!child) {
+                child = make_node(node, key.substr(pos));
+                link_child(node, child);
+                return child;
+            }
+
+            common = 1;
+            while (common < child->label_len && pos + common < key.size() &&
+                   child->label[common] == key[pos + common]) {
+                common++;
+            }
+
+            if (common < child->label_len) {
+                /* Split the child at the end of the common prefix */
+                mid = make_node(node, std::string_view(child->label, common));
+                replace_child(node, child, mid);
+                set_label(child, std::string_view(child->label + common,
+                                                  child->label_len - common));
+                child->next_sibling = nullptr;
+                link_child(mid, child);
+                child = mid;
+            }
+
+            node = child;
+            pos += common;
+        }
+
+        return node;
+    }
+
+    Node *find_node (std::string_view key) const
+    {
+        Node *node = root_;
+        Node *child;
+        std::size_t pos = 0;
+
+        if (!node) {
+            return nullptr;
+        }
+
+        while (pos < key.size()) {
+            child = find_child(node, key[pos]);
+            if (!child || child->label_len > key.size() - pos ||
+                std::memcmp(child->label, key.data() + pos,
+                            child->label_len) != 0) {
+                return nullptr;
+            }
+            node = child;
+            pos += child->label_len;
+        }
+
+        return node;
+    }
+
+    /* Return the topmost node whose key starts with prefix */
+    Node *find_prefix_node (std::string_view prefix) const
+    {
+        Node *node = root_;
+        Node *child;
+        std::size_t pos = 0, len;
+
+        if (!node) {
+            return nullptr;
+        }
+
+        while (pos < prefix.size()) {
+            child = find_child(node, prefix[pos]);
+            if (!child) {
+                return nullptr;
+            }
+            len = std::min(child->label_len, prefix.size() - pos);
+            if (std::memcmp(child->label, prefix.data() + pos, len) != 0) {
+                return nullptr;
+            }
+            node = child;
+            pos += child->label_len;
+        }
+
+        return node;
+    }
+
+    iterator first_in (Node *node) const
+    {
+        if (!node) {
+            return iterator();
+        }
+
+        iterator it(node);
+        if (!node->value) {
+            it.advance();
+        }
+        return it;
+    }
+
+    node_alloc_t    node_alloc_;
+    char_alloc_t    char_alloc_;
+    Node            *root_;
+    size_type       size_;
+};
+
+} /* namespace patricia */
+
+#endif /* PATRICIA_TREE_H */
@@ -0,0 +1,101 @@
+/*
+ * test.h - Helpers shared by the tests
+ *
+ * Every test is a program that exits 0 when all its checks pass. A failed
+ * check prints where it failed and exits 1.
+ */
+
+#ifndef PATRICIA_TEST_H
+#define PATRICIA_TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <set>
+#include <string>
+#include <vector>
+#include <random>
+
+/* Defines */
+
+#define TEST_CHECK(cond)                                                \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__,      \
+                    __LINE__, #cond);                                   \
+            exit(1);                                                    \
+        }                                                               \
+    } while (0)
+
+#define TEST_SEED   12345
+
+/* The keys a test expects, in order */
+typedef std::set<std::string> test_set_t;
+
+/*
+ * test_random_key
+ *
+ * A key of 0 to maxlen bytes over a small alphabet, so that random keys
+ * share prefixes and collide often
+ */
+static inline std::string
+test_random_key (std::mt19937 &rng, int maxlen,
+                 const char *alphabet = "abcd/.")
+{
+    std::string key;
+    int len, n, i;
+
+    for (n = 0; alphabet[n]; n++);
+    len = rng() % (maxlen + 1);
+    for (i = 0; i < len; i++) {
+        key += alphabet[rng() % n];
+    }
+
+    return key;
+}
+
+/*
+ * test_collect
+ *
+ * Walk callbacks that append each key to the std::vector<std::string> arg,
+ * for NUL terminated keys and for keys given with their length
+ */
+static inline int
+test_collect (char *key, void *arg)
+{
+    ((std::vector<std::string> *)arg)->push_back(key);
+    return 0;
+}
+
+static inline int
+test_collect (const char *key, int len, void *arg)
+{
+    ((std::vector<std::string> *)arg)->push_back(std::string(key, len));
+    return 0;
+}
+
+/*
+ * test_leaves
+ *
+ * The keys of the set that are not a prefix of another key. The core tree
+ * keeps its keys at the leaves, so these are the keys patricia_walk and
+ * everything built from it report.
+ */
+static inline test_set_t
+test_leaves (const test_set_t &keys)
+{
+    test_set_t leaves;
+    test_set_t::const_iterator it, next;
+
+    for (it = keys.begin(); it != keys.end(); it = next) {
+        next = it;
+        ++next;
+        if (next == keys.end() || next->compare(0, it->size(), *it) != 0) {
+            leaves.insert(*it);
+        }
+    }
+
+    return leaves;
+}
+
+#endif /* PATRICIA_TEST_H */
@@ -0,0 +1,215 @@
+/*
+ * test_arena.cpp
+ *
+ * The arena tree against a std::set: random adds, deletes and lookups, the
+ * node layout they leave behind, walks, an image opened from a copy at
+ * another address, damaged images, and an arena built from a core tree.
+ */
+
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_arena.h"
+
+static int
+test_stop (const char *key, int len, void *arg)
+{
+    (void)key;
+    (void)len;
+    return ++*(int *)arg == 3 ? 7 : 0;
+}
+
+/*
+ * test_check_nodes
+ *
+ * Children are in order of their first byte, and every node but the root
+ * ends a key or branches. Returns the number of nodes under ref.
+ */
+static uint32_t
+test_check_nodes (patricia_arena_t *arena, patricia_ref_t ref, int root)
+{
+    patricia_arena_node_t *node, *child;
+    patricia_ref_t next;
+    uint32_t count = 1, children = 0;
+    int last = -1;
+
+    node = PATRICIA_ARENA_NODE(arena, ref);
+    TEST_CHECK(root || node->label_len > 0);
+    for (next = node->first_child; next; next = child->next_sibling) {
+        child = PATRICIA_ARENA_NODE(arena, next);
+        TEST_CHECK((unsigned char)child->label[0] > last);
+        last = (unsigned char)child->label[0];
+        count += test_check_nodes(arena, next, 0);
+        children++;
+    }
+    TEST_CHECK(root || (node->flags & PATRICIA_ARENA_KEY) || children >= 2);
+
+    return count;
+}
+
+static void
+test_check (patricia_arena_t *arena, const test_set_t &ref)
+{
+    patricia_arena_header_t *hdr = PATRICIA_ARENA_HDR(arena);
+    std::vector<std::string> got;
+
+    TEST_CHECK(hdr->key_count == ref.size());
+    TEST_CHECK(test_check_nodes(arena, hdr->root, 1) == hdr->node_count);
+    TEST_CHECK(patricia_arena_walk(arena, test_collect, &got) == 0);
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+}
+
+/*
+ * test_corrupt
+ *
+ * Damaged copies of a sound image, which patricia_arena_open refuses
+ */
+static void
+test_corrupt (const void *image, size_t len)
+{
+    std::vector<uint64_t> copy(len / sizeof(uint64_t));
+    patricia_arena_node_t *root, *first, *second;
+    patricia_arena_header_t *hdr;
+    patricia_arena_t view, *opened;
+    int i;
+
+    view.base = (char *)&copy[0];
+    hdr = PATRICIA_ARENA_HDR(&view);
+    for (i = 0; i < 7; i++) {
+        memcpy(&copy[0], image, len);
+        root = PATRICIA_ARENA_NODE(&view, hdr->root);
+        TEST_CHECK(root->first_child != PATRICIA_ARENA_NULL);
+        first = PATRICIA_ARENA_NODE(&view, root->first_child);
+        TEST_CHECK(first->next_sibling != PATRICIA_ARENA_NULL);
+        second = PATRICIA_ARENA_NODE(&view, first->next_sibling);
+
+        switch (i) {
+        case 0:
+            /* A ref past the used units */
+            first->next_sibling = hdr->used;
+            break;
+        case 1:
+            /* A ref into the header */
+            root->first_child = 1;
+            break;
+        case 2:
+            /* A label longer than any key */
+            second->label_len = 0xffff;
+            break;
+        case 3:
+            /* Siblings out of order */
+            first->label[0] = second->label[0];
+            break;
+        case 4:
+            /* A child pointing back up at the root */
+            second->first_child = hdr->root;
+            break;
+        case 5:
+            /* The longest key no longer fits the walk buffer */
+            hdr->max_keylen--;
+            break;
+        default:
+            /* Counts that do not match the tree */
+            hdr->key_count++;
+            break;
+        }
+        TEST_CHECK(patricia_arena_open(&copy[0], len) == NULL);
+    }
+
+    memcpy(&copy[0], image, len);
+    opened = patricia_arena_open(&copy[0], len);
+    TEST_CHECK(opened != NULL);
+    patricia_arena_destroy(opened);
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    std::vector<uint64_t> copy;
+    patricia_arena_t *arena, *opened, *built;
+    patricia_tree_t *tree;
+    test_set_t ref, leaves;
+    std::string key;
+    size_t len;
+    void *image;
+    int i, calls;
+
+    arena = patricia_arena_init(64, 0);
+    TEST_CHECK(arena != NULL);
+
+    for (i = 0; i < 40000; i++) {
+        key = test_random_key(rng, 8);
+        switch (rng() % 4) {
+        case 0:
+        case 1:
+            TEST_CHECK(patricia_arena_add(arena, key.c_str()) == 0);
+            ref.insert(key);
+            break;
+        case 2:
+            TEST_CHECK(patricia_arena_delete(arena, key.c_str()) ==
+                       (ref.erase(key) ? 0 : -1));
+            break;
+        default:
+            TEST_CHECK(patricia_arena_lookup(arena, key.c_str()) ==
+                       (int)ref.count(key));
+            break;
+        }
+        if (i % 1000 == 0) {
+            test_check(arena, ref);
+        }
+    }
+    test_check(arena, ref);
+
+    calls = 0;
+    TEST_CHECK(patricia_arena_walk(arena, test_stop, &calls) == 7);
+    TEST_CHECK(calls == 3);
+
+    /* A copy of the image works at its new address */
+    image = patricia_arena_image(arena, &len);
+    TEST_CHECK(image != NULL && len % PATRICIA_ARENA_ALIGN == 0);
+    copy.resize(len / sizeof(uint64_t));
+    memcpy(&copy[0], image, len);
+    opened = patricia_arena_open(&copy[0], len);
+    TEST_CHECK(opened != NULL);
+    test_check(opened, ref);
+    for (const std::string &k : ref) {
+        TEST_CHECK(patricia_arena_lookup(opened, k.c_str()) == 1);
+    }
+    TEST_CHECK(patricia_arena_destroy(opened) == 0);
+
+    /* Images that are not arenas, or cut short */
+    memcpy(&copy[0], "XXXX", 4);
+    TEST_CHECK(patricia_arena_open(&copy[0], len) == NULL);
+    memcpy(&copy[0], image, len);
+    TEST_CHECK(patricia_arena_open(&copy[0], len / 2) == NULL);
+    test_corrupt(image, len);
+
+    /* An arena built from the leaves of a core tree */
+    tree = patricia_init();
+    for (i = 0; i < 2000; i++) {
+        key = test_random_key(rng, 8);
+        if (!key.empty() && patricia_add(tree, &key[0]) == 0) {
+            leaves.insert(key);
+        }
+    }
+    built = patricia_arena_build(tree, 0);
+    TEST_CHECK(built != NULL);
+    test_check(built, test_leaves(leaves));
+    patricia_arena_destroy(built);
+    patricia_destroy(tree);
+
+    /* Emptied, the arena is still usable */
+    for (const std::string &k : ref) {
+        TEST_CHECK(patricia_arena_delete(arena, k.c_str()) == 0);
+    }
+    ref.clear();
+    test_check(arena, ref);
+    TEST_CHECK(patricia_arena_add(arena, "x") == 0 &&
+               patricia_arena_lookup(arena, "x") == 1);
+    TEST_CHECK(patricia_arena_destroy(arena) == 0);
+
+    return 0;
+}
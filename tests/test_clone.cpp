@@ -0,0 +1,138 @@
+/*
+ * test_clone.cpp
+ *
+ * Copy-on-write clones of the persistent tree against std::maps: a tree
+ * and its clones are edited independently and each must keep its own
+ * keys, whichever of them is destroyed first.
+ */
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "test.h"
+#include "patricia_persist.h"
+
+#define TEST_TREES  4
+
+typedef std::map<std::string, uintptr_t> test_map_t;
+typedef std::vector<std::pair<std::string, uintptr_t>> test_pairs_t;
+
+static int
+test_collect (const char *key, int len, void *data, void *arg)
+{
+    ((test_pairs_t *)arg)->push_back(std::make_pair(std::string(key, len),
+                                                    (uintptr_t)data));
+    return 0;
+}
+
+static void
+test_check (patricia_pt_tree_t *tree, const test_map_t &ref)
+{
+    test_pairs_t got;
+    void *data;
+
+    TEST_CHECK(tree->count == ref.size());
+    TEST_CHECK(patricia_pt_walk(tree->root, "", test_collect, &got) == 0);
+    TEST_CHECK(got == test_pairs_t(ref.begin(), ref.end()));
+    for (const auto &kv : ref) {
+        data = NULL;
+        TEST_CHECK(patricia_pt_lookup(tree->root, kv.first.c_str(),
+                                      &data) == 1);
+        TEST_CHECK((uintptr_t)data == kv.second);
+    }
+}
+
+/*
+ * test_edit
+ *
+ * n random adds, replaces and deletes on tree and ref
+ */
+static void
+test_edit (patricia_pt_tree_t *tree, test_map_t &ref, std::mt19937 &rng,
+           int n)
+{
+    std::string key;
+    uintptr_t data;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        key = test_random_key(rng, 6);
+        if (rng() % 3) {
+            data = rng();
+            TEST_CHECK(patricia_pt_add(tree, key.c_str(),
+                                       (void *)data) == 0);
+            ref[key] = data;
+        } else {
+            TEST_CHECK(patricia_pt_delete(tree, key.c_str(), NULL) ==
+                       (ref.erase(key) ? 0 : -1));
+        }
+    }
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_pt_tree_t *trees[TEST_TREES], *empty, *copy;
+    test_map_t refs[TEST_TREES];
+    patricia_pt_stats_t before, after;
+    int t, round;
+
+    trees[0] = patricia_pt_init();
+    TEST_CHECK(trees[0] != NULL);
+    test_edit(trees[0], refs[0], rng, 5000);
+
+    /* A clone copies nothing until it is written to */
+    patricia_pt_get_stats(&before);
+    trees[1] = patricia_pt_clone(trees[0]);
+    patricia_pt_get_stats(&after);
+    TEST_CHECK(trees[1] != NULL && trees[1]->root == trees[0]->root);
+    TEST_CHECK(after.total_nodes == before.total_nodes);
+    refs[1] = refs[0];
+
+    /* Clones of clones, all edited in turn */
+    trees[2] = patricia_pt_clone(trees[1]);
+    refs[2] = refs[1];
+    trees[3] = patricia_pt_clone(trees[0]);
+    refs[3] = refs[0];
+    for (round = 0; round < 5; round++) {
+        for (t = 0; t < TEST_TREES; t++) {
+            test_edit(trees[t], refs[t], rng, 500);
+        }
+        for (t = 0; t < TEST_TREES; t++) {
+            test_check(trees[t], refs[t]);
+        }
+    }
+
+    /* The original goes first, a clone of the last one goes with it */
+    TEST_CHECK(patricia_pt_destroy(trees[0]) == 0);
+    copy = patricia_pt_clone(trees[3]);
+    refs[0] = refs[3];
+    test_edit(copy, refs[0], rng, 1000);
+    TEST_CHECK(patricia_pt_destroy(trees[3]) == 0);
+    for (t = 1; t < TEST_TREES - 1; t++) {
+        test_check(trees[t], refs[t]);
+    }
+    test_check(copy, refs[0]);
+
+    /* Cloning an empty tree */
+    empty = patricia_pt_init();
+    trees[0] = patricia_pt_clone(empty);
+    TEST_CHECK(trees[0] != NULL && trees[0]->root == NULL);
+    TEST_CHECK(patricia_pt_add(trees[0], "a", NULL) == 0);
+    TEST_CHECK(empty->root == NULL && empty->count == 0);
+
+    patricia_pt_destroy(empty);
+    patricia_pt_destroy(trees[0]);
+    patricia_pt_destroy(copy);
+    patricia_pt_destroy(trees[1]);
+    patricia_pt_destroy(trees[2]);
+
+#ifdef PATRICIA_STATS_ON
+    patricia_pt_get_stats(&after);
+    TEST_CHECK(after.total_nodes == 0 && after.total_mem == 0);
+#endif
+
+    return 0;
+}
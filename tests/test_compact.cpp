@@ -0,0 +1,141 @@
+/*
+ * test_compact.cpp
+ *
+ * Compaction of a churned arena tree: the keys, walks and prefix walks
+ * match a std::set before and after, the dead space is gone, and the nodes
+ * are laid out in depth first order with every subtree in one range.
+ */
+
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_arena.h"
+
+static int
+test_stop (const char *key, int len, void *arg)
+{
+    (void)key;
+    (void)len;
+    return ++*(int *)arg == 2 ? 5 : 0;
+}
+
+/*
+ * test_check_order
+ *
+ * Refs follow a preorder of the tree. next is the ref the node at ref has
+ * to have, returns the ref following its subtree.
+ */
+static patricia_ref_t
+test_check_order (patricia_arena_t *arena, patricia_ref_t ref,
+                  patricia_ref_t next)
+{
+    patricia_arena_node_t *node;
+    patricia_ref_t child;
+
+    TEST_CHECK(ref == next);
+    node = PATRICIA_ARENA_NODE(arena, ref);
+    next = ref + PATRICIA_ARENA_NODE_UNITS(node->label_len);
+    for (child = node->first_child; child;
+         child = PATRICIA_ARENA_NODE(arena, child)->next_sibling) {
+        next = test_check_order(arena, child, next);
+    }
+
+    return next;
+}
+
+static void
+test_check (patricia_arena_t *arena, const test_set_t &ref,
+            std::mt19937 &rng)
+{
+    std::vector<std::string> got;
+    test_set_t::const_iterator it;
+    std::string prefix;
+    size_t j;
+    int i;
+
+    TEST_CHECK(patricia_arena_walk(arena, test_collect, &got) == 0);
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+
+    for (i = 0; i < 300; i++) {
+        prefix = i ? test_random_key(rng, 4) : std::string();
+        got.clear();
+        TEST_CHECK(patricia_arena_walk_prefix(arena, prefix.c_str(),
+                                              test_collect, &got) == 0);
+        it = ref.lower_bound(prefix);
+        for (j = 0; j < got.size(); j++, ++it) {
+            TEST_CHECK(it != ref.end() && got[j] == *it);
+        }
+        TEST_CHECK(it == ref.end() ||
+                   it->compare(0, prefix.size(), prefix) != 0);
+    }
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_arena_header_t *hdr;
+    patricia_arena_t *arena, *opened;
+    std::vector<uint64_t> copy;
+    test_set_t ref;
+    std::string key;
+    uint32_t nodes, used;
+    size_t len;
+    void *image;
+    int i, round, calls;
+
+    arena = patricia_arena_init(0, 0);
+    TEST_CHECK(arena != NULL);
+
+    for (round = 0; round < 3; round++) {
+        /* Churn, which leaves dead nodes all over the arena */
+        for (i = 0; i < 20000; i++) {
+            key = test_random_key(rng, 8);
+            if (rng() % 3) {
+                TEST_CHECK(patricia_arena_add(arena, key.c_str()) == 0);
+                ref.insert(key);
+            } else {
+                TEST_CHECK(patricia_arena_delete(arena, key.c_str()) ==
+                           (ref.erase(key) ? 0 : -1));
+            }
+        }
+        hdr = PATRICIA_ARENA_HDR(arena);
+        TEST_CHECK(hdr->dead > 0);
+        nodes = hdr->node_count;
+        used = hdr->used - hdr->dead;
+        test_check(arena, ref, rng);
+
+        TEST_CHECK(patricia_arena_compact(arena) == 0);
+        hdr = PATRICIA_ARENA_HDR(arena);
+        TEST_CHECK(hdr->dead == 0 && hdr->used == used);
+        TEST_CHECK(hdr->node_count == nodes && hdr->key_count == ref.size());
+        TEST_CHECK(arena->cap >= (uint64_t)used * PATRICIA_ARENA_ALIGN);
+        TEST_CHECK(test_check_order(arena, hdr->root, hdr->root) ==
+                   hdr->used);
+        test_check(arena, ref, rng);
+        for (const std::string &k : ref) {
+            TEST_CHECK(patricia_arena_lookup(arena, k.c_str()) == 1);
+        }
+    }
+
+    calls = 0;
+    TEST_CHECK(patricia_arena_walk_prefix(arena, "a", test_stop,
+                                          &calls) == 5 && calls == 2);
+    TEST_CHECK(patricia_arena_walk_prefix(arena, "zz", test_collect,
+                                          NULL) == 0);
+
+    /* An arena on a caller's buffer cannot be moved */
+    image = patricia_arena_image(arena, &len);
+    copy.resize(len / sizeof(uint64_t));
+    memcpy(&copy[0], image, len);
+    opened = patricia_arena_open(&copy[0], len);
+    TEST_CHECK(opened != NULL && patricia_arena_compact(opened) == -1);
+    test_check(opened, ref, rng);
+    patricia_arena_destroy(opened);
+
+    TEST_CHECK(patricia_arena_destroy(arena) == 0);
+
+    return 0;
+}
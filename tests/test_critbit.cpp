@@ -0,0 +1,89 @@
+/*
+ * test_critbit.cpp
+ *
+ * Random adds, deletes and lookups on a crit-bit tree of 64-bit keys,
+ * checked against a std::map. The walk has to return the keys in numeric
+ * order.
+ */
+
+#include <map>
+#include <vector>
+#include "test.h"
+#include "patricia_critbit.h"
+
+typedef std::vector<std::pair<uint64_t, void *>> test_pairs_t;
+
+static int
+test_collect (const uint8_t *key, void *data, void *arg)
+{
+    ((test_pairs_t *)arg)->push_back(
+        std::make_pair(patricia_cb_key_to_u64(key), data));
+    return 0;
+}
+
+static int
+test_stop (const uint8_t *key, void *data, void *arg)
+{
+    (void)key;
+    (void)data;
+    return ++*(int *)arg == 3 ? 7 : 0;
+}
+
+int
+main (void)
+{
+    std::map<uint64_t, void *> ref;
+    std::mt19937 rng(TEST_SEED);
+    patricia_cb_tree_t *tree;
+    test_pairs_t got;
+    uint8_t key[8];
+    uint64_t val;
+    void *data;
+    int i, op, calls;
+
+    tree = patricia_cb_init(8);
+    TEST_CHECK(tree);
+    patricia_cb_key_from_u64(0, key);
+    TEST_CHECK(patricia_cb_lookup(tree, key, NULL) == 0);
+
+    for (i = 0; i < 50000; i++) {
+        /* Few distinct keys, with both nearby and far apart values */
+        val = (rng() % 2) ? rng() % 2000 : ((uint64_t)rng() << 32) % 50000;
+        patricia_cb_key_from_u64(val, key);
+        TEST_CHECK(patricia_cb_key_to_u64(key) == val);
+
+        op = rng() % 3;
+        if (op == 0) {
+            data = (void *)(uintptr_t)(i + 1);
+            TEST_CHECK(patricia_cb_add(tree, key, data) == 0);
+            ref[val] = data;
+        } else if (op == 1) {
+            data = NULL;
+            TEST_CHECK(patricia_cb_delete(tree, key, &data) ==
+                       (ref.count(val) ? 0 : -1));
+            if (ref.count(val)) {
+                TEST_CHECK(data == ref[val]);
+                ref.erase(val);
+            }
+        } else {
+            data = NULL;
+            TEST_CHECK(patricia_cb_lookup(tree, key, &data) ==
+                       (int)ref.count(val));
+            TEST_CHECK(!ref.count(val) || data == ref[val]);
+        }
+        TEST_CHECK(tree->count == ref.size());
+    }
+
+    got.clear();
+    TEST_CHECK(patricia_cb_walk(tree, test_collect, &got) == 0);
+    TEST_CHECK(got == test_pairs_t(ref.begin(), ref.end()));
+
+    /* A non zero return stops the walk and is passed back */
+    calls = 0;
+    TEST_CHECK(patricia_cb_walk(tree, test_stop, &calls) == 7);
+    TEST_CHECK(calls == 3);
+
+    TEST_CHECK(patricia_cb_destroy(tree) == 0);
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+/*
+ * test_da.cpp
+ *
+ * Lookup, common prefix and predictive search on a double-array trie
+ * built from random keys, on the trie itself and on a saved and mapped
+ * copy. Loading a damaged image has to fail.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_da.h"
+
+/*
+ * test_check
+ *
+ * Compare da with the keys in ref
+ */
+static void
+test_check (patricia_da_t *da, const test_set_t &ref)
+{
+    std::mt19937 rng(TEST_SEED + 1);
+    std::vector<std::string> got;
+    test_set_t::iterator it;
+    std::string key;
+    size_t i, j;
+    int n;
+
+    TEST_CHECK(da->key_count == ref.size());
+    for (it = ref.begin(); it != ref.end(); ++it) {
+        TEST_CHECK(patricia_da_lookup(da, it->c_str()) == 1);
+    }
+
+    for (i = 0; i < 5000; i++) {
+        key = test_random_key(rng, 10);
+        TEST_CHECK(patricia_da_lookup(da, key.c_str()) ==
+                   (int)ref.count(key));
+
+        /* The keys that are a prefix of key, shortest first */
+        got.clear();
+        n = patricia_da_common_prefix(da, key.c_str(), test_collect, &got);
+        TEST_CHECK(n == (int)got.size());
+        j = 0;
+        for (size_t len = 0; len <= key.size(); len++) {
+            if (ref.count(key.substr(0, len))) {
+                TEST_CHECK(j < got.size() && got[j++] == key.substr(0, len));
+            }
+        }
+        TEST_CHECK(j == got.size());
+
+        /* The keys starting with key, in order */
+        key.resize(key.size() / 2);
+        got.clear();
+        n = patricia_da_predictive(da, key.c_str(), test_collect, &got);
+        TEST_CHECK(n == (int)got.size());
+        it = ref.lower_bound(key);
+        for (j = 0; j < got.size(); j++, ++it) {
+            TEST_CHECK(it != ref.end() && got[j] == *it);
+        }
+        TEST_CHECK(it == ref.end() ||
+                   it->compare(0, key.size(), key) != 0);
+    }
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    char path[] = "/tmp/test_da.XXXXXX";
+    test_set_t keys;
+    std::string key;
+    patricia_tree_t *tree;
+    patricia_da_t *da, *mapped;
+    std::vector<char> image;
+    FILE *fp;
+    int fd, i;
+
+    tree = patricia_init();
+    for (i = 0; i < 3000; i++) {
+        key = test_random_key(rng, 10);
+        if (!key.empty() && patricia_add(tree, &key[0]) == 0) {
+            keys.insert(key);
+        }
+    }
+    keys = test_leaves(keys);
+
+    da = patricia_da_build(tree);
+    TEST_CHECK(da != NULL);
+    test_check(da, keys);
+
+    fd = mkstemp(path);
+    TEST_CHECK(fd >= 0);
+    close(fd);
+    TEST_CHECK(patricia_da_save(da, path) == 0);
+    mapped = patricia_da_load(path);
+    TEST_CHECK(mapped != NULL && mapped->map != NULL);
+    test_check(mapped, keys);
+    patricia_da_destroy(mapped);
+
+    /* A truncated image, and one with a tail offset past the tail */
+    fp = fopen(path, "rb");
+    TEST_CHECK(fp != NULL);
+    image.resize(sizeof(patricia_da_header_t) +
+                 (size_t)da->size * 2 * sizeof(int32_t) + da->tail_size);
+    TEST_CHECK(fread(&image[0], 1, image.size(), fp) == image.size());
+    fclose(fp);
+    TEST_CHECK(truncate(path, image.size() - 1) == 0);
+    TEST_CHECK(patricia_da_load(path) == NULL);
+    ((int32_t *)&image[sizeof(patricia_da_header_t)])[PATRICIA_DA_ROOT] =
+        -(int32_t)da->tail_size - 100;
+    fp = fopen(path, "wb");
+    TEST_CHECK(fp != NULL);
+    TEST_CHECK(fwrite(&image[0], 1, image.size(), fp) == image.size());
+    TEST_CHECK(fclose(fp) == 0);
+    TEST_CHECK(patricia_da_load(path) == NULL);
+
+    unlink(path);
+    patricia_da_destroy(da);
+    patricia_destroy(tree);
+
+    return 0;
+}
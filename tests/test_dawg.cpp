@@ -0,0 +1,176 @@
+/*
+ * test_dawg.cpp
+ *
+ * Every key the DAWG is built from, and nothing else, is found by lookup
+ * and predictive search, for random keys and for paths with shared endings.
+ * No two states may accept the same endings, which makes it minimal.
+ */
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_dawg.h"
+
+static int
+test_stop (const char *key, int len, void *arg)
+{
+    (void)key;
+    (void)len;
+    return ++*(int *)arg == 3 ? 7 : 0;
+}
+
+/*
+ * test_log_key
+ *
+ * A log file path, many of which end the same way
+ */
+static std::string
+test_log_key (std::mt19937 &rng)
+{
+    char buf[64];
+
+    snprintf(buf, sizeof(buf), "/var/log/svc%u/2024-%02u-%02u.log%s",
+             (unsigned)(rng() % 50), (unsigned)(1 + rng() % 12),
+             (unsigned)(1 + rng() % 28), rng() % 2 ? ".gz" : "");
+
+    return buf;
+}
+
+/*
+ * test_check_minimal
+ *
+ * Two states with the same final bit and the same edges to the same
+ * targets accept the same endings, so a minimal DAWG has no such pair.
+ * Edges are also sorted and point to valid states.
+ */
+static void
+test_check_minimal (patricia_dawg_t *dawg)
+{
+    std::set<std::vector<uint32_t>> seen;
+    std::vector<uint32_t> sig;
+    uint32_t s, e, end;
+
+    for (s = 0; s < dawg->state_count; s++) {
+        sig.clear();
+        sig.push_back(dawg->state[s] & PATRICIA_DAWG_FINAL);
+        end = dawg->state[s + 1] & ~PATRICIA_DAWG_FINAL;
+        for (e = dawg->state[s] & ~PATRICIA_DAWG_FINAL; e < end; e++) {
+            TEST_CHECK(e + 1 == end || dawg->label[e] < dawg->label[e + 1]);
+            TEST_CHECK(dawg->target[e] < dawg->state_count);
+            sig.push_back(dawg->label[e]);
+            sig.push_back(dawg->target[e]);
+        }
+        TEST_CHECK(seen.insert(sig).second);
+    }
+}
+
+/*
+ * test_check
+ *
+ * Build a DAWG from the keys of a tree and compare it with the leaves
+ */
+static void
+test_check (const test_set_t &keys, std::mt19937 &rng,
+            std::string (*gen) (std::mt19937 &))
+{
+    std::vector<std::string> got;
+    patricia_tree_t *tree;
+    patricia_dawg_t *dawg;
+    test_set_t::iterator it;
+    test_set_t ref;
+    std::string key;
+    size_t i, j;
+    int n;
+
+    tree = patricia_init();
+    TEST_CHECK(tree != NULL);
+    for (const auto &k : keys) {
+        key = k;
+        TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+    }
+    ref = test_leaves(keys);
+    dawg = patricia_dawg_build(tree);
+    TEST_CHECK(dawg != NULL);
+    TEST_CHECK(dawg->key_count == ref.size());
+    TEST_CHECK(dawg->state_count <= dawg->trie_states);
+    test_check_minimal(dawg);
+
+    for (const auto &k : ref) {
+        TEST_CHECK(patricia_dawg_lookup(dawg, k.c_str()) == 1);
+    }
+    TEST_CHECK(patricia_dawg_predictive(dawg, "", test_collect, &got) ==
+               (int)ref.size());
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+
+    for (i = 0; i < 3000; i++) {
+        key = gen(rng);
+        if (i % 2) {
+            key.resize(rng() % (key.size() + 1));
+        }
+        TEST_CHECK(patricia_dawg_lookup(dawg, key.c_str()) ==
+                   (int)ref.count(key));
+
+        /* The keys starting with key, in order */
+        key.resize(key.size() / 2);
+        got.clear();
+        n = patricia_dawg_predictive(dawg, key.c_str(), test_collect, &got);
+        TEST_CHECK(n == (int)got.size());
+        it = ref.lower_bound(key);
+        for (j = 0; j < got.size(); j++, ++it) {
+            TEST_CHECK(it != ref.end() && got[j] == *it);
+        }
+        TEST_CHECK(it == ref.end() ||
+                   it->compare(0, key.size(), key) != 0);
+    }
+
+    if (ref.size() >= 3) {
+        n = 0;
+        patricia_dawg_predictive(dawg, "", test_stop, &n);
+        TEST_CHECK(n == 3);
+    }
+
+    patricia_dawg_destroy(dawg);
+    patricia_destroy(tree);
+}
+
+static std::string
+test_short_key (std::mt19937 &rng)
+{
+    return test_random_key(rng, 10);
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    test_set_t keys;
+    std::string key;
+    int i;
+
+    test_check(keys, rng, test_short_key);
+    keys.insert("abc");
+    test_check(keys, rng, test_short_key);
+
+    keys.clear();
+    for (i = 0; i < 3000; i++) {
+        key = test_random_key(rng, 10);
+        if (!key.empty()) {
+            keys.insert(key);
+        }
+    }
+    test_check(keys, rng, test_short_key);
+
+    /* Shared endings, where merging must pay off */
+    keys.clear();
+    for (i = 0; i < 5000; i++) {
+        keys.insert(test_log_key(rng));
+    }
+    test_check(keys, rng, test_log_key);
+
+    TEST_CHECK(patricia_dawg_build(NULL) == NULL);
+    TEST_CHECK(patricia_dawg_lookup(NULL, "a") == 0);
+
+    return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * test_diff.cpp
+ *
+ * patricia_pt_diff between versions of a persistent tree against the
+ * difference of std::maps, and the number of nodes it visits when the
+ * versions differ in a few keys only.
+ */
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "test.h"
+#include "patricia_persist.h"
+
+#define TEST_ROUNDS 50
+
+typedef std::map<std::string, uintptr_t> test_map_t;
+typedef std::vector<std::pair<std::string, int>> test_diffs_t;
+
+static int
+test_collect (const char *key, int len, int side, void *arg)
+{
+    ((test_diffs_t *)arg)->push_back(std::make_pair(std::string(key, len),
+                                                    side));
+    return 0;
+}
+
+static int
+test_stop (const char *key, int len, int side, void *arg)
+{
+    (void)key;
+    (void)len;
+    (void)side;
+
+    return ++*(int *)arg == 3 ? 7 : 0;
+}
+
+/*
+ * test_expect
+ *
+ * The differences between two maps, in key order
+ */
+static test_diffs_t
+test_expect (const test_map_t &ra, const test_map_t &rb)
+{
+    test_diffs_t diffs;
+    test_map_t all;
+
+    all = ra;
+    all.insert(rb.begin(), rb.end());
+    for (const auto &kv : all) {
+        if (!rb.count(kv.first)) {
+            diffs.push_back(std::make_pair(kv.first, PATRICIA_PT_DIFF_A));
+        } else if (!ra.count(kv.first)) {
+            diffs.push_back(std::make_pair(kv.first, PATRICIA_PT_DIFF_B));
+        } else if (ra.at(kv.first) != rb.at(kv.first)) {
+            diffs.push_back(std::make_pair(kv.first, PATRICIA_PT_DIFF_DATA));
+        }
+    }
+
+    return diffs;
+}
+
+static void
+test_check (patricia_pt_node_t *a, const test_map_t &ra,
+            patricia_pt_node_t *b, const test_map_t &rb)
+{
+    test_diffs_t got;
+
+    TEST_CHECK(patricia_pt_diff(a, b, test_collect, &got) == 0);
+    TEST_CHECK(got == test_expect(ra, rb));
+}
+
+static void
+test_edit (patricia_pt_tree_t *tree, test_map_t &ref, std::mt19937 &rng,
+           int n)
+{
+    std::string key;
+    uintptr_t data;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        key = test_random_key(rng, 6);
+        if (rng() % 4) {
+            data = rng() % 4;
+            TEST_CHECK(patricia_pt_add(tree, key.c_str(),
+                                       (void *)data) == 0);
+            ref[key] = data;
+        } else {
+            patricia_pt_delete(tree, key.c_str(), NULL);
+            ref.erase(key);
+        }
+    }
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_pt_tree_t *a, *b;
+    patricia_pt_node_t *snap;
+    patricia_pt_stats_t before, after;
+    std::vector<std::string> keys;
+    test_map_t ra, rb;
+    int round, calls;
+    size_t i;
+
+    /* A snapshot against the tree after random edits */
+    a = patricia_pt_init();
+    TEST_CHECK(a != NULL);
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        snap = patricia_pt_snapshot(a);
+        rb = ra;
+        test_edit(a, ra, rng, rng() % 200);
+        test_check(snap, rb, a->root, ra);
+        test_check(a->root, ra, snap, rb);
+        patricia_pt_release(snap);
+    }
+
+    /* Against independent trees, and with either side empty */
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        rb.clear();
+        b = patricia_pt_init();
+        test_edit(b, rb, rng, rng() % 1000);
+        test_check(a->root, ra, b->root, rb);
+        patricia_pt_destroy(b);
+    }
+    test_check(a->root, ra, NULL, test_map_t());
+    test_check(NULL, test_map_t(), a->root, ra);
+    test_check(a->root, ra, a->root, ra);
+
+    /* Stops on the first non zero return */
+    calls = 0;
+    b = patricia_pt_init();
+    TEST_CHECK(patricia_pt_diff(a->root, b->root, test_stop, &calls) == 7);
+    TEST_CHECK(calls == 3);
+    TEST_CHECK(patricia_pt_diff(a->root, b->root, NULL, NULL) == -1);
+    patricia_pt_destroy(a);
+    patricia_pt_destroy(b);
+
+    /*
+     * The same keys added in opposite orders give trees with no node in
+     * common, which differ in two keys. The diff must only visit the nodes
+     * on their paths.
+     */
+    rb.clear();
+    a = patricia_pt_init();
+    while (rb.size() < 20000) {
+        rb[test_random_key(rng, 12, "abcdefgh")] = 0;
+    }
+    for (const auto &kv : rb) {
+        keys.push_back(kv.first);
+    }
+    for (i = 0; i < keys.size(); i++) {
+        patricia_pt_add(a, keys[i].c_str(), NULL);
+    }
+    b = patricia_pt_init();
+    for (i = keys.size(); i-- > 0;) {
+        patricia_pt_add(b, keys[i].c_str(), NULL);
+    }
+    ra = rb;
+    patricia_pt_delete(b, keys[100].c_str(), NULL);
+    rb.erase(keys[100]);
+    patricia_pt_add(b, keys[5000].c_str(), (void *)1);
+    rb[keys[5000]] = 1;
+    patricia_pt_get_stats(&before);
+    test_check(a->root, ra, b->root, rb);
+    patricia_pt_get_stats(&after);
+#ifdef PATRICIA_STATS_ON
+    TEST_CHECK(after.total_diff_nodes - before.total_diff_nodes < 200);
+#endif
+    patricia_pt_destroy(a);
+    patricia_pt_destroy(b);
+
+#ifdef PATRICIA_STATS_ON
+    patricia_pt_get_stats(&after);
+    TEST_CHECK(after.total_nodes == 0 && after.total_mem == 0);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,169 @@
+/*
+ * test_fc.cpp
+ *
+ * Lookup and predictive search on the front-coded store, built and then
+ * saved and mapped, for random keys and for long keys that share most of
+ * their bytes. Loading a damaged image has to fail.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_fc.h"
+
+/*
+ * test_check
+ *
+ * Compare fc with the keys in ref
+ */
+static void
+test_check (patricia_fc_t *fc, const test_set_t &ref, const char *alphabet)
+{
+    std::mt19937 rng(TEST_SEED + 1);
+    std::vector<std::string> got;
+    test_set_t::iterator it;
+    std::string key;
+    size_t i, j;
+    int n;
+
+    TEST_CHECK(fc->key_count == ref.size());
+    for (it = ref.begin(); it != ref.end(); ++it) {
+        TEST_CHECK(patricia_fc_lookup(fc, it->c_str()) == 1);
+    }
+
+    got.clear();
+    TEST_CHECK(patricia_fc_predictive(fc, "", test_collect, &got) ==
+               (int)ref.size());
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+
+    for (i = 0; i < 5000; i++) {
+        key = test_random_key(rng, 10, alphabet);
+        if (i % 2 && !ref.empty()) {
+            /* Near a stored key, before, after or inside its block */
+            it = ref.lower_bound(key);
+            key = it == ref.end() ? *ref.rbegin() : *it;
+            key.resize(rng() % (key.size() + 1));
+            key += test_random_key(rng, 2, alphabet);
+        }
+        TEST_CHECK(patricia_fc_lookup(fc, key.c_str()) ==
+                   (int)ref.count(key));
+
+        /* The keys starting with key, in order */
+        key.resize(key.size() / 2);
+        got.clear();
+        n = patricia_fc_predictive(fc, key.c_str(), test_collect, &got);
+        TEST_CHECK(n == (int)got.size());
+        it = ref.lower_bound(key);
+        for (j = 0; j < got.size(); j++, ++it) {
+            TEST_CHECK(it != ref.end() && got[j] == *it);
+        }
+        TEST_CHECK(it == ref.end() ||
+                   it->compare(0, key.size(), key) != 0);
+    }
+}
+
+/*
+ * test_build
+ *
+ * A store of n random keys, checked as built and after a save and load
+ */
+static void
+test_build (std::mt19937 &rng, int n, const std::string &head,
+            const char *alphabet, const char *path)
+{
+    patricia_tree_t *tree;
+    patricia_fc_t *fc, *mapped;
+    test_set_t keys;
+    std::string key;
+    int i;
+
+    tree = patricia_init();
+    TEST_CHECK(tree != NULL);
+    for (i = 0; i < n; i++) {
+        key = head + test_random_key(rng, 10, alphabet);
+        if (!key.empty() && patricia_add(tree, &key[0]) == 0) {
+            keys.insert(key);
+        }
+    }
+    keys = test_leaves(keys);
+
+    fc = patricia_fc_build(tree);
+    TEST_CHECK(fc != NULL);
+    test_check(fc, keys, alphabet);
+
+    TEST_CHECK(patricia_fc_save(fc, path) == 0);
+    mapped = patricia_fc_load(path);
+    TEST_CHECK(mapped != NULL && mapped->map != NULL);
+    TEST_CHECK(mapped->block_count == fc->block_count &&
+               mapped->data_size == fc->data_size);
+    test_check(mapped, keys, alphabet);
+
+    patricia_fc_destroy(mapped);
+    patricia_fc_destroy(fc);
+    patricia_destroy(tree);
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    char path[] = "/tmp/test_fc.XXXXXX";
+    std::vector<char> image;
+    patricia_tree_t *tree;
+    patricia_fc_t *fc;
+    std::string key;
+    uint32_t *index;
+    FILE *fp;
+    int fd, i;
+
+    fd = mkstemp(path);
+    TEST_CHECK(fd >= 0);
+    close(fd);
+
+    test_build(rng, 0, "", "abcd/.", path);
+    test_build(rng, 1, "", "abcd/.", path);
+    test_build(rng, 3000, "", "abcd/.", path);
+    test_build(rng, 3000, std::string(200, '/') + "x", "ab", path);
+
+    /* A truncated image, and one with a block past the data */
+    tree = patricia_init();
+    TEST_CHECK(tree != NULL);
+    for (i = 0; i < 100; i++) {
+        key = "k" + test_random_key(rng, 8);
+        patricia_add(tree, &key[0]);
+    }
+    fc = patricia_fc_build(tree);
+    TEST_CHECK(fc != NULL && fc->block_count > 1);
+    TEST_CHECK(patricia_fc_save(fc, path) == 0);
+
+    fp = fopen(path, "rb");
+    TEST_CHECK(fp != NULL);
+    image.resize(sizeof(patricia_fc_header_t) +
+                 (size_t)fc->block_count * sizeof(uint32_t) + fc->data_size);
+    TEST_CHECK(fread(&image[0], 1, image.size(), fp) == image.size());
+    fclose(fp);
+    TEST_CHECK(truncate(path, image.size() - 1) == 0);
+    TEST_CHECK(patricia_fc_load(path) == NULL);
+    index = (uint32_t *)&image[sizeof(patricia_fc_header_t)];
+    index[1] = fc->data_size + 100;
+    fp = fopen(path, "wb");
+    TEST_CHECK(fp != NULL);
+    TEST_CHECK(fwrite(&image[0], 1, image.size(), fp) == image.size());
+    TEST_CHECK(fclose(fp) == 0);
+    TEST_CHECK(patricia_fc_load(path) == NULL);
+    image[0] = 'X';
+    fp = fopen(path, "wb");
+    TEST_CHECK(fp != NULL);
+    TEST_CHECK(fwrite(&image[0], 1, image.size(), fp) == image.size());
+    TEST_CHECK(fclose(fp) == 0);
+    TEST_CHECK(patricia_fc_load(path) == NULL);
+
+    unlink(path);
+    patricia_fc_destroy(fc);
+    patricia_destroy(tree);
+
+    return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * test_feed.cpp
+ *
+ * The change feed against a std::set: random adds and deletes on a tree,
+ * streamed through a pipe and replayed on a follower, which must hold the
+ * same keys. Keys end in '$' so that deletes are exact, see
+ * test_patricia.cpp. Also replays a stream cut at random points, and
+ * rejects corrupt and out of sequence batches.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_feed.h"
+
+static void
+test_check (patricia_tree_t *tree, const test_set_t &ref)
+{
+    std::vector<std::string> got;
+
+    TEST_CHECK(patricia_walk(tree, test_collect, &got) == 0);
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+}
+
+static void
+test_edit (patricia_tree_t *tree, test_set_t &ref, std::mt19937 &rng, int n)
+{
+    std::string key;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        key = test_random_key(rng, 8) + "$";
+        if (rng() % 3) {
+            TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+            ref.insert(key);
+        } else if (ref.erase(key)) {
+            TEST_CHECK(patricia_delete(tree, &key[0]) == 0);
+        }
+    }
+}
+
+/*
+ * test_read_bytes
+ *
+ * The len bytes the feed wrote to the pipe since the last call
+ */
+static std::string
+test_read_bytes (int fd, size_t len)
+{
+    std::string buf(len, 0);
+    size_t pos;
+    ssize_t n;
+
+    for (pos = 0; pos < len; pos += n) {
+        n = read(fd, &buf[pos], len - pos);
+        TEST_CHECK(n > 0);
+    }
+
+    return buf;
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_tree_t *tree, *follower, *copy;
+    patricia_feed_t *feed;
+    test_set_t ref;
+    std::string stream, bad;
+    unsigned long batches, bytes;
+    uint64_t seq, copy_seq;
+    size_t pos, len;
+    long used;
+    int fds[2], round, ret;
+
+    TEST_CHECK(pipe(fds) == 0);
+    tree = patricia_init();
+    follower = patricia_init();
+    TEST_CHECK(tree && follower);
+    TEST_CHECK(patricia_feed_init(NULL, fds[1], 0) == NULL);
+
+    /* Small batches, so that appends write batches of their own */
+    feed = patricia_feed_init(tree, fds[1], 256);
+    TEST_CHECK(feed != NULL);
+    TEST_CHECK(patricia_feed_init(tree, fds[1], 0) == NULL);
+
+    /* Batches read one at a time and replayed by patricia_feed_read */
+    seq = 0;
+    batches = 0;
+    for (round = 0; round < 50; round++) {
+        test_edit(tree, ref, rng, rng() % 200);
+        TEST_CHECK(patricia_feed_flush(feed) == 0);
+        for (; batches < feed->batches; batches++) {
+            TEST_CHECK(patricia_feed_read(follower, fds[0], &seq) > 0);
+        }
+        TEST_CHECK(seq == feed->seq);
+        test_check(follower, ref);
+    }
+
+    /* A second follower, starting from a copy of the first */
+    copy = patricia_init();
+    TEST_CHECK(copy != NULL);
+    for (const auto &key : ref) {
+        TEST_CHECK(patricia_add(copy, (char *)key.c_str()) == 0);
+    }
+    copy_seq = seq;
+
+    /*
+     * The raw stream, replayed by patricia_feed_apply in pieces cut at
+     * random points on one follower, and at once on the other
+     */
+    bytes = feed->bytes;
+    for (round = 0; round < 20; round++) {
+        test_edit(tree, ref, rng, rng() % 200);
+        TEST_CHECK(patricia_feed_flush(feed) == 0);
+        stream += test_read_bytes(fds[0], feed->bytes - bytes);
+        bytes = feed->bytes;
+    }
+    for (pos = 0; pos < stream.size(); pos += used) {
+        len = 1 + rng() % 2000;
+        len = std::min(len, stream.size() - pos);
+        used = patricia_feed_apply(follower, &stream[pos], len, &seq);
+        TEST_CHECK(used >= 0 && (size_t)used <= len);
+        if (used == 0) {
+            /* Not a whole batch yet, give it the rest */
+            used = patricia_feed_apply(follower, &stream[pos],
+                                       stream.size() - pos, &seq);
+            TEST_CHECK(used > 0);
+        }
+    }
+    TEST_CHECK(seq == feed->seq);
+    test_check(follower, ref);
+
+    TEST_CHECK(patricia_feed_apply(copy, &stream[0], stream.size(),
+                                   &copy_seq) == (long)stream.size());
+    TEST_CHECK(copy_seq == seq);
+    test_check(copy, ref);
+
+    /* Out of sequence: the stream again, or a corrupt header */
+    TEST_CHECK(patricia_feed_apply(copy, &stream[0], stream.size(),
+                                   &copy_seq) == -1);
+    bad = stream;
+    bad[0] ^= 1;
+    copy_seq = 0;
+    TEST_CHECK(patricia_feed_apply(copy, &bad[0], bad.size(),
+                                   &copy_seq) == -1);
+    TEST_CHECK(patricia_feed_apply(NULL, &stream[0], stream.size(),
+                                   &copy_seq) == -1);
+    test_check(copy, ref);
+
+    /* Destroying the feed writes the rest and detaches it */
+    test_edit(tree, ref, rng, 10);
+    ret = patricia_feed_destroy(feed);
+    TEST_CHECK(ret == 0);
+    TEST_CHECK(tree->change_fn == NULL);
+    close(fds[1]);
+    while ((ret = patricia_feed_read(follower, fds[0], &seq)) > 0);
+    TEST_CHECK(ret == 0);
+    test_check(follower, ref);
+    test_check(tree, ref);
+    close(fds[0]);
+
+    patricia_destroy(tree);
+    patricia_destroy(follower);
+    patricia_destroy(copy);
+
+    return 0;
+}
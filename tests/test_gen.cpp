@@ -0,0 +1,101 @@
+/*
+ * test_gen.cpp
+ *
+ * The code patricia_gen writes for test_gen_keys.txt, built into this
+ * test, against patricia_lookup on a tree of the same keys and against a
+ * std::set of the keys. The keys include quotes, backslashes and bytes
+ * above 0x7f, which the generator has to escape.
+ */
+
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia.h"
+
+/* Defined in the generated test_gen_keys.cpp */
+int test_gen_lookup (const char *key);
+int test_gen_lookup_prefix (const char *prefix,
+                            void (*fn) (const char *key, void *arg),
+                            void *arg);
+
+static void
+test_collect (const char *key, void *arg)
+{
+    ((std::vector<std::string> *)arg)->push_back(key);
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    std::set<std::string> keys, leaves;
+    std::set<std::string>::iterator it, next;
+    std::vector<std::string> got, prefixes;
+    patricia_tree_t *tree;
+    char line[256];
+    std::string key;
+    FILE *in;
+    size_t i;
+    int n;
+
+    in = fopen(TEST_GEN_KEYS, "r");
+    TEST_CHECK(in != NULL);
+    tree = patricia_init();
+    while (fgets(line, sizeof(line), in)) {
+        line[strcspn(line, "\n")] = 0;
+        keys.insert(line);
+        TEST_CHECK(patricia_add(tree, line) == 0);
+    }
+    fclose(in);
+    TEST_CHECK(keys.size() > 400);
+
+    /* The tree keeps keys at the leaves, a key that prefixes another is not */
+    for (it = keys.begin(); it != keys.end(); it = next) {
+        next = it;
+        ++next;
+        if (next == keys.end() || next->compare(0, it->size(), *it) != 0) {
+            leaves.insert(*it);
+        }
+    }
+
+    /* Every key, all of their prefixes, and random near misses */
+    for (it = keys.begin(); it != keys.end(); ++it) {
+        TEST_CHECK(test_gen_lookup(it->c_str()) == 1);
+        for (i = 0; i <= it->size(); i++) {
+            key = it->substr(0, i);
+            prefixes.push_back(key);
+            TEST_CHECK(test_gen_lookup(key.c_str()) ==
+                       patricia_lookup(tree, &key[0]));
+        }
+        key = *it + "x";
+        TEST_CHECK(test_gen_lookup(key.c_str()) ==
+                   patricia_lookup(tree, &key[0]));
+    }
+    for (i = 0; i < 20000; i++) {
+        key = test_random_key(rng, 12, "abcdefilorsuv/.");
+        TEST_CHECK(test_gen_lookup(key.c_str()) ==
+                   patricia_lookup(tree, &key[0]));
+    }
+
+    /* Prefix enumeration, in order, with prefixes ending inside labels */
+    prefixes.push_back("zzz");
+    for (i = 0; i < prefixes.size(); i += 3) {
+        got.clear();
+        n = test_gen_lookup_prefix(prefixes[i].c_str(), test_collect, &got);
+        TEST_CHECK(n == (int)got.size());
+        it = leaves.lower_bound(prefixes[i]);
+        for (std::string &g : got) {
+            TEST_CHECK(it != leaves.end() && g == *it);
+            ++it;
+        }
+        TEST_CHECK(it == leaves.end() ||
+                   it->compare(0, prefixes[i].size(), prefixes[i]) != 0);
+    }
+    TEST_CHECK(test_gen_lookup_prefix(NULL, test_collect, &got) == -1);
+
+    patricia_destroy(tree);
+
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * test_hat.cpp
+ *
+ * The burst trie against a std::set, with a burst threshold small enough
+ * that buckets burst all the time and with the default one. Keys include
+ * the empty key and keys that are prefixes of others.
+ */
+
+#include <stddef.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_hat.h"
+
+static int
+test_collect (const char *key, void *arg)
+{
+    ((std::vector<std::string> *)arg)->push_back(key);
+    return 0;
+}
+
+static int
+test_stop (const char *key, void *arg)
+{
+    (void)key;
+    return ++*(int *)arg == 3;
+}
+
+/*
+ * test_check_nodes
+ *
+ * The bytes of every node are strictly ascending and the memory counted by
+ * the tree is what its nodes and buckets take
+ */
+static void
+test_check_nodes (void *p, unsigned long *bytes)
+{
+    patricia_hat_bucket_t *bucket;
+    patricia_hat_node_t *node;
+    uint32_t i;
+
+    if (*(uint8_t *)p == PATRICIA_HAT_BUCKET) {
+        bucket = (patricia_hat_bucket_t *)p;
+        TEST_CHECK(bucket->size <= bucket->cap);
+        *bytes += offsetof(patricia_hat_bucket_t, data) + bucket->cap;
+        return;
+    }
+
+    node = (patricia_hat_node_t *)p;
+    TEST_CHECK(node->count <= node->cap);
+    *bytes += sizeof(patricia_hat_node_t) + node->cap * (1 + sizeof(void *));
+    for (i = 0; i < node->count; i++) {
+        TEST_CHECK(i == 0 || node->bytes[i - 1] < node->bytes[i]);
+        test_check_nodes(node->child[i], bytes);
+    }
+}
+
+static void
+test_burst (uint32_t burst)
+{
+    std::mt19937 rng(TEST_SEED + burst);
+    std::vector<std::string> got;
+    patricia_hat_tree_t *tree;
+    test_set_t ref;
+    test_set_t::iterator it;
+    std::string key;
+    unsigned long bytes;
+    int i, n, calls;
+    size_t j;
+
+    tree = patricia_hat_init(burst);
+    TEST_CHECK(tree != NULL);
+
+    for (i = 0; i < 40000; i++) {
+        key = test_random_key(rng, 8);
+        switch (rng() % 4) {
+        case 0:
+        case 1:
+            TEST_CHECK(patricia_hat_add(tree, key.c_str()) == 0);
+            ref.insert(key);
+            break;
+        case 2:
+            TEST_CHECK(patricia_hat_delete(tree, key.c_str()) ==
+                       (ref.erase(key) ? 0 : -1));
+            break;
+        default:
+            TEST_CHECK(patricia_hat_lookup(tree, key.c_str()) ==
+                       (int)ref.count(key));
+            break;
+        }
+        TEST_CHECK(tree->count == ref.size());
+        if (i % 1000 == 0) {
+            bytes = sizeof(patricia_hat_tree_t);
+            test_check_nodes(tree->root, &bytes);
+            TEST_CHECK(tree->total_mem == bytes);
+        }
+    }
+
+    /* Prefix walks, the empty prefix walks everything */
+    for (i = 0; i < 1000; i++) {
+        key = i ? test_random_key(rng, 4) : std::string();
+        got.clear();
+        n = patricia_hat_lookup_prefix(tree, key.c_str(), test_collect, &got);
+        TEST_CHECK(n == (int)got.size());
+        it = ref.lower_bound(key);
+        for (j = 0; j < got.size(); j++, ++it) {
+            TEST_CHECK(it != ref.end() && got[j] == *it);
+        }
+        TEST_CHECK(it == ref.end() || it->compare(0, key.size(), key) != 0);
+    }
+
+    calls = 0;
+    TEST_CHECK(patricia_hat_lookup_prefix(tree, "", test_stop, &calls) == 3);
+    TEST_CHECK(calls == 3);
+
+    /* Deleting everything leaves an empty but usable tree */
+    for (it = ref.begin(); it != ref.end(); ++it) {
+        TEST_CHECK(patricia_hat_delete(tree, it->c_str()) == 0);
+    }
+    TEST_CHECK(tree->count == 0 && patricia_hat_lookup(tree, "a") == 0);
+    TEST_CHECK(patricia_hat_add(tree, "a") == 0 &&
+               patricia_hat_lookup(tree, "a") == 1);
+
+    TEST_CHECK(patricia_hat_destroy(tree) == 0);
+}
+
+int
+main (void)
+{
+    test_burst(2);
+    test_burst(16);
+    test_burst(PATRICIA_HAT_DEFAULT_BURST);
+
+    return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * test_hope.cpp
+ *
+ * The order-preserving encoder: round trips and byte order of encoded
+ * keys against the keys themselves, on keys like the training sample and
+ * on arbitrary bytes, and a core tree using it as its codec against a
+ * std::set. Keys in the tree end in '$', see test_patricia.cpp.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_hope.h"
+
+#define TEST_BUF    4096
+
+/*
+ * test_path_key
+ *
+ * A URL-like key made of common words and a few random bytes
+ */
+static std::string
+test_path_key (std::mt19937 &rng)
+{
+    static const char *words[] = { "static", "images", "api", "v1", "blog",
+                                   "user", "index", "docs", ".html", "-" };
+    std::string key;
+    int n;
+
+    for (n = rng() % 5; n >= 0; n--) {
+        key += "/";
+        key += words[rng() % 10];
+        key += test_random_key(rng, 2, "0123456789");
+    }
+
+    return key;
+}
+
+/*
+ * test_any_key
+ *
+ * Up to 12 arbitrary bytes other than 0
+ */
+static std::string
+test_any_key (std::mt19937 &rng)
+{
+    std::string key;
+    int n;
+
+    for (n = rng() % 13; n > 0; n--) {
+        key += (char)(1 + rng() % 255);
+    }
+
+    return key;
+}
+
+static std::string
+test_encode (patricia_hope_t *hope, const std::string &key)
+{
+    char out[TEST_BUF], back[TEST_BUF];
+    int len;
+
+    len = patricia_hope_encode(key.c_str(), out, sizeof(out), hope);
+    TEST_CHECK(len >= 0 && (size_t)len == strlen(out));
+    TEST_CHECK(patricia_hope_decode(out, back, sizeof(back), hope) ==
+               (int)key.size());
+    TEST_CHECK(key == back);
+
+    return std::string(out, len);
+}
+
+/*
+ * test_order
+ *
+ * Pairs of keys compare the same way, as unsigned bytes, before and after
+ * encoding
+ */
+static void
+test_order (patricia_hope_t *hope, const std::vector<std::string> &keys)
+{
+    std::vector<std::string> enc;
+    size_t i;
+
+    for (i = 0; i < keys.size(); i++) {
+        enc.push_back(test_encode(hope, keys[i]));
+    }
+    for (i = 1; i < keys.size(); i++) {
+        TEST_CHECK((keys[i - 1] < keys[i]) == (enc[i - 1] < enc[i]));
+        TEST_CHECK((keys[i - 1] == keys[i]) == (enc[i - 1] == enc[i]));
+    }
+}
+
+static void
+test_check_walk (patricia_tree_t *tree, const test_set_t &ref,
+                 std::mt19937 &rng)
+{
+    std::vector<std::string> got;
+    test_set_t::const_iterator it;
+    std::string lo, hi;
+    size_t j;
+
+    TEST_CHECK(patricia_walk(tree, test_collect, &got) == 0);
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+
+    lo = test_path_key(rng);
+    lo.resize(rng() % (lo.size() + 1));
+    got.clear();
+    TEST_CHECK(patricia_walk_prefix(tree, &lo[0], test_collect, &got) == 0);
+    it = ref.lower_bound(lo);
+    for (j = 0; j < got.size(); j++, ++it) {
+        TEST_CHECK(it != ref.end() && got[j] == *it);
+    }
+    TEST_CHECK(it == ref.end() || it->compare(0, lo.size(), lo) != 0);
+
+    hi = test_path_key(rng);
+    if (hi < lo) {
+        lo.swap(hi);
+    }
+    got.clear();
+    TEST_CHECK(patricia_walk_range(tree, &lo[0], &hi[0], test_collect,
+                                   &got) == 0);
+    TEST_CHECK(got == std::vector<std::string>(ref.lower_bound(lo),
+                                               ref.lower_bound(hi)));
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    std::vector<std::string> sample, keys;
+    std::vector<const char *> ptrs;
+    patricia_hope_t *hope;
+    patricia_tree_t *tree;
+    test_set_t ref;
+    std::string key;
+    char buf[TEST_BUF], small[2];
+    int i;
+
+    for (i = 0; i < 2000; i++) {
+        sample.push_back(test_path_key(rng));
+    }
+    for (i = 0; i < 2000; i++) {
+        ptrs.push_back(sample[i].c_str());
+    }
+    hope = patricia_hope_train(ptrs.data(), ptrs.size(), 0);
+    TEST_CHECK(hope != NULL);
+    TEST_CHECK(hope->dict_count > 0);
+    TEST_CHECK(hope->sample_out > 0 && hope->sample_out < hope->sample_in);
+
+    /* Round trips and order, for keys like the sample and for any bytes */
+    for (i = 0; i < 5000; i++) {
+        keys.push_back(test_path_key(rng));
+        keys.push_back(test_any_key(rng));
+        key = keys[rng() % keys.size()];
+        key.resize(rng() % (key.size() + 1));
+        keys.push_back(key);
+    }
+    keys.push_back("");
+    std::sort(keys.begin(), keys.end());
+    test_order(hope, keys);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    test_order(hope, keys);
+
+    /* Outputs that do not fit */
+    TEST_CHECK(patricia_hope_encode("/static/index.html", small,
+                                    sizeof(small), hope) == -1);
+    TEST_CHECK(patricia_hope_encode("/static/index.html", buf, sizeof(buf),
+                                    hope) > 0);
+    TEST_CHECK(patricia_hope_decode(buf, small, sizeof(small), hope) == -1);
+
+    /* A tree storing encoded keys */
+    tree = patricia_init();
+    TEST_CHECK(tree != NULL);
+    TEST_CHECK(patricia_set_codec(tree, patricia_hope_encode, NULL,
+                                  hope) == -1);
+    TEST_CHECK(patricia_set_codec(tree, patricia_hope_encode,
+                                  patricia_hope_decode, hope) == 0);
+    for (i = 0; i < 20000; i++) {
+        key = test_path_key(rng) + "$";
+        switch (rng() % 4) {
+        case 0:
+        case 1:
+            TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+            ref.insert(key);
+            break;
+        case 2:
+            if (ref.erase(key)) {
+                TEST_CHECK(patricia_delete(tree, &key[0]) == 0);
+            }
+            break;
+        default:
+            TEST_CHECK(patricia_lookup(tree, &key[0]) == (int)ref.count(key));
+            break;
+        }
+        if (i % 1000 == 0) {
+            test_check_walk(tree, ref, rng);
+        }
+    }
+    test_check_walk(tree, ref, rng);
+    TEST_CHECK(patricia_lookup_prefix_full(tree, (char *)"/", buf) == -1);
+
+    /* A codec only goes on an empty tree */
+    patricia_destroy(tree);
+    tree = patricia_init();
+    TEST_CHECK(patricia_add(tree, (char *)"a") == 0);
+    TEST_CHECK(patricia_set_codec(tree, patricia_hope_encode,
+                                  patricia_hope_decode, hope) == -1);
+    patricia_destroy(tree);
+    patricia_hope_destroy(hope);
+
+    TEST_CHECK(patricia_hope_train(NULL, 0, 0) == NULL);
+
+    return 0;
+}
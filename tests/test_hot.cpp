@@ -0,0 +1,79 @@
+/*
+ * test_hot.cpp
+ *
+ * The cache line blocked layout against a std::set of the keys of the
+ * arena it was built from. The alphabet is wide enough for nodes to
+ * overflow into more blocks, and some keys share prefixes longer than the
+ * inline part of a label.
+ */
+
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_hot.h"
+
+static void
+test_layout (const char *alphabet, int maxlen, const char *stem, int wide)
+{
+    std::mt19937 rng(TEST_SEED + maxlen);
+    std::vector<std::string> got;
+    patricia_arena_t *arena;
+    patricia_hot_t *hot;
+    test_set_t ref;
+    std::string key;
+    uint32_t i, b, more = 0;
+
+    arena = patricia_arena_init(0, 0);
+    TEST_CHECK(arena != NULL);
+    for (i = 0; i < 5000; i++) {
+        key = test_random_key(rng, maxlen, alphabet);
+        if (rng() % 2) {
+            key = stem + key;
+        }
+        TEST_CHECK(patricia_arena_add(arena, key.c_str()) == 0);
+        ref.insert(key);
+    }
+
+    hot = patricia_hot_build(arena);
+    TEST_CHECK(hot != NULL);
+    TEST_CHECK(hot->key_count == ref.size());
+    TEST_CHECK(((uintptr_t)hot->blocks % PATRICIA_HOT_BLOCK_SIZE) == 0);
+    for (b = 0; b < hot->block_count; b++) {
+        TEST_CHECK(hot->blocks[b].nchildren <= PATRICIA_HOT_FANOUT);
+        more += (hot->blocks[b].flags & PATRICIA_HOT_MORE) != 0;
+    }
+    TEST_CHECK(hot->cold_size > 0 && (more > 0) == wide);
+
+    /* A key below the root takes its block and at least one more */
+    for (const std::string &k : ref) {
+        TEST_CHECK(patricia_hot_lookup(hot, k.c_str()) == 1);
+        TEST_CHECK(patricia_hot_blocks_read(hot, k.c_str()) >=
+                   (k.empty() ? 1u : 2u));
+    }
+    for (i = 0; i < 20000; i++) {
+        key = test_random_key(rng, maxlen, alphabet);
+        if (rng() % 2) {
+            key = std::string(stem).substr(0, rng() % 20) + key;
+        }
+        TEST_CHECK(patricia_hot_lookup(hot, key.c_str()) ==
+                   (int)ref.count(key));
+    }
+
+    TEST_CHECK(patricia_hot_walk(hot, test_collect, &got) == 0);
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+
+    patricia_hot_destroy(hot);
+    patricia_arena_destroy(arena);
+}
+
+int
+main (void)
+{
+    /* Narrow, and wide enough to fill overflow blocks */
+    test_layout("abcd/.", 8, "static/images/thumbnails/", 0);
+    test_layout("abcdefghijklmnopqrstuvwxyz0123456789", 4,
+                "0123456789abcdefghij", 1);
+
+    return 0;
+}
@@ -0,0 +1,109 @@
+/*
+ * test_huge.cpp
+ *
+ * An arena backed by huge pages against a std::set and against an arena
+ * on the heap fed the same operations. Whether the kernel hands out huge
+ * pages is up to its configuration, so only the layout of the buffer and
+ * the bounds of the coverage counter are checked, not the coverage.
+ */
+
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_arena.h"
+
+/*
+ * test_check_buffer
+ *
+ * A huge page buffer is whole 2 MB pages at a 2 MB boundary
+ */
+static void
+test_check_buffer (patricia_arena_t *arena)
+{
+    TEST_CHECK(arena->mem == PATRICIA_ARENA_MEM_THP ||
+               arena->mem == PATRICIA_ARENA_MEM_HUGETLB);
+    TEST_CHECK(((uintptr_t)arena->base % PATRICIA_ARENA_HUGE_SIZE) == 0);
+    TEST_CHECK(arena->cap % PATRICIA_ARENA_HUGE_SIZE == 0);
+    TEST_CHECK(patricia_arena_huge_bytes(arena) <= arena->cap);
+}
+
+static void
+test_check (patricia_arena_t *arena, const test_set_t &ref)
+{
+    std::vector<std::string> got;
+
+    TEST_CHECK(PATRICIA_ARENA_HDR(arena)->key_count == ref.size());
+    TEST_CHECK(patricia_arena_walk(arena, test_collect, &got) == 0);
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_arena_t *huge, *heap, *built;
+    patricia_tree_t *tree;
+    test_set_t ref, leaves;
+    std::string key;
+    size_t hlen, plen;
+    void *himage, *pimage;
+    int i;
+
+    huge = patricia_arena_init(0, PATRICIA_ARENA_HUGE);
+    heap = patricia_arena_init(0, 0);
+    TEST_CHECK(huge != NULL && heap != NULL);
+    TEST_CHECK(heap->mem == PATRICIA_ARENA_MEM_HEAP);
+    test_check_buffer(huge);
+
+    /* Enough keys to grow past the first huge page */
+    for (i = 0; i < 160000; i++) {
+        key = test_random_key(rng, 16, "abcdefghijklmnop");
+        if (rng() % 4) {
+            TEST_CHECK(patricia_arena_add(huge, key.c_str()) == 0);
+            TEST_CHECK(patricia_arena_add(heap, key.c_str()) == 0);
+            ref.insert(key);
+        } else {
+            TEST_CHECK(patricia_arena_delete(huge, key.c_str()) ==
+                       (ref.count(key) ? 0 : -1));
+            TEST_CHECK(patricia_arena_delete(heap, key.c_str()) ==
+                       (ref.erase(key) ? 0 : -1));
+        }
+    }
+    TEST_CHECK(huge->cap > PATRICIA_ARENA_HUGE_SIZE);
+    test_check_buffer(huge);
+    test_check(huge, ref);
+
+    /* The buffers only differ in where they are */
+    himage = patricia_arena_image(huge, &hlen);
+    pimage = patricia_arena_image(heap, &plen);
+    TEST_CHECK(hlen == plen && memcmp(himage, pimage, hlen) == 0);
+
+    TEST_CHECK(patricia_arena_compact(huge) == 0);
+    test_check_buffer(huge);
+    test_check(huge, ref);
+    for (const std::string &k : ref) {
+        TEST_CHECK(patricia_arena_lookup(huge, k.c_str()) == 1);
+    }
+
+    /* Built from a core tree */
+    tree = patricia_init();
+    for (i = 0; i < 1000; i++) {
+        key = test_random_key(rng, 8);
+        if (!key.empty() && patricia_add(tree, &key[0]) == 0) {
+            leaves.insert(key);
+        }
+    }
+    built = patricia_arena_build(tree, PATRICIA_ARENA_HUGE);
+    TEST_CHECK(built != NULL);
+    test_check_buffer(built);
+    test_check(built, test_leaves(leaves));
+
+    patricia_arena_destroy(built);
+    patricia_destroy(tree);
+    TEST_CHECK(patricia_arena_destroy(heap) == 0);
+    TEST_CHECK(patricia_arena_destroy(huge) == 0);
+
+    return 0;
+}
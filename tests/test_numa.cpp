@@ -0,0 +1,139 @@
+/*
+ * test_numa.cpp
+ *
+ * The replicated tree against two std::sets, the writer's keys and the
+ * published ones: updates only show in lookups once a batch is published.
+ * Reader threads look up keys that are never deleted while the writer
+ * keeps publishing, which must not lose them or touch freed replicas.
+ */
+
+#include <pthread.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_numa.h"
+
+#define TEST_BATCH      64
+#define TEST_READERS    3
+
+typedef struct test_reader_s {
+    patricia_numa_t *numa;
+    int             *stop;
+    unsigned long   misses;
+} test_reader_t;
+
+/* Keys present from the start and never deleted */
+static const char *test_fixed[] = { "fixed/a", "fixed/b", "fixed/c" };
+
+static void *
+test_reader (void *arg)
+{
+    test_reader_t *reader = (test_reader_t *)arg;
+    unsigned long i;
+
+    for (i = 0; !__atomic_load_n(reader->stop, __ATOMIC_ACQUIRE); i++) {
+        if (!patricia_numa_lookup(reader->numa, test_fixed[i % 3])) {
+            reader->misses++;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+test_check (patricia_numa_t *numa, const test_set_t &published,
+            std::mt19937 &rng)
+{
+    std::string key;
+    int i;
+
+    for (const std::string &k : published) {
+        TEST_CHECK(patricia_numa_lookup(numa, k.c_str()) == 1);
+    }
+    for (i = 0; i < 200; i++) {
+        key = test_random_key(rng, 6);
+        TEST_CHECK(patricia_numa_lookup(numa, key.c_str()) ==
+                   (int)published.count(key));
+    }
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    test_reader_t readers[TEST_READERS];
+    pthread_t threads[TEST_READERS];
+    patricia_arena_t *arena;
+    patricia_numa_t *numa;
+    test_set_t master, published;
+    std::string key;
+    uint32_t node, online = 0;
+    unsigned long publishes;
+    int i, stop = 0;
+
+    arena = patricia_arena_init(0, 0);
+    TEST_CHECK(arena != NULL);
+    for (i = 0; i < 3; i++) {
+        TEST_CHECK(patricia_arena_add(arena, test_fixed[i]) == 0);
+        master.insert(test_fixed[i]);
+    }
+
+    numa = patricia_numa_init(arena, TEST_BATCH);
+    TEST_CHECK(numa != NULL && numa->node_count >= 1);
+    for (node = 0; node < PATRICIA_NUMA_MAX_NODES; node++) {
+        if (numa->online[node]) {
+            TEST_CHECK(numa->slot[node].cur != NULL);
+            online++;
+        }
+    }
+    TEST_CHECK(online == numa->node_count);
+    published = master;
+    test_check(numa, published, rng);
+
+    for (i = 0; i < TEST_READERS; i++) {
+        readers[i].numa = numa;
+        readers[i].stop = &stop;
+        readers[i].misses = 0;
+        TEST_CHECK(pthread_create(&threads[i], NULL, test_reader,
+                                  &readers[i]) == 0);
+    }
+
+    /* Updates stay private until every TEST_BATCH of them */
+    for (i = 0; i < 5000; i++) {
+        key = test_random_key(rng, 6);
+        publishes = numa->publishes;
+        if (rng() % 3) {
+            TEST_CHECK(patricia_numa_add(numa, key.c_str()) == 0);
+            master.insert(key);
+        } else if (master.erase(key)) {
+            TEST_CHECK(patricia_numa_delete(numa, key.c_str()) == 0);
+        } else {
+            TEST_CHECK(patricia_numa_delete(numa, key.c_str()) == -1);
+            continue;
+        }
+        if (numa->publishes != publishes) {
+            TEST_CHECK(numa->pending == 0);
+            published = master;
+        } else {
+            TEST_CHECK(numa->pending > 0 && numa->pending < TEST_BATCH);
+        }
+        if (i % 250 == 0) {
+            test_check(numa, published, rng);
+        }
+    }
+
+    TEST_CHECK(patricia_numa_publish(numa) == 0 && numa->pending == 0);
+    published = master;
+    test_check(numa, published, rng);
+
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    for (i = 0; i < TEST_READERS; i++) {
+        TEST_CHECK(pthread_join(threads[i], NULL) == 0);
+        TEST_CHECK(readers[i].misses == 0);
+    }
+
+    TEST_CHECK(patricia_numa_destroy(numa) == 0);
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+/*
+ * test_paged.cpp
+ *
+ * The paged trie against a std::set: random adds, lookups and prefix
+ * walks through a pool much smaller than the file, before and after the
+ * file is closed and opened again. Keys range from empty to the longest
+ * allowed, and some share long prefixes, so buckets split and burst and
+ * labels split.
+ */
+
+#include <unistd.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_paged.h"
+
+static int
+test_stop (const char *key, int len, void *arg)
+{
+    (void)key;
+    (void)len;
+    return ++*(int *)arg == 3 ? 7 : 0;
+}
+
+/*
+ * test_key
+ *
+ * A short random key, or one under a long shared prefix
+ */
+static std::string
+test_key (std::mt19937 &rng)
+{
+    static const std::string longer(300, 'x');
+
+    switch (rng() % 4) {
+    case 0:
+        return longer + test_random_key(rng, 8);
+    case 1:
+        return test_random_key(rng, 6, "ab") + longer.substr(rng() % 300) +
+               test_random_key(rng, 4);
+    default:
+        return test_random_key(rng, 10);
+    }
+}
+
+static void
+test_check (patricia_paged_t *pt, const test_set_t &ref, std::mt19937 &rng)
+{
+    std::vector<std::string> got;
+    test_set_t::const_iterator it;
+    std::string key;
+    int i;
+
+    TEST_CHECK(pt->meta.key_count == ref.size());
+    for (const auto &k : ref) {
+        TEST_CHECK(patricia_paged_lookup(pt, k.c_str()) == 1);
+    }
+    for (i = 0; i < 1000; i++) {
+        key = test_key(rng);
+        TEST_CHECK(patricia_paged_lookup(pt, key.c_str()) ==
+                   (int)ref.count(key));
+    }
+
+    TEST_CHECK(patricia_paged_walk_prefix(pt, "", test_collect, &got) == 0);
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+    for (i = 0; i < 20; i++) {
+        key = test_key(rng).substr(0, rng() % 8);
+        got.clear();
+        TEST_CHECK(patricia_paged_walk_prefix(pt, key.c_str(), test_collect,
+                                              &got) == 0);
+        it = ref.lower_bound(key);
+        for (const auto &k : got) {
+            TEST_CHECK(it != ref.end() && k == *it);
+            ++it;
+        }
+        TEST_CHECK(it == ref.end() || it->compare(0, key.size(), key) != 0);
+    }
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_paged_t *pt;
+    test_set_t ref;
+    std::string key, path;
+    int round, i, calls;
+
+    path = "/tmp/patricia_test_paged_" + std::to_string(getpid());
+    unlink(path.c_str());
+    TEST_CHECK(patricia_paged_open(path.c_str(), 0, 0) == NULL);
+
+    pt = patricia_paged_open(path.c_str(), 0, PATRICIA_PAGED_CREATE);
+    TEST_CHECK(pt != NULL);
+    TEST_CHECK(pt->frame_count == PATRICIA_PAGED_MIN_POOL);
+    TEST_CHECK(patricia_paged_lookup(pt, "") == 0);
+
+    for (round = 0; round < 5; round++) {
+        for (i = 0; i < 1000; i++) {
+            key = test_key(rng);
+            TEST_CHECK(patricia_paged_add(pt, key.c_str()) == 0);
+            ref.insert(key);
+        }
+        test_check(pt, ref, rng);
+    }
+    TEST_CHECK(pt->meta.page_count > 4 * pt->frame_count);
+    TEST_CHECK(pt->reads > 0 && pt->writes > 0);
+
+    /* Keys too long are refused, the longest allowed is not */
+    key.assign(PATRICIA_PAGED_MAX_KEYLEN + 1, 'a');
+    TEST_CHECK(patricia_paged_add(pt, key.c_str()) == -1);
+    key.pop_back();
+    TEST_CHECK(patricia_paged_add(pt, key.c_str()) == 0);
+    ref.insert(key);
+    TEST_CHECK(patricia_paged_add(pt, "") == 0);
+    ref.insert("");
+
+    calls = 0;
+    TEST_CHECK(patricia_paged_walk_prefix(pt, "", test_stop, &calls) == 7);
+    TEST_CHECK(calls == 3);
+    TEST_CHECK(patricia_paged_close(pt) == 0);
+
+    /* Reopened with another pool size, and with O_DIRECT where possible */
+    pt = patricia_paged_open(path.c_str(), 64, 0);
+    TEST_CHECK(pt != NULL);
+    test_check(pt, ref, rng);
+    for (i = 0; i < 1000; i++) {
+        key = test_key(rng);
+        TEST_CHECK(patricia_paged_add(pt, key.c_str()) == 0);
+        ref.insert(key);
+    }
+    TEST_CHECK(patricia_paged_close(pt) == 0);
+    pt = patricia_paged_open(path.c_str(), 16, PATRICIA_PAGED_DIRECT);
+    TEST_CHECK(pt != NULL);
+    test_check(pt, ref, rng);
+    TEST_CHECK(patricia_paged_close(pt) == 0);
+
+    /* A file that is not a tree is refused */
+    TEST_CHECK(truncate(path.c_str(), 100) == 0);
+    TEST_CHECK(patricia_paged_open(path.c_str(), 0, 0) == NULL);
+    unlink(path.c_str());
+
+    return 0;
+}
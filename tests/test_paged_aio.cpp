@@ -0,0 +1,112 @@
+/*
+ * test_paged_aio.cpp
+ *
+ * Batch lookups on the paged trie against a std::set and against
+ * patricia_paged_lookup, through io_uring where the kernel has it and
+ * through the thread pool, with pools small enough that most lookups
+ * wait for reads and batches that ask for the same pages many times.
+ */
+
+#include <unistd.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_paged_aio.h"
+
+#define TEST_KEYS   20000
+
+/*
+ * test_batches
+ *
+ * Look up batches of keys, half of them present and some repeated, and
+ * check every result
+ */
+static void
+test_batches (patricia_paged_aio_t *aio, const std::vector<std::string> &keys,
+              const test_set_t &ref, std::mt19937 &rng)
+{
+    std::vector<std::string> batch;
+    std::vector<const char *> ptrs;
+    std::vector<int> results;
+    uint32_t round, n, i;
+
+    for (round = 0; round < 20; round++) {
+        n = rng() % 1500;
+        batch.clear();
+        for (i = 0; i < n; i++) {
+            if (rng() % 2) {
+                batch.push_back(keys[rng() % keys.size()]);
+            } else if (i > 0 && rng() % 4 == 0) {
+                batch.push_back(batch[rng() % i]);
+            } else {
+                batch.push_back(test_random_key(rng, 10));
+            }
+        }
+        ptrs.clear();
+        for (i = 0; i < n; i++) {
+            ptrs.push_back(batch[i].c_str());
+        }
+        results.assign(n + 1, -7);
+        TEST_CHECK(patricia_paged_aio_lookup(aio, ptrs.data(), n,
+                                             results.data()) == 0);
+        for (i = 0; i < n; i++) {
+            TEST_CHECK(results[i] == (int)ref.count(batch[i]));
+            TEST_CHECK(patricia_paged_lookup(aio->pt, ptrs[i]) ==
+                       results[i]);
+        }
+        TEST_CHECK(results[n] == -7);
+    }
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    std::vector<std::string> keys;
+    patricia_paged_aio_t *aio;
+    patricia_paged_t *pt;
+    test_set_t ref;
+    std::string key, path;
+    const char *empty = "";
+    uint32_t pools[] = { 8, 32 }, p;
+    int flags;
+
+    path = "/tmp/patricia_test_paged_aio_" + std::to_string(getpid());
+    unlink(path.c_str());
+    pt = patricia_paged_open(path.c_str(), 64, PATRICIA_PAGED_CREATE);
+    TEST_CHECK(pt != NULL);
+    while (ref.size() < TEST_KEYS) {
+        key = test_random_key(rng, 12);
+        TEST_CHECK(patricia_paged_add(pt, key.c_str()) == 0);
+        ref.insert(key);
+    }
+    keys.assign(ref.begin(), ref.end());
+    TEST_CHECK(patricia_paged_close(pt) == 0);
+
+    for (flags = 0; flags <= PATRICIA_PAGED_AIO_NO_URING; flags++) {
+        for (p = 0; p < sizeof(pools) / sizeof(pools[0]); p++) {
+            pt = patricia_paged_open(path.c_str(), pools[p], 0);
+            TEST_CHECK(pt != NULL);
+            aio = patricia_paged_aio_init(pt, 0, flags);
+            TEST_CHECK(aio != NULL);
+            TEST_CHECK(aio->depth <= pools[p] / 2);
+            TEST_CHECK(!(flags & PATRICIA_PAGED_AIO_NO_URING) ||
+                       aio->ring_fd == -1);
+            TEST_CHECK(patricia_paged_aio_lookup(aio, NULL, 0, NULL) == -1);
+            TEST_CHECK(patricia_paged_aio_lookup(aio, &empty, 0,
+                                                 &flags) == 0);
+            test_batches(aio, keys, ref, rng);
+#ifdef PATRICIA_STATS_ON
+            TEST_CHECK(aio->reads > 0);
+#endif
+            patricia_paged_aio_destroy(aio);
+            TEST_CHECK(patricia_paged_close(pt) == 0);
+        }
+    }
+
+    TEST_CHECK(patricia_paged_aio_init(NULL, 0, 0) == NULL);
+    unlink(path.c_str());
+
+    return 0;
+}
@@ -0,0 +1,267 @@
+/*
+ * test_patricia.cpp
+ *
+ * The core tree against a std::set. patricia_lookup also finds the
+ * prefixes the tree split at, and deleting such a prefix takes its subtree
+ * with it, so every key ends in '$', which no other byte is. That keeps
+ * the key set prefix-free and makes lookup and delete exact. Lookups
+ * without the '$' may only find prefixes of keys.
+ */
+
+#include <string.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia.h"
+
+static int
+test_stop (char *key, void *arg)
+{
+    (void)key;
+    return ++*(int *)arg == 3 ? 7 : 0;
+}
+
+/*
+ * test_check_nodes
+ *
+ * A children list only exists while it is not empty, and every node below
+ * the root ends a key or branches
+ */
+static void
+test_check_nodes (patricia_node_t *node)
+{
+    patricia_node_t *child;
+
+    TEST_CHECK(!node->children || !list_empty(node->children));
+    child = PATRICIA_FIRST_CHILD(node);
+    TEST_CHECK(node->key[0] == 0 || node->is_key ||
+               (child && list_get_next(node->children, child)));
+    while (child) {
+        TEST_CHECK(child->key[0] != 0);
+        test_check_nodes(child);
+        child = (patricia_node_t *)list_get_next(node->children, child);
+    }
+}
+
+/*
+ * test_tree_bytes
+ *
+ * Count the nodes under the given node and the memory they take, the way
+ * the tree's own counters do
+ */
+static void
+test_tree_bytes (patricia_node_t *node, unsigned long *nodes,
+                 unsigned long *bytes)
+{
+    patricia_node_t *child;
+
+    *nodes += 1;
+    *bytes += sizeof(patricia_node_t) + strlen(node->key) + 1;
+    if (node->children) {
+        *bytes += sizeof(list_t);
+    }
+    child = PATRICIA_FIRST_CHILD(node);
+    while (child) {
+        test_tree_bytes(child, nodes, bytes);
+        child = (patricia_node_t *)list_get_next(node->children, child);
+    }
+}
+
+/*
+ * test_check_stats
+ *
+ * The counters of the tree match its nodes
+ */
+static void
+test_check_stats (patricia_tree_t *tree)
+{
+    unsigned long nodes = 0, bytes = sizeof(patricia_tree_t);
+
+    test_tree_bytes(tree->root, &nodes, &bytes);
+    TEST_CHECK(tree->stats.total_nodes == nodes);
+    TEST_CHECK(tree->stats.total_mem == bytes);
+}
+
+/*
+ * test_check_walk
+ *
+ * Walks over the whole tree, a prefix and a range match the set
+ */
+static void
+test_check_walk (patricia_tree_t *tree, const test_set_t &ref,
+                 std::mt19937 &rng)
+{
+    std::vector<std::string> got;
+    test_set_t::const_iterator it, end;
+    std::string lo, hi;
+    size_t j;
+
+    TEST_CHECK(patricia_walk(tree, test_collect, &got) == 0);
+    TEST_CHECK(got == std::vector<std::string>(ref.begin(), ref.end()));
+
+    lo = test_random_key(rng, 3);
+    got.clear();
+    TEST_CHECK(patricia_walk_prefix(tree, &lo[0], test_collect, &got) == 0);
+    it = ref.lower_bound(lo);
+    for (j = 0; j < got.size(); j++, ++it) {
+        TEST_CHECK(it != ref.end() && got[j] == *it);
+    }
+    TEST_CHECK(it == ref.end() || it->compare(0, lo.size(), lo) != 0);
+
+    hi = test_random_key(rng, 3);
+    if (hi < lo) {
+        lo.swap(hi);
+    }
+    got.clear();
+    TEST_CHECK(patricia_walk_range(tree, &lo[0], &hi[0], test_collect,
+                                   &got) == 0);
+    end = ref.lower_bound(hi);
+    TEST_CHECK(got == std::vector<std::string>(ref.lower_bound(lo), end));
+}
+
+/*
+ * test_prefix_keys
+ *
+ * Keys without the '$', so that many are prefixes of others. Deleting a
+ * key takes the keys it is a prefix of with it, and must leave every
+ * other key, the shorter ones included, in place.
+ */
+static void
+test_prefix_keys (std::mt19937 &rng)
+{
+    patricia_tree_t *tree;
+    test_set_t ref, leaves;
+    test_set_t::iterator it;
+    std::vector<std::string> got;
+    std::string key;
+    int i;
+
+    tree = patricia_init();
+    TEST_CHECK(tree != NULL);
+
+    /* The cases that once lost "ab" */
+    key = "ab";
+    TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+    key = "abc";
+    TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+    TEST_CHECK(patricia_delete(tree, &key[0]) == 0);
+    TEST_CHECK(patricia_lookup(tree, (char *)"ab") == 1);
+    key = "abc";
+    TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+    key = "abd";
+    TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+    TEST_CHECK(patricia_delete(tree, &key[0]) == 0);
+    TEST_CHECK(patricia_lookup(tree, (char *)"ab") == 1);
+    TEST_CHECK(patricia_lookup(tree, (char *)"abc") == 1);
+    TEST_CHECK(patricia_lookup(tree, (char *)"abd") == 0);
+    ref.insert("ab");
+    ref.insert("abc");
+
+    for (i = 0; i < 20000; i++) {
+        key = test_random_key(rng, 6);
+        if (key.empty()) {
+            continue;
+        }
+        if (rng() % 3) {
+            TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+            ref.insert(key);
+        } else if (ref.count(key)) {
+            TEST_CHECK(patricia_delete(tree, &key[0]) == 0);
+            it = ref.lower_bound(key);
+            while (it != ref.end() && it->compare(0, key.size(), key) == 0) {
+                it = ref.erase(it);
+            }
+        }
+        if (i % 500 == 0) {
+            test_check_nodes(tree->root);
+            for (it = ref.begin(); it != ref.end(); ++it) {
+                key = *it;
+                TEST_CHECK(patricia_lookup(tree, &key[0]) == 1);
+            }
+            leaves = test_leaves(ref);
+            got.clear();
+            TEST_CHECK(patricia_walk(tree, test_collect, &got) == 0);
+            TEST_CHECK(got ==
+                       std::vector<std::string>(leaves.begin(), leaves.end()));
+        }
+    }
+
+    TEST_CHECK(patricia_destroy(tree) == 0);
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_tree_t *tree;
+    test_set_t ref;
+    test_set_t::iterator it;
+    std::string key;
+    unsigned long count;
+    int i, calls;
+
+    tree = patricia_init();
+    TEST_CHECK(tree != NULL);
+
+    for (i = 0; i < 20000; i++) {
+        key = test_random_key(rng, 7) + "$";
+        switch (rng() % 4) {
+        case 0:
+        case 1:
+            TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+            ref.insert(key);
+            break;
+        case 2:
+            if (ref.erase(key)) {
+                TEST_CHECK(patricia_delete(tree, &key[0]) == 0);
+            } else {
+                patricia_delete(tree, &key[0]);
+            }
+            break;
+        default:
+            TEST_CHECK(patricia_lookup(tree, &key[0]) == (int)ref.count(key));
+            key.resize(rng() % key.size());
+            if (patricia_lookup(tree, &key[0])) {
+                it = ref.lower_bound(key);
+                TEST_CHECK(it != ref.end() &&
+                           it->compare(0, key.size(), key) == 0);
+            }
+            break;
+        }
+        if (i % 500 == 0) {
+            test_check_nodes(tree->root);
+            test_check_stats(tree);
+            test_check_walk(tree, ref, rng);
+        }
+    }
+    test_check_nodes(tree->root);
+    test_check_walk(tree, ref, rng);
+
+    count = 0;
+    patricia_get_key_count(tree->root, &count);
+    TEST_CHECK(count == ref.size());
+
+    calls = 0;
+    TEST_CHECK(patricia_walk(tree, test_stop, &calls) == 7 && calls == 3);
+
+    /* Emptied, the root is a leaf again and the tree still works */
+    for (it = ref.begin(); it != ref.end(); ++it) {
+        key = *it;
+        TEST_CHECK(patricia_delete(tree, &key[0]) == 0);
+    }
+    TEST_CHECK(PATRICIA_IS_LEAF(tree->root) && !tree->root->children);
+    TEST_CHECK(tree->stats.total_nodes == 1);
+    test_check_stats(tree);
+    ref.clear();
+    test_check_walk(tree, ref, rng);
+    key = "abc$";
+    TEST_CHECK(patricia_add(tree, &key[0]) == 0 &&
+               patricia_lookup(tree, &key[0]) == 1);
+
+    TEST_CHECK(patricia_destroy(tree) == 0);
+
+    test_prefix_keys(rng);
+
+    return 0;
+}
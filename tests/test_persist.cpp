@@ -0,0 +1,197 @@
+/*
+ * test_persist.cpp
+ *
+ * The persistent tree against a std::map from key to data: random adds,
+ * replaces and deletes, with snapshots taken along the way that must keep
+ * showing the keys of their point in time. A reader thread scans a
+ * snapshot while the writer keeps going. Once everything is released no
+ * node may be left.
+ */
+
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "test.h"
+#include "patricia_persist.h"
+
+typedef std::map<std::string, uintptr_t> test_map_t;
+typedef std::vector<std::pair<std::string, uintptr_t>> test_pairs_t;
+
+typedef struct test_scan_s {
+    patricia_pt_node_t  *root;
+    test_pairs_t        expect;
+    int                 *stop;
+    unsigned long       scans;
+    int                 failed;
+} test_scan_t;
+
+static int
+test_collect (const char *key, int len, void *data, void *arg)
+{
+    ((test_pairs_t *)arg)->push_back(std::make_pair(std::string(key, len),
+                                                    (uintptr_t)data));
+    return 0;
+}
+
+static int
+test_stop (const char *key, int len, void *data, void *arg)
+{
+    (void)key;
+    (void)len;
+    (void)data;
+    return ++*(int *)arg == 2 ? 3 : 0;
+}
+
+/*
+ * test_check
+ *
+ * The version under root holds exactly the pairs of ref
+ */
+static void
+test_check (patricia_pt_node_t *root, const test_map_t &ref,
+            std::mt19937 &rng)
+{
+    test_map_t::const_iterator it;
+    test_pairs_t got;
+    std::string prefix;
+    void *data;
+    size_t j;
+    int i;
+
+    TEST_CHECK(patricia_pt_walk(root, "", test_collect, &got) == 0);
+    TEST_CHECK(got == test_pairs_t(ref.begin(), ref.end()));
+    TEST_CHECK((root ? root->keys : 0) == ref.size());
+
+    for (i = 0; i < 100; i++) {
+        prefix = test_random_key(rng, 3);
+        got.clear();
+        TEST_CHECK(patricia_pt_walk(root, prefix.c_str(), test_collect,
+                                    &got) == 0);
+        it = ref.lower_bound(prefix);
+        for (j = 0; j < got.size(); j++, ++it) {
+            TEST_CHECK(it != ref.end() && got[j].first == it->first &&
+                       got[j].second == it->second);
+        }
+        TEST_CHECK(it == ref.end() ||
+                   it->first.compare(0, prefix.size(), prefix) != 0);
+
+        prefix = test_random_key(rng, 6);
+        data = NULL;
+        it = ref.find(prefix);
+        TEST_CHECK(patricia_pt_lookup(root, prefix.c_str(), &data) ==
+                   (it != ref.end()));
+        TEST_CHECK(it == ref.end() || (uintptr_t)data == it->second);
+    }
+}
+
+static void *
+test_scanner (void *arg)
+{
+    test_scan_t *scan = (test_scan_t *)arg;
+    test_pairs_t got;
+
+    while (!__atomic_load_n(scan->stop, __ATOMIC_ACQUIRE) ||
+           scan->scans == 0) {
+        got.clear();
+        patricia_pt_walk(scan->root, "", test_collect, &got);
+        if (got != scan->expect) {
+            scan->failed = 1;
+        }
+        scan->scans++;
+    }
+
+    return NULL;
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    std::vector<patricia_pt_node_t *> snaps;
+    std::vector<test_map_t> snap_refs;
+    patricia_pt_stats_t stats;
+    patricia_pt_tree_t *tree;
+    test_scan_t scan;
+    pthread_t thread;
+    test_map_t ref;
+    std::string key;
+    void *data;
+    size_t s;
+    int i, stop = 0, calls;
+
+    tree = patricia_pt_init();
+    TEST_CHECK(tree != NULL);
+    TEST_CHECK(patricia_pt_snapshot(tree) == NULL);
+
+    for (i = 0; i < 30000; i++) {
+        key = test_random_key(rng, 7);
+        if (rng() % 3) {
+            TEST_CHECK(patricia_pt_add(tree, key.c_str(),
+                                       (void *)(uintptr_t)(i + 1)) == 0);
+            ref[key] = i + 1;
+        } else {
+            data = NULL;
+            if (ref.count(key)) {
+                TEST_CHECK(patricia_pt_delete(tree, key.c_str(), &data) == 0);
+                TEST_CHECK((uintptr_t)data == ref[key]);
+                ref.erase(key);
+            } else {
+                TEST_CHECK(patricia_pt_delete(tree, key.c_str(), &data) ==
+                           -1);
+            }
+        }
+        TEST_CHECK(tree->count == ref.size());
+
+        /* Snapshots of the history, every one is checked at the end */
+        if (i % 3000 == 1500) {
+            snaps.push_back(patricia_pt_snapshot(tree));
+            snap_refs.push_back(ref);
+            test_check(tree->root, ref, rng);
+        }
+    }
+    test_check(tree->root, ref, rng);
+    for (s = 0; s < snaps.size(); s++) {
+        test_check(snaps[s], snap_refs[s], rng);
+    }
+
+    calls = 0;
+    TEST_CHECK(patricia_pt_walk(tree->root, "", test_stop, &calls) == 3);
+    TEST_CHECK(calls == 2);
+
+    /* A scan of a snapshot sees it whole while the writer goes on */
+    scan.root = patricia_pt_snapshot(tree);
+    scan.expect = test_pairs_t(ref.begin(), ref.end());
+    scan.stop = &stop;
+    scan.scans = 0;
+    scan.failed = 0;
+    TEST_CHECK(pthread_create(&thread, NULL, test_scanner, &scan) == 0);
+    for (i = 0; i < 20000; i++) {
+        key = test_random_key(rng, 7);
+        if (rng() % 2) {
+            patricia_pt_add(tree, key.c_str(), (void *)(uintptr_t)i);
+        } else {
+            patricia_pt_delete(tree, key.c_str(), NULL);
+        }
+    }
+    __atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+    TEST_CHECK(pthread_join(thread, NULL) == 0);
+    TEST_CHECK(!scan.failed && scan.scans > 0);
+
+    /* The tree goes first, the snapshots keep their nodes alive */
+    TEST_CHECK(patricia_pt_destroy(tree) == 0);
+    test_check(scan.root, ref, rng);
+    patricia_pt_release(scan.root);
+    for (s = 0; s < snaps.size(); s++) {
+        test_check(snaps[s], snap_refs[s], rng);
+        patricia_pt_release(snaps[s]);
+    }
+
+#ifdef PATRICIA_STATS_ON
+    patricia_pt_get_stats(&stats);
+    TEST_CHECK(stats.total_nodes == 0 && stats.total_mem == 0);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * test_route.cpp
+ *
+ * Random route adds and deletes against a std::map of masked prefixes.
+ * Every longest prefix match is checked against a search of the map from
+ * the longest length down, for IPv4 with and without the direct index and
+ * for IPv6. The slots the direct index answers alone are checked too.
+ */
+
+#include <string.h>
+#include <map>
+#include <string>
+#include "test.h"
+#include "patricia_route.h"
+
+typedef std::map<std::pair<std::string, uint32_t>, void *> test_routes_t;
+
+/*
+ * test_mask
+ *
+ * The first len bits of addr, the rest cleared
+ */
+static std::string
+test_mask (const uint8_t *addr, size_t addrlen, uint32_t len)
+{
+    std::string s((const char *)addr, addrlen);
+    uint32_t i;
+
+    for (i = len; i < addrlen * 8; i++) {
+        s[i / 8] &= ~(0x80 >> (i % 8));
+    }
+
+    return s;
+}
+
+/*
+ * test_best
+ *
+ * Longest prefix match in the reference
+ */
+static int
+test_best (test_routes_t &ref, const uint8_t *addr, size_t addrlen,
+           void **data)
+{
+    test_routes_t::iterator it;
+    int len;
+
+    for (len = addrlen * 8; len >= 0; len--) {
+        it = ref.find(std::make_pair(test_mask(addr, addrlen, len), len));
+        if (it != ref.end()) {
+            *data = it->second;
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * test_random_addr
+ *
+ * An address from a few dense regions, so that routes nest and overlap
+ */
+static void
+test_random_addr (std::mt19937 &rng, uint8_t *addr, size_t addrlen)
+{
+    static const uint8_t first[] = { 10, 172, 192, 0x20 };
+    size_t i;
+
+    for (i = 0; i < addrlen; i++) {
+        addr[i] = rng();
+    }
+    addr[0] = first[rng() % 4];
+    addr[1] = rng() % 4;
+    if (rng() % 2) {
+        addr[2] = rng() % 8;
+    }
+}
+
+static void
+test_table (size_t addrlen, int flags)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_rt_tree_t *tree;
+    uint8_t addr[PATRICIA_RT_MAX_ADDRLEN];
+    test_routes_t ref;
+    std::pair<std::string, uint32_t> route;
+    void *data, *want;
+    uint32_t len;
+    int i, op, found, longer;
+
+    tree = patricia_rt_init(addrlen, flags);
+    TEST_CHECK(tree);
+
+    for (i = 0; i < 40000; i++) {
+        test_random_addr(rng, addr, addrlen);
+
+        /* Mostly lengths around the /16 boundary of the direct index */
+        len = (rng() % 4) ? 8 + rng() % 17 : rng() % (addrlen * 8 + 1);
+        route = std::make_pair(test_mask(addr, addrlen, len), len);
+
+        op = rng() % 4;
+        if (op == 0) {
+            data = (void *)(uintptr_t)(i + 1);
+            TEST_CHECK(patricia_rt_add(tree, addr, len, data) == 0);
+            ref[route] = data;
+        } else if (op == 1) {
+            data = NULL;
+            TEST_CHECK(patricia_rt_delete(tree, addr, len, &data) ==
+                       (ref.count(route) ? 0 : -1));
+            if (ref.count(route)) {
+                TEST_CHECK(data == ref[route]);
+                ref.erase(route);
+            }
+        } else if (op == 2) {
+            data = NULL;
+            TEST_CHECK(patricia_rt_lookup_exact(tree, addr, len, &data) ==
+                       (int)ref.count(route));
+            TEST_CHECK(!ref.count(route) || data == ref[route]);
+        } else {
+            data = want = NULL;
+            found = test_best(ref, addr, addrlen, &want);
+            TEST_CHECK(patricia_rt_lookup(tree, addr, &data) == found);
+            TEST_CHECK(!found || data == want);
+        }
+        TEST_CHECK(tree->count == ref.size());
+    }
+
+    /* The direct index alone answers where no route is longer than /16 */
+    for (i = 0; i < 2000; i++) {
+        test_random_addr(rng, addr, addrlen);
+        longer = 0;
+        for (const auto &r : ref) {
+            longer |= r.first.second > PATRICIA_RT_ACCEL_BITS &&
+                      r.first.first.compare(0, 2, (const char *)addr, 2) == 0;
+        }
+        TEST_CHECK(patricia_rt_accel_hit(tree, addr) ==
+                   ((flags & PATRICIA_RT_ACCEL) && !longer));
+    }
+
+    TEST_CHECK(patricia_rt_destroy(tree) == 0);
+}
+
+int
+main (void)
+{
+    uint8_t addr[PATRICIA_RT_MAX_ADDRLEN];
+    uint32_t len;
+
+    TEST_CHECK(patricia_rt_parse("10.1.0.0/16", addr, &len) == 4);
+    TEST_CHECK(len == 16 && addr[0] == 10 && addr[1] == 1);
+    TEST_CHECK(patricia_rt_parse("192.168.1.1", addr, &len) == 4);
+    TEST_CHECK(len == 32);
+    TEST_CHECK(patricia_rt_parse("2001:db8::/32", addr, &len) == 16);
+    TEST_CHECK(len == 32 && addr[0] == 0x20 && addr[1] == 0x01);
+    TEST_CHECK(patricia_rt_parse("10.0.0.0/33", addr, &len) == -1);
+    TEST_CHECK(patricia_rt_parse("not an address", addr, &len) == -1);
+
+    test_table(PATRICIA_RT_IPV4_ADDRLEN, 0);
+    test_table(PATRICIA_RT_IPV4_ADDRLEN, PATRICIA_RT_ACCEL);
+    test_table(PATRICIA_RT_IPV6_ADDRLEN, 0);
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+/*
+ * test_setop.cpp
+ *
+ * Union, intersection and difference of persistent trees against the same
+ * operations on std::maps, for independent trees and for trees that share
+ * nodes through a clone.
+ */
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "test.h"
+#include "patricia_persist.h"
+
+#define TEST_ROUNDS 50
+
+typedef std::map<std::string, uintptr_t> test_map_t;
+typedef std::vector<std::pair<std::string, uintptr_t>> test_pairs_t;
+
+static int
+test_collect (const char *key, int len, void *data, void *arg)
+{
+    ((test_pairs_t *)arg)->push_back(std::make_pair(std::string(key, len),
+                                                    (uintptr_t)data));
+    return 0;
+}
+
+static void
+test_check (patricia_pt_tree_t *tree, const test_map_t &ref)
+{
+    test_pairs_t got;
+    void *data;
+
+    TEST_CHECK(tree != NULL);
+    TEST_CHECK(tree->count == ref.size());
+    TEST_CHECK(patricia_pt_walk(tree->root, "", test_collect, &got) == 0);
+    TEST_CHECK(got == test_pairs_t(ref.begin(), ref.end()));
+    for (const auto &kv : ref) {
+        TEST_CHECK(patricia_pt_lookup(tree->root, kv.first.c_str(),
+                                      &data) == 1);
+    }
+}
+
+static void
+test_edit (patricia_pt_tree_t *tree, test_map_t &ref, std::mt19937 &rng,
+           int n)
+{
+    std::string key;
+    uintptr_t data;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        key = test_random_key(rng, 5);
+        if (rng() % 4) {
+            data = rng();
+            TEST_CHECK(patricia_pt_add(tree, key.c_str(),
+                                       (void *)data) == 0);
+            ref[key] = data;
+        } else {
+            patricia_pt_delete(tree, key.c_str(), NULL);
+            ref.erase(key);
+        }
+    }
+}
+
+/*
+ * test_setops
+ *
+ * The three operations on a and b, and the union of the results, which
+ * must give back a. The inputs are destroyed before the results are
+ * checked, so the results must hold their own references.
+ */
+static void
+test_setops (patricia_pt_tree_t *a, const test_map_t &ra,
+             patricia_pt_tree_t *b, const test_map_t &rb)
+{
+    patricia_pt_tree_t *u, *in, *diff, *back;
+    test_map_t ru, rin, rdiff;
+
+    u = patricia_pt_union(a, b);
+    in = patricia_pt_intersect(a, b);
+    diff = patricia_pt_difference(a, b);
+    back = patricia_pt_union(diff, in);
+    patricia_pt_destroy(a);
+    patricia_pt_destroy(b);
+
+    ru = rb;
+    for (const auto &kv : ra) {
+        ru[kv.first] = kv.second;
+        if (rb.count(kv.first)) {
+            rin.insert(kv);
+        } else {
+            rdiff.insert(kv);
+        }
+    }
+    test_check(u, ru);
+    test_check(in, rin);
+    test_check(diff, rdiff);
+    test_check(back, ra);
+
+    patricia_pt_destroy(u);
+    patricia_pt_destroy(in);
+    patricia_pt_destroy(diff);
+    patricia_pt_destroy(back);
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_pt_tree_t *a, *b, *empty;
+    test_map_t ra, rb;
+    patricia_pt_stats_t stats;
+    int round;
+
+    for (round = 0; round < TEST_ROUNDS; round++) {
+        ra.clear();
+        rb.clear();
+        a = patricia_pt_init();
+        TEST_CHECK(a != NULL);
+        test_edit(a, ra, rng, rng() % 1000);
+        if (round % 2) {
+            /* b shares most of a's nodes */
+            b = patricia_pt_clone(a);
+            rb = ra;
+            test_edit(b, rb, rng, rng() % 100);
+        } else {
+            b = patricia_pt_init();
+            test_edit(b, rb, rng, rng() % 1000);
+        }
+        test_setops(a, ra, b, rb);
+    }
+
+    /* With an empty tree on either side, and with itself */
+    ra.clear();
+    a = patricia_pt_init();
+    test_edit(a, ra, rng, 500);
+    empty = patricia_pt_init();
+    test_setops(patricia_pt_clone(a), ra, patricia_pt_clone(empty),
+                test_map_t());
+    test_setops(patricia_pt_clone(empty), test_map_t(),
+                patricia_pt_clone(a), ra);
+    test_setops(patricia_pt_clone(a), ra, patricia_pt_clone(a), ra);
+    patricia_pt_destroy(a);
+    patricia_pt_destroy(empty);
+
+    TEST_CHECK(patricia_pt_union(NULL, NULL) == NULL);
+    TEST_CHECK(patricia_pt_intersect(NULL, NULL) == NULL);
+    TEST_CHECK(patricia_pt_difference(NULL, NULL) == NULL);
+
+#ifdef PATRICIA_STATS_ON
+    patricia_pt_get_stats(&stats);
+    TEST_CHECK(stats.total_nodes == 0 && stats.total_mem == 0);
+#endif
+
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * test_shard.cpp
+ *
+ * The sharded tree against a std::set in both partitioning modes: random
+ * updates and lookups, ordered prefix walks merged across shards, keys
+ * kept in the shard their first byte maps to, and writers on several
+ * threads at once. Keys end in '$' to make lookup and delete exact, see
+ * test_patricia.cpp.
+ */
+
+#include <pthread.h>
+#include <set>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_shard.h"
+
+#define TEST_WRITERS    4
+#define TEST_PER_WRITER 3000
+
+typedef struct test_writer_s {
+    patricia_shard_tree_t   *st;
+    int                     id;
+    int                     failed;
+} test_writer_t;
+
+static int
+test_stop (char *key, void *arg)
+{
+    (void)key;
+    return ++*(int *)arg == 4 ? 9 : 0;
+}
+
+static void
+test_check_walk (patricia_shard_tree_t *st, const test_set_t &ref,
+                 const std::string &prefix)
+{
+    std::vector<std::string> got;
+    test_set_t::const_iterator it;
+    size_t j;
+
+    TEST_CHECK(patricia_shard_walk(st, prefix.c_str(), test_collect,
+                                   &got) == 0);
+    it = ref.lower_bound(prefix);
+    for (j = 0; j < got.size(); j++, ++it) {
+        TEST_CHECK(it != ref.end() && got[j] == *it);
+    }
+    TEST_CHECK(it == ref.end() || it->compare(0, prefix.size(), prefix) != 0);
+}
+
+static void
+test_mode (uint32_t count, uint32_t mode, const char *bounds)
+{
+    std::mt19937 rng(TEST_SEED + count + mode);
+    std::vector<std::string> got;
+    patricia_shard_tree_t *st;
+    unsigned long adds = 0, deletes = 0;
+    test_set_t ref;
+    std::string key;
+    uint32_t s;
+    int i, calls;
+
+    st = patricia_shard_init(count, mode);
+    TEST_CHECK(st != NULL);
+    if (bounds) {
+        TEST_CHECK(patricia_shard_set_bounds(st, bounds) == 0);
+    }
+
+    for (i = 0; i < 20000; i++) {
+        key = test_random_key(rng, 6, "abcdxyz/.") + "$";
+        switch (rng() % 4) {
+        case 0:
+        case 1:
+            TEST_CHECK(patricia_shard_add(st, &key[0]) == 0);
+            ref.insert(key);
+            adds++;
+            break;
+        case 2:
+            if (ref.erase(key)) {
+                TEST_CHECK(patricia_shard_delete(st, &key[0]) == 0);
+                deletes++;
+            } else {
+                TEST_CHECK(patricia_shard_delete(st, &key[0]) == -1);
+            }
+            break;
+        default:
+            TEST_CHECK(patricia_shard_lookup(st, &key[0]) ==
+                       (int)ref.count(key));
+            break;
+        }
+    }
+
+    test_check_walk(st, ref, "");
+    for (i = 0; i < 300; i++) {
+        test_check_walk(st, ref, test_random_key(rng, 3, "abcdxyz/."));
+    }
+    calls = 0;
+    TEST_CHECK(patricia_shard_walk(st, "", test_stop, &calls) == 9);
+    TEST_CHECK(calls == 4);
+
+    /*
+     * Every shard only holds keys that map to it, and counts only the
+     * changes that took
+     */
+    for (s = 0; s < st->count; s++) {
+        got.clear();
+        TEST_CHECK(patricia_walk(st->shard[s]->tree, test_collect,
+                                 &got) == 0);
+        for (const std::string &k : got) {
+            if (mode == PATRICIA_SHARD_PREFIX) {
+                TEST_CHECK(st->map[(unsigned char)k[0]] == s);
+            }
+        }
+        adds -= st->shard[s]->adds;
+        deletes -= st->shard[s]->deletes;
+    }
+    TEST_CHECK(adds == 0 && deletes == 0);
+
+    TEST_CHECK(patricia_shard_destroy(st) == 0);
+}
+
+static void *
+test_writer (void *arg)
+{
+    test_writer_t *w = (test_writer_t *)arg;
+    std::string key;
+    int i;
+
+    for (i = 0; i < TEST_PER_WRITER; i++) {
+        key = std::to_string(i) + "/" + std::to_string(w->id) + "$";
+        if (patricia_shard_add(w->st, &key[0]) != 0 ||
+            patricia_shard_lookup(w->st, &key[0]) != 1) {
+            w->failed = 1;
+        }
+        if (i % 3 == 0 && patricia_shard_delete(w->st, &key[0]) != 0) {
+            w->failed = 1;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+test_threads (uint32_t mode)
+{
+    test_writer_t writers[TEST_WRITERS];
+    pthread_t threads[TEST_WRITERS];
+    patricia_shard_tree_t *st;
+    test_set_t ref;
+    int i, j;
+
+    st = patricia_shard_init(8, mode);
+    TEST_CHECK(st != NULL);
+    for (i = 0; i < TEST_WRITERS; i++) {
+        writers[i].st = st;
+        writers[i].id = i;
+        writers[i].failed = 0;
+        TEST_CHECK(pthread_create(&threads[i], NULL, test_writer,
+                                  &writers[i]) == 0);
+        for (j = 0; j < TEST_PER_WRITER; j++) {
+            if (j % 3) {
+                ref.insert(std::to_string(j) + "/" + std::to_string(i) +
+                           "$");
+            }
+        }
+    }
+    for (i = 0; i < TEST_WRITERS; i++) {
+        TEST_CHECK(pthread_join(threads[i], NULL) == 0);
+        TEST_CHECK(!writers[i].failed);
+    }
+
+    test_check_walk(st, ref, "");
+    test_check_walk(st, ref, "12");
+    TEST_CHECK(patricia_shard_destroy(st) == 0);
+}
+
+int
+main (void)
+{
+    test_mode(1, PATRICIA_SHARD_HASH, NULL);
+    test_mode(7, PATRICIA_SHARD_HASH, NULL);
+    test_mode(PATRICIA_SHARD_DEFAULT, PATRICIA_SHARD_PREFIX, NULL);
+    test_mode(3, PATRICIA_SHARD_PREFIX, "by");
+
+    test_threads(PATRICIA_SHARD_HASH);
+    test_threads(PATRICIA_SHARD_PREFIX);
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+/*
+ * test_shm.cpp
+ *
+ * The shared memory tree against a std::set: a writer makes random adds
+ * and deletes while a reader attached to the same segment looks the keys
+ * up, in this process and in a forked one. Also covers a full segment, a
+ * reader that tries to write, a bad header and unlinking.
+ */
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <set>
+#include <string>
+#include "test.h"
+#include "patricia_shm.h"
+
+#define TEST_SHM_SIZE   (1 << 20)
+
+static void
+test_check (patricia_shm_t *shm, const test_set_t &ref, std::mt19937 &rng)
+{
+    std::string key;
+    int i;
+
+    for (const auto &k : ref) {
+        TEST_CHECK(patricia_shm_lookup(shm, k.c_str()) == 1);
+    }
+    for (i = 0; i < 1000; i++) {
+        key = test_random_key(rng, 8);
+        TEST_CHECK(patricia_shm_lookup(shm, key.c_str()) ==
+                   (int)ref.count(key));
+    }
+}
+
+static void
+test_edit (patricia_shm_t *shm, test_set_t &ref, std::mt19937 &rng, int n)
+{
+    std::string key;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        key = test_random_key(rng, 8);
+        if (rng() % 3) {
+            TEST_CHECK(patricia_shm_add(shm, key.c_str()) == 0);
+            ref.insert(key);
+        } else if (ref.erase(key)) {
+            TEST_CHECK(patricia_shm_delete(shm, key.c_str()) == 0);
+        }
+    }
+}
+
+/*
+ * test_reader
+ *
+ * In a forked process, look up the keys that are never deleted while the
+ * parent changes the rest, until the parent closes the pipe
+ */
+static int
+test_reader (const char *name, const test_set_t &stable, int fd)
+{
+    patricia_shm_t *shm;
+    char c;
+
+    shm = patricia_shm_attach(name);
+    if (!shm) {
+        return 1;
+    }
+    do {
+        for (const auto &k : stable) {
+            if (patricia_shm_lookup(shm, k.c_str()) != 1) {
+                return 1;
+            }
+        }
+    } while (read(fd, &c, 1) > 0);
+    patricia_shm_detach(shm);
+
+    return 0;
+}
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    patricia_shm_t *writer, *reader;
+    patricia_tree_t *tree;
+    test_set_t ref, stable;
+    std::string key, name;
+    int round, status, fds[2], fd;
+    pid_t pid;
+
+    name = "/patricia_test_shm_" + std::to_string(getpid());
+    patricia_shm_unlink(name.c_str());
+
+    /* The segment starts with the keys of a core tree */
+    tree = patricia_init();
+    TEST_CHECK(tree != NULL);
+    while (ref.size() < 200) {
+        key = "#" + test_random_key(rng, 8) + "$";
+        ref.insert(key);
+        TEST_CHECK(patricia_add(tree, &key[0]) == 0);
+    }
+    stable = ref;
+    writer = patricia_shm_create(name.c_str(), TEST_SHM_SIZE, tree);
+    TEST_CHECK(writer != NULL);
+    TEST_CHECK(patricia_shm_create(name.c_str(), TEST_SHM_SIZE, NULL) ==
+               NULL);
+    patricia_destroy(tree);
+
+    reader = patricia_shm_attach(name.c_str());
+    TEST_CHECK(reader != NULL);
+    TEST_CHECK(patricia_shm_add(reader, "a") == -1);
+    TEST_CHECK(patricia_shm_delete(reader, ref.begin()->c_str()) == -1);
+    test_check(reader, ref, rng);
+
+    /* Changes by the writer show in the reader at once */
+    for (round = 0; round < 20; round++) {
+        test_edit(writer, ref, rng, 500);
+        test_check(reader, ref, rng);
+        test_check(writer, ref, rng);
+    }
+
+    /* A forked reader keeps finding the stable keys during changes */
+    TEST_CHECK(pipe(fds) == 0);
+    pid = fork();
+    TEST_CHECK(pid >= 0);
+    if (pid == 0) {
+        close(fds[1]);
+        _exit(test_reader(name.c_str(), stable, fds[0]));
+    }
+    close(fds[0]);
+    for (round = 0; round < 50; round++) {
+        test_edit(writer, ref, rng, 500);
+        TEST_CHECK(write(fds[1], "", 1) == 1);
+    }
+    close(fds[1]);
+    TEST_CHECK(waitpid(pid, &status, 0) == pid);
+    TEST_CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    test_check(reader, ref, rng);
+
+    /* Once unlinked, nobody else can attach, the mappings stay */
+    TEST_CHECK(patricia_shm_unlink(name.c_str()) == 0);
+    TEST_CHECK(patricia_shm_attach(name.c_str()) == NULL);
+    test_check(reader, ref, rng);
+    TEST_CHECK(patricia_shm_detach(reader) == 0);
+    TEST_CHECK(patricia_shm_detach(writer) == 0);
+
+    /* A full segment fails the add and keeps the keys it has */
+    ref.clear();
+    writer = patricia_shm_create(name.c_str(), 8192, NULL);
+    TEST_CHECK(writer != NULL);
+    for (round = 0; round < 100000; round++) {
+        key = test_random_key(rng, 16, "abcdefghijklmnop");
+        if (patricia_shm_add(writer, key.c_str()) != 0) {
+            break;
+        }
+        ref.insert(key);
+    }
+    TEST_CHECK(round < 100000);
+    test_check(writer, ref, rng);
+    TEST_CHECK(patricia_shm_detach(writer) == 0);
+
+    /* A segment with a bad header is refused */
+    fd = shm_open(name.c_str(), O_RDWR, 0);
+    TEST_CHECK(fd >= 0);
+    TEST_CHECK(pwrite(fd, "XXXX", 4, 0) == 4);
+    close(fd);
+    TEST_CHECK(patricia_shm_attach(name.c_str()) == NULL);
+    TEST_CHECK(patricia_shm_unlink(name.c_str()) == 0);
+    TEST_CHECK(patricia_shm_create(name.c_str(), 16, NULL) == NULL);
+    TEST_CHECK(patricia_shm_attach(name.c_str()) == NULL);
+
+    return 0;
+}
@@ -0,0 +1,93 @@
+/*
+ * test_static.cpp
+ *
+ * patricia::StaticSet against a std::map of the same keywords. Some of
+ * the keywords are prefixes of others, two share a long run of bytes, and
+ * the lookups include their truncations, extensions, single byte changes
+ * and random strings.
+ */
+
+#include <map>
+#include <string>
+#include "test.h"
+#include "patricia_static.h"
+
+static constexpr char kw_do[] = "do";
+static constexpr char kw_double[] = "double";
+static constexpr char kw_if[] = "if";
+static constexpr char kw_in[] = "in";
+static constexpr char kw_int[] = "int";
+static constexpr char kw_inline[] = "inline";
+static constexpr char kw_a[] = "a";
+static constexpr char kw_hi[] = "\xff\x80";
+static constexpr char kw_assert[] = "static_assert";
+static constexpr char kw_cast[] = "static_cast";
+
+typedef patricia::StaticSet<patricia::literal_of<kw_do>,
+                            patricia::literal_of<kw_double>,
+                            patricia::literal_of<kw_if>,
+                            patricia::literal_of<kw_in>,
+                            patricia::literal_of<kw_int>,
+                            patricia::literal_of<kw_inline>,
+                            patricia::literal_of<kw_a>,
+                            patricia::literal_of<kw_hi>,
+                            patricia::literal_of<kw_assert>,
+                            patricia::literal_of<kw_cast>> test_kw_t;
+
+static const char *test_keywords[] = {
+    kw_do, kw_double, kw_if, kw_in, kw_int, kw_inline, kw_a, kw_hi,
+    kw_assert, kw_cast,
+};
+
+#define TEST_KEYWORDS   (sizeof(test_keywords) / sizeof(test_keywords[0]))
+
+int
+main (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    std::map<std::string, int> ref;
+    std::string key;
+    size_t i, j;
+
+    static_assert(test_kw_t::size == TEST_KEYWORDS, "size");
+    static_assert(test_kw_t::min_len == 1 && test_kw_t::max_len == 13,
+                  "lengths");
+
+    for (i = 0; i < TEST_KEYWORDS; i++) {
+        ref[test_keywords[i]] = (int)i;
+    }
+
+    /* Every keyword, every truncation and extension, every changed byte */
+    for (i = 0; i < TEST_KEYWORDS; i++) {
+        key = test_keywords[i];
+        TEST_CHECK(test_kw_t::lookup(key) == (int)i);
+        TEST_CHECK(test_kw_t::contains(key));
+        for (j = 0; j <= key.size(); j++) {
+            std::string part = key.substr(0, j);
+            TEST_CHECK(test_kw_t::lookup(part) ==
+                       (ref.count(part) ? ref[part] : -1));
+            part = key + (char)('a' + j);
+            TEST_CHECK(test_kw_t::lookup(part) ==
+                       (ref.count(part) ? ref[part] : -1));
+            if (j < key.size()) {
+                part = key;
+                part[j] ^= 1;
+                TEST_CHECK(test_kw_t::lookup(part) ==
+                           (ref.count(part) ? ref[part] : -1));
+            }
+        }
+    }
+
+    /* Random strings over the keyword bytes */
+    for (i = 0; i < 200000; i++) {
+        key = test_random_key(rng, 7, "abdefilnotu");
+        TEST_CHECK(test_kw_t::lookup(key.data(), key.size()) ==
+                   (ref.count(key) ? ref[key] : -1));
+    }
+
+    /* Only len bytes are looked at */
+    TEST_CHECK(test_kw_t::lookup("intx", 3) == 4);
+    TEST_CHECK(test_kw_t::lookup("in", 1) == -1);
+
+    return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ * test_tree.cpp
+ *
+ * patricia::Tree against a std::map: random inserts, assignments and
+ * erases, ordered iteration, prefix ranges, move-only values, and moves
+ * between trees with allocators that do and do not propagate.
+ */
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include "test.h"
+#include "patricia_tree.h"
+
+/*
+ * A stateful allocator that does not propagate on move assignment. Trees
+ * using different ids cannot take over each other's nodes.
+ */
+template <typename T>
+struct test_alloc {
+    using value_type = T;
+    using propagate_on_container_move_assignment = std::false_type;
+    using is_always_equal = std::false_type;
+
+    int id;
+
+    test_alloc (int i = 0) : id(i) {}
+    template <typename U> test_alloc (const test_alloc<U> &o) : id(o.id) {}
+
+    T *allocate (std::size_t n) { return std::allocator<T>().allocate(n); }
+    void deallocate (T *p, std::size_t n)
+    {
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    template <typename U> bool operator== (const test_alloc<U> &o) const
+    {
+        return id == o.id;
+    }
+    template <typename U> bool operator!= (const test_alloc<U> &o) const
+    {
+        return id != o.id;
+    }
+};
+
+typedef patricia::Tree<int> test_tree_t;
+typedef std::map<std::string, int> test_map_t;
+
+/*
+ * test_same
+ *
+ * Check that tree holds exactly the pairs of ref, in order
+ */
+template <typename Tree>
+static void
+test_same (Tree &tree, const test_map_t &ref)
+{
+    test_map_t::const_iterator it = ref.begin();
+
+    TEST_CHECK(tree.size() == ref.size());
+    for (auto &&kv : tree) {
+        TEST_CHECK(it != ref.end());
+        TEST_CHECK(kv.first == it->first && kv.second == it->second);
+        ++it;
+    }
+    TEST_CHECK(it == ref.end());
+}
+
+static void
+test_random (void)
+{
+    std::mt19937 rng(TEST_SEED);
+    test_tree_t tree;
+    test_map_t ref;
+    std::string key, prefix;
+    int i, op;
+
+    for (i = 0; i < 50000; i++) {
+        key = test_random_key(rng, 8);
+        op = rng() % 5;
+        if (op == 0) {
+            TEST_CHECK(tree.insert(key, i).second == !ref.count(key));
+            ref.insert(std::make_pair(key, i));
+        } else if (op == 1) {
+            TEST_CHECK(tree.insert_or_assign(key, i).second ==
+                       !ref.count(key));
+            ref[key] = i;
+        } else if (op == 2) {
+            tree[key] += 1;
+            ref[key] += 1;
+        } else if (op == 3) {
+            TEST_CHECK(tree.erase(key) == ref.erase(key));
+        } else {
+            auto it = tree.find(key);
+            auto next = it;
+            TEST_CHECK((it != tree.end()) == (ref.count(key) == 1));
+
+            /* Stepping on before the key was built, it is built later */
+            if (next != tree.end()) {
+                ++next;
+                auto ref_next = ref.upper_bound(key);
+                TEST_CHECK((next == tree.end()) == (ref_next == ref.end()));
+                TEST_CHECK(next == tree.end() ||
+                           (next.key() == ref_next->first &&
+                            (++next == tree.end() ||
+                             next.key() == (++ref_next)->first)));
+            }
+            TEST_CHECK(it == tree.end() || (it.key() == key &&
+                                            it.value() == ref[key]));
+            TEST_CHECK(tree.contains(key) == (ref.count(key) == 1));
+        }
+        TEST_CHECK(tree.size() == ref.size());
+    }
+    test_same(tree, ref);
+
+    /* Prefix ranges, including prefixes ending inside a label */
+    for (i = 0; i < 2000; i++) {
+        prefix = test_random_key(rng, 4);
+        auto range = tree.prefix_range(prefix);
+        test_map_t::iterator it = ref.lower_bound(prefix);
+        for (; range.first != range.second; ++range.first, ++it) {
+            TEST_CHECK(it != ref.end() &&
+                       it->first.compare(0, prefix.size(), prefix) == 0);
+            TEST_CHECK(range.first.key() == it->first);
+        }
+        TEST_CHECK(it == ref.end() ||
+                   it->first.compare(0, prefix.size(), prefix) != 0);
+    }
+
+    tree.clear();
+    TEST_CHECK(tree.empty() && tree.begin() == tree.end());
+}
+
+static void
+test_moves (void)
+{
+    patricia::Tree<std::unique_ptr<int>> a, b;
+    test_map_t ref;
+
+    a.insert("abc", std::unique_ptr<int>(new int(1)));
+    a.insert("abd", std::unique_ptr<int>(new int(2)));
+
+    /* The source of a move stays usable */
+    b = std::move(a);
+    TEST_CHECK(b.size() == 2 && *b.find("abd").value() == 2);
+    TEST_CHECK(a.empty() && a.begin() == a.end());
+    TEST_CHECK(a.find("abc") == a.end() && !a.contains("abc"));
+    TEST_CHECK(a.erase("abc") == 0);
+    TEST_CHECK(a.prefix_range("a").first == a.end());
+    a.clear();
+    a.insert("x", std::unique_ptr<int>(new int(3)));
+    TEST_CHECK(a.size() == 1 && *a.find("x").value() == 3);
+
+    patricia::Tree<std::unique_ptr<int>> c(std::move(b));
+    TEST_CHECK(c.size() == 2 && b.empty() && b.cbegin() == b.cend());
+    b.insert("y", nullptr);
+    TEST_CHECK(b.size() == 1);
+
+    /* Allocators that compare unequal: the values are moved one by one */
+    patricia::Tree<int, test_alloc<int>> x(test_alloc<int>(1));
+    patricia::Tree<int, test_alloc<int>> y(test_alloc<int>(2));
+    patricia::Tree<int, test_alloc<int>> z(test_alloc<int>(2));
+    x.insert("k1", 1);
+    x.insert("k2", 2);
+    y.insert("old", 0);
+    y = std::move(x);
+    ref["k1"] = 1;
+    ref["k2"] = 2;
+    test_same(y, ref);
+    TEST_CHECK(y.get_allocator().id == 2 && x.empty());
+    x.insert("again", 5);
+    TEST_CHECK(x.size() == 1);
+
+    /* Equal allocators: the nodes are taken over */
+    z.insert("z", 26);
+    y = std::move(z);
+    TEST_CHECK(y.size() == 1 && y.find("z").value() == 26 && z.empty());
+}
+
+int
+main (void)
+{
+    test_random();
+    test_moves();
+
+    return 0;
+}